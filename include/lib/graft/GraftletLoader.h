@@ -55,6 +55,13 @@ private:
         {
             return (Res)gh->invokeRA<Res,Ts...>(cls_method, std::forward<Args>(args)...);
         }
+
+        std::function<sign_t> getHandle(const std::string& cls_method)
+        {
+            std::string method;
+            BaseT& concreteGraftlet = gh->findGraftlet(cls_method, method);
+            return concreteGraftlet.template getHandle<Res,Ts...>(method);
+        }
     private:
         GraftletHandlerT* gh;
     };
@@ -64,8 +71,15 @@ private:
     template <typename Res, typename...Ts, typename = Res(Ts...), typename...Args>
     Res invokeRA(const std::string& cls_method, Args&&...args)
     {
-        ClsName_ cls;
         std::string method;
+        BaseT& concreteGraftlet = findGraftlet(cls_method, method);
+        return (Res)concreteGraftlet.template invoke<Res,Ts...>(method, std::forward<Args>(args)...);
+    }
+
+    //finds the graftlet of "cls.method", the method is returned
+    BaseT& findGraftlet(const std::string& cls_method, std::string& method)
+    {
+        ClsName_ cls;
         {
             int pos = cls_method.find('.');
             if(pos != std::string::npos)
@@ -80,8 +94,9 @@ private:
         }
         auto it = m_cls2any.find(cls);
         if(it == m_cls2any.end()) throw std::runtime_error("Cannot find graftlet class name:" + cls);
-        std::shared_ptr<BaseT> concreteGraftlet = std::any_cast<std::shared_ptr<BaseT>>(it->second);
-        return (Res)concreteGraftlet->template invoke<Res,Ts...>(method, std::forward<Args>(args)...);
+        //by reference, the shared_ptr is not copied
+        const std::shared_ptr<BaseT>& concreteGraftlet = std::any_cast<const std::shared_ptr<BaseT>&>(it->second);
+        return *concreteGraftlet;
     }
 
     const std::map<ClsName_, std::any>& m_cls2any;
@@ -97,6 +112,14 @@ public:
         struct helperSign<Sign> h(this);
         return h.invoke(cls_method, std::forward<Args>(args)...);
     }
+
+    //Resolves "cls.method" once; the result is called without lookups, it is valid while the loader holds the graftlet
+    template <typename Sign>
+    std::function<Sign> getHandle(const std::string& cls_method)
+    {
+        struct helperSign<Sign> h(this);
+        return h.getHandle(cls_method);
+    }
 };
 
 class GraftletLoader
@@ -67,22 +67,17 @@ public:
     template <typename Res, typename...Ts, typename = Res(Ts...), typename...Args>
     Res invoke(const FuncName& name, Args&&...args)
     {
-        using Callable = std::function<Res (Ts...)>;
-        std::type_index ti = std::type_index(typeid(Callable));
-
-        auto it = m_map.find(name);
-        if(it == m_map.end())  throw std::runtime_error("cannot find function " + name);
-        TypeIndex2any& ti2any = it->second;
-        auto it1 = ti2any.find(ti);
-        if(it1 == ti2any.end()) throw std::runtime_error("cannot find function " + name + " with typeid " + ti.name() );
-
-        std::any& any = std::get<0>(it1->second);
-
-        Callable callable = std::any_cast<Callable>(any);
-
+        const std::function<Res (Ts...)>& callable = findCallable<Res,Ts...>(name);
         return callable(std::forward<Args>(args)...);
     }
 
+    //Resolves the function once, the result can be called without lookups while the graftlet is loaded
+    template <typename Res, typename...Ts>
+    std::function<Res (Ts...)> getHandle(const FuncName& name)
+    {
+        return findCallable<Res,Ts...>(name);
+    }
+
     //It can be used to register any callable object like a function, to register member function use register_handler_memf
     template<typename Res,  typename...Ts, typename Callable = Res (Ts...)>
     void register_handler(const FuncName& name, Callable callable, const EndpointPath& endpoint = EndpointPath(), Methods methods = 0)
@@ -105,8 +100,7 @@ public:
     template<typename Obj, typename Res,  typename...Ts>
     void register_handler_memf(const FuncName& name, Obj* p, Res (Obj::*f)(Ts...))
     {
-        std::function<Res(Obj*,Ts...)> memf = f;
-        std::function<Res(Ts...)> fun = [p,memf](Ts&&...ts)->Res { return memf(p,std::forward<Ts>(ts)...); };
+        std::function<Res(Ts...)> fun = [p,f](Ts&&...ts)->Res { return (p->*f)(std::forward<Ts>(ts)...); };
         register_handler<Res, Ts...,decltype(fun)>(name, fun);
     }
 
@@ -121,11 +115,11 @@ public:
                                 , graft::Status (Obj::*f)(const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)
                                 , const EndpointPath& endpoint, Methods methods )
     {
-        std::function<graft::Status (Obj*,const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)> memf = f;
+        //the member is called directly, so a graftlet route costs the same as a built-in one
         graft::Router::Handler fun =
-                [p,memf](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+                [p,f](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
         {
-            return memf(p,vars,input,ctx,output);
+            return (p->*f)(vars,input,ctx,output);
         };
         register_endpoint(name, fun, endpoint, methods);
     }
@@ -133,6 +127,22 @@ protected:
     IGraftlet(const ClsName& name = ClsName() ) : m_clsName(name) { }
     virtual void initOnce(const graft::CommonOpts& opts) = 0;
 private:
+    template <typename Res, typename...Ts>
+    const std::function<Res (Ts...)>& findCallable(const FuncName& name)
+    {
+        using Callable = std::function<Res (Ts...)>;
+        std::type_index ti = std::type_index(typeid(Callable));
+
+        auto it = m_map.find(name);
+        if(it == m_map.end())  throw std::runtime_error("cannot find function " + name);
+        TypeIndex2any& ti2any = it->second;
+        auto it1 = ti2any.find(ti);
+        if(it1 == ti2any.end()) throw std::runtime_error("cannot find function " + name + " with typeid " + ti.name() );
+
+        //by reference, the callable is not copied
+        return std::any_cast<const Callable&>(std::get<0>(it1->second));
+    }
+
     using TypeIndex2any = std::map<std::type_index, std::tuple<std::any, EndpointPath, Methods> >;
     using Map = std::map<FuncName, TypeIndex2any>;
 
@@ -0,0 +1,410 @@
+#pragma once
+
+#include "lib/graft/common/utils.h"
+#include "lib/graft/reflective-rapidjson/traits.h"
+
+#include <boost/hana.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+/*
+ *  Compact binary encoding of the structures defined with GRAFT_DEFINE_IO_STRUCT
+ *  ========================================================================
+ *                           C++ type                        |  encoding
+ *  ---------------------------------------------------------+--------------
+ *   custom structures (BOOST_HANA_DEFINE_STRUCT)            | varint size, fields in declaration order
+ *   bool                                                    | 1 byte
+ *   unsigned integral types                                 | varint (LEB128)
+ *   signed integral types                                   | zigzag varint
+ *   enum and enum class                                     | as underlying type
+ *   float and double                                        | raw little endian
+ *   std::string                                             | varint (size << 1 | hex), bytes
+ *   iteratable lists, sets                                  | varint count, items
+ *   std::map, std::unordered_map                            | varint count, key/value pairs
+ *   std::tuple                                              | items
+ *   std::unique_ptr, std::shared_ptr                        | 1 byte presence, value
+ *  ---------------------------------------------------------+--------------
+ *
+ *  Field names are not written, so both sides must agree on the structure. Structures are
+ *  size prefixed (except the top level one that spans the whole buffer); a reader
+ *  skips trailing fields it does not know and keeps defaults for the fields absent in the
+ *  data, so a field can be appended to a structure without breaking older peers.
+ *  Lowercase hex strings (keys, hashes, signatures) are stored as raw bytes, that halves them.
+ *  Decoding reads the source buffer directly, there is no intermediate document.
+ */
+
+namespace graft
+{
+    namespace serializer
+    {
+        class BinaryParseError : public std::runtime_error
+        {
+        public:
+            BinaryParseError(const std::string& what, size_t offset)
+                : std::runtime_error( "Binary parse error: " + what + ", offset: " + std::to_string(offset))
+            {
+            }
+        };
+
+        namespace binary
+        {
+            template<typename T, typename = void>
+            struct IsHanaStruct : std::false_type { };
+            template<typename T>
+            struct IsHanaStruct<T, std::enable_if_t<boost::hana::Struct<T>::value>> : std::true_type { };
+
+            template<typename T, typename = void>
+            struct IsMap : std::false_type { };
+            template<typename T>
+            struct IsMap<T, std::void_t<typename T::key_type, typename T::mapped_type>> : std::true_type { };
+
+            template<typename T, typename = void>
+            struct HasPushBack : std::false_type { };
+            template<typename T>
+            struct HasPushBack<T, std::void_t<decltype(std::declval<T&>().push_back(std::declval<typename T::value_type>()))>> : std::true_type { };
+
+            template<typename T>
+            struct AlwaysFalse : std::false_type { };
+
+            class Writer
+            {
+            public:
+                explicit Writer(std::string& out) : m_out(out) { }
+
+                void byte(uint8_t b) { m_out.push_back(static_cast<char>(b)); }
+                void raw(const void* data, size_t size) { m_out.append(static_cast<const char*>(data), size); }
+
+                void varint(uint64_t v)
+                {
+                    while(v >= 0x80)
+                    {
+                        byte(static_cast<uint8_t>(v) | 0x80);
+                        v >>= 7;
+                    }
+                    byte(static_cast<uint8_t>(v));
+                }
+
+                std::string& out() { return m_out; }
+            private:
+                std::string& m_out;
+            };
+
+            class Reader
+            {
+            public:
+                Reader(const char* data, size_t size) : m_begin(data), m_ptr(data), m_end(data + size) { }
+
+                bool empty() const { return m_ptr == m_end; }
+                size_t offset() const { return m_ptr - m_begin; }
+                size_t left() const { return m_end - m_ptr; }
+
+                [[noreturn]] void fail(const char* what) const { throw BinaryParseError(what, offset()); }
+
+                uint8_t byte()
+                {
+                    if(m_ptr == m_end) fail("unexpected end of data");
+                    return static_cast<uint8_t>(*m_ptr++);
+                }
+
+                const char* raw(size_t size)
+                {
+                    if(size_t(m_end - m_ptr) < size) fail("unexpected end of data");
+                    const char* res = m_ptr;
+                    m_ptr += size;
+                    return res;
+                }
+
+                uint64_t varint()
+                {
+                    uint64_t v = 0;
+                    for(int shift = 0; shift < 64; shift += 7)
+                    {
+                        uint8_t b = byte();
+                        v |= uint64_t(b & 0x7f) << shift;
+                        if(!(b & 0x80)) return v;
+                    }
+                    fail("varint is too long");
+                }
+
+                //reader of the next size prefixed span, the span is skipped in this reader
+                Reader sub()
+                {
+                    uint64_t size = varint();
+                    if(uint64_t(m_end - m_ptr) < size) fail("unexpected end of data");
+                    Reader res(m_ptr, size);
+                    res.m_begin = m_begin;
+                    m_ptr += size;
+                    return res;
+                }
+            private:
+                const char* m_begin;
+                const char* m_ptr;
+                const char* m_end;
+            };
+
+            inline bool isLowerHex(const std::string& s)
+            {
+                if(s.empty() || s.size() % 2) return false;
+                for(char c : s)
+                {
+                    if(!(('0' <= c && c <= '9') || ('a' <= c && c <= 'f'))) return false;
+                }
+                return true;
+            }
+
+            inline void writeString(Writer& w, const std::string& s)
+            {
+                if(isLowerHex(s))
+                {
+                    size_t size = s.size() / 2;
+                    w.varint((uint64_t(size) << 1) | 1);
+                    auto nibble = [](char c)->uint8_t { return (c <= '9')? c - '0' : c - 'a' + 10; };
+                    for(size_t i = 0; i < size; ++i)
+                    {
+                        w.byte((nibble(s[2*i]) << 4) | nibble(s[2*i + 1]));
+                    }
+                    return;
+                }
+                w.varint(uint64_t(s.size()) << 1);
+                w.raw(s.data(), s.size());
+            }
+
+            inline void readString(Reader& r, std::string& s)
+            {
+                uint64_t header = r.varint();
+                size_t size = header >> 1;
+                const char* data = r.raw(size);
+                if(!(header & 1))
+                {
+                    s.assign(data, size);
+                    return;
+                }
+                static const char digits[] = "0123456789abcdef";
+                s.resize(2 * size);
+                for(size_t i = 0; i < size; ++i)
+                {
+                    uint8_t b = static_cast<uint8_t>(data[i]);
+                    s[2*i] = digits[b >> 4];
+                    s[2*i + 1] = digits[b & 0x0f];
+                }
+            }
+
+            template<typename T>
+            void write(Writer& w, const T& v);
+            template<typename T>
+            void read(Reader& r, T& v);
+
+            template<typename T>
+            void writeFields(Writer& w, const T& v)
+            {
+                boost::hana::for_each(boost::hana::keys(v), [&w, &v](auto key)
+                {
+                    write(w, boost::hana::at_key(v, key));
+                });
+            }
+
+            template<typename T>
+            void readFields(Reader& r, T& v)
+            {
+                boost::hana::for_each(boost::hana::keys(v), [&r, &v](auto key)
+                {
+                    //fields absent in the data keep their defaults
+                    if(r.empty()) return;
+                    read(r, boost::hana::at_key(v, key));
+                });
+            }
+
+            template<typename T>
+            void write(Writer& w, const T& v)
+            {
+                if constexpr (std::is_same<T, bool>::value)
+                {
+                    w.byte(v? 1 : 0);
+                }
+                else if constexpr (std::is_enum<T>::value)
+                {
+                    write(w, static_cast<std::underlying_type_t<T>>(v));
+                }
+                else if constexpr (std::is_integral<T>::value && std::is_unsigned<T>::value)
+                {
+                    w.varint(v);
+                }
+                else if constexpr (std::is_integral<T>::value)
+                {
+                    int64_t s = v;
+                    w.varint((static_cast<uint64_t>(s) << 1) ^ static_cast<uint64_t>(s >> 63));
+                }
+                else if constexpr (std::is_floating_point<T>::value)
+                {
+                    w.raw(&v, sizeof(v));
+                }
+                else if constexpr (std::is_same<T, std::string>::value)
+                {
+                    writeString(w, v);
+                }
+                else if constexpr (Traits::IsSpecializationOf<T, std::unique_ptr>::value || Traits::IsSpecializationOf<T, std::shared_ptr>::value)
+                {
+                    w.byte(v? 1 : 0);
+                    if(v) write(w, *v);
+                }
+                else if constexpr (Traits::IsSpecializationOf<T, std::tuple>::value)
+                {
+                    std::apply([&w](const auto&... items) { (write(w, items), ...); }, v);
+                }
+                else if constexpr (IsHanaStruct<T>::value)
+                {
+                    std::string fields;
+                    Writer fw(fields);
+                    writeFields(fw, v);
+                    w.varint(fields.size());
+                    w.raw(fields.data(), fields.size());
+                }
+                else if constexpr (IsMap<T>::value)
+                {
+                    w.varint(v.size());
+                    for(auto& item : v)
+                    {
+                        write(w, item.first);
+                        write(w, item.second);
+                    }
+                }
+                else if constexpr (Traits::IsIteratable<T>::value)
+                {
+                    w.varint(v.size());
+                    for(auto& item : v)
+                    {
+                        write(w, item);
+                    }
+                }
+                else
+                {
+                    static_assert(AlwaysFalse<T>::value, "type is not supported by the binary serializer");
+                }
+            }
+
+            template<typename T>
+            void read(Reader& r, T& v)
+            {
+                if constexpr (std::is_same<T, bool>::value)
+                {
+                    v = r.byte() != 0;
+                }
+                else if constexpr (std::is_enum<T>::value)
+                {
+                    std::underlying_type_t<T> u;
+                    read(r, u);
+                    v = static_cast<T>(u);
+                }
+                else if constexpr (std::is_integral<T>::value && std::is_unsigned<T>::value)
+                {
+                    uint64_t u = r.varint();
+                    if(u > std::numeric_limits<T>::max()) r.fail("integer is out of range");
+                    v = static_cast<T>(u);
+                }
+                else if constexpr (std::is_integral<T>::value)
+                {
+                    uint64_t u = r.varint();
+                    int64_t s = static_cast<int64_t>(u >> 1) ^ -static_cast<int64_t>(u & 1);
+                    if(s < std::numeric_limits<T>::min() || std::numeric_limits<T>::max() < s) r.fail("integer is out of range");
+                    v = static_cast<T>(s);
+                }
+                else if constexpr (std::is_floating_point<T>::value)
+                {
+                    std::memcpy(&v, r.raw(sizeof(v)), sizeof(v));
+                }
+                else if constexpr (std::is_same<T, std::string>::value)
+                {
+                    readString(r, v);
+                }
+                else if constexpr (Traits::IsSpecializationOf<T, std::unique_ptr>::value || Traits::IsSpecializationOf<T, std::shared_ptr>::value)
+                {
+                    v.reset();
+                    if(!r.byte()) return;
+                    v.reset(new typename T::element_type());
+                    read(r, *v);
+                }
+                else if constexpr (Traits::IsSpecializationOf<T, std::tuple>::value)
+                {
+                    std::apply([&r](auto&... items) { (read(r, items), ...); }, v);
+                }
+                else if constexpr (IsHanaStruct<T>::value)
+                {
+                    Reader fr = r.sub();
+                    readFields(fr, v);
+                }
+                else if constexpr (IsMap<T>::value)
+                {
+                    v.clear();
+                    for(uint64_t count = r.varint(); count; --count)
+                    {
+                        typename T::key_type key;
+                        read(r, key);
+                        read(r, v[key]);
+                    }
+                }
+                else if constexpr (Traits::IsIteratable<T>::value)
+                {
+                    v.clear();
+                    uint64_t count = r.varint();
+                    if constexpr (Traits::IsReservable<T>::value)
+                    {
+                        //every item takes one byte at least
+                        v.reserve(std::min<uint64_t>(count, r.left()));
+                    }
+                    for(; count; --count)
+                    {
+                        typename T::value_type item;
+                        read(r, item);
+                        if constexpr (HasPushBack<T>::value) v.push_back(std::move(item));
+                        else v.insert(std::move(item));
+                    }
+                }
+                else
+                {
+                    static_assert(AlwaysFalse<T>::value, "type is not supported by the binary serializer");
+                }
+            }
+        } //namespace binary
+
+        //Content-Type of the requests and responses encoded with BINARY
+        constexpr const char* BINARY_CONTENT_TYPE = "application/x-graft-binary";
+
+        template<typename T>
+        struct BINARY
+        {
+            static std::string serialize(const T& t)
+            {
+                std::string res;
+                binary::Writer w(res);
+                binary::writeFields(w, t);
+                return res;
+            }
+            static void deserialize(const std::string& s, T& t)
+            {
+                binary::Reader r(s.data(), s.size());
+                binary::readFields(r, t);
+            }
+        };
+
+        template<typename T>
+        struct BINARY_B64
+        {
+            static std::string serialize(const T& t)
+            {
+                return utils::base64_encode(BINARY<T>::serialize(t));
+            }
+            static void deserialize(const std::string& s, T& t)
+            {
+                BINARY<T>::deserialize(utils::base64_decode(s), t);
+            }
+        };
+    } //namespace serializer
+} //namespace graft
@@ -6,6 +6,7 @@
 #include <memory>
 
 typedef uint32_t in_addr_t;
+struct sockaddr;
 
 namespace graft {
 
@@ -20,11 +21,20 @@ public:
 
     virtual ~BlackList() = default;
 
+    //the rules can be (re)loaded by any thread while connections are processed;
+    //the new rules replace the current ones as a whole, the current ones remain on errors
     virtual void readRules(const char* filepath) = 0;
     virtual void readRules(std::istream& is) = 0;
+    //of the last readRules
     virtual std::string getWarnings() = 0;
 
+    //IO thread only; the request counters are reset, the bans in effect remain as they are
+    virtual void setLimits(int requests_per_sec, int window_size_sec, int ban_ip_sec) = 0;
+
+    //returns false if the connection should be refused
     virtual bool processIp(in_addr_t addr, bool networkOrder = true) = 0;
+    //IPv4 and IPv6 addresses
+    virtual bool processIp(const sockaddr* sa) = 0;
 protected:
     BlackList(const BlackList&) = delete;
     BlackList& operator = (const BlackList&) = delete;
@@ -36,6 +46,7 @@ class BlackListTest : public BlackList
 public:
     static std::unique_ptr<BlackListTest> Create(int requests_per_sec, int window_size_sec, int ban_ip_sec);
 
+    //ip is IPv4 or IPv6, len is the prefix length of its family
     virtual void addEntry(const char* ip, int len = 32, Allow allow = false) = 0;
     virtual void addEntry(in_addr_t addr, bool networkOrder = true, Allow allow = false, int len = 32) = 0;
     virtual void removeEntry(const char* ip) = 0;
@@ -44,6 +55,7 @@ public:
     virtual std::pair<bool, Allow> find(in_addr_t addr, bool networkOrder = true) = 0;
     virtual std::pair<bool, Allow> find(const char* ip) = 0;
     virtual bool active(in_addr_t addr) = 0;
+    virtual bool active(const char* ip) = 0;
     virtual size_t activeCnt() = 0;
 };
 
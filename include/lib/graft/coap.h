@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace graft {
+namespace coap {
+
+//CoAP (RFC 7252) option numbers and codes used by CoapConnectionManager, with Observe (RFC 7641)
+//and block-wise transfer (RFC 7959). The encoding of messages is done by mongoose.
+
+const uint32_t OPT_URI_HOST = 3;
+const uint32_t OPT_OBSERVE = 6;
+const uint32_t OPT_URI_PORT = 7;
+const uint32_t OPT_URI_PATH = 11;
+const uint32_t OPT_CONTENT_FORMAT = 12;
+const uint32_t OPT_URI_QUERY = 15;
+const uint32_t OPT_ACCEPT = 17;
+const uint32_t OPT_BLOCK2 = 23;
+const uint32_t OPT_BLOCK1 = 27;
+const uint32_t OPT_SIZE2 = 28;
+const uint32_t OPT_SIZE1 = 60;
+
+const uint32_t CONTENT_FORMAT_TEXT = 0;
+const uint32_t CONTENT_FORMAT_OCTET_STREAM = 42;
+const uint32_t CONTENT_FORMAT_JSON = 50;
+
+//the values of the Observe option in a request
+const uint32_t OBSERVE_REGISTER = 0;
+const uint32_t OBSERVE_DEREGISTER = 1;
+//the sequence number of notifications is 24 bits
+const uint32_t OBSERVE_SEQ_MASK = 0xffffff;
+
+//response code, class.detail, e.g. 2.05 is {2, 5}
+struct Code
+{
+    uint8_t cls;
+    uint8_t detail;
+};
+
+const Code CREATED{2, 1};
+const Code CHANGED{2, 4};
+const Code CONTENT{2, 5};
+const Code CONTINUE{2, 31};
+const Code BAD_REQUEST{4, 0};
+const Code BAD_OPTION{4, 2};
+const Code NOT_FOUND{4, 4};
+const Code METHOD_NOT_ALLOWED{4, 5};
+const Code REQUEST_ENTITY_INCOMPLETE{4, 8};
+const Code REQUEST_ENTITY_TOO_LARGE{4, 13};
+//RFC 8516
+const Code TOO_MANY_REQUESTS{4, 29};
+const Code INTERNAL_SERVER_ERROR{5, 0};
+const Code SERVICE_UNAVAILABLE{5, 3};
+
+//the options of odd numbers are critical, a request with an unknown one is rejected
+inline bool isCritical(uint32_t option) { return option & 1; }
+
+//unsigned integer option value, big-endian without leading zero bytes; the value 0 is empty
+std::string encodeUint(uint32_t value);
+//returns false if it is longer than 4 bytes
+bool decodeUint(const char* data, size_t len, uint32_t& value);
+
+//Block1 and Block2 option value
+struct Block
+{
+    static const unsigned MAX_SZX = 6;
+
+    uint32_t num = 0;
+    bool more = false;
+    //the block size is 16 << szx, from 16 to 1024 bytes
+    unsigned szx = MAX_SZX;
+
+    size_t size() const { return size_t(16) << szx; }
+    size_t offset() const { return num * size(); }
+
+    std::string encode() const;
+    //returns false if the value is malformed, szx 7 is reserved
+    static bool decode(const char* data, size_t len, Block& block);
+    //the greatest szx with the block size not greater than the size
+    static unsigned szxOf(size_t size);
+};
+
+} //namespace coap
+} //namespace graft
@@ -3,6 +3,15 @@
 
 #include "lib/graft/task.h"
 #include "lib/graft/blacklist.h"
+#include "lib/graft/ip_tables.h"
+#include "lib/graft/coap.h"
+
+#include <mutex>
+#include <set>
+#include <unordered_map>
+
+struct mg_coap_message;
+struct websocket_message;
 
 namespace graft {
 
@@ -54,6 +63,8 @@ public:
     {
         m_onCloseCallback = onCloseCallback;
     }
+    //closes an idle connection, the callback is called on the close event
+    static void close(mg_connection* upstream);
 
     void ev_handler(mg_connection *upstream, int ev, void *ev_data);
 
@@ -118,6 +129,9 @@ private:
     ////static functions
     static void cb_event(mg_mgr* mgr, uint64_t cnt);
 
+    //sends the messages published by the handlers to the subscribers
+    void deliverPublished();
+
     std::atomic_bool m_ready {false};
     std::atomic_bool m_stop {false};
     std::atomic_bool m_forceStop {false};
@@ -140,6 +154,16 @@ public:
     bool enableRouting() { return m_root.arm(); }
     bool matchRoute(const std::string& target, int method, Router::JobParams& params) { return m_root.match(target, method, params); }
 
+    //A WebSocket client sends text frames to subscribe to topics and to unsubscribe from them. The callback makes the topic
+    //and the reply of a frame and sets unsubscribe for the frames of the latter kind, it returns false if the frame is rejected.
+    //The frame of each subscribed topic is checked again when the client is pinged, the topic is dropped if it is rejected
+    //or unsubscribed then, e.g. its object is gone; the reply is not sent. It is called by IO thread, the context is for
+    //the global part only.
+    using Subscribe = std::function<bool (const std::string& frame, Context& ctx, std::string& topic, bool& unsubscribe, std::string& reply)>;
+    void addWebSocketEndpoint(const std::string& uri, Subscribe subscribe) { m_wsEndpoints[uri] = std::move(subscribe); }
+    //IO thread; sends the message to the clients subscribed to the topic, see HandlerAPI::publish
+    virtual void publish(const std::string& topic, const std::string& message, bool last) { }
+
     std::string dbgDumpRouters() const { return m_root.dbgDumpRouters(); }
     void dbgDumpR3Tree(int level = 0) const { return m_root.dbgDumpR3Tree(level); }
     //returns conflicting endpoint
@@ -148,14 +172,25 @@ public:
 
     static void ev_handler(ClientTask* ct, mg_connection *client, int ev, void *ev_data);
 protected:
+    //the connection is done with the request; it is closed after the response is sent or,
+    //if keepAlive, it is ready for the next request
+    virtual void release(mg_connection* client, bool keepAlive);
+    //the connection is closed by the client while its request is processed
+    virtual void onClose(mg_connection* client) { }
+
     static ConnectionManager* from_accepted(mg_connection* cn);
     static void ev_handler_empty(mg_connection *client, int ev, void *ev_data);
+
+    //sends Output::stream to the client
+    class ChunkedReply;
 #define _M(x) std::make_pair(#x, METHOD_##x)
     constexpr static std::pair<const char *, int> m_methods[] = {
         _M(GET), _M(POST), _M(PUT), _M(DELETE), _M(HEAD) //, _M(CONNECT)
     };
 
     Router::Root m_root;
+    //by uri
+    std::map<std::string, Subscribe> m_wsEndpoints;
 private:
     Proto m_proto;
     std::atomic_bool m_stop{false};
@@ -164,6 +199,9 @@ private:
 class ConnectionBase final
 {
 public:
+    //fills the options from the configuration, returns false or throws on errors
+    using ConfigLoader = std::function<bool (ConfigOpts& copts)>;
+
     ConnectionBase() = default;
     ~ConnectionBase();
     ConnectionBase(const ConnectionBase&) = delete;
@@ -172,6 +210,14 @@ public:
     void setSysInfoCounter(std::unique_ptr<SysInfoCounter>& counter);
     void createSystemInfoCounter();
     void loadBlacklist(const ConfigOpts& copts);
+    //reloads the rules if the file has been modified since the last load; returns true if reloaded
+    bool reloadBlacklistRules(const ConfigOpts& copts);
+    void loadRouteLimits(const ConfigOpts& copts);
+    void setConfigLoader(ConfigLoader loader) { m_configLoader = std::move(loader); }
+    //it can be called from a signal handler, the configuration is reloaded by the IO thread
+    void requestReconfigure() { m_reconfigure = true; }
+    //IO thread only; applies the options that can be changed without restart
+    void reconfigureIfRequested();
     void createLooper(ConfigOpts& configOpts);
     void initConnectionManagers();
     void bindConnectionManagers();
@@ -181,19 +227,36 @@ public:
     bool stopped() { return m_stop; }
 
     BlackList& getBlackList() { return *m_blackList; }
+    //nullptr if no route group is limited; it is used by the IO thread only
+    ipfilter::RouteLimiter* getRouteLimiter() { return m_routeLimiter.get(); }
     SysInfoCounter& getSysInfoCounter() { assert(m_sysInfo); return *m_sysInfo; }
     Looper& getLooper() { assert(m_looper); return *m_looper; }
     ConfigOpts& getCopts() { assert(m_looper); return m_looper->getCopts(); }
     ConnectionManager* getConMgr(const ConnectionManager::Proto& proto);
+    //IO thread, see ConnectionManager::publish
+    void publish(const std::string& topic, const std::string& message, bool last);
 
     static ConnectionBase* from(mg_mgr* mgr);
 private:
     static void checkRoutes(graft::ConnectionManager& cm);
 
     std::atomic_bool m_stop{false};
+    std::atomic_bool m_reconfigure{false};
+    ConfigLoader m_configLoader;
 
     //the order of members is important because of destruction order.
     std::unique_ptr<BlackList> m_blackList;
+    //modification time with nanoseconds and size of the rules file as it was loaded, so edits within a second are seen
+    struct FileStamp
+    {
+        int64_t mtime_ns = 0;
+        int64_t size = -1;
+        bool operator == (const FileStamp& other) const { return mtime_ns == other.mtime_ns && size == other.size; }
+    };
+    static bool getFileStamp(const std::string& filename, FileStamp& stamp);
+    std::mutex m_rulesStampMutex;
+    FileStamp m_rulesStamp;
+    std::unique_ptr<ipfilter::RouteLimiter> m_routeLimiter;
     std::unique_ptr<SysInfoCounter> m_sysInfo;
     std::atomic_bool m_looperReady{false};
     std::unique_ptr<Looper> m_looper;
@@ -221,24 +284,154 @@ public:
     HttpConnectionManager() : ConnectionManager("HTTP") { }
 
     void bind(Looper& looper) override;
+    void publish(const std::string& topic, const std::string& message, bool last) override;
+    //topics subscribed to by the WebSocket clients connected now, it can be read from any thread
+    size_t subscriptions() const { return m_subscriptions; }
+
+protected:
+    void release(mg_connection* client, bool keepAlive) override;
+    void onClose(mg_connection* client) override;
 
 private:
+    //the topics a client can subscribe to over a connection
+    static constexpr size_t WEBSOCKET_MAX_TOPICS = 64;
+
+    struct WebSocketClient
+    {
+        const Subscribe* subscribe = nullptr;
+        //the frames of the topics, by topic
+        std::map<std::string, std::string> topics;
+    };
+
     static void ev_handler_http(mg_connection *client, int ev, void *ev_data);
     static int translateMethod(const char *method, std::size_t len);
     static HttpConnectionManager* from_accepted(mg_connection* cn);
+    //decides whether the connection is kept open after the response to the request
+    bool keepAlive(mg_connection* client, struct http_message* hm, int maxRequests);
+    void onWebSocketFrame(mg_connection* client, websocket_message* wm);
+    void closeWebSocket(mg_connection* client);
+    //checks the frames of the topics of the client again, see Subscribe
+    void checkTopics(mg_connection* client, WebSocketClient& wsc);
+    //removes the client from the subscribers of the topic, it does not change WebSocketClient::topics
+    void eraseSubscriber(const std::string& topic, mg_connection* client);
+
+    //requests served by the connections kept open
+    std::unordered_map<mg_connection*, int> m_keepAliveRequests;
+    std::unordered_map<mg_connection*, WebSocketClient> m_wsClients;
+    //by topic
+    std::unordered_multimap<std::string, mg_connection*> m_subscribers;
+    std::atomic<size_t> m_subscriptions{0};
 };
 
+/*!
+ * \brief CoapConnectionManager - CoAP front-end, the requests are routed and processed by tasks the same way as HTTP ones.
+ *
+ * A client address has a connection of mongoose that is kept while the client is active or observes resources,
+ * the connection switches neither handler nor user_data, so it serves several requests at a time.
+ * Confirmable requests are answered by piggybacked ACKs, a repeated one gets the same ACK again.
+ * Block-wise transfer: the request body is collected from Block1 blocks before the task is created;
+ * a response that does not fit a block is sent by Block2 blocks, the next blocks are served from the representation kept
+ * for the resource.
+ * Observe: the request of a registration is repeated by a task every coap-observe-interval-ms, a notification is sent
+ * when the response changes. The observation ends on deregistration, on RST to a notification, on an error response
+ * and after coap-observe-lifetime, the client registers again to go on.
+ */
 class CoapConnectionManager final : public ConnectionManager
 {
 public:
     CoapConnectionManager() : ConnectionManager("COAP") { }
 
     void bind(Looper& looper) override;
+    void respond(ClientTask* ct, const std::string& s) override;
+    //requests of the path may be observed whatever their method, its handlers must have no side effects;
+    //GET requests can always be observed, the rest are answered once
+    void addObservable(const std::string& path) { m_observable.insert(path); }
 
 private:
+    //a request processed by a task
+    struct Exchange
+    {
+        mg_connection* client = nullptr;
+        uint16_t msgId = 0;
+        bool confirmable = false;
+        std::string token;
+        int method = 0;
+        //path and query, the key of block-wise transfers
+        std::string resource;
+        //block size exponent and the block asked by the client
+        unsigned szx = 0;
+        uint32_t block2Num = 0;
+        //echoed in the response to the last block of the request
+        bool block1 = false;
+        uint32_t block1Num = 0;
+        unsigned block1Szx = 0;
+        //the response is for the observation of the token
+        bool observe = false;
+        //the request is repeated for an observation, the response is sent if it changed
+        bool notification = false;
+    };
+
+    struct Representation
+    {
+        coap::Code code = coap::CONTENT;
+        uint32_t contentFormat = 0;
+        std::string payload;
+        double expires = 0;
+    };
+
+    struct Observation
+    {
+        int method = 0;
+        std::string path;
+        std::string query;
+        std::string body;
+        unsigned szx = 0;
+        uint32_t seq = 0;
+        //the payload of the last notification
+        std::string last;
+        //RST to this message cancels the observation
+        uint16_t lastMsgId = 0;
+        bool refreshing = false;
+        double expires = 0;
+    };
+
+    struct Peer
+    {
+        //by token
+        std::map<std::string, Observation> observations;
+        //request bodies being received, by resource
+        std::map<std::string, std::string> block1;
+        //responses being fetched, by resource
+        std::map<std::string, Representation> block2;
+        //confirmable requests being processed
+        std::set<uint16_t> inFlight;
+        size_t tasks = 0;
+        //the last piggybacked response, it is sent again if the request is repeated
+        uint16_t lastMsgId = 0;
+        std::string lastReply;
+        uint16_t nextMsgId = 0;
+        double lastActive = 0;
+    };
+
     static void ev_handler_coap(mg_connection *client, int ev, void *ev_data);
     static int translateMethod(int i);
     static CoapConnectionManager* from_accepted(mg_connection* cn);
+
+    Peer& getPeer(mg_connection* client);
+    void onRequest(mg_connection* client, mg_coap_message* cm);
+    void onReset(mg_connection* client, uint16_t msgId);
+    void onTimer(mg_connection* client);
+    void closePeer(mg_connection* client);
+    void startTask(Exchange&& ex, Router::JobParams& prms, const std::string& path, const std::string& query, std::string&& body);
+    void refresh(mg_connection* client, const std::string& token, Observation& obs);
+    //sends the block of the representation the exchange asks for, returns the message id
+    uint16_t sendResponse(const Exchange& ex, const Representation& rep, const uint32_t* observeSeq = nullptr);
+    void sendError(const Exchange& ex, coap::Code code, const std::string& message = std::string());
+    static double tickInterval(const ConfigOpts& opts);
+
+    std::unordered_map<mg_connection*, Peer> m_peers;
+    std::unordered_map<ClientTask*, Exchange> m_exchanges;
+    std::set<std::string> m_observable;
 };
 
 }//namespace graft
@@ -11,6 +11,8 @@
 #include <thread>
 #include <mutex>
 #include <map>
+#include <unordered_map>
+#include <atomic>
 #include <vector>
 #include <chrono>
 #include <any>
@@ -28,9 +30,32 @@ class HandlerAPI;
 class GlobalContextMap : public TSHashtable<std::string, std::any>
 {
 public:
-    GlobalContextMap(HandlerAPI* handlerAPI = nullptr) : m_handlerAPI(handlerAPI) { }
+    //a waiter is called once, on the next set, remove or expiration of the key;
+    //it is called by the thread that makes the change, with no lock held
+    using Waiter = std::function<void (const std::string& key)>;
+    using WatchId = uint64_t;
+
+    GlobalContextMap(HandlerAPI* handlerAPI = nullptr);
+
+    WatchId watch(const std::string& key, Waiter waiter);
+    //removes the waiter if it is not woken yet
+    void unwatch(const std::string& key, WatchId id);
+    size_t waiters() const { return m_waitersCount; }
+
+    //these hide the ones of TSHashtable to wake the waiters of the key; groupSet does not wake them
+    void addOrUpdate(const std::string& key, const std::any& value, std::chrono::seconds ttl = std::chrono::seconds(0), OnExpired onExpired = nullptr);
+    void remove(const std::string& key);
+    bool apply(const std::string& key, std::function<bool(std::any&)> f);
 protected:
     HandlerAPI* m_handlerAPI;
+private:
+    void wake(const std::string& key);
+
+    std::mutex m_waitersMutex;
+    std::unordered_multimap<std::string, std::pair<WatchId, Waiter>> m_waiters;
+    WatchId m_lastWatchId = 0;
+    //the changes do not take the lock while nobody waits
+    std::atomic<size_t> m_waitersCount{0};
 };
 
 class GlobalContextMapFriend : protected GlobalContextMap
@@ -228,6 +253,16 @@ public:
             return m_map.hasKey(key);
         }
 
+        GlobalContextMap::WatchId watch(const std::string& key, GlobalContextMap::Waiter waiter)
+        {
+            return m_map.watch(key, std::move(waiter));
+        }
+
+        void unwatch(const std::string& key, GlobalContextMap::WatchId id)
+        {
+            m_map.unwatch(key, id);
+        }
+
         template<typename T>
         void set(const std::string& key, T&& val, std::chrono::seconds ttl, GlobalContextMap::OnExpired onExpired = nullptr)
         {
@@ -344,6 +379,12 @@ public:
             GlobalFriend& gf = static_cast<GlobalFriend&>(global);
             gf.m_map.cleanup(all);
         }
+        //incremental cleanup, see TSHashtable::cleanup(budget)
+        static GlobalContextMap::CleanupStats cleanup(Global& global, std::chrono::steady_clock::duration budget)
+        {
+            GlobalFriend& gf = static_cast<GlobalFriend&>(global);
+            return gf.m_map.cleanup(budget);
+        }
         static HandlerAPI* handlerAPI(Global& global)
         {
             GlobalFriend& gf = static_cast<GlobalFriend&>(global);
@@ -376,8 +417,15 @@ public:
 
     HandlerAPI* handlerAPI() { return GlobalFriend::handlerAPI(global); }
 
+    //the task that returns Status::Postpone is resumed on the next change of the key of the global context,
+    //or as usual by the task with setNextTaskId; call it before the value is checked, so no change is missed
+    void resumeOnChange(const std::string& key);
+    //removes the waiters of resumeOnChange that are not woken; it is called when the task is resumed, expires or is done
+    void stopWatching();
+
 private:
     bool m_setXCallbackHeader = false;
+    std::vector<std::pair<std::string, GlobalContextMap::WatchId>> m_watches;
     mutable uuid_t m_uuid;
     uuid_t m_nextUuid;
 };
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "lib/graft/context.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+#include <any>
+#include <cstring>
+#include <type_traits>
+
+namespace graft {
+
+//Saves and restores entries of GlobalContextMap that belong to registered namespaces.
+//A namespace is a key suffix (e.g. ":status"), the value type of a namespace is fixed by its codec.
+//TTLs are preserved, entries with onExpired callbacks are not saved.
+class ContextSnapshot
+{
+public:
+    using Encode = std::function<bool(const std::any& value, std::string& out)>;
+    using Decode = std::function<bool(const char*& data, const char* end, std::any& value)>;
+
+    void addNamespace(const std::string& suffix, Encode encode, Decode decode);
+
+    //for arithmetic, enum and std::string values
+    template<typename T>
+    void addNamespace(const std::string& suffix)
+    {
+        addNamespace(suffix,
+                     [](const std::any& value, std::string& out)->bool
+                     {
+                         const T* v = std::any_cast<T>(&value);
+                         if(!v) return false;
+                         write(out, *v);
+                         return true;
+                     },
+                     [](const char*& data, const char* end, std::any& value)->bool
+                     {
+                         T v;
+                         if(!read(data, end, v)) return false;
+                         value = std::move(v);
+                         return true;
+                     });
+    }
+
+    //only registered namespaces listed here are saved and loaded, all registered if empty
+    void selectNamespaces(const std::vector<std::string>& suffixes) { m_selected = suffixes; }
+    bool empty() const { return m_codecs.empty(); }
+
+    //returns number of saved entries; the file is written to a temporary file and renamed
+    size_t save(GlobalContextMap& gcm, const std::string& filename) const;
+    //returns number of restored entries; existing keys and entries expired meanwhile are skipped
+    size_t load(GlobalContextMap& gcm, const std::string& filename) const;
+
+    template<typename T, typename std::enable_if<std::is_arithmetic<T>::value || std::is_enum<T>::value, int>::type = 0>
+    static void write(std::string& out, const T& v)
+    {
+        out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+
+    static void write(std::string& out, const std::string& v)
+    {
+        write(out, static_cast<uint32_t>(v.size()));
+        out.append(v);
+    }
+
+    template<typename T, typename std::enable_if<std::is_arithmetic<T>::value || std::is_enum<T>::value, int>::type = 0>
+    static bool read(const char*& data, const char* end, T& v)
+    {
+        if(size_t(end - data) < sizeof(v)) return false;
+        std::memcpy(&v, data, sizeof(v));
+        data += sizeof(v);
+        return true;
+    }
+
+    static bool read(const char*& data, const char* end, std::string& v)
+    {
+        uint32_t size;
+        if(!read(data, end, size) || size_t(end - data) < size) return false;
+        v.assign(data, size);
+        data += size;
+        return true;
+    }
+
+private:
+    struct Codec
+    {
+        Encode encode;
+        Decode decode;
+    };
+
+    const Codec* findCodec(const std::string& key) const;
+
+    std::map<std::string, Codec> m_codecs;
+    std::vector<std::string> m_selected;
+};
+
+}//namespace graft
@@ -9,6 +9,7 @@
 #include <mutex>
 #include <map>
 #include <shared_mutex>
+#include <algorithm>
 
 namespace graft
 {
@@ -18,7 +19,7 @@ namespace graft
     class TSList
     {
     public:
-        struct node
+        struct node : public std::enable_shared_from_this<node>
         {
             using OnExpired = std::function<void(T&)>;
 
@@ -28,6 +29,8 @@ namespace graft
             ch::seconds ttl;
             ch::seconds expires;
             OnExpired onExpired = nullptr;
+            //it is set under the lock of the node when the node is removed from the list
+            bool unlinked = false;
 
             node() : expires(ch::seconds::max()), ttl(ch::seconds(0)) {}
 
@@ -60,6 +63,7 @@ namespace graft
 
         using func = std::function<bool(T&)>;
         using NodePtr = std::shared_ptr<node>;
+        using NodeWPtr = std::weak_ptr<node>;
         //return true to continue
         using FuncNode = std::function<bool(NodePtr& node_ptr)>;
         using OnExpired = typename node::OnExpired;
@@ -83,6 +87,17 @@ namespace graft
             head->next = std::move(new_node);
         }
 
+        //restores the node with given expiration time, as it was saved from another instance
+        void pushFrontExpiring(T const& value, ch::seconds ttl, ch::seconds expires)
+        {
+            std::shared_ptr<node> new_node = std::make_shared<node>(value, ttl);
+            new_node->expires = expires;
+
+            std::lock_guard<std::mutex> lk(head->m);
+            new_node->next = std::move(head->next);
+            head->next = std::move(new_node);
+        }
+
         void forEach(func f, bool timeUpdate = false)
         {
             node* current = head.get();
@@ -166,6 +181,7 @@ namespace graft
                 std::unique_lock<std::mutex> next_lk(next->m);
                 if (p(*next->data))
                 {
+                    next->unlinked = true;
                     std::shared_ptr<node> old_next = std::move(current->next);
                     current->next = std::move(next->next);
                     next_lk.unlock();
@@ -179,18 +195,48 @@ namespace graft
             }
         }
 
-        void  safe_cleanup(std::vector<std::function<void()>>& res)
+        //returns false if the deadline came before the end of the list, the nodes walked so far are cleaned;
+        //the removed values are added to expired if it is given. If resume is given, the walk starts after
+        //the node it points to, if that is still in the list, and it is set to the last node walked when
+        //the deadline comes; so each pass goes at least DEADLINE_CHECK_INTERVAL nodes further
+        bool  safe_cleanup(std::vector<std::function<void()>>& res, size_t& removed,
+                           ch::steady_clock::time_point deadline = ch::steady_clock::time_point::max(),
+                           std::vector<std::shared_ptr<T>>* expired = nullptr, NodeWPtr* resume = nullptr)
         {
+            //checking the clock on every node would cost more than the check itself
+            constexpr size_t DEADLINE_CHECK_INTERVAL = 32;
+
             ch::seconds now_sec = ch::time_point_cast<ch::seconds>(
                             ch::steady_clock::now()
                         ).time_since_epoch();
             node *current = head.get();
             std::unique_lock<std::mutex> lk(head->m);
-            while (node* const next = current->next.get())
+            std::shared_ptr<node> from = resume? resume->lock() : nullptr;
+            if (from)
+            {
+                //the locked node cannot be removed, the walk goes on from it
+                std::unique_lock<std::mutex> from_lk(from->m);
+                if (!from->unlinked)
+                {
+                    current = from.get();
+                    lk = std::move(from_lk);
+                }
+            }
+            if (resume)
+                resume->reset();
+            for (size_t walked = 1; node* const next = current->next.get(); ++walked)
             {
+                if (walked % DEADLINE_CHECK_INTERVAL == 0 && deadline <= ch::steady_clock::now())
+                {
+                    if (resume && current != head.get())
+                        *resume = current->weak_from_this();
+                    return false;
+                }
                 std::unique_lock<std::mutex> next_lk(next->m);
                 if (next->expired(now_sec))
                 {
+                    ++removed;
+                    if(expired) expired->push_back(next->data);
                     if(next->onExpired)
                     {
                         auto makeCall = [](std::shared_ptr<T>&& ptr, OnExpired&& onExp )->std::function<void()>
@@ -200,6 +246,7 @@ namespace graft
                         res.push_back(makeCall(std::move(next->data), std::move(next->onExpired)));
                     }
 
+                    next->unlinked = true;
                     std::shared_ptr<node> old_next = std::move(current->next);
                     current->next = std::move(next->next);
                 }
@@ -209,6 +256,7 @@ namespace graft
                     lk = std::move(next_lk);
                 }
             }
+            return true;
         }
 
         void  unsafe_cleanup(std::vector<std::function<void()>>& res)
@@ -230,6 +278,7 @@ namespace graft
                         res.push_back(makeCall(std::move(next->data), std::move(next->onExpired)));
                     }
 
+                    next->unlinked = true;
                     std::shared_ptr<node> old_next = std::move(current->next);
                     current->next = std::move(next->next);
                 }
@@ -305,6 +354,13 @@ namespace graft
                 return (found_entry != nullptr);
             }
 
+            bool restore(Key const& key, Value const& value, ch::seconds ttl, ch::seconds expires)
+            {
+                if(hasKey(key)) return false;
+                m_data.pushFrontExpiring(BucketValue(key,value), ttl, expires);
+                return true;
+            }
+
             bool applyFor(Key const& key, std::function<bool(Value&)> f)
             {
                 return m_data.findAndApplyFirstOf(
@@ -315,13 +371,28 @@ namespace graft
                 );
             }
 
-            void cleanup(std::vector<std::function<void()>>& res)
+            bool cleanup(std::vector<std::function<void()>>& res, size_t& removed, ch::steady_clock::time_point deadline,
+                         std::vector<BucketPtr>* expired)
             {
 //                m_data.unsafe_cleanup(res);
-                m_data.safe_cleanup(res);
+                return m_data.safe_cleanup(res, removed, deadline, expired, &m_cleanupFrom);
             }
+
+        private:
+            //where the interrupted cleanup goes on, the live entries before it are not walked again
+            typename BucketData::NodeWPtr m_cleanupFrom;
+        };
+
+    public:
+        struct CleanupStats
+        {
+            size_t buckets = 0; //completely cleaned
+            size_t expired = 0;
+            ch::steady_clock::duration maxPause = ch::steady_clock::duration::zero(); //the longest lock of a bucket
+            ch::steady_clock::duration duration = ch::steady_clock::duration::zero(); //including onExpired callbacks
         };
 
+    private:
         std::vector<std::unique_ptr<BucketType>> m_buckets;
         Hash m_hasher;
         typename std::vector<std::unique_ptr<BucketType>>::iterator m_bit;
@@ -339,17 +410,28 @@ namespace graft
             return b;
         }
 
-        void cleanup(BucketType& b)
+        //returns true if the whole bucket is cleaned, adds the time the bucket was locked to stats
+        bool cleanup(BucketType& b, ch::steady_clock::time_point deadline, CleanupStats& stats)
         {
             std::vector<std::function<void()>> res;
+            std::vector<std::shared_ptr<std::pair<Key, Value>>> expired;
+            bool complete;
             {
+                auto begin = ch::steady_clock::now();
                 std::unique_lock<std::shared_mutex> lock(b.blk);
-                b.cleanup(res);
+                complete = b.cleanup(res, stats.expired, deadline, m_onKeyExpired? &expired : nullptr);
+                lock.unlock();
+                stats.maxPause = std::max(stats.maxPause, ch::steady_clock::now() - begin);
             }
             for(auto& f : res)
             {
                 f();
             }
+            for(auto& ptr : expired)
+            {
+                m_onKeyExpired(ptr->first);
+            }
+            return complete;
         }
 
     public:
@@ -505,6 +587,12 @@ namespace graft
         TSHashtable(const TSHashtable& other) = delete;
         TSHashtable& operator=(const TSHashtable& other) = delete;
 
+    protected:
+        //it is called by cleanup for each expired key, after the onExpired callbacks, with no lock held
+        std::function<void(const Key&)> m_onKeyExpired;
+
+    public:
+
         Value valueFor(Key const& key, Value const& default_value = Value()) const
         {
             BucketType& b = getBucket(key);
@@ -538,16 +626,59 @@ namespace graft
             return b.applyFor(key, f);
         }
 
+        //the entry is added only if the key is absent; expires is steady clock time in seconds, as in the node
+        bool restore(const Key& key, const Value& value, ch::seconds ttl, ch::seconds expires)
+        {
+            BucketType& b = getBucket(key);
+            std::shared_lock<std::shared_mutex> lock(b.blk);
+            return b.restore(key, value, ttl, expires);
+        }
+
+        using ForEachEntryFunc = std::function<void(const Key& key, const Value& value, ch::seconds ttl, ch::seconds expires, bool hasOnExpired)>;
+
+        //visits all the entries; only one bucket is locked (shared) at a time, so the table remains available
+        void forEachEntry(ForEachEntryFunc f)
+        {
+            for(auto& bptr : m_buckets)
+            {
+                BucketType& b = *bptr;
+                std::shared_lock<std::shared_mutex> lock(b.blk);
+                b.forEachNode([&f](std::shared_ptr<typename BucketType::node>& ptr)->bool
+                {
+                    f(ptr->data->first, ptr->data->second, ptr->ttl, ptr->expires, bool(ptr->onExpired));
+                    return true;
+                });
+            }
+        }
+
         void cleanup(bool all = false)
         {
-            BucketType* b = &getNextBucket();
-            for(BucketType* n = b;;)
+            if(all)
+            {
+                cleanup(ch::steady_clock::duration::max());
+                return;
+            }
+            CleanupStats stats;
+            cleanup(getNextBucket(), ch::steady_clock::time_point::max(), stats);
+        }
+
+        //cleans buckets starting from the cursor until the budget is spent or all the buckets are visited.
+        //A bucket left unfinished is the first one of the next pass, which goes on where it stopped, so large
+        //expired cohorts behind the live entries are removed within several passes without long locks.
+        CleanupStats cleanup(ch::steady_clock::duration budget)
+        {
+            CleanupStats stats;
+            auto begin = ch::steady_clock::now();
+            auto deadline = (budget < ch::steady_clock::time_point::max() - begin)? begin + budget : ch::steady_clock::time_point::max();
+            for(size_t i = 0; i < m_buckets.size(); ++i)
             {
-                cleanup(*n);
-                if(!all) break;
-                n = &getNextBucket();
-                if(n == b) break;
+                if(!cleanup(**m_bit, deadline, stats)) break;
+                getNextBucket();
+                ++stats.buckets;
+                if(deadline <= ch::steady_clock::now()) break;
             }
+            stats.duration = ch::steady_clock::now() - begin;
+            return stats;
         }
     };
 }
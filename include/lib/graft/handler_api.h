@@ -2,6 +2,8 @@
 
 #include "lib/graft/router.h"
 
+#include <functional>
+
 namespace graft
 {
 
@@ -11,13 +13,24 @@ struct ConfigOpts;
 class HandlerAPI
 {
 public:
+    //the callback of sendUpstreamAsync, it is called in IO thread; err is empty on success
+    using UpstreamCallback = std::function<void(Input& input, const std::string& err)>;
+
     virtual void sendUpstreamBlocking(Output& output, Input& input, std::string& err) = 0;
+    //non-blocking, the request is sent by IO thread; returns false if the request cannot be queued
+    virtual bool sendUpstreamAsync(const Output& output, UpstreamCallback callback) = 0;
     virtual bool addPeriodicTask(const Router::Handler& h_worker,
                                  std::chrono::milliseconds interval_ms,
                                  std::chrono::milliseconds initial_interval_ms = std::chrono::milliseconds::max(),
                                  double random_factor = 0) = 0;
     virtual request::system_info::Counter& runtimeSysInfo() = 0;
     virtual const ConfigOpts& configOpts() const = 0;
+    //sends the message to the WebSocket clients subscribed to the topic, see ConnectionManager::addWebSocketEndpoint;
+    //it can be called from any thread, the message is sent by IO thread. If last, the topic ends with the message
+    //and the clients are unsubscribed from it; an empty message is not sent
+    virtual void publish(const std::string& topic, const std::string& message, bool last = false) = 0;
+    //resumes the task postponed with the uuid, or the task that is about to be postponed; it can be called from any thread
+    virtual void resumePostponed(const Context::uuid_t& uuid) = 0;
 };
 
 }//namespace graft
@@ -3,11 +3,17 @@
 
 #include "lib/graft/graft_macros.h"
 #include "lib/graft/common/utils.h"
+#include "lib/graft/binary_serializer.h"
+#include "lib/graft/json_reader.h"
 
 #include "lib/graft/reflective-rapidjson/reflector-boosthana.h"
 #include "lib/graft/reflective-rapidjson/serializable.h"
 #include "lib/graft/reflective-rapidjson/types.h"
 
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <memory>
 #include <utility>
 #include <string>
 #include <vector>
@@ -99,7 +105,11 @@ namespace graft
             }
             static void deserialize(const std::string& s, T& t)
             {
-                t = T::fromJson(s);
+                //IO structs are read without building rapidjson::Document
+                if constexpr (boost::hana::Struct<T>::value)
+                    json::fromJson(s.data(), s.size(), t);
+                else
+                    t = T::fromJson(s);
             }
         };
 
@@ -112,7 +122,7 @@ namespace graft
             }
             static void deserialize(const std::string& s, T& t)
             {
-                t = T::fromJson(utils::base64_decode(s));
+                JSON<T>::deserialize(utils::base64_decode(s), t);
             }
         };
 
@@ -135,6 +145,10 @@ namespace graft
 
         void reset() { *this = InOutHttpBase(); }
         std::string combine_headers();
+        //value of the header from headers, the name is case insensitive; empty if there is no such header
+        std::string get_header(const std::string& name) const;
+        //replaces the value of the header in headers or adds the header
+        void set_header(const std::string& name, const std::string& value);
 
         //sometimes it is required to know client's host in a handler from input
         std::string host;
@@ -189,6 +203,76 @@ namespace graft
             body = S<T>::serialize(t);
         }
 
+        /*!
+         * \brief loadNegotiated - serializes t with serializer::BINARY or serializer::JSON and sets Content-Type accordingly.
+         * Pass input.acceptsBinary() as binary to reply in the format the client has asked for.
+         */
+        template<typename T>
+        void loadNegotiated(const T& t, bool binary)
+        {
+            if(binary)
+            {
+                loadT<serializer::BINARY>(t);
+                set_header("Content-Type", serializer::BINARY_CONTENT_TYPE);
+            }
+            else
+            {
+                loadT<serializer::JSON>(t);
+                set_header("Content-Type", "application/json");
+            }
+        }
+
+        /*!
+         * \brief loadStream - replies with the JSON envelope where the empty array array_name is replaced by the items.
+         * The reply is sent with chunked transfer encoding; the items are serialized by the IO thread, items_per_chunk
+         * at a time, while the client reads it, so that the whole JSON is never in memory.
+         * \param envelope - serialized response with "array_name":[] in it, e.g. a JSON-RPC result with no items.
+         * \param serialize_item - returns JSON of an item.
+         */
+        template<typename T, typename F>
+        void loadStream(const std::string& envelope, const std::string& array_name, std::vector<T> items,
+                        F serialize_item, size_t items_per_chunk = 64)
+        {
+            const std::string name = "\"" + array_name + "\":";
+            size_t pos = envelope.find(name + "[]");
+            assert(pos != std::string::npos);
+            pos += name.size();
+
+            struct State
+            {
+                std::string prefix;
+                std::string suffix;
+                std::vector<T> items;
+                size_t next = 0;
+            };
+            auto state = std::make_shared<State>();
+            state->prefix = envelope.substr(0, pos) + "[";
+            state->suffix = "]" + envelope.substr(pos + 2);
+            state->items = std::move(items);
+            items_per_chunk = std::max<size_t>(1, items_per_chunk);
+
+            body.clear();
+            stream = [state, serialize_item, items_per_chunk](std::string& chunk)->bool
+            {
+                if(state->next == 0) chunk += state->prefix;
+                size_t end = std::min(state->items.size(), state->next + items_per_chunk);
+                for(; state->next < end; ++state->next)
+                {
+                    if(state->next != 0) chunk += ',';
+                    chunk += serialize_item(state->items[state->next]);
+                }
+                if(state->next < state->items.size()) return true;
+                chunk += state->suffix;
+                return false;
+            };
+        }
+
+        template<typename T>
+        void loadStream(const std::string& envelope, const std::string& array_name, std::vector<T> items, size_t items_per_chunk = 64)
+        {
+            loadStream(envelope, array_name, std::move(items), &serializer::JSON<T>::serialize, items_per_chunk);
+        }
+
         std::pair<const char *, size_t> get() const
         {
             return std::make_pair(body.c_str(), body.length());
@@ -209,6 +293,12 @@ namespace graft
          */
         std::string makeUri(const std::string& default_uri) const;
 
+        //appends the next part of the reply to chunk, returns false after the last one;
+        //if it is set, the reply is sent with chunked transfer encoding and body is not sent,
+        //it is called by the IO thread as the client reads the reply, see loadStream
+        using StreamProducer = std::function<bool (std::string& chunk)>;
+        StreamProducer stream;
+
         std::string port;
         std::string path;
         static std::unordered_map<std::string, std::tuple<std::string,int,bool,double>> uri_substitutions;
@@ -288,6 +378,27 @@ namespace graft
             }
         }
 
+        /*!
+         * \brief binary - true if the body is encoded with serializer::BINARY, according to Content-Type
+         */
+        bool binary() const;
+
+        /*!
+         * \brief acceptsBinary - true if the client accepts serializer::BINARY responses, according to Accept or Content-Type
+         */
+        bool acceptsBinary() const;
+
+        /*!
+         * \brief getNegotiated - parses object with serializer::BINARY or serializer::JSON depending on Content-Type
+         * \param result - reference to result object of type T
+         * \return  - true on success
+         */
+        template<typename T>
+        bool getNegotiated(T& result) const
+        {
+            return binary()? getT<serializer::BINARY>(result) : getT<serializer::JSON>(result);
+        }
+
         void load(const char *buf, size_t size)
         {
             InOutHttpBase::reset();
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+typedef uint32_t in_addr_t;
+struct sockaddr;
+
+/*
+ *  Tables of the IP filter, used by BlackList on every accepted connection.
+ *  ========================================================================
+ *  PrefixTable - allow/deny rules compiled into a multibit trie: 16 bits on the first level
+ *      and 8 bits on the next ones, prefixes are expanded to the level boundaries. An IPv4 lookup
+ *      is at most three array accesses. IPv4 and IPv6 rules are in separate tries. A compiled table
+ *      is immutable, it is replaced as a whole when the rules change.
+ *  RateTable - sliding window counters in a fixed size open addressed table. An update probes
+ *      a few slots, the table does not grow under a flood of distinct addresses; the slot with
+ *      the least requests in the probe sequence is reused when there is no free one.
+ *  RouteLimiter - token buckets per (address, route group), checked on the IO thread after the route
+ *      is matched, so the requests over the budget are refused without a task. The table is open
+ *      addressed the same way as RateTable; a full bucket holds no state and its slot is reused.
+ */
+
+namespace graft
+{
+namespace ipfilter
+{
+
+//IPv4 addresses are stored as IPv4-mapped IPv6 ones, ::ffff:a.b.c.d
+struct IpAddress
+{
+    std::array<uint8_t, 16> bytes{};
+
+    //host order
+    static IpAddress fromV4(in_addr_t addr);
+    static IpAddress fromV6(const uint8_t* addr);
+    //AF_INET and AF_INET6 are supported
+    static bool fromSockaddr(const sockaddr* sa, IpAddress& addr);
+    //dotted IPv4 or IPv6 text
+    static bool parse(const std::string& s, IpAddress& addr);
+
+    bool isV4() const;
+    //host order, valid if isV4()
+    in_addr_t v4() const;
+    //prefix length limit of the family, 32 or 128
+    int maxPrefixLen() const { return isV4()? 32 : 128; }
+    //the address with bits beyond len of the family cleared
+    IpAddress network(int len) const;
+    std::string toString() const;
+
+    bool operator == (const IpAddress& other) const { return bytes == other.bytes; }
+    bool operator != (const IpAddress& other) const { return bytes != other.bytes; }
+    bool operator < (const IpAddress& other) const { return bytes < other.bytes; }
+};
+
+struct IpAddressHash
+{
+    size_t operator()(const IpAddress& addr) const;
+};
+
+class PrefixTable
+{
+public:
+    using Allow = bool;
+
+    void clear();
+    //len is of the address family, 1..32 for IPv4 and 1..128 for IPv6
+    void insert(const IpAddress& addr, int len, Allow allow);
+    bool erase(const IpAddress& addr, int len);
+    bool empty() const { return m_rules.empty(); }
+
+    //rebuilds the trie after changes of the rules
+    void compile();
+    //longest prefix match in the compiled trie, first is false if no rule covers the address;
+    //the table is not modified, so a compiled table can be shared by threads
+    std::pair<bool, Allow> find(const IpAddress& addr) const;
+    //the same over the rules as they are, without compiling
+    std::pair<bool, Allow> findRule(const IpAddress& addr) const;
+private:
+    struct Entry
+    {
+        int32_t child = -1; //index of the first entry of the child node
+        int8_t value = -1;  //-1 if no rule, else Allow
+    };
+
+    class Trie
+    {
+    public:
+        static constexpr int ROOT_BITS = 16;
+        static constexpr int BITS = 8;
+
+        void clear() { m_entries.clear(); }
+        void insert(const uint8_t* key, int len, Allow allow);
+        std::pair<bool, Allow> find(const uint8_t* key, int keyBytes) const;
+    private:
+        std::vector<Entry> m_entries;
+    };
+
+    //(network address, prefix length of the family)
+    std::map<std::pair<IpAddress, int>, Allow> m_rules;
+    Trie m_v4;
+    Trie m_v6;
+    bool m_dirty = false;
+};
+
+class RateTable
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr size_t DEFAULT_CAPACITY = 1 << 14;
+    static constexpr size_t PROBES = 8;
+
+    RateTable(int requests_per_sec, int window_size_sec, size_t capacity = DEFAULT_CAPACITY);
+
+    //counts a request, returns true if the rate is exceeded; the counter of the address is dropped then
+    bool inc(const IpAddress& addr, clock::time_point now = clock::now());
+    //number of addresses with counters that are not outdated, walks the whole table
+    size_t activeCount(clock::time_point now = clock::now()) const;
+private:
+    struct Slot
+    {
+        IpAddress addr;
+        bool used = false;
+        clock::time_point start;
+        int count = 0;
+    };
+
+    bool outdated(const Slot& slot, clock::time_point now) const { return slot.start + m_wndSize + m_wndSize <= now; }
+
+    static constexpr std::chrono::seconds one_sec{1};
+
+    int m_requestsPerSec;
+    int m_wndSizeSec;
+    clock::duration m_wndSize;
+    std::vector<Slot> m_slots;
+    size_t m_mask;
+    //random, so the probe sequences cannot be predicted by clients
+    uint64_t m_seed;
+};
+
+class RouteLimiter
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr size_t DEFAULT_CAPACITY = 1 << 14;
+    static constexpr size_t PROBES = 8;
+
+    struct Group
+    {
+        //the requests with paths starting with the prefix are in the group
+        std::string prefix;
+        double requests_per_sec = 0;
+        //bucket size, the number of requests a client can send at once
+        double burst = 0;
+    };
+
+    //groups with zero rate are not limited, their prefixes exempt the paths from the groups of shorter ones
+    explicit RouteLimiter(const std::vector<Group>& groups, size_t capacity = DEFAULT_CAPACITY);
+
+    bool empty() const { return !m_limited; }
+    //index of the group with the longest prefix of the path, -1 if the path is not limited
+    int group(const std::string& path) const;
+    //takes a token from the bucket of the address in the group, returns false if the bucket is empty
+    bool take(const IpAddress& addr, int group, clock::time_point now = clock::now());
+    //seconds until the next token of the group, for Retry-After
+    int retryAfterSec(int group) const;
+private:
+    struct Slot
+    {
+        IpAddress addr;
+        int group = -1; //-1 if not used
+        double tokens = 0;
+        clock::time_point last;
+    };
+
+    double tokens(const Slot& slot, clock::time_point now) const;
+
+    std::vector<Group> m_groups;
+    bool m_limited = false;
+    std::vector<Slot> m_slots;
+    size_t m_mask;
+    uint64_t m_seed;
+};
+
+} //namespace ipfilter
+} //namespace graft
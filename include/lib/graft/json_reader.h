@@ -0,0 +1,350 @@
+#pragma once
+
+#include "lib/graft/reflective-rapidjson/reflector.h"
+
+#include <boost/hana.hpp>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+/*
+ *  Reader of JSON directly into the structures defined with GRAFT_DEFINE_IO_STRUCT.
+ *  ========================================================================
+ *  The input is scanned once, there is no rapidjson::Document in between. The members of
+ *  an object are matched to the structure fields by a perfect hash of field names that is
+ *  built at compile time for each structure, and the values are written in place.
+ *
+ *  The result is the same as of JsonReflector::fromJson without errors argument:
+ *  absent members keep defaults, unknown members and values of mismatching types are skipped.
+ *  Syntax errors throw rapidjson::ParseResult, as parsing of the Document does.
+ */
+
+namespace graft
+{
+    namespace json
+    {
+        constexpr uint32_t fnv1a(const char* s, size_t len)
+        {
+            uint32_t h = 2166136261u;
+            for(size_t i = 0; i < len; ++i)
+            {
+                h = (h ^ static_cast<uint8_t>(s[i])) * 16777619u;
+            }
+            return h;
+        }
+
+        constexpr size_t length(const char* s)
+        {
+            size_t len = 0;
+            while(s[len]) ++len;
+            return len;
+        }
+
+        //Pull tokenizer of JSON text
+        class JsonReader
+        {
+        public:
+            enum class Type { Null, Bool, Number, String, Object, Array };
+
+            struct Number
+            {
+                //integer without fraction and exponent that fits int64 or uint64
+                bool integer = false;
+                bool negative = false;
+                uint64_t u = 0; //absolute value if integer
+                double d = 0;
+
+                int64_t toInt64() const { return negative? -static_cast<int64_t>(u - 1) - 1 : static_cast<int64_t>(u); }
+            };
+
+            static constexpr int MAX_DEPTH = 128;
+
+            JsonReader(const char* data, size_t size) : m_begin(data), m_ptr(data), m_end(data + size) { }
+
+            //type of the next value, it is not consumed
+            Type next();
+
+            bool readBool();
+            void readNull();
+            void readNumber(Number& number);
+            void readString(std::string& s);
+            //skips the next value of any type
+            void skipValue();
+
+            //iterate members as
+            //  r.beginObject(); while(r.nextMember(key)) { ...read or skip the value... }
+            //key is valid until the value is read
+            void beginObject();
+            bool nextMember(std::string_view& key);
+
+            void beginArray();
+            bool nextItem();
+
+            //the whole document has been read
+            void finish();
+
+            [[noreturn]] void fail(rapidjson::ParseErrorCode code) const;
+        private:
+            char peek();
+            void expect(const char* literal);
+            void leave();
+            //unescaped string, points either to the input or to m_scratch
+            std::string_view readStringView();
+
+            const char* m_begin;
+            const char* m_ptr;
+            const char* m_end;
+            int m_depth = 0;
+            bool m_first = false;
+            std::string m_scratch;
+        };
+
+        template<typename T>
+        void read(JsonReader& r, T& v);
+
+        namespace detail
+        {
+            template<typename T>
+            using Accessors = decltype(boost::hana::accessors<T>());
+
+            template<typename T>
+            constexpr size_t fieldCount()
+            {
+                return decltype(boost::hana::length(std::declval<Accessors<T>>()))::value;
+            }
+
+            template<typename T, size_t I>
+            constexpr const char* fieldName()
+            {
+                using Name = std::decay_t<decltype(boost::hana::first(boost::hana::at_c<I>(std::declval<Accessors<T>>())))>;
+                return Name::c_str();
+            }
+
+            template<typename T, size_t I>
+            void readField(JsonReader& r, T& t)
+            {
+                read(r, boost::hana::second(boost::hana::at_c<I>(boost::hana::accessors<T>()))(t));
+            }
+
+            template<typename T>
+            struct Field
+            {
+                const char* name;
+                size_t len;
+                uint32_t hash;
+                void (*read)(JsonReader& r, T& t);
+            };
+
+            template<typename T, size_t... I>
+            constexpr std::array<Field<T>, sizeof...(I)> makeFields(std::index_sequence<I...>)
+            {
+                return {{ Field<T>{fieldName<T, I>(), length(fieldName<T, I>()),
+                                   fnv1a(fieldName<T, I>(), length(fieldName<T, I>())), &readField<T, I>}... }};
+            }
+
+            //the smallest modulus that maps the hashes to distinct slots, 0 if there is no such
+            template<typename T, size_t N>
+            constexpr size_t perfectModulus(const std::array<Field<T>, N>& fields)
+            {
+                for(size_t m = (N? N : 1); m < 64 * N + 64; ++m)
+                {
+                    bool unique = true;
+                    for(size_t i = 0; i < N && unique; ++i)
+                    {
+                        for(size_t j = 0; j < i && unique; ++j)
+                        {
+                            unique = (fields[i].hash % m) != (fields[j].hash % m);
+                        }
+                    }
+                    if(unique) return m;
+                }
+                return 0;
+            }
+
+            template<size_t M, typename T, size_t N>
+            constexpr std::array<int, M> perfectSlots(const std::array<Field<T>, N>& fields)
+            {
+                std::array<int, M> slots{};
+                for(size_t i = 0; i < M; ++i) slots[i] = -1;
+                for(size_t i = 0; i < N; ++i) slots[fields[i].hash % M] = int(i);
+                return slots;
+            }
+        } //namespace detail
+
+        //Field names of the structure T with their perfect hash, built at compile time
+        template<typename T>
+        struct Fields
+        {
+            static constexpr size_t N = detail::fieldCount<T>();
+            static constexpr std::array<detail::Field<T>, N> fields = detail::makeFields<T>(std::make_index_sequence<N>());
+            static constexpr size_t M = detail::perfectModulus(fields);
+            static_assert(M != 0, "no perfect hash of the field names");
+            static constexpr std::array<int, M> slots = detail::perfectSlots<M>(fields);
+
+            //reads the value of the field with the name, returns false if there is no such field
+            static bool read(JsonReader& r, const std::string_view& key, T& t)
+            {
+                if(N == 0) return false;
+                int idx = slots[fnv1a(key.data(), key.size()) % M];
+                if(idx < 0) return false;
+                const detail::Field<T>& f = fields[idx];
+                if(f.len != key.size() || std::memcmp(f.name, key.data(), f.len) != 0) return false;
+                f.read(r, t);
+                return true;
+            }
+        };
+
+        template<typename Tuple, size_t... I>
+        void readTupleItem(JsonReader& r, Tuple& t, size_t idx, std::index_sequence<I...>)
+        {
+            ((idx == I? read(r, std::get<I>(t)) : void()), ...);
+        }
+
+        template<typename T>
+        void read(JsonReader& r, T& v)
+        {
+            using namespace ReflectiveRapidJSON::JsonReflector;
+            using JsonType = JsonReader::Type;
+
+            JsonType type = r.next();
+            if constexpr (std::is_same<T, bool>::value)
+            {
+                if(type != JsonType::Bool) return r.skipValue();
+                v = r.readBool();
+            }
+            else if constexpr (std::is_enum<T>::value)
+            {
+                if(type != JsonType::Number) return r.skipValue();
+                JsonReader::Number n;
+                r.readNumber(n);
+                if(!n.integer) return;
+                v = static_cast<T>(n.toInt64());
+            }
+            else if constexpr (std::is_integral<T>::value || std::is_floating_point<T>::value)
+            {
+                if(type != JsonType::Number) return r.skipValue();
+                JsonReader::Number n;
+                r.readNumber(n);
+                if constexpr (std::is_integral<T>::value)
+                {
+                    //the values out of the range of T are converted from double, as JsonReflector does
+                    if(n.integer && !n.negative && n.u <= uint64_t(std::numeric_limits<T>::max()))
+                    {
+                        v = static_cast<T>(n.u);
+                        return;
+                    }
+                    if constexpr (std::is_signed<T>::value)
+                    {
+                        if(n.integer && n.negative && n.u - 1 <= uint64_t(std::numeric_limits<T>::max()))
+                        {
+                            v = static_cast<T>(n.toInt64());
+                            return;
+                        }
+                    }
+                }
+                v = static_cast<T>(n.d);
+            }
+            else if constexpr (std::is_same<T, std::string>::value)
+            {
+                if(type != JsonType::String) return r.skipValue();
+                r.readString(v);
+            }
+            else if constexpr (std::is_pointer<T>::value)
+            {
+                r.skipValue();
+            }
+            else if constexpr (Traits::IsSpecializationOf<T, std::unique_ptr>::value || Traits::IsSpecializationOf<T, std::shared_ptr>::value)
+            {
+                if(type == JsonType::Null)
+                {
+                    r.readNull();
+                    v.reset();
+                    return;
+                }
+                v.reset(new typename T::element_type());
+                read(r, *v);
+            }
+            else if constexpr (Traits::IsSpecializationOf<T, std::tuple>::value)
+            {
+                constexpr size_t N = std::tuple_size<T>::value;
+                if(type != JsonType::Array) return r.skipValue();
+                //the tuple is assigned only if the sizes match
+                T tuple;
+                size_t count = 0;
+                r.beginArray();
+                for(; r.nextItem(); ++count)
+                {
+                    if(count < N) readTupleItem(r, tuple, count, std::make_index_sequence<N>());
+                    else r.skipValue();
+                }
+                if(count == N) v = std::move(tuple);
+            }
+            else if constexpr (IsMapOrHash<T>::value)
+            {
+                if(type != JsonType::Object) return r.skipValue();
+                std::string_view key;
+                r.beginObject();
+                while(r.nextMember(key))
+                {
+                    read(r, v[std::string(key)]);
+                }
+            }
+            else if constexpr (IsSet<T>::value || IsMultiSet<T>::value)
+            {
+                if(type != JsonType::Array) return r.skipValue();
+                v.clear();
+                r.beginArray();
+                while(r.nextItem())
+                {
+                    typename T::value_type item;
+                    read(r, item);
+                    v.emplace(std::move(item));
+                }
+            }
+            else if constexpr (IsArray<T>::value)
+            {
+                if(type != JsonType::Array) return r.skipValue();
+                v.clear();
+                r.beginArray();
+                while(r.nextItem())
+                {
+                    v.emplace_back();
+                    read(r, v.back());
+                }
+            }
+            else if constexpr (boost::hana::Struct<T>::value)
+            {
+                if(type != JsonType::Object) return r.skipValue();
+                std::string_view key;
+                r.beginObject();
+                while(r.nextMember(key))
+                {
+                    if(!Fields<T>::read(r, key, v)) r.skipValue();
+                }
+            }
+            else
+            {
+                static_assert(!std::is_same<T, T>::value, "type is not supported by the JSON reader");
+            }
+        }
+
+        /*!
+         * \brief fromJson - reads the structure from JSON, throws rapidjson::ParseResult on syntax errors
+         */
+        template<typename T>
+        void fromJson(const char* data, size_t size, T& t)
+        {
+            JsonReader r(data, size);
+            t = T();
+            read(r, t);
+            r.finish();
+        }
+    } //namespace json
+} //namespace graft
@@ -2,6 +2,7 @@
 
 #include <string>
 #include <vector>
+#include <chrono>
 #include <cassert>
 
 namespace graft {
@@ -21,6 +22,31 @@ struct IPFilterOpts
     int window_size_sec = 0;
     int ban_ip_sec = 0;
     std::string rules_filename;
+    //the rules file is checked for changes and reloaded with this interval, 0 to disable
+    int rules_reload_interval_ms = 5000;
+};
+
+struct RateLimitOpts
+{
+    //token bucket per client IP, requests_per_sec 0 to disable limiting of the group
+    struct Budget
+    {
+        double requests_per_sec = 0;
+        //0 means requests_per_sec
+        int burst = 0;
+    };
+    Budget dapi;      // /dapi/v2.0/*
+    Budget walletapi; // /walletapi/*
+    Budget debug;     // /debug/*
+};
+
+struct ContextSnapshotOpts
+{
+    //empty to disable snapshots
+    std::string filename;
+    int interval_ms = 0;
+    //key suffixes to save, all registered if empty
+    std::vector<std::string> namespaces;
 };
 
 struct ConfigOpts
@@ -28,29 +54,62 @@ struct ConfigOpts
     std::string config_filename;
     std::string http_address;
     std::string coap_address;
+    //the greatest block of CoAP block-wise transfer, a power of two from 16 to 1024
+    int coap_block_size = 1024;
+    //how often the observed CoAP resources are checked for changes, 0 means Observe is not supported
+    int coap_observe_interval_ms = 1000;
+    //seconds an observation lasts without registering again
+    double coap_observe_lifetime = 300;
     double http_connection_timeout;
+    //requests served by an inbound connection before it is closed, 0 means the connection is closed after the first response
+    int http_keep_alive_requests = 0;
     double upstream_request_timeout;
     int workers_count;
+    //the pool grows up to it under load and shrinks back to workers_count, 0 means fixed size
+    int workers_max_count = 0;
     int worker_queue_len;
     int workers_expelling_interval_ms;
+    //CPU the IO thread is pinned to, -1 means no pinning
+    int io_cpu = -1;
+    //CPUs the workers are pinned to in turn, e.g. "0-3,8"; "node" means the NUMA node of io_cpu; empty means no pinning
+    std::string workers_cpus;
     std::string cryptonode_rpc_address;
     int timer_poll_interval_ms;
     int log_trunc_to_size;
     std::vector<std::string> graftlet_dirs;
     int lru_timeout_ms;
+    //time limit of a GlobalContextMap cleanup pass, 0 means no limit
+    int gcm_cleanup_budget_us = 2000;
     IPFilterOpts ipfilter;
+    RateLimitOpts ratelimit;
+    ContextSnapshotOpts context_snapshot;
     CommonOpts common;
 
+    //time limit of a cleanup pass from gcm_cleanup_budget_us; no limit is duration::max, which does not overflow on conversion
+    std::chrono::steady_clock::duration gcm_cleanup_budget() const
+    {
+        if(gcm_cleanup_budget_us == 0) return std::chrono::steady_clock::duration::max();
+        return std::chrono::microseconds(gcm_cleanup_budget_us);
+    }
+
     void check_asserts() const
     {
         assert(!http_address.empty());
         assert(!coap_address.empty());
+        assert(16 <= coap_block_size && coap_block_size <= 1024 && (coap_block_size & (coap_block_size - 1)) == 0);
+        assert(0 <= coap_observe_interval_ms);
+        assert(0 < coap_observe_lifetime);
         assert(0 < http_connection_timeout);
+        assert(0 <= http_keep_alive_requests);
         assert(0 < upstream_request_timeout);
         assert(0 < workers_expelling_interval_ms);
+        assert(0 <= workers_max_count);
         assert(0 < timer_poll_interval_ms);
         assert(0 < lru_timeout_ms);
+        assert(0 <= gcm_cleanup_budget_us);
         assert(ipfilter.requests_per_sec == 0 || 0 < ipfilter.window_size_sec);
+        assert(0 <= ratelimit.dapi.requests_per_sec && 0 <= ratelimit.walletapi.requests_per_sec && 0 <= ratelimit.debug.requests_per_sec);
+        assert(context_snapshot.filename.empty() || 0 <= context_snapshot.interval_ms);
     }
 };
 
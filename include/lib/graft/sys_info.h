@@ -28,6 +28,7 @@ class Counter
     void count_http_resp_status_error(void)   { ++m_http_resp_status_error_cnt; }   // 500
     void count_http_resp_status_drop(void)    { ++m_http_resp_status_drop_cnt; }    // 400
     void count_http_resp_status_busy(void)    { ++m_http_resp_status_busy_cnt; }    // 503
+    void count_http_resp_status_limited(void) { ++m_http_resp_status_limited_cnt; } // 429
 
     void count_http_req_bytes_raw(u32 inc_delta)         { m_http_req_bytes_raw_cnt += inc_delta; }
     void count_http_resp_bytes_raw(u32 inc_delta)        { m_http_resp_bytes_raw_cnt += inc_delta; }
@@ -39,6 +40,15 @@ class Counter
     void count_upstrm_http_req_bytes_raw(u32 inc_delta)   { m_upstrm_http_req_bytes_raw_cnt += inc_delta; }
     void count_upstrm_http_resp_bytes_raw(u32 inc_delta)  { m_upstrm_http_resp_bytes_raw_cnt += inc_delta; }
 
+    void count_gcm_cleanup(u64 expired, u64 pause_us, u64 pass_us)
+    {
+        ++m_gcm_cleanup_pass_cnt;
+        m_gcm_cleanup_expired_cnt += expired;
+        m_gcm_cleanup_expired_last = expired;
+        update_max(m_gcm_cleanup_pause_max_us, pause_us);
+        update_max(m_gcm_cleanup_pass_max_us, pass_us);
+    }
+
     // interface for consumer
     u64 http_request_total_cnt(void)          const { return m_http_req_total_cnt; }
     u64 http_request_routed_cnt(void)         const { return m_http_req_routed_cnt; }
@@ -48,6 +58,7 @@ class Counter
     u64 http_resp_status_error_cnt(void)      const { return m_http_resp_status_error_cnt; }   // 500
     u64 http_resp_status_drop_cnt(void)       const { return m_http_resp_status_drop_cnt; }    // 400
     u64 http_resp_status_busy_cnt(void)       const { return m_http_resp_status_busy_cnt; }    // 503
+    u64 http_resp_status_limited_cnt(void)    const { return m_http_resp_status_limited_cnt; } // 429
 
     u64 http_req_bytes_raw_cnt(void)          const { return m_http_req_bytes_raw_cnt; }
     u64 http_resp_bytes_raw_cnt(void)         const { return m_http_resp_bytes_raw_cnt; }
@@ -59,6 +70,12 @@ class Counter
     u64 upstrm_http_req_bytes_raw_cnt(void)   const { return m_upstrm_http_req_bytes_raw_cnt; }
     u64 upstrm_http_resp_bytes_raw_cnt(void)  const { return m_upstrm_http_resp_bytes_raw_cnt; }
 
+    u64 gcm_cleanup_pass_cnt(void)            const { return m_gcm_cleanup_pass_cnt; }
+    u64 gcm_cleanup_expired_cnt(void)         const { return m_gcm_cleanup_expired_cnt; }
+    u64 gcm_cleanup_expired_last(void)        const { return m_gcm_cleanup_expired_last; }   // per the last pass
+    u64 gcm_cleanup_pause_max_us(void)        const { return m_gcm_cleanup_pause_max_us; }   // the longest bucket lock
+    u64 gcm_cleanup_pass_max_us(void)         const { return m_gcm_cleanup_pass_max_us; }
+
     u32 system_uptime_sec(void) const
     {
       return std::chrono::duration_cast<std::chrono::seconds>(
@@ -66,6 +83,12 @@ class Counter
     }
 
   private:
+    static void update_max(std::atomic<u64>& max, u64 value)
+    {
+        u64 prev = max;
+        while(prev < value && !max.compare_exchange_weak(prev, value));
+    }
+
     std::atomic<u64>  m_http_req_total_cnt;
     std::atomic<u64>  m_http_req_routed_cnt;
     std::atomic<u64>  m_http_req_unrouted_cnt;
@@ -74,6 +97,7 @@ class Counter
     std::atomic<u64>  m_http_resp_status_error_cnt;
     std::atomic<u64>  m_http_resp_status_drop_cnt;
     std::atomic<u64>  m_http_resp_status_busy_cnt;
+    std::atomic<u64>  m_http_resp_status_limited_cnt;
 
     std::atomic<u64>  m_http_req_bytes_raw_cnt;
     std::atomic<u64>  m_http_resp_bytes_raw_cnt;
@@ -85,6 +109,12 @@ class Counter
     std::atomic<u64>  m_upstrm_http_req_bytes_raw_cnt;
     std::atomic<u64>  m_upstrm_http_resp_bytes_raw_cnt;
 
+    std::atomic<u64>  m_gcm_cleanup_pass_cnt;
+    std::atomic<u64>  m_gcm_cleanup_expired_cnt;
+    std::atomic<u64>  m_gcm_cleanup_expired_last;
+    std::atomic<u64>  m_gcm_cleanup_pause_max_us;
+    std::atomic<u64>  m_gcm_cleanup_pass_max_us;
+
     const SysClockTimePoint m_system_start_time;
 };
 
@@ -21,10 +21,12 @@ GRAFT_DEFINE_IO_STRUCT_INITED(Configuratioon,
     (u32, http_connection_timeout, 0),
     (u32, upstream_request_timeout, 0),
     (u32, workers_count, 0),
+    (u32, workers_max_count, 0),
     (u32, worker_queue_len, 0),
     (std::string, cryptonode_rpc_address, std::string()),
     (u32, timer_poll_interval_ms, 0),
     (u32, lru_timeout_ms, 0),
+    (u32, gcm_cleanup_budget_us, 0),
     (std::vector<std::string>, graftlet_dirs, std::vector<std::string>()),
     (bool, testnet, false),
     (std::string, data_dir, std::string()),
@@ -47,6 +49,7 @@ GRAFT_DEFINE_IO_STRUCT_INITED(Running,
     (u64, http_resp_status_error, 0),
     (u64, http_resp_status_drop, 0),
     (u64, http_resp_status_busy, 0),
+    (u64, http_resp_status_limited, 0),
 
     (u64, http_req_bytes_raw, 0),
     (u64, http_resp_bytes_raw, 0),
@@ -58,6 +61,12 @@ GRAFT_DEFINE_IO_STRUCT_INITED(Running,
     (u64, upstrm_http_req_bytes_raw, 0),
     (u64, upstrm_http_resp_bytes_raw, 0),
 
+    (u64, gcm_cleanup_passes, 0),
+    (u64, gcm_cleanup_expired, 0),
+    (u64, gcm_cleanup_expired_last_pass, 0),
+    (u64, gcm_cleanup_pause_max_us, 0),
+    (u64, gcm_cleanup_pass_max_us, 0),
+
     (u32, uptime_sec, 0)
 );
 
@@ -13,6 +13,7 @@
 #include "misc_log_ex.h"
 #include <future>
 #include <deque>
+#include <mutex>
 
 #define LOG_PRINT_CLN(level,client,x) LOG_PRINT_L##level("[" << client_addr(client) << "] " << x)
 
@@ -134,9 +135,12 @@ class UpstreamTask : public BaseTask
 {
 public:
     using PromiseItem = std::pair< std::promise<Input>, Output >;
+    using CallbackItem = std::pair< HandlerAPI::UpstreamCallback, Output >;
 
     virtual void finalize() override;
     PromiseItem m_pi;
+    //set for sendUpstreamAsync requests, m_pi.first is not used then
+    HandlerAPI::UpstreamCallback m_callback;
 private:
     friend class SelfHolder<BaseTask>;
     UpstreamTask(TaskManager& manager, PromiseItem&& pi)
@@ -144,6 +148,15 @@ private:
                 Router::Handler3(nullptr, nullptr, nullptr)}))
         , m_pi(std::move(pi))
     {
+        m_output = m_pi.second;
+    }
+
+    UpstreamTask(TaskManager& manager, CallbackItem&& ci)
+        : BaseTask(manager, Router::JobParams({Input(), Router::vars_t(),
+                Router::Handler3(nullptr, nullptr, nullptr)}))
+        , m_callback(std::move(ci.first))
+    {
+        m_output = std::move(ci.second);
     }
 };
 
@@ -186,6 +199,8 @@ public:
 
     mg_connection *m_client;
     ConnectionManager* m_connectionManager;
+    //the connection is kept open for the next request after the response
+    bool m_keepAlive = false;
 };
 
 
@@ -224,12 +239,15 @@ public:
 
     //HandlerAPI implementation
     virtual void sendUpstreamBlocking(Output& output, Input& input, std::string& err) override;
+    virtual bool sendUpstreamAsync(const Output& output, UpstreamCallback callback) override;
     virtual bool addPeriodicTask(const Router::Handler& h_worker,
                                  std::chrono::milliseconds interval_ms,
                                  std::chrono::milliseconds initial_interval_ms = std::chrono::milliseconds::max(),
                                  double random_factor = 0 ) override;
     virtual request::system_info::Counter& runtimeSysInfo() override;
     virtual const ConfigOpts& configOpts() const override;
+    virtual void publish(const std::string& topic, const std::string& message, bool last = false) override;
+    virtual void resumePostponed(const Context::uuid_t& uuid) override;
 
     //
     void runWorkerActionFromTheThreadPool(BaseTaskPtr bt);
@@ -239,10 +257,27 @@ public:
     void cb_event(uint64_t cnt);
 
     void getThreadPoolInfo(uint64_t& activeWorkers, uint64_t& expelledWorkers) const;
+
+    //applies the options that can be changed without restart, it is called by the IO thread;
+    //the thread pool is resized and the upstream substitutions are updated, connections are kept
+    void reconfigure(const ConfigOpts& copts);
 protected:
+    struct Publication
+    {
+        std::string topic;
+        std::string message;
+        bool last = false;
+    };
+    using Published = std::deque<Publication>;
+
     bool canStop();
     void executePostponedTasks();
+    //IO thread; the messages published since the previous call
+    Published takePublished();
     void expelWorkers();
+    //grows the thread pool up to workers_max_count while workers are blocked or the queues are filling,
+    //and shrinks it back to workers_count while workers are idle
+    void scaleWorkers();
     void setIOThread(bool current);
     void checkUpstreamBlockingIO();
     void checkPeriodicTaskIO();
@@ -254,6 +289,8 @@ private:
     void processOk(BaseTaskPtr bt);
     void respondAndDie(BaseTaskPtr bt, const std::string& s, bool die = true);
     void postponeTask(BaseTaskPtr bt);
+    //IO thread; moves the postponed tasks woken by resumePostponed to m_readyToResume
+    void resumeWoken();
     void upstreamDoneProcess(UpstreamSender& uss);
 
     void checkThreadPoolOverflow(BaseTaskPtr bt);
@@ -261,7 +298,13 @@ private:
     void runWorkerAction(BaseTaskPtr bt);
     void runPostAction(BaseTaskPtr bt);
 
-    void initThreadPool(int threadCount = std::thread::hardware_concurrency(), int workersQueueSize = 32, int expellingIntervalMs = 2000);
+    void initThreadPool(int threadCount = std::thread::hardware_concurrency(), int workersQueueSize = 32, int expellingIntervalMs = 2000,
+                        int workersMaxCount = 0);
+    void resizeThreadPool(size_t threadCount);
+    //workers_count to the number of workers
+    static size_t workersCount(int threadCount);
+    //workers_cpus to the CPUs, empty if the workers are not pinned
+    static std::vector<int> workersCpus(const ConfigOpts& copts);
     bool tryProcessReadyJob();
 
     static inline size_t next_pow2(size_t val);
@@ -276,6 +319,8 @@ private:
     uint64_t m_cntJobDone = 0;
 
     uint64_t m_threadPoolInputSize = 0;
+    std::chrono::steady_clock::time_point m_scaleTime;
+    std::chrono::steady_clock::time_point m_idleSince;
     std::unique_ptr<ThreadPoolX> m_threadPool;
     std::unique_ptr<TPResQueue> m_resQueue;
     TimerList<BaseTaskPtr> m_timerList;
@@ -288,12 +333,19 @@ private:
 
     using PromiseItem = UpstreamTask::PromiseItem;
     using PromiseQueue = tp::MPMCBoundedQueue<PromiseItem>;
+    using CallbackItem = UpstreamTask::CallbackItem;
+    using CallbackQueue = tp::MPMCBoundedQueue<CallbackItem>;
 
     using PeridicTaskItem = std::tuple<Router::Handler3, std::chrono::milliseconds, std::chrono::milliseconds, double>;
     using PeriodicTaskQueue = tp::MPMCBoundedQueue<PeridicTaskItem>;
 
     std::unique_ptr<PromiseQueue> m_promiseQueue;
+    std::unique_ptr<CallbackQueue> m_callbackQueue;
     std::unique_ptr<PeriodicTaskQueue> m_periodicTaskQueue;
+    std::mutex m_publishedMutex;
+    Published m_published;
+    std::mutex m_wokenMutex;
+    std::vector<Context::uuid_t> m_woken;
     static thread_local bool io_thread;
 
     friend class StateMachine;
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace tp
+{
+
+/**
+ * @brief Thread placement helpers. They are implemented for Linux only,
+ * elsewhere nothing is placed and the functions report a failure.
+ * NUMA nodes are read from sysfs, memory is placed on the node of the
+ * thread that touches it first, which is the default policy of Linux.
+ */
+using CpuSet = std::vector<int>;
+
+/**
+ * @brief parseCpuList Parse a list of CPUs in the form of sysfs and taskset, e.g. "0-3,8,10-11".
+ * @return 'false' if the list is malformed.
+ */
+inline bool parseCpuList(const std::string& s, CpuSet& cpus)
+{
+    cpus.clear();
+    std::istringstream is(s);
+    std::string item;
+    while(std::getline(is, item, ','))
+    {
+        size_t pos = 0;
+        int first, last;
+        try
+        {
+            first = std::stoi(item, &pos);
+            last = first;
+            if(pos < item.size() && item[pos] == '-')
+            {
+                size_t pos1 = 0;
+                last = std::stoi(item.substr(pos + 1), &pos1);
+                pos += 1 + pos1;
+            }
+        }
+        catch(std::exception&)
+        {
+            return false;
+        }
+        if(item.find_first_not_of(" \t\n", pos) != std::string::npos) return false;
+        if(first < 0 || last < first) return false;
+        for(int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+    }
+    return !cpus.empty();
+}
+
+/**
+ * @brief currentAffinity Return the CPUs the current thread is allowed to run on.
+ */
+inline CpuSet currentAffinity()
+{
+    CpuSet cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) != 0) return cpus;
+    for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if(CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+    }
+#endif
+    return cpus;
+}
+
+/**
+ * @brief setCurrentAffinity Restrict the current thread to the CPUs.
+ * The threads created by it inherit the restriction.
+ */
+inline bool setCurrentAffinity(const CpuSet& cpus)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int cpu : cpus)
+    {
+        if(cpu < 0 || CPU_SETSIZE <= cpu) return false;
+        CPU_SET(cpu, &set);
+    }
+    return !cpus.empty() && sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief nodeCpus Return the CPUs of the NUMA node, empty if the node is unknown.
+ */
+inline CpuSet nodeCpus(int node)
+{
+    CpuSet cpus;
+    std::ifstream is("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string s;
+    if(!std::getline(is, s) || !parseCpuList(s, cpus)) cpus.clear();
+    return cpus;
+}
+
+/**
+ * @brief cpuNode Return the NUMA node of the CPU, -1 if it is unknown.
+ */
+inline int cpuNode(int cpu)
+{
+    //the nodes are numbered without gaps usually, a few missing ones are skipped
+    for(int node = 0, missing = 0; missing < 8; ++node)
+    {
+        CpuSet cpus = nodeCpus(node);
+        if(cpus.empty())
+        {
+            ++missing;
+            continue;
+        }
+        for(int c : cpus)
+        {
+            if(c == cpu) return node;
+        }
+    }
+    return -1;
+}
+
+}
@@ -3,7 +3,6 @@
 #include "lib/graft/thread_pool/thread_pool.hpp"
 
 #include <atomic>
-#include <cassert>
 
 namespace tp
 {
@@ -16,6 +15,10 @@ using Strand = StrandImpl<FixedFunction<void(), 128>,
 /**
  * @brief The StrandImpl class implements serialized handler execution.
  * It is header only.
+ * Handlers are kept in an intrusive unbounded MPSC queue of the strand, the
+ * strand takes a single slot of the thread pool while it has handlers.
+ * After batch_size handlers it is posted to the pool again, behind the tasks
+ * and the strands posted meanwhile, so a busy strand does not starve others.
  */
 template <typename Task, template<typename> class Queue>
 class StrandImpl
@@ -26,25 +29,40 @@ public:
     /// Constructor
     ///
     /// @param thread_pool Linked thread pool
-    /// @param queue_size Size of queue for handlers
-    StrandImpl(ThreadPool& thread_pool, size_t queue_size);
+    /// @param batch_size Number of handlers executed in a row before
+    /// yielding the worker to other tasks
+    StrandImpl(ThreadPool& thread_pool, size_t batch_size = 8);
 
-    /** 
+    /// Waits until the posted handlers are done
+    ~StrandImpl();
+
+    StrandImpl(const StrandImpl&) = delete;
+    StrandImpl& operator = (const StrandImpl&) = delete;
+
+    /**
       * @brief Post handler to be executed in a sequential order in a thread pool
       *
-      * @param pool Target thread pool
       * @param handler Handler to be called from thread pool worker. It has to be
       * callable as 'handler()'.
-      * @param to_any_queue If true, attempts to post into each worker queue
-      * until success. Throws the exception otherwise. If false only one
-      * attempt will be made.
-      * @throw std::overflow_error if worker's queue is full.
+      * @note If the worker queues are full the handlers are executed by the
+      * calling thread, the strand never rejects a handler.
       * @note All exceptions thrown by handler will be suppressed.
       */
     template <typename Handler>
-    void post(Handler&& handler, bool to_any_queue = false);
+    void post(Handler&& handler);
 
 private:
+    struct Node
+    {
+        std::atomic<Node*> next{nullptr};
+        Task task;
+    };
+
+    void push(Node* node);
+    //returns nullptr if the queue is empty or a push is not complete
+    Node* pop();
+    //posts the strand to the pool, returns false if the pool is full
+    bool trySchedule();
     void invokeCall();
 
     class StrandImplHandler
@@ -59,54 +77,133 @@ private:
     };
 
     ThreadPool& m_thread_pool;
-    Queue<Task> m_queue;
-    std::atomic<size_t> m_deferred_calls_count;
+    const size_t m_batch_size;
+    //handlers posted and not done yet, the strand is in the pool while it is not zero
+    std::atomic<size_t> m_pending_count;
+    //producers push to the head, the single consumer pops from the tail
+    std::atomic<Node*> m_head;
+    Node* m_tail;
+    Node m_stub;
 };
 
 template <typename Task, template<typename> class Queue>
-StrandImpl<Task, Queue>::StrandImpl(ThreadPool& thread_pool, size_t queue_size)
+StrandImpl<Task, Queue>::StrandImpl(ThreadPool& thread_pool, size_t batch_size)
   : m_thread_pool(thread_pool)
-  , m_queue(queue_size)
-  , m_deferred_calls_count()
+  , m_batch_size(std::max<size_t>(1, batch_size))
+  , m_pending_count(0)
+  , m_head(&m_stub)
+  , m_tail(&m_stub)
+{
+}
+
+template <typename Task, template<typename> class Queue>
+StrandImpl<Task, Queue>::~StrandImpl()
 {
+    //the last handler can be finishing
+    while (m_pending_count.load(std::memory_order_acquire))
+    {
+        std::this_thread::yield();
+    }
+    while (Node* node = pop())
+    {
+        delete node;
+    }
 }
 
 template <typename Task, template<typename> class Queue>
 template <typename Handler>
-void StrandImpl<Task, Queue>::post(Handler&& handler, bool to_any_queue)
+void StrandImpl<Task, Queue>::post(Handler&& handler)
 {
-    m_queue.push(std::forward<Handler>(handler));
+    Node* node = new Node;
+    node->task = Task(std::forward<Handler>(handler));
+    push(node);
 
-    m_thread_pool.post(StrandImplHandler(*this), to_any_queue);
+    if (m_pending_count.fetch_add(1, std::memory_order_acq_rel) == 0 && !trySchedule())
+        invokeCall();
 }
 
 template <typename Task, template<typename> class Queue>
-void StrandImpl<Task, Queue>::invokeCall()
+void StrandImpl<Task, Queue>::push(Node* node)
 {
-    if (m_deferred_calls_count.fetch_add(1, std::memory_order_acq_rel))
-        return;
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node* prev = m_head.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+}
 
-    Task handler;
+template <typename Task, template<typename> class Queue>
+typename StrandImpl<Task, Queue>::Node* StrandImpl<Task, Queue>::pop()
+{
+    Node* tail = m_tail;
+    Node* next = tail->next.load(std::memory_order_acquire);
+    if (tail == &m_stub)
+    {
+        if (!next)
+            return nullptr;
+        m_tail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+    if (next)
+    {
+        m_tail = next;
+        return tail;
+    }
+    if (tail != m_head.load(std::memory_order_acquire))
+        return nullptr;
+    //the last node is returned, the stub takes its place
+    push(&m_stub);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next)
+    {
+        m_tail = next;
+        return tail;
+    }
+    return nullptr;
+}
 
-    for (;;)
+template <typename Task, template<typename> class Queue>
+bool StrandImpl<Task, Queue>::trySchedule()
+{
+    for (size_t i = 0, count = m_thread_pool.threadCount(); i < count; ++i)
     {
-        bool res = m_queue.pop(handler);
-        assert(res);
+        if (m_thread_pool.tryPost(StrandImplHandler(*this)))
+            return true;
+    }
+    return false;
+}
 
-        try
+template <typename Task, template<typename> class Queue>
+void StrandImpl<Task, Queue>::invokeCall()
+{
+    //it goes on while the pool is full
+    do
+    {
+        for (size_t i = 0; i < m_batch_size; ++i)
         {
-            handler();
+            Node* node;
+            //the handler is counted, so its push is about to complete
+            while (!(node = pop()))
+            {
+                std::this_thread::yield();
+            }
+
+            try
+            {
+                node->task();
+            }
+            catch (...)
+            {
+                // suppress all exceptions
+            }
+
+            bool has_deferred_calls = m_pending_count.fetch_sub(1, std::memory_order_acq_rel) > 1;
+            //the handler can hold the owner of the strand, the strand is not touched after it is destroyed
+            delete node;
+
+            if (!has_deferred_calls)
+                return;
         }
-        catch (...)
-        {
-            // suppress all exceptions
-        }           
-        
-        bool has_deferred_calls = m_deferred_calls_count.fetch_sub(1, std::memory_order_acq_rel) > 1;
-
-        if (!has_deferred_calls)
-          break;
-    }
+    } while (!trySchedule());
 }
 
 }
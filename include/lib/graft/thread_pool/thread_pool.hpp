@@ -28,10 +28,36 @@ using ThreadPool = ThreadPoolImpl<FixedFunction<void(), 128>,
  * It implements both work-stealing and work-distribution balancing
  * startegies.
  * It implements cooperative scheduling strategy for tasks.
+ * Idle workers are parked, a post wakes the worker of the queue.
+ * Workers can be pinned to CPUs, see ThreadPoolOptions::setCpus.
  */
 template <typename Task, template<typename> class Queue>
 class ThreadPoolImpl {
+    using Worker = WorkerT<Task, Queue>;
 public:
+    /**
+     * @brief The BlockingScope class marks the current worker as blocked
+     * while it exists, e.g. waiting for an upstream response. The number of
+     * blocked workers is taken into account when the pool is resized.
+     * It does nothing out of the worker threads.
+     */
+    class BlockingScope
+    {
+    public:
+        BlockingScope() : m_worker(Worker::getWorkerIdForCurrentThread() != -1u)
+        {
+            if(m_worker) ++Worker::blockedCount;
+        }
+        ~BlockingScope()
+        {
+            if(m_worker) --Worker::blockedCount;
+        }
+        BlockingScope(const BlockingScope&) = delete;
+        BlockingScope& operator = (const BlockingScope&) = delete;
+    private:
+        bool m_worker;
+    };
+
     /**
      * @brief ThreadPool Construct and start new thread pool.
      * @param options Creation options.
@@ -92,19 +118,56 @@ public:
     //it is for a single thread
     void expelWorkers();
 
+    /**
+     * @brief resize Start or retire workers to have the given number of them.
+     * @param count Number of workers, it is limited by maxThreadCount of the
+     * options.
+     * @note Retired workers do the tasks left in their queues and exit, the
+     * queues are kept for the case the pool grows again. It is for a single
+     * thread, the same as expelWorkers.
+     */
+    void resize(size_t count);
+
+    size_t threadCount() const { return m_count; }
+    size_t maxThreadCount() const { return m_max_count; }
+    size_t queueSize() const { return m_queue_size; }
+
+    void setExpellingIntervalMs(size_t ms) { Worker::defaultPeriodMs = typename Worker::Milliseconds(ms); }
+
     static uint64_t getActiveWorkersCount();
     static uint64_t getExpelledWorkersCount();
+    static uint64_t getParkedWorkersCount();
+    static uint64_t getBlockedWorkersCount();
 
 private:
     size_t getWorkerIdx();
+    //sets the sibling queues of the active workers
+    void linkWorkers();
+    //wakes the worker of the queue, or the one that steals from it if the worker is busy
+    void wake(size_t idx, size_t count);
+    //CPUs of the worker with the index
+    CpuSet placement(size_t idx) const;
+    //the queue of the worker with the index, allocated on the NUMA node of the worker if it is pinned
+    Queue<Task> makeQueue(size_t idx) const;
 
-    using Worker = WorkerT<Task, Queue>;
     using TimePoint = typename Worker::TimePoint;
     using QueuesVec = std::vector<Queue<Task>>;
     using WorkersVec = std::vector<std::shared_ptr<Worker>>;
 
+    //the vectors are reserved for maxThreadCount, so growing does not move the queues the workers refer to
     std::unique_ptr<std::vector<Queue<Task>>> m_queues;
     std::unique_ptr<std::vector<std::shared_ptr<Worker>>> m_workers;
+    //per worker index, maxThreadCount of them
+    std::unique_ptr<Parking[]> m_parkings;
+    //the workers are pinned to them in turn
+    CpuSet m_cpus;
+    //the CPUs of the process when the pool is created; workers that are not pinned run on them,
+    //not on the ones of the thread that starts them, e.g. the pinned IO thread
+    CpuSet m_process_cpus;
+    //active workers are [0, m_count)
+    std::atomic<size_t> m_count = 0;
+    size_t m_max_count = 0;
+    size_t m_queue_size = 0;
 
     std::atomic<size_t> m_next_worker = 0;
 };
@@ -119,17 +182,22 @@ inline ThreadPoolImpl<Task, Queue>::ThreadPoolImpl(
     using Milliseconds = typename Worker::Milliseconds;
     Worker::defaultPeriodMs = Milliseconds(options.expellingIntervalMs());
 
+    m_max_count = options.maxThreadCount();
+    m_queue_size = options.queueSize();
+    m_cpus = options.cpus();
+    m_process_cpus = currentAffinity();
     m_queues = std::make_unique<QueuesVec>();
-    m_queues->reserve(options.threadCount());
+    m_queues->reserve(m_max_count);
     m_workers = std::make_unique<WorkersVec>();
-    m_workers->reserve(options.threadCount());
+    m_workers->reserve(m_max_count);
+    m_parkings = std::make_unique<Parking[]>(m_max_count);
 
     QueuesVec& queues = *m_queues;
     WorkersVec& workers = *m_workers;
 
     for(size_t i = 0; i < options.threadCount(); ++i)
     {
-        queues.emplace_back(Queue<Task>(options.queueSize()));
+        queues.emplace_back(makeQueue(i));
         workers.emplace_back(std::make_shared<Worker>());
     }
 
@@ -137,7 +205,80 @@ inline ThreadPoolImpl<Task, Queue>::ThreadPoolImpl(
     {
         size_t i1 = (i + 1) % workers.size();
         std::shared_ptr wrkr(workers[i]);
-        workers[i]->start(i, queues[i], queues[i1], std::move(wrkr));
+        workers[i]->start(i, queues[i], queues[i1], m_parkings[i], placement(i), std::move(wrkr));
+    }
+    m_count = workers.size();
+}
+
+template <typename Task, template<typename> class Queue>
+inline CpuSet ThreadPoolImpl<Task, Queue>::placement(size_t idx) const
+{
+    if(m_cpus.empty()) return m_process_cpus;
+    return CpuSet{ m_cpus[idx % m_cpus.size()] };
+}
+
+template <typename Task, template<typename> class Queue>
+inline Queue<Task> ThreadPoolImpl<Task, Queue>::makeQueue(size_t idx) const
+{
+    if(m_cpus.empty()) return Queue<Task>(m_queue_size);
+    //the pages of the cells are placed on the node of the thread that initializes them
+    std::unique_ptr<Queue<Task>> queue;
+    std::thread([this, idx, &queue]()
+    {
+        setCurrentAffinity(placement(idx));
+        queue = std::make_unique<Queue<Task>>(m_queue_size);
+    }).join();
+    return std::move(*queue);
+}
+
+template <typename Task, template<typename> class Queue>
+inline void ThreadPoolImpl<Task, Queue>::linkWorkers()
+{
+    QueuesVec& queues = *m_queues;
+    WorkersVec& workers = *m_workers;
+    size_t count = m_count;
+    for(size_t i = 0; i < count; ++i)
+    {
+        workers[i]->m_steal_queue = &queues[(i + 1) % count];
+    }
+}
+
+template <typename Task, template<typename> class Queue>
+inline void ThreadPoolImpl<Task, Queue>::resize(size_t count)
+{
+    count = std::min(std::max<size_t>(1, count), m_max_count);
+    size_t prev = m_count;
+    if(count == prev) return;
+
+    QueuesVec& queues = *m_queues;
+    WorkersVec& workers = *m_workers;
+
+    if(prev < count)
+    {
+        for(size_t i = queues.size(); i < count; ++i)
+        {
+            queues.emplace_back(makeQueue(i));
+            workers.emplace_back();
+        }
+        for(size_t i = prev; i < count; ++i)
+        {
+            std::shared_ptr<Worker> nworker = std::make_shared<Worker>();
+            workers[i] = nworker;
+            workers[i]->start(i, queues[i], queues[(i + 1) % count], m_parkings[i], placement(i), std::move(nworker));
+        }
+        m_count = count;
+        linkWorkers();
+    }
+    else
+    {
+        //new tasks are not posted to the retired workers from now, see tryPost
+        m_count = count;
+        linkWorkers();
+        for(size_t i = count; i < prev; ++i)
+        {
+            workers[i]->retire();
+            workers[i].reset();
+        }
     }
 }
 
@@ -150,7 +291,8 @@ inline void ThreadPoolImpl<Task, Queue>::expelWorkers()
     QueuesVec& queues = *m_queues;
     WorkersVec& workers = *m_workers;
 
-    for(size_t i = 0; i < workers.size(); ++i)
+    size_t count = m_count;
+    for(size_t i = 0; i < count; ++i)
     {
         if(now < workers[i]->m_timePoint.load()) continue;
         auto oworker = workers[i];
@@ -159,8 +301,8 @@ inline void ThreadPoolImpl<Task, Queue>::expelWorkers()
 
         std::shared_ptr<Worker> nworker = std::make_shared<Worker>();
         workers[i] = nworker;
-        size_t i1 = (i + 1) % workers.size();
-        workers[i]->start(i, queues[i], queues[i1], std::move(nworker));
+        size_t i1 = (i + 1) % count;
+        workers[i]->start(i, queues[i], queues[i1], m_parkings[i], placement(i), std::move(nworker));
 
         ++Worker::expelledCount;
     }
@@ -178,6 +320,31 @@ inline uint64_t ThreadPoolImpl<Task, Queue>::getExpelledWorkersCount()
     return Worker::expelledCount;
 }
 
+template <typename Task, template<typename> class Queue>
+inline uint64_t ThreadPoolImpl<Task, Queue>::getParkedWorkersCount()
+{
+    return Worker::parkedCount;
+}
+
+template <typename Task, template<typename> class Queue>
+inline uint64_t ThreadPoolImpl<Task, Queue>::getBlockedWorkersCount()
+{
+    return Worker::blockedCount;
+}
+
+template <typename Task, template<typename> class Queue>
+inline void ThreadPoolImpl<Task, Queue>::wake(size_t idx, size_t count)
+{
+    Parking& parking = m_parkings[idx];
+    if(parking.parked)
+    {
+        parking.wake();
+        return;
+    }
+    Parking& thief = m_parkings[(idx + count - 1) % count];
+    if(thief.parked) thief.wake();
+}
+
 template <typename Task, template<typename> class Queue>
 inline ThreadPoolImpl<Task, Queue>::ThreadPoolImpl(ThreadPoolImpl<Task, Queue>&& rhs) noexcept
 {
@@ -192,7 +359,7 @@ inline ThreadPoolImpl<Task, Queue>::~ThreadPoolImpl()
     //more strictly that all jobs are done
     for (auto& worker_ptr : *m_workers)
     {
-        worker_ptr->stop();
+        if(worker_ptr) worker_ptr->stop();
     }
 
     while(Worker::activeCount)
@@ -210,6 +377,12 @@ ThreadPoolImpl<Task, Queue>::operator=(ThreadPoolImpl<Task, Queue>&& rhs) noexce
     {
         m_queues = std::move(rhs.m_queues);
         m_workers = std::move(rhs.m_workers);
+        m_parkings = std::move(rhs.m_parkings);
+        m_cpus = std::move(rhs.m_cpus);
+        m_process_cpus = std::move(rhs.m_process_cpus);
+        m_count = rhs.m_count.load();
+        m_max_count = rhs.m_max_count;
+        m_queue_size = rhs.m_queue_size;
         m_next_worker = rhs.m_next_worker.load();
     }
     return *this;
@@ -219,14 +392,45 @@ template <typename Task, template<typename> class Queue>
 template <typename Handler>
 inline bool ThreadPoolImpl<Task, Queue>::tryPost(Handler&& handler)
 {
-    return (*m_queues)[getWorkerIdx()].push(std::forward<Handler>(handler));
+    size_t idx = getWorkerIdx();
+    QueuesVec& queues = *m_queues;
+    if(!queues[idx].push(std::forward<Handler>(handler))) return false;
+
+    //the pool could be shrunk meanwhile; then the tasks of the retired worker are moved to the active
+    //ones, the retired worker does the same before exit, so nothing is left in its queue
+    //the fence is also against a lost wakeup, see WorkerT::park
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    size_t count = m_count;
+    if(idx < count)
+    {
+        wake(idx, count);
+        return true;
+    }
+    Task task;
+    while(queues[idx].pop(task))
+    {
+        bool ok = false;
+        for(size_t i = 0; !ok && i < count; ++i)
+        {
+            size_t idx1 = m_next_worker.fetch_add(1, std::memory_order_relaxed) % count;
+            ok = queues[idx1].push(std::move(task));
+            if(ok)
+            {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                wake(idx1, count);
+            }
+        }
+        //all the queues are full, it is unlikely at the moment of resizing
+        if(!ok) task();
+    }
+    return true;
 }
 
 template <typename Task, template<typename> class Queue>
 template <typename Handler>
 inline void ThreadPoolImpl<Task, Queue>::post(Handler&& handler, bool to_any_queue)
 {
-    int try_count = (to_any_queue)? m_workers->size() : 1;
+    int try_count = (to_any_queue)? m_count.load() : 1;
     for(int i = 0; i < try_count; ++i)
     {
         bool ok = tryPost(std::forward<Handler>(handler));
@@ -239,11 +443,12 @@ template <typename Task, template<typename> class Queue>
 inline size_t ThreadPoolImpl<Task, Queue>::getWorkerIdx()
 {
     auto id = Worker::getWorkerIdForCurrentThread();
+    size_t count = m_count;
 
-    if (id > m_workers->size())
+    //a retired worker posts to the active ones too
+    if (id >= count)
     {
-        id = m_next_worker.fetch_add(1, std::memory_order_relaxed) %
-             m_workers->size();
+        id = m_next_worker.fetch_add(1, std::memory_order_relaxed) % count;
     }
 
     return id;
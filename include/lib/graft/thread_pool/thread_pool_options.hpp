@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <thread>
+#include <vector>
 
 namespace tp
 {
@@ -30,11 +31,22 @@ public:
      */
     void setQueueSize(size_t size);
 
+    /**
+     * @brief setMaxThreadCount Set the limit of thread count for resizing.
+     * @param count Maximum number of threads, thread count by default.
+     */
+    void setMaxThreadCount(size_t count) { m_max_thread_count = count; }
+
     /**
      * @brief threadCount Return thread count.
      */
     size_t threadCount() const;
 
+    /**
+     * @brief maxThreadCount Return the limit of thread count for resizing.
+     */
+    size_t maxThreadCount() const { return std::max(m_max_thread_count, m_thread_count); }
+
     /**
      * @brief queueSize Return single worker queue size.
      */
@@ -51,16 +63,31 @@ public:
      */
     size_t expellingIntervalMs() const { return m_workers_expelling_interval_ms; }
 
+    /**
+     * @brief setCpus Set CPUs to pin the workers to, one per worker in turn.
+     * The queue of a pinned worker is allocated on its NUMA node.
+     * @param cpus CPU numbers, empty (default) means no pinning.
+     */
+    void setCpus(const std::vector<int>& cpus) { m_cpus = cpus; }
+
+    /**
+     * @brief cpus Return CPUs to pin the workers to.
+     */
+    const std::vector<int>& cpus() const { return m_cpus; }
+
 private:
     size_t m_thread_count;
+    size_t m_max_thread_count;
     size_t m_queue_size;
     size_t m_workers_expelling_interval_ms;
+    std::vector<int> m_cpus;
 };
 
 /// Implementation
 
 inline ThreadPoolOptions::ThreadPoolOptions()
     : m_thread_count(std::max<size_t>(2u, std::thread::hardware_concurrency()))
+    , m_max_thread_count(0u)
     , m_queue_size(1024u)
     , m_workers_expelling_interval_ms(1000u)
 {
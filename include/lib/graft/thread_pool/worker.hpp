@@ -1,17 +1,50 @@
 #pragma once
 
+#include "lib/graft/thread_pool/affinity.hpp"
+
 #include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <cassert>
 
 namespace tp
 {
 
+/**
+ * @brief The Parking struct is a place where an idle worker waits for tasks.
+ * The pool keeps one per worker index, so a poster can wake the worker of
+ * the queue while the workers are replaced by expelling and resizing.
+ */
+struct Parking
+{
+    /**
+     * @brief wake Wake the workers parked here, if any.
+     */
+    void wake()
+    {
+        {
+            std::lock_guard<std::mutex> lk(mutex);
+            ++signals;
+        }
+        //an expelled worker can be parked here with its substitute for a moment
+        cv.notify_all();
+    }
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    uint64_t signals = 0;
+    std::atomic<int> parked{0};
+};
+
 /**
  * @brief The WorkerT class owns task queue and executing thread.
  * In thread it tries to pop task from queue. If queue is empty then it tries
- * to steal task from the sibling worker. If steal was unsuccessful then spins
- * with one millisecond delay.
+ * to steal task from the sibling worker. If steal was unsuccessful then parks
+ * until a task is posted to its queue or to the queue of the sibling it steals
+ * from while the sibling is busy; the parking is limited by parkingTimeoutMs.
+ * The sibling can be changed while the worker runs, when the pool is resized.
  */
 template <typename Task, template<typename> class Queue>
 class WorkerT
@@ -52,8 +85,11 @@ public:
      * @brief start Create the executing thread and start tasks execution.
      * @param id WorkerT ID.
      * @param steal_donor Sibling worker to steal task from it.
+     * @param parking Parking of the worker index.
+     * @param cpus CPUs the executing thread is placed on, empty to inherit them.
      */
-    void start(size_t id, Queue<Task>& queue, Queue<Task>& steal_queue, std::shared_ptr<WorkerT>&& rwptr);
+    void start(size_t id, Queue<Task>& queue, Queue<Task>& steal_queue, Parking& parking, const CpuSet& cpus,
+               std::shared_ptr<WorkerT>&& rwptr);
 
     /**
      * @brief stop Stop all worker's thread and stealing activity.
@@ -61,6 +97,12 @@ public:
      */
     void stop();
 
+    /**
+     * @brief retire Stop the worker after the tasks left in its queue are done.
+     * Does not wait for the executing thread.
+     */
+    void retire();
+
     /**
      * @brief getWorkerIdForCurrentThread Return worker ID associated with
      * current thread if exists.
@@ -71,19 +113,30 @@ public:
     /**
      * @brief threadFunc Executing thread function.
      * @param id WorkerT ID to be associated with this thread.
-     * @param steal_donor Sibling worker to steal task from it.
      */
 
-    void threadFunc(size_t id, Queue<Task>& queue, Queue<Task>& steal_queue, std::shared_ptr<WorkerT>&& rwptr);
+    void threadFunc(size_t id, Queue<Task>& queue, std::shared_ptr<WorkerT>&& rwptr);
+
+    /**
+     * @brief park Wait for a task to be posted.
+     * @return 'true' if a task is popped meanwhile, it is in handler then.
+     */
+    bool park(Queue<Task>& queue, Task& handler);
 
     static_assert(std::atomic<uint64_t>::is_always_lock_free);
     static std::atomic<uint64_t> activeCount;
     static std::atomic<uint64_t> expelledCount;
+    static std::atomic<uint64_t> parkedCount;
+    static std::atomic<uint64_t> blockedCount;
     static std::chrono::milliseconds defaultPeriodMs;
+    static std::chrono::milliseconds parkingTimeoutMs;
 
     std::atomic<TimePoint> m_timePoint = maxTimePoint();
     static_assert(decltype(m_timePoint)::is_always_lock_free);
     std::atomic<bool> m_running_flag{true};
+    std::atomic<bool> m_retired{false};
+    std::atomic<Queue<Task>*> m_steal_queue{nullptr};
+    Parking* m_parking = nullptr;
     std::thread m_thread;
 };
 
@@ -105,9 +158,18 @@ std::atomic<uint64_t> WorkerT<Task, Queue>::activeCount = 0;
 template <typename Task, template<typename> class Queue>
 std::atomic<uint64_t> WorkerT<Task, Queue>::expelledCount = 0;
 
+template <typename Task, template<typename> class Queue>
+std::atomic<uint64_t> WorkerT<Task, Queue>::parkedCount = 0;
+
+template <typename Task, template<typename> class Queue>
+std::atomic<uint64_t> WorkerT<Task, Queue>::blockedCount = 0;
+
 template <typename Task, template<typename> class Queue>
 std::chrono::milliseconds WorkerT<Task, Queue>::defaultPeriodMs(200);
 
+template <typename Task, template<typename> class Queue>
+std::chrono::milliseconds WorkerT<Task, Queue>::parkingTimeoutMs(100);
+
 template <typename Task, template<typename> class Queue>
 inline WorkerT<Task, Queue>::WorkerT(WorkerT&& rhs) noexcept
 {
@@ -120,6 +182,7 @@ inline WorkerT<Task, Queue>& WorkerT<Task, Queue>::operator=(WorkerT&& rhs) noex
     if (this != &rhs)
     {
         m_running_flag = rhs.m_running_flag.load();
+        m_parking = rhs.m_parking;
         m_thread = std::move(rhs.m_thread);
     }
     return *this;
@@ -129,18 +192,32 @@ template <typename Task, template<typename> class Queue>
 inline void WorkerT<Task, Queue>::stop()
 {
     m_running_flag.store(false, std::memory_order_relaxed);
+    if (m_parking) m_parking->wake();
     m_thread.join();
 }
 
 template <typename Task, template<typename> class Queue>
-inline void WorkerT<Task, Queue>::start(size_t id, Queue<Task>& queue, Queue<Task>& steal_queue, std::shared_ptr<WorkerT>&& rwptr)
+inline void WorkerT<Task, Queue>::retire()
+{
+    m_retired = true;
+    m_running_flag = false;
+    if (m_parking) m_parking->wake();
+    m_thread.detach();
+}
+
+template <typename Task, template<typename> class Queue>
+inline void WorkerT<Task, Queue>::start(size_t id, Queue<Task>& queue, Queue<Task>& steal_queue, Parking& parking, const CpuSet& cpus,
+                                   std::shared_ptr<WorkerT>&& rwptr)
 {
     assert(rwptr.get() == this);
     ++activeCount;
-    m_thread = std::thread([this,id,&queue,&steal_queue,rwptr]()
+    m_steal_queue = &steal_queue;
+    m_parking = &parking;
+    m_thread = std::thread([this,id,&queue,cpus,rwptr]()
     {
+        if (!cpus.empty()) setCurrentAffinity(cpus);
         std::shared_ptr<WorkerT> wptr = rwptr;
-        threadFunc(id, queue, steal_queue, std::move(wptr));
+        threadFunc(id, queue, std::move(wptr));
     });
 
 }
@@ -152,7 +229,7 @@ inline size_t WorkerT<Task, Queue>::getWorkerIdForCurrentThread()
 }
 
 template <typename Task, template<typename> class Queue>
-inline void WorkerT<Task, Queue>::threadFunc(size_t id, Queue<Task>& queue, Queue<Task>& steal_queue, std::shared_ptr<WorkerT>&& rwptr)
+inline void WorkerT<Task, Queue>::threadFunc(size_t id, Queue<Task>& queue, std::shared_ptr<WorkerT>&& rwptr)
 {
     assert(rwptr.get() == this);
 
@@ -162,7 +239,7 @@ inline void WorkerT<Task, Queue>::threadFunc(size_t id, Queue<Task>& queue, Queu
 
     while (m_running_flag.load(std::memory_order_relaxed))
     {
-        if (queue.pop(handler) || steal_queue.pop(handler))
+        if (queue.pop(handler) || m_steal_queue.load(std::memory_order_relaxed)->pop(handler) || park(queue, handler))
         {
             try
             {
@@ -175,12 +252,45 @@ inline void WorkerT<Task, Queue>::threadFunc(size_t id, Queue<Task>& queue, Queu
                 throw;
             }
         }
-        else
+    }
+    //nobody posts to the queue of a retired worker, except a poster that has not seen the resizing yet
+    //and moves the task further; the tasks left are done here
+    if (m_retired)
+    {
+        while (queue.pop(handler))
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            handler();
         }
     }
     --activeCount;
 }
 
+template <typename Task, template<typename> class Queue>
+inline bool WorkerT<Task, Queue>::park(Queue<Task>& queue, Task& handler)
+{
+    Parking& parking = *m_parking;
+    uint64_t signals;
+    {
+        std::lock_guard<std::mutex> lk(parking.mutex);
+        signals = parking.signals;
+        ++parking.parked;
+    }
+    ++parkedCount;
+    //a poster pushes and then checks parked, here it is the other way around,
+    //so either the poster wakes us or we see the task
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool popped = queue.pop(handler) || m_steal_queue.load(std::memory_order_relaxed)->pop(handler);
+    if (!popped)
+    {
+        std::unique_lock<std::mutex> lk(parking.mutex);
+        parking.cv.wait_for(lk, parkingTimeoutMs, [this, &parking, signals]()
+        {
+            return parking.signals != signals || !m_running_flag.load(std::memory_order_relaxed);
+        });
+    }
+    --parking.parked;
+    --parkedCount;
+    return popped;
+}
+
 }
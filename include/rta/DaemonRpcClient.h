@@ -33,6 +33,9 @@
 #include <string>
 #include <vector>
 #include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <boost/optional.hpp>
 
 #include <net/http_client.h>
@@ -42,9 +45,15 @@
 
 namespace graft {
 
+class HandlerAPI;
+
 class DaemonRpcClient
 {
 public:
+    using HeightCallback = std::function<void(bool ok, uint64_t height)>;
+    using BlockHashCallback = std::function<void(bool ok, const std::string &hash)>;
+    using ResultCallback = std::function<void(bool ok)>;
+
     DaemonRpcClient(const std::string &daemon_addr, const std::string &daemon_login, const std::string &daemon_pass);
     virtual ~DaemonRpcClient();
     bool get_tx_from_pool(const std::string &hash_str, cryptonote::transaction &out_tx);
@@ -54,12 +63,42 @@ public:
     bool send_supernode_stakes(const char* network_address, const char* address);
     bool send_supernode_blockchain_based_list(const char* network_address, const char* address, uint64_t last_received_block_height);
 
+    /*!
+     * \brief enableAsync - enables *_async calls. They are sent to the cryptonode of [cryptonode]rpc-address
+     *                      by the IO thread through UpstreamManager and do not hold the calling thread.
+     *                      Identical calls in flight are coalesced into one request.
+     *                      Callbacks are called in the IO thread, so they should be short.
+     * \param api         - from Context::handlerAPI()
+     */
+    void enableAsync(HandlerAPI *api);
+    bool isAsync() const;
+
+    void get_height_async(HeightCallback callback);
+    void get_block_hash_async(uint64_t height, BlockHashCallback callback);
+    void send_supernode_stakes_async(const char* network_address, const char* address, ResultCallback callback = nullptr);
+    void send_supernode_blockchain_based_list_async(const char* network_address, const char* address, uint64_t last_received_block_height,
+                                                    ResultCallback callback = nullptr);
+    /*!
+     * \brief coalescedCount - number of async calls that have been joined to an identical call in flight
+     */
+    size_t coalescedCount() const;
+
 protected:
     bool init(const std::string &daemon_address, boost::optional<epee::net_utils::http::login> daemon_login);
 
 private:
+    using RawCallback = std::function<void(bool ok, const std::string &body)>;
+    struct AsyncState;
+
+    template<typename Request, typename Response>
+    bool invoke(const std::string &path, const Request &req, Response &res);
+    void invokeAsync(const std::string &path, const std::string &body, RawCallback callback);
+
+    // http_simple_client is not thread safe, synchronous calls are serialized
+    std::mutex m_http_mutex;
     epee::net_utils::http::http_simple_client m_http_client;
     std::chrono::seconds m_rpc_timeout;
+    std::shared_ptr<AsyncState> m_async;
 };
 
 }
@@ -0,0 +1,77 @@
+#ifndef BLOCKHEADERCACHE_H
+#define BLOCKHEADERCACHE_H
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace graft {
+
+/*!
+ * \brief The BlockHeaderCache class - chain height and hashes of recent blocks known to the supernode.
+ *
+ * The height is raised by blockchain based list pushes of the cryptonode and set by polls
+ * of /getheight when no push came within the TTL. Hashes of blocks with less than
+ * CONFIRMATIONS blocks on top can change on reorganization, so they are served from the cache
+ * within the TTL only; hashes of deeper blocks are served until evicted.
+ */
+class BlockHeaderCache
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr size_t DEFAULT_CAPACITY = 128;
+    static constexpr int64_t DEFAULT_TTL_SECONDS = 10;
+    static constexpr uint64_t CONFIRMATIONS = 10;
+
+    explicit BlockHeaderCache(size_t capacity = DEFAULT_CAPACITY, clock::duration ttl = std::chrono::seconds(DEFAULT_TTL_SECONDS));
+
+    /*!
+     * \brief setHeight - sets the height reported by the cryptonode; hashes above it are dropped
+     */
+    void setHeight(uint64_t height);
+
+    /*!
+     * \brief advanceHeight - raises the height; lower values (e.g. lists of past blocks) are ignored
+     */
+    void advanceHeight(uint64_t height);
+
+    /*!
+     * \brief getHeight - returns false if the height is unknown or older than the TTL
+     */
+    bool getHeight(uint64_t &height) const;
+
+    /*!
+     * \brief lastHeight - last known height regardless of its age, 0 if unknown
+     */
+    uint64_t lastHeight() const;
+
+    bool stale() const;
+
+    void setBlockHash(uint64_t height, const std::string &hash);
+    bool getBlockHash(uint64_t height, std::string &hash) const;
+
+    size_t size() const;
+
+private:
+    struct Entry
+    {
+        std::string hash;
+        clock::time_point updated;
+    };
+
+    bool fresh(clock::time_point updated, clock::time_point now) const;
+
+    const size_t m_capacity;
+    const clock::duration m_ttl;
+    mutable std::mutex m_mutex;
+    uint64_t m_height = 0;
+    clock::time_point m_height_updated;
+    std::map<uint64_t, Entry> m_hashes;
+};
+
+} // namespace graft
+
+#endif // BLOCKHEADERCACHE_H
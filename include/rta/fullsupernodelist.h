@@ -5,11 +5,13 @@
 
 #include "rta/supernode.h"
 #include "rta/DaemonRpcClient.h"
+#include "rta/blockheadercache.h"
 
 #include <cryptonote_config.h>
 #include <string>
 #include <vector>
 #include <future>
+#include <mutex>
 #include <unordered_map>
 
 #include <boost/shared_ptr.hpp>
@@ -18,10 +20,6 @@
 
 namespace graft {
 
-namespace utils {
-    class ThreadPool;
-}
-
 
 class FullSupernodeList
 {
@@ -105,7 +103,7 @@ public:
     std::vector<std::string> items() const;
 
     /*!
-     * \brief getBlockHash - returns block hash for given height
+     * \brief getBlockHash - returns block hash for given height, cryptonode is asked on cache miss only
      * \param height       - block height
      * \param hash         - output hash value
      * \return             - true on success
@@ -113,18 +111,21 @@ public:
     bool getBlockHash(uint64_t height, std::string &hash);
 
     /*!
-     * \brief refreshAsync - starts asynchronous parallel refresh all supernodes using internal threadpool.
-     *                       number of parallel jobs equals to number of hardware CPU cores
-     *
-     * \return             - std::future to wait for result
+     * \brief loadIndex - loads supernodes persisted with saveIndex, without waiting for stakes from cryptonode.
+     *                    supernodes already present in the list are not overwritten
+     * \param path      - path to the index file
+     * \return          - number of loaded supernodes
      */
-    std::future<void> refreshAsync();
+    size_t loadIndex(const std::string &path);
 
     /*!
-     * \brief refreshedItems - returns number of refreshed supernodes
-     * \return
+     * \brief saveIndex - refreshes supernodes changed since the index was loaded or saved last time
+     *                    and rewrites the index file if anything changed.
+     *                    intended to be called periodically from the worker thread pool
+     * \param path      - path to the index file
+     * \return          - number of changed (added, updated or removed) entries
      */
-    size_t refreshedItems() const;
+    size_t saveIndex(const std::string &path);
 
     typedef std::vector<supernode_stake> supernode_stake_array;
 
@@ -195,7 +196,17 @@ public:
     void synchronizeWithCryptonode(const char* supernode_network_address, const char* supernode_address);
 
     /*!
-     * \brief getBlockchainHeight - returns current daemon block height
+     * \brief enableAsyncRpc - cryptonode requests of synchronizeWithCryptonode are sent asynchronously
+     *                         by the IO thread, see DaemonRpcClient::enableAsync
+     * \param api            - from Context::handlerAPI()
+     */
+    void enableAsyncRpc(HandlerAPI* api);
+
+    /*!
+     * \brief getBlockchainHeight - returns current daemon block height.
+     *                               The height is cached, it is updated by blockchain based list pushes
+     *                               and polled from cryptonode when no push came within the cache TTL.
+     *                               In async mode the last known height is returned while the poll is in flight
      * \return
      */
     uint64_t getBlockchainHeight() const;
@@ -204,18 +215,36 @@ private:
     // bool loadWallet(const std::string &wallet_path);
     void addImpl(SupernodePtr item);
     bool selectSupernodes(size_t items_count, const std::string& payment_id, const blockchain_based_list_tier& src_array, supernode_array& dst_array);    
+    void pollBlockchainHeight() const;
 
     typedef std::unordered_map<uint64_t, blockchain_based_list_ptr> blockchain_based_list_map;
 
+    // persisted state of the supernode, see loadIndex/saveIndex
+    struct index_entry
+    {
+        std::string wallet_address;
+        std::string network_address;
+        uint64_t    stake_amount = 0;
+        uint64_t    stake_block_height = 0;
+        uint64_t    stake_unlock_time = 0;
+        int64_t     last_update_time = 0;
+
+        bool operator == (const index_entry &other) const;
+    };
+
+    typedef std::unordered_map<std::string, index_entry> index_map;
+
 private:
     // key is public id as a string
     std::unordered_map<std::string, SupernodePtr> m_list;
     std::string m_daemon_address;
     bool m_testnet;
     mutable DaemonRpcClient m_rpc_client;
+    // shared with async callbacks, which may outlive the list
+    std::shared_ptr<BlockHeaderCache> m_block_headers;
     mutable boost::shared_mutex m_access;
-    std::unique_ptr<utils::ThreadPool> m_tp;
-    std::atomic_size_t m_refresh_counter;
+    std::mutex m_index_access;
+    index_map m_index;
     uint64_t m_blockchain_based_list_max_block_number;
     uint64_t m_stakes_max_block_number;
     blockchain_based_list_map m_blockchain_based_lists;
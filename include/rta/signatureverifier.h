@@ -0,0 +1,97 @@
+#ifndef SIGNATUREVERIFIER_H
+#define SIGNATUREVERIFIER_H
+
+#include <crypto/crypto.h>
+#include <crypto/hash.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace graft {
+
+/*!
+ * \brief The SignatureVerifier class - shared service for supernode signature checks.
+ *
+ * Checks submitted by concurrent handlers are put into one pending queue, and every caller
+ * drains that queue while its own checks are still waiting, so the work is spread over
+ * whichever pool workers are currently verifying. Results are cached by
+ * (public key, hash, signature), so duplicate deliveries of the same multicast message
+ * (and identical checks that are already in flight) are not verified twice.
+ */
+class SignatureVerifier
+{
+public:
+    static constexpr size_t DEFAULT_CACHE_SIZE = 4096;
+
+    struct Item
+    {
+        crypto::hash hash;
+        crypto::public_key pkey;
+        crypto::signature signature;
+    };
+
+    explicit SignatureVerifier(size_t cacheSize = DEFAULT_CACHE_SIZE);
+    ~SignatureVerifier();
+
+    SignatureVerifier(const SignatureVerifier&) = delete;
+    SignatureVerifier& operator = (const SignatureVerifier&) = delete;
+
+    /*!
+     * \brief verify    - verifies single signature of the hash
+     * \return          - true if signature valid
+     */
+    bool verify(const crypto::hash &hash, const crypto::public_key &pkey, const crypto::signature &signature);
+
+    /*!
+     * \brief verifyBatch - verifies all the items together
+     * \param items       - signatures to verify
+     * \param results     - optional, per item results, in the same order as items
+     * \return            - true if all the signatures are valid
+     */
+    bool verifyBatch(const std::vector<Item> &items, std::vector<bool> *results = nullptr);
+
+    /*!
+     * \brief instance - process wide verifier, used by Supernode::verifySignature/verifyHash
+     */
+    static SignatureVerifier &instance();
+
+    size_t cacheHits() const { return m_cacheHits; }
+    size_t cacheMisses() const { return m_cacheMisses; }
+    void clearCache();
+
+private:
+    struct Job;
+    using JobPtr = std::shared_ptr<Job>;
+
+    struct ItemHash
+    {
+        size_t operator()(const Item &item) const;
+    };
+
+    struct ItemEqual
+    {
+        bool operator()(const Item &l, const Item &r) const;
+    };
+
+    void runJob(const JobPtr &job, std::unique_lock<std::mutex> &lock);
+    void cacheResult(const Item &item, bool result);
+
+    const size_t m_cacheSize;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<JobPtr> m_queue;
+    std::unordered_map<Item, JobPtr, ItemHash, ItemEqual> m_inflight;
+    std::unordered_map<Item, bool, ItemHash, ItemEqual> m_cache;
+    std::deque<Item> m_cacheOrder;
+    std::atomic<size_t> m_cacheHits {0};
+    std::atomic<size_t> m_cacheMisses {0};
+};
+
+} // namespace graft
+
+#endif // SIGNATUREVERIFIER_H
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "lib/graft/router.h"
+#include "lib/graft/jsonrpc.h"
+
+#include <chrono>
+
+namespace graft { class ConnectionManager; }
+
+namespace graft::supernode::request {
+
+// WebSocket frame from client, subscribes to the status of the payment or unsubscribes from it
+GRAFT_DEFINE_IO_STRUCT_INITED(PaymentStatusSubscription,
+    (std::string, PaymentID, std::string()),
+    (bool, Unsubscribe, false)
+);
+
+// WebSocket frame to client, the current status and then each change of it
+GRAFT_DEFINE_IO_STRUCT_INITED(PaymentStatus,
+    (std::string, PaymentID, std::string()),
+    (int, Status, 0)
+);
+
+/*!
+ * \brief setPaymentStatus - sets the status of the payment in the global context
+ *        and pushes it to the clients subscribed to the payment; they are unsubscribed after a final status
+ * \param ctx
+ * \param payment_id
+ * \param status
+ * \param ttl - zero keeps the ttl of the global context
+ */
+void setPaymentStatus(graft::Context& ctx, const std::string& payment_id, int status,
+                      std::chrono::seconds ttl = std::chrono::seconds(0));
+
+/*!
+ * \brief removePaymentStatus - removes the status of the payment from the global context
+ *        and unsubscribes the clients from it
+ * \param ctx
+ * \param payment_id
+ */
+void removePaymentStatus(graft::Context& ctx, const std::string& payment_id);
+
+void registerPaymentStatusSubscription(graft::ConnectionManager& cm);
+
+}
+
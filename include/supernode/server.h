@@ -3,6 +3,7 @@
 
 #include "lib/graft/serveropts.h"
 #include "lib/graft/connection.h"
+#include "lib/graft/context_snapshot.h"
 
 namespace graftlet { class GraftletLoader; }
 namespace graft::request::system_info { class Counter; }
@@ -46,6 +47,8 @@ protected:
     ConnectionManager* getConMgr(const ConnectionManager::Proto& proto) { assert(m_connectionBase); return m_connectionBase->getConMgr(proto); }
     Looper& getLooper() { assert(m_connectionBase); return m_connectionBase->getLooper(); }
     ConnectionBase& getConnectionBase() { assert(m_connectionBase); return *m_connectionBase; }
+    //register namespaces to be saved in initMisc
+    ContextSnapshot& getContextSnapshot() { return m_contextSnapshot; }
 private:
     void initLog(int log_level);
     void initGlobalContext();
@@ -54,6 +57,9 @@ private:
     void serve();
     static void initSignals();
     void addGlobalCtxCleaner();
+    void addBlacklistReloader();
+    void initContextSnapshot();
+    void saveContextSnapshot();
     void initGraftlets();
     void initGraftletRouters();
 
@@ -62,6 +68,7 @@ private:
     std::unique_ptr<graftlet::GraftletLoader> m_graftletLoader;
     std::atomic_bool m_connectionBaseReady{false};
     std::unique_ptr<ConnectionBase> m_connectionBase;
+    ContextSnapshot m_contextSnapshot;
 };
 
 }//namespace graft
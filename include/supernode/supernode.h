@@ -15,13 +15,15 @@ class Supernode : public GraftServer
         // runtime parameters.
         // path to watch-only wallets (supernodes)
         std::string watchonly_wallets_path;
+        // path to the persisted supernode list index
+        std::string supernode_list_index_path;
     };
 
     void prepareSupernode();
     void startSupernodePeriodicTasks();
     void setHttpRouters(ConnectionManager& httpcm);
     void setCoapRouters(ConnectionManager& coapcm);
-    void loadStakeWallets();
+    void registerContextSnapshotNamespaces();
 
     ConfigOptsEx m_configEx;
 protected:
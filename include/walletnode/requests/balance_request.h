@@ -23,6 +23,8 @@ GRAFT_DEFINE_IO_STRUCT_INITED(WalletBalanceResponse,
 
 GRAFT_DEFINE_JSON_RPC_REQUEST(WalletBalanceResponseJsonRpc, WalletBalanceResponse)
 
+// The balance is of the chain height the wallet is scanned to, it may lag the chain by a few seconds,
+// see WalletManager
 GRAFT_DEFINE_IO_STRUCT(WalletBalanceCallbackRequest,
     (int,         Result),
     (std::string, Balance),
@@ -47,6 +47,8 @@ GRAFT_DEFINE_IO_STRUCT(TransactionHistory,
   (std::vector<TransactionInfo>, Transactions)
 );
 
+// The history is of the chain height the wallet is scanned to, it may lag the chain by a few seconds,
+// see WalletManager
 GRAFT_DEFINE_IO_STRUCT(WalletTransactionHistoryCallbackRequest,
     (int,                Result),
     (TransactionHistory, History)
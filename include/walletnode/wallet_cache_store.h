@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace graft
+{
+
+namespace walletnode
+{
+
+/// Background I/O stage for wallet cache files.
+/// Writes are done by its own thread, so disk latency does not hold request workers. Repeated writes
+/// of the same file are coalesced while the first one is pending, and a file is replaced atomically
+/// via a temporary file and rename. Cache files are indexed with last access times, so expired files
+/// are found without directory scans.
+class WalletCacheStore
+{
+public:
+    using clock  = std::chrono::system_clock;
+    /// Writes the cache to the given temporary file, returns false if there is nothing to write
+    using Writer = std::function<bool(const std::string& tmp_file_name)>;
+    /// Called after the write, successful or not
+    using Done   = std::function<void()>;
+
+    /// The index is built from the files under the directory by the I/O thread
+    explicit WalletCacheStore(const std::string& dir);
+    /// Pending writes are completed
+    ~WalletCacheStore();
+    WalletCacheStore(const WalletCacheStore&) = delete;
+    WalletCacheStore& operator = (const WalletCacheStore&) = delete;
+
+    /// Queues the write of the file; if a write of the file is pending, the writer is dropped and done is added to it
+    void store(const std::string& file_name, Writer writer, Done done = nullptr);
+
+    /// Marks the file as used now
+    void touch(const std::string& file_name);
+
+    /// Queues the removal of the files not used for the age
+    void removeExpired(std::chrono::seconds age);
+
+    /// Number of the indexed files
+    size_t size() const;
+
+private:
+    struct Job
+    {
+        Writer            writer;
+        std::vector<Done> done;
+    };
+
+    void run();
+    void buildIndex();
+    void write(const std::string& file_name, Job& job);
+    void remove(std::chrono::seconds age);
+
+    const std::string                        m_dir;
+    mutable std::mutex                       m_mutex;
+    std::condition_variable                  m_cond;
+    bool                                     m_stop = false;
+    std::deque<std::string>                  m_queue;    // files in the order of writes
+    std::map<std::string, Job>               m_pending;  // by file name
+    std::deque<std::chrono::seconds>         m_removals; // ages of removeExpired calls
+    std::map<std::string, clock::time_point> m_index;    // last access by file name
+    std::thread                              m_thread;
+};
+
+}//namespace walletnode
+
+}//namespace graft
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "walletnode/wallet_manager.h"
+#include "lib/graft/thread_pool/strand.hpp"
+
+#include <crypto/hash.h>
+
+#include <wallet/graft_wallet.h>
+
+namespace graft
+{
+
+namespace walletnode
+{
+
+using StrandX = tp::StrandImpl<tp::FixedFunction<void(), sizeof(GJPtr)>, tp::MPMCBoundedQueue>;
+
+/// Wallet session; the fields besides strand and mutex are accessed from the strand, or by the cache I/O thread
+struct WalletManager::WalletHolder
+{
+    tools::GraftWallet wallet;
+    StrandX            strand;
+    std::mutex         mutex;                              // guards wallet and the fields below
+    bool               loaded         = false;             // keys and cache are resident
+    crypto::hash       session_key    = crypto::null_hash; // identifies account data and password the wallet is loaded with
+    bool               dirty          = false;             // the cache is changed since it is stored
+    std::string        cache_file_name;
+    uint64_t           scanned_height = 0;                 // chain height the wallet is refreshed to
+    bool               scan_queued    = false;             // guarded by m_sessions_mutex
+
+    WalletHolder(ThreadPoolX& thread_pool, bool testnet, unsigned strand_batch_size)
+      : wallet(testnet? cryptonote::TESTNET : cryptonote::MAINNET)
+      , strand(thread_pool, strand_batch_size)
+    {
+    }
+};
+
+}//namespace walletnode
+
+}//namespace graft
@@ -3,8 +3,13 @@
 #include "lib/graft/context.h"
 #include "lib/graft/task.h"
 #include "lib/graft/thread_pool/strand.hpp"
+#include "walletnode/wallet_cache_store.h"
+#include "walletnode/webhook_queue.h"
 
 #include <atomic>
+#include <deque>
+#include <map>
+#include <mutex>
 #include <string>
 #include <memory>
 #include <vector>
@@ -23,12 +28,21 @@ namespace walletnode
 {
 
 /// Wallet manager
+/// A wallet session stays resident while it is used and its cache is written to disk when it expires in the
+/// global context (WALLET_MEMORY_CACHE_TTL_SECONDS after the last request), or when the manager is destroyed on
+/// shutdown or restart. The cache is not written after each request, so a crash loses the scan progress of the
+/// resident sessions; it is rescanned from the stored cache on the next load.
+/// Resident sessions are refreshed by the background scan when the chain grows, and the requests to a session that
+/// is scanned to the last known chain height do not refresh it; so the balance and the history a request returns may
+/// lag the chain by up to the scan interval plus the time the wallet waits for its turn in the scan.
 class WalletManager
 {
 public:
     using WalletId = std::string;
     using Url = std::string;
 
+    static constexpr size_t SCAN_BATCH_SIZE = 8; //TODO: move to config; wallets refreshed at a time by the background scan
+
     struct TransferDestination
     {
       std::string address;
@@ -42,6 +56,7 @@ public:
 
     // Constructors / destructor
     WalletManager(TaskManager& task_manager, bool testnet = false);
+    /// Stores the caches of the resident sessions
     ~WalletManager();
     WalletManager(const WalletManager&) = delete;
     WalletManager& operator = (const WalletManager&) = delete;
@@ -52,19 +67,28 @@ public:
     /// Restore account
     void restoreAccount(Context&, const std::string& password, const std::string& seed, const Url& callback_url = Url());
 
-    /// Request balance
+    /// Request balance; it is of the chain height the session is scanned to, see the class description
     void requestBalance(Context&, const WalletId&, const std::string& account_data, const std::string& password, const Url& callback_url = Url());
 
     /// Prepare transfer
     void prepareTransfer(Context&, const WalletId&, const std::string& account_data, const std::string& password, const TransferDestinationArray& destinations, const Url& callback_url = Url());
 
-    /// Request transaction history
+    /// Request transaction history; it is of the chain height the session is scanned to, see the class description
     void requestTransactionHistory(Context&, const WalletId&, const std::string& account_data, const std::string& password, const Url& callback_url = Url());
 
     /// Flush disk caches
     void flushDiskCaches();
 
+    /// Periodic handler; gets the chain height from cryptonode and, when the chain grows,
+    /// refreshes the resident wallets in the background, at most SCAN_BATCH_SIZE at a time
+    Status scanWallets(const Input&, Context&, Output&);
+
+    /// Sends the webhook callbacks which retry time has come
+    void sendWebHooks();
+
 private:
+    friend class WalletManagerTest;
+
     struct WalletHolder;
     using WalletPtr = std::shared_ptr<WalletHolder>;
 
@@ -77,6 +101,27 @@ private:
     // Register wallet in global context
     void registerWallet(Context&, const WalletId&, const WalletPtr&);
 
+    // Stores the cache of the wallet expired in global context; the wallet is kept until it is stored
+    void closeWallet(const WalletId&, const WalletPtr&);
+
+    // Returns the wallet being closed, so its session goes on
+    WalletPtr reopenWallet(const WalletId&);
+
+    // Loads the wallet with the credentials, or checks them against the loaded one; it is called in the strand of the wallet
+    void openSession(WalletHolder&, const WalletId& public_address, const std::string& account_data, const std::string& password);
+
+    // Refreshes the loaded wallet up to the chain height; it is called in the strand of the wallet
+    void refreshWallet(WalletHolder&);
+
+    // Queues the write of the wallet cache to the I/O thread, the cache is written if it is changed
+    void storeCache(const WalletPtr&, WalletCacheStore::Done done = nullptr);
+
+    // Queues the resident wallets for the scan
+    void startScan();
+
+    // Posts the queued wallets to their strands while the batch is not full
+    void scanNext();
+
     // Executes asynchronously for specific wallet
     template <class Fn> void runAsyncForWallet(Context& context, const WalletId& wallet_id, const std::string& account_data,
         const std::string& password, const Url& callback_url, const Fn& fn);
@@ -87,6 +132,19 @@ private:
 
     bool         m_testnet;
     TaskManager& m_task_manager;
+    WebHookQueue m_webhooks;
+
+    std::mutex                    m_closing_mutex;
+    std::map<WalletId, WalletPtr> m_closing_wallets;
+
+    std::atomic<uint64_t>                           m_chain_height{0}; // 0 if unknown
+    std::mutex                                      m_sessions_mutex;
+    std::map<WalletId, std::weak_ptr<WalletHolder>> m_sessions;
+    std::deque<WalletPtr>                           m_scan_queue;
+    size_t                                          m_scan_running = 0;
+
+    // the last one, the pending writes are done while the rest is alive
+    WalletCacheStore                                m_cache_store;
 };
 
 }//namespace walletnode
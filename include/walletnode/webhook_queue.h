@@ -0,0 +1,81 @@
+#pragma once
+
+#include "lib/graft/inout.h"
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace graft
+{
+
+class HandlerAPI;
+class GlobalContextMap;
+
+namespace walletnode
+{
+
+/// Delivery queue of webhook callbacks.
+/// Callbacks are queued per host and sent with non-blocking upstream requests, a few at a time per host,
+/// so a burst to one host neither opens a connection per callback nor holds the others. A host that is
+/// configured as a keep-alive [upstream] is reached over the pooled connections of the upstream.
+/// Failed deliveries are retried with exponential backoff, the number of outstanding deliveries is bounded.
+class WebHookQueue
+{
+public:
+    static constexpr size_t   MAX_PENDING          = 1024; // outstanding deliveries, queued and in flight
+    static constexpr size_t   MAX_IN_FLIGHT        = 4;    // per host
+    static constexpr unsigned MAX_ATTEMPTS         = 5;
+    static constexpr int      RETRY_BASE_DELAY_MS  = 500;  // doubled with each attempt
+
+    explicit WebHookQueue(GlobalContextMap& gcm);
+    WebHookQueue(const WebHookQueue&) = delete;
+    WebHookQueue& operator = (const WebHookQueue&) = delete;
+
+    /// Queues the delivery of output, it can be called from any thread; returns false if too many deliveries are outstanding
+    bool push(const Output& output);
+
+    /// Sends the deliveries which retry time has come and takes the keep-alive upstreams of the current
+    /// configuration; it is called periodically by IO thread, as the configuration is reloaded by it
+    void pump();
+
+    size_t pending() const;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct Delivery
+    {
+        Output            output;
+        unsigned          attempts = 0;
+        clock::time_point due;
+    };
+
+    struct Host
+    {
+        std::deque<Delivery> queue;
+        size_t               in_flight = 0;
+    };
+
+    // Sends the due deliveries of the host while MAX_IN_FLIGHT allows; m_mutex is locked
+    void sendDue(const std::string& host_key, Host& host, clock::time_point now);
+    // Upstream callback, it is called by IO thread
+    void onDone(const std::string& host_key, Delivery& delivery, const Input& input, const std::string& err);
+
+    // Maps the hosts of keep-alive upstreams to their names; m_mutex is locked or it is not shared yet
+    void loadUpstreams();
+
+    static std::string hostKey(const Output& output);
+
+    HandlerAPI*                        m_api;
+    std::map<std::string, std::string> m_upstreams; // "$name" of keep-alive upstream by host key, it is applied on send
+    mutable std::recursive_mutex       m_mutex;
+    std::map<std::string, Host>        m_hosts;
+    size_t                             m_pending = 0;
+};
+
+}//namespace walletnode
+
+}//namespace graft
@@ -1,159 +1,60 @@
 #include "lib/graft/blacklist.h"
+#include "lib/graft/ip_tables.h"
 #include "lib/graft/mongoosex.h"
-#include "radix_tree/radix_tree.hpp"
+#include <cassert>
 #include <sstream>
 #include <fstream>
 #include <regex>
 #include <chrono>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <unordered_set>
 
 namespace graft {
 
-namespace
-{
-
-struct Window
-{
-    std::chrono::steady_clock::time_point m_tpStart;
-    int m_count;
-
-    Window(std::chrono::steady_clock::time_point now, int count = 1) : m_tpStart(now), m_count(count) { }
-};
-
-class IpMap
-{
-public:
-    IpMap(int requests_per_sec, int window_size_sec)
-        : m_requestsPerSec(requests_per_sec)
-        , m_wndSizeSec(window_size_sec)
-        , m_wndSize(std::chrono::seconds(window_size_sec))
-    { }
-
-    //return true if triggered
-    bool inc(in_addr_t addr, bool networkOrder)
-    {
-        if(networkOrder) addr = htonl(addr);
-        auto now = std::chrono::steady_clock::now();
-        auto it = m_ipwnd.find(addr);
-        bool triggered = false;
-        if(it != m_ipwnd.end())
-        {
-            while(true)
-            {
-                Window& wnd = it->second;
-                auto tp_end = wnd.m_tpStart + m_wndSize;
-                if(tp_end + m_wndSize < now)
-                {//too old data
-                    wnd = Window(now);
-                    break;
-                }
-                if(tp_end + one_sec < now)
-                {
-                    auto secs = std::chrono::duration_cast<std::chrono::seconds>(now - tp_end);
-                    wnd.m_count -= secs.count() * m_requestsPerSec;
-                    if(wnd.m_count <= 0)
-                    {
-                        wnd = Window(now);
-                        break;
-                    }
-                    wnd.m_tpStart += std::chrono::seconds(secs.count());
-                }
-                if(m_wndSizeSec * m_requestsPerSec < ++wnd.m_count) triggered = true;
-                break;
-            }
-        }
-        else
-        {
-            auto res = m_ipwnd.emplace(std::make_pair(addr, Window(now)));
-            it = res.first;
-        }
-
-        removeItAndNeighbor(it, triggered, now);
-
-        return triggered;
-    }
-
-    size_t getCnt() { return m_ipwnd.size(); }
-
-private:
-    using IpWnd = std::map<in_addr_t, Window>;
-
-    const std::chrono::steady_clock::duration one_sec = std::chrono::seconds(1);
-
-    int m_requestsPerSec;
-    int m_wndSizeSec;
-    std::chrono::steady_clock::duration m_wndSize;
-    //host order
-    IpWnd m_ipwnd;
-
-    void removeItAndNeighbor(IpWnd::iterator it, bool triggered, std::chrono::steady_clock::time_point now)
-    {
-        //remove data if triggered, and position to neighbor
-        if(triggered)
-        {
-            it = m_ipwnd.erase(it);
-        }
-        else ++it;
-        if(it == m_ipwnd.end()) it = m_ipwnd.begin();
-
-        if(it != m_ipwnd.end())
-        {//remove neighbor if old
-            Window& wnd = it->second;
-            if(wnd.m_tpStart + m_wndSize + m_wndSize <= now) m_ipwnd.erase(it);
-        }
-    }
-};
-
-} // namespace
+using ipfilter::IpAddress;
 
 class BlackListImpl : public BlackListTest
 {
 public:
     BlackListImpl(int requests_per_sec, int window_size_sec, int ban_ip_sec)
         : banEnabled(requests_per_sec != 0)
-        , m_ipmap(requests_per_sec, window_size_sec)
+        , m_rates(requests_per_sec, window_size_sec)
         , m_banTimeout(std::chrono::seconds(ban_ip_sec))
-    { }
+    {
+        publish(std::make_shared<RuleSet>());
+    }
 
     virtual ~BlackListImpl() override = default;
 
-    //radix table entry
-    struct RtEntry
+private:
+    //rules are immutable once published; a new set replaces the current one as a whole,
+    //so rules can be reloaded by any thread while the IO thread keeps using the previous set
+    struct RuleSet
     {
-        //host order
-        in_addr_t m_addr = 0;
-        int m_prefixLen = 0;
-
-        //
-        in_addr_t operator [] (int n) const
-        {
-            return (m_addr & (0x80000000 >> n))? 1 : 0;
-        }
-
-        bool operator == (const RtEntry &rhs) const
-        {
-            return m_prefixLen == rhs.m_prefixLen && m_addr == rhs.m_addr;
-        }
-
-        bool operator< (const RtEntry &rhs) const
-        {
-            if (m_addr == rhs.m_addr)
-                return m_prefixLen < rhs.m_prefixLen;
-            else
-                return m_addr < rhs.m_addr;
-        }
+        ipfilter::PrefixTable table;
+        Allow defaultAllow = true;
     };
+    using RuleSetPtr = std::shared_ptr<const RuleSet>;
 
-private:
-    using Table = radix_tree<RtEntry, Allow>;
+    //accessed with std::atomic_load/std::atomic_store
+    RuleSetPtr m_rules;
+    std::atomic<uint64_t> m_rulesVersion{0};
+    //serializes writers of the rules
+    std::mutex m_writeMutex;
+    std::string m_warns;
 
-    Table m_table;
-    Allow m_defaultAllow = true;
-    std::ostringstream m_warns;
+    //the set used by processIp, refreshed when the version changes
+    RuleSetPtr m_ioRules;
+    uint64_t m_ioRulesVersion = 0;
 
     bool banEnabled;
-    IpMap m_ipmap;
+    ipfilter::RateTable m_rates;
     std::chrono::steady_clock::duration m_banTimeout;
-    std::deque< std::pair<std::chrono::steady_clock::time_point, in_addr_t> > m_bannedIPs;
+    //banned addresses are not in the rules table, so bans do not cause its rebuilding
+    std::unordered_set<IpAddress, ipfilter::IpAddressHash> m_banned;
+    std::deque< std::pair<std::chrono::steady_clock::time_point, IpAddress> > m_bannedIPs;
 
     void unban()
     {
@@ -162,14 +63,14 @@ private:
         {
             auto& item = m_bannedIPs.front();
             if(now < item.first) break;
-            removeEntry(item.second, false);
+            m_banned.erase(item.second);
             m_bannedIPs.pop_front();
         }
     }
 
-    void ban(in_addr_t addr)
+    void ban(const IpAddress& addr)
     {
-        addEntry(addr, false, false, 32);
+        m_banned.insert(addr);
 
         if(m_banTimeout.count() == 0) return;
         m_bannedIPs.emplace_back( std::make_pair(
@@ -177,47 +78,150 @@ private:
                                       addr ) );
     }
 
-    void addRule(Allow allow, const char* ip, int len, int line)
+    static IpAddress parse(const char* ip, const char* where)
     {
-        assert(0 < len && len <= 32);
-        in_addr addr;
-        if(inet_aton(ip, &addr) == 0)
+        IpAddress addr;
+        if(!IpAddress::parse(ip, addr))
         {
-            m_warns << "error: invalid address " << ip << " at line " << line << '\n';
-            throw std::runtime_error("invalid address error; addRule");
+            std::stringstream ss;
+            ss << "invalid address " << ip << " in " << where;
+            throw std::runtime_error(ss.str());
         }
-        addr.s_addr = ntohl(addr.s_addr);
+        return addr;
+    }
+
+    void publish(std::shared_ptr<RuleSet> rules)
+    {
+        rules->table.compile();
+        std::atomic_store(&m_rules, RuleSetPtr(std::move(rules)));
+        m_rulesVersion.fetch_add(1, std::memory_order_release);
+    }
+
+    //modifies a copy of the current rules, for testing
+    template<typename F>
+    void modifyRules(F f)
+    {
+        std::lock_guard<std::mutex> lk(m_writeMutex);
+        auto rules = std::make_shared<RuleSet>(*std::atomic_load(&m_rules));
+        f(*rules);
+        publish(std::move(rules));
+    }
 
-        in_addr_t mask = -1;
-        if(len < 32)
+    static void addRule(RuleSet& rules, std::ostringstream& warns, Allow allow, const char* ip, int len, int line)
+    {
+        IpAddress addr;
+        if(!IpAddress::parse(ip, addr))
+        {
+            warns << "error: invalid address " << ip << " at line " << line << '\n';
+            throw std::runtime_error("invalid address error; addRule");
+        }
+        if(len == 0) len = addr.maxPrefixLen();
+        if(addr.maxPrefixLen() < len)
         {
-            mask = ~((1 << (32 - len)) - 1);
+            warns << "error: invalid mask length " << len << " at line " << line << '\n';
+            throw std::runtime_error("invalid mask");
         }
-        addr.s_addr &= mask;
+        addr = addr.network(len);
 
-        if(find(addr.s_addr, false).first)
+        if(rules.table.findRule(addr).first)
         {
-            m_warns << "warning: the rule at line " << line << " is superceded by one of previous rule\n";
+            warns << "warning: the rule at line " << line << " is superceded by one of previous rule\n";
             return;
         }
 
-        RtEntry entry{addr.s_addr, len};
-        m_table.insert(std::make_pair(entry,allow));
+        rules.table.insert(addr, len, allow);
     }
-public:
-    virtual bool processIp(in_addr_t addr, bool networkOrder = true) override
+
+    static void parseRules(std::istream& is, RuleSet& rules, std::ostringstream& warns)
+    {
+        static const std::regex comment(R"(^\s*(.*?);;.*(\r)?$)");
+        static const std::regex trim(R"(^\s*(.*?)\s*(\r)?$)");
+        static const std::regex rule(R"(^(allow|deny)\s+(all|((\d{1,3}\.\d{1,3}\.\d{1,3}\.\d{1,3}|[0-9A-Fa-f:.]*:[0-9A-Fa-f:.]*)(/(\d{1,3}))?))$)");
+
+        bool terminator_found = false;
+        for(int line = 1; ; ++line)
+        {
+            if(is.eof()) break;
+            std::string s;
+            std::getline(is, s);
+            if(is.fail() && !is.eof())
+            {
+                warns << "error: reading error '" << s << "' at line " << line << '\n';
+                throw std::runtime_error("reading error");
+            }
+
+            //remove comment ;;
+            s = std::regex_replace(s, comment, "$1");
+            s = std::regex_replace(s, trim, "$1");
+
+            if(s.empty()) continue;
+            if(terminator_found)
+            {
+                warns << "warning: all rules are superseded starting from line " << line << '\n';
+                break;
+            }
+            std::smatch m;
+            if(!std::regex_match(s, m, rule))
+            {
+                warns << "error: invalid rule format '" << s << "' at line " << line << '\n';
+                throw std::runtime_error("invalid rule");
+            }
+            assert(2 < m.size());
+            assert(m[1] == "allow" || m[1] == "deny");
+            bool allow = (m[1] == "allow")? true : false;
+            if(m[2] == "all")
+            {//allow|deny all
+                terminator_found = true;
+                rules.defaultAllow = allow;
+            }
+            else
+            {
+                assert(4 < m.size());
+                std::string ip = m[4];
+                int prefix_len = 0;
+                if(6 < m.size() && m[6].matched)
+                {
+                    prefix_len = std::stoi(m[6]);
+                    if(prefix_len == 0)
+                    {
+                        warns << "error: invalid mask length " << prefix_len << " at line " << line << '\n';
+                        throw std::runtime_error("invalid mask");
+                    }
+                }
+                addRule(rules, warns, allow, ip.c_str(), prefix_len, line);
+            }
+        }
+    }
+
+    static std::pair<bool, Allow> find(const RuleSet& rules, const IpAddress& addr)
+    {
+        if(rules.table.empty()) return std::make_pair(false, rules.defaultAllow);
+        std::pair<bool, Allow> res = rules.table.find(addr);
+        if(!res.first) res.second = rules.defaultAllow;
+        return res;
+    }
+
+    //IO thread only
+    bool process(const IpAddress& addr)
     {
         if(banEnabled && m_banTimeout.count() != 0)
         {
             unban();
         }
 
-        if(networkOrder) addr = ntohl(addr);
-        if(!find(addr, false).second) return false;
+        if(!m_banned.empty() && m_banned.count(addr)) return false;
+
+        uint64_t version = m_rulesVersion.load(std::memory_order_acquire);
+        if(version != m_ioRulesVersion)
+        {
+            m_ioRules = std::atomic_load(&m_rules);
+            m_ioRulesVersion = version;
+        }
+        if(!find(*m_ioRules, addr).second) return false;
 
         if(!banEnabled) return true;
 
-        bool triggered = m_ipmap.inc( addr, false);
+        bool triggered = m_rates.inc(addr);
         if(triggered)
         {
             ban(addr);
@@ -225,71 +229,72 @@ public:
         }
         return true;
     }
+public:
+    virtual void setLimits(int requests_per_sec, int window_size_sec, int ban_ip_sec) override
+    {
+        banEnabled = (requests_per_sec != 0);
+        m_rates = ipfilter::RateTable(requests_per_sec, window_size_sec);
+        m_banTimeout = std::chrono::seconds(ban_ip_sec);
+    }
+
+    virtual bool processIp(in_addr_t addr, bool networkOrder = true) override
+    {
+        if(networkOrder) addr = ntohl(addr);
+        return process(IpAddress::fromV4(addr));
+    }
+
+    virtual bool processIp(const sockaddr* sa) override
+    {
+        IpAddress addr;
+        if(!IpAddress::fromSockaddr(sa, addr)) return true;
+        return process(addr);
+    }
 
     virtual std::string getWarnings() override
     {
-        return m_warns.str();
+        std::lock_guard<std::mutex> lk(m_writeMutex);
+        return m_warns;
     }
 
     virtual void addEntry(const char* ip, int len, Allow allow) override
     {
-        assert(0<len && len<=32);
-        in_addr addr;
-        int res = inet_aton(ip,&addr);
-        assert(res);
-        addEntry(addr.s_addr, true, allow, len);
+        IpAddress addr = parse(ip, "addEntry()");
+        assert(0 < len && len <= addr.maxPrefixLen());
+        modifyRules([&](RuleSet& rules) { rules.table.insert(addr, len, allow); });
     }
     virtual void addEntry(in_addr_t addr, bool networkOrder, Allow allow, int len) override
     {
         assert(0<len && len<=32);
         if(networkOrder) addr = ntohl(addr);
-        RtEntry entry{ addr, len };
-        m_table.insert(std::make_pair(entry,allow));
+        modifyRules([&](RuleSet& rules) { rules.table.insert(IpAddress::fromV4(addr), len, allow); });
     }
 
     virtual void removeEntry(const char* ip) override
     {
-        in_addr addr;
-        int res = inet_aton(ip,&addr);
-        assert(res);
-        removeEntry(addr.s_addr, true);
+        IpAddress addr = parse(ip, "removeEntry()");
+        modifyRules([&](RuleSet& rules) { rules.table.erase(addr, addr.maxPrefixLen()); });
+        m_banned.erase(addr);
     }
 
     virtual void removeEntry(in_addr_t addr, bool networkOrder = true) override
     {
         if(networkOrder) addr = ntohl(addr);
-
-        RtEntry entry{ addr, 32 };
-        m_table.erase(entry);
+        modifyRules([&](RuleSet& rules) { rules.table.erase(IpAddress::fromV4(addr), 32); });
+        m_banned.erase(IpAddress::fromV4(addr));
     }
 
     virtual std::pair<bool, Allow> find(in_addr_t addr, bool networkOrder) override
     {
         if(networkOrder) addr = ntohl(addr);
-
-        RtEntry entry{addr, 32};
-
-        Table::iterator it = m_table.longest_match(entry);
-        if (it == m_table.end())
-        {
-            return std::make_pair(false, m_defaultAllow);
-        }
-        return std::make_pair(true, it->second);
+        return find(*std::atomic_load(&m_rules), IpAddress::fromV4(addr));
     }
 
     virtual std::pair<bool, Allow> find(const char* ip) override
     {
-        in_addr addr;
-        if(!inet_aton(ip, &addr))
-        {
-            std::stringstream ss;
-            ss << "invalid address " << ip << " in find()";
-            throw std::runtime_error(ss.str());
-        }
-        return find(addr.s_addr, true);
+        return find(*std::atomic_load(&m_rules), parse(ip, "find()"));
     }
 
-    virtual void readRules(const char* filepath)
+    virtual void readRules(const char* filepath) override
     {
         std::ifstream ifs(filepath);
         if(!ifs.is_open())
@@ -303,78 +308,38 @@ public:
 
     virtual void readRules(std::istream& is) override
     {
-        m_warns.clear();
-        m_table.clear();
-        bool terminator_found = false;
-        for(int line = 1; ; ++line)
+        //the rules are parsed aside, the current ones remain if the new ones are invalid
+        auto rules = std::make_shared<RuleSet>();
+        std::ostringstream warns;
+        try
         {
-            if(is.eof()) break;
-            std::string s;
-            std::getline(is, s);
-            if(is.fail() && !is.eof())
-            {
-                m_warns << "error: reading error '" << s << "' at line " << line << '\n';
-                throw std::runtime_error("reading error");
-            }
-
-            {//remove comment ;;
-                std::regex r(R"(^\s*(.*?);;.*(\r)?$)");
-                s = std::regex_replace(s, r, "$1");
-            }
-            {//trim
-                std::regex r(R"(^\s*(.*?)\s*(\r)?$)");
-                s = std::regex_replace(s, r, "$1");
-            }
-
-            if(s.empty()) continue;
-            if(terminator_found)
-            {
-                m_warns << "warning: all rules are superseded starting from line " << line << '\n';
-                break;
-            }
-            std::regex regex(R"(^(allow|deny)\s+(all|((\d{1,3}\.\d{1,3}\.\d{1,3}\.\d{1,3})(/(\d{1,2}))?))$)");
-            std::smatch m;
-            if(!std::regex_match(s, m, regex))
-            {
-                m_warns << "error: invalid rule format '" << s << "' at line " << line << '\n';
-                throw std::runtime_error("invalid rule");
-            }
-            assert(2 < m.size());
-            assert(m[1] == "allow" || m[1] == "deny");
-            bool allow = (m[1] == "allow")? true : false;
-            if(m[2] == "all")
-            {//allow|deny all
-                terminator_found = true;
-                m_defaultAllow = allow;
-            }
-            else
-            {
-                assert(4 < m.size());
-                std::string ip = m[4];
-                int prefix_len = 32;
-                if(6 < m.size() && m[6].matched)
-                {
-                    prefix_len = std::stoi(m[6]);
-                    if(prefix_len == 0 || 32 < prefix_len)
-                    {
-                        m_warns << "error: invalid mask length " << prefix_len << " at line " << line << '\n';
-                        throw std::runtime_error("invalid mask");
-                    }
-                }
-                addRule(allow, ip.c_str(), prefix_len, line);
-            }
+            parseRules(is, *rules, warns);
+        }
+        catch(...)
+        {
+            std::lock_guard<std::mutex> lk(m_writeMutex);
+            m_warns = warns.str();
+            throw;
         }
+        std::lock_guard<std::mutex> lk(m_writeMutex);
+        m_warns = warns.str();
+        publish(std::move(rules));
     }
 
     //for testing
     virtual bool active(in_addr_t addr) override
     {
-        return m_ipmap.inc(addr, false);
+        return m_rates.inc(IpAddress::fromV4(addr));
+    }
+
+    virtual bool active(const char* ip) override
+    {
+        return m_rates.inc(parse(ip, "active()"));
     }
 
     virtual size_t activeCnt() override
     {
-        return m_ipmap.getCnt();
+        return m_rates.activeCount();
     }
 };
 
@@ -389,37 +354,3 @@ std::unique_ptr<BlackListTest> BlackListTest::Create(int requests_per_sec, int w
 }
 
 } //namespace graft
-
-template<>
-inline int radix_length<graft::BlackListImpl::RtEntry>(const graft::BlackListImpl::RtEntry &entry)
-{
-    return entry.m_prefixLen;
-}
-
-template<>
-inline graft::BlackListImpl::RtEntry radix_substr<graft::BlackListImpl::RtEntry>(const graft::BlackListImpl::RtEntry &entry, int begin, int num)
-{
-    assert(num + begin <= 32);
-    in_addr_t mask;
-    if (num == 32) mask = 0;
-    else mask = 1 << num;
-    mask  -= 1;
-    mask <<= 32 - num - begin;
-
-    graft::BlackListImpl::RtEntry res;
-    res.m_addr = (entry.m_addr & mask) << begin;
-    res.m_prefixLen = num;
-    return res;
-}
-
-template<>
-inline graft::BlackListImpl::RtEntry radix_join(const graft::BlackListImpl::RtEntry& entry1, const graft::BlackListImpl::RtEntry& entry2)
-{
-    graft::BlackListImpl::RtEntry res;
-
-    res.m_addr = entry1.m_addr;
-    res.m_addr |= entry2.m_addr >> entry1.m_prefixLen;
-    res.m_prefixLen  = entry1.m_prefixLen + entry2.m_prefixLen;
-
-    return res;
-}
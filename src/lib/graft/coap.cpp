@@ -0,0 +1,50 @@
+#include "lib/graft/coap.h"
+
+namespace graft {
+namespace coap {
+
+std::string encodeUint(uint32_t value)
+{
+    std::string res;
+    for(; value; value >>= 8)
+    {
+        res.insert(res.begin(), char(value & 0xff));
+    }
+    return res;
+}
+
+bool decodeUint(const char* data, size_t len, uint32_t& value)
+{
+    if(4 < len) return false;
+    value = 0;
+    for(size_t i = 0; i < len; ++i)
+    {
+        value = (value << 8) | uint8_t(data[i]);
+    }
+    return true;
+}
+
+std::string Block::encode() const
+{
+    return encodeUint((num << 4) | (more? 0x8 : 0) | szx);
+}
+
+bool Block::decode(const char* data, size_t len, Block& block)
+{
+    uint32_t value;
+    if(3 < len || !decodeUint(data, len, value)) return false;
+    block.num = value >> 4;
+    block.more = value & 0x8;
+    block.szx = value & 0x7;
+    return block.szx <= MAX_SZX;
+}
+
+unsigned Block::szxOf(size_t size)
+{
+    unsigned szx = 0;
+    while(szx < MAX_SZX && (size_t(16) << (szx + 1)) <= size) ++szx;
+    return szx;
+}
+
+} //namespace coap
+} //namespace graft
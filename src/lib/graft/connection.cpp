@@ -3,6 +3,7 @@
 #include "lib/graft/mongoosex.h"
 #include "lib/graft/sys_info.h"
 #include "lib/graft/graft_exception.h"
+#include <sys/stat.h>
 
 #include <boost/uuid/uuid_io.hpp>
 
@@ -43,6 +44,11 @@ void UpstreamStub::setConnection(mg_connection* upstream)
     upstream->handler = static_ev_handler<UpstreamStub>;
 }
 
+void UpstreamStub::close(mg_connection* upstream)
+{
+    upstream->flags |= MG_F_CLOSE_IMMEDIATELY;
+}
+
 void UpstreamStub::ev_handler(mg_connection *upstream, int ev, void *ev_data)
 {
     switch (ev)
@@ -233,6 +239,10 @@ void ConnectionBase::loadBlacklist(const ConfigOpts& copts)
         std::string error;
         try
         {
+            {
+                std::lock_guard<std::mutex> lk(m_rulesStampMutex);
+                getFileStamp(ipfilter.rules_filename, m_rulesStamp);
+            }
             m_blackList->readRules(ipfilter.rules_filename.c_str());
         }
         catch(std::exception& e)
@@ -251,6 +261,98 @@ void ConnectionBase::loadBlacklist(const ConfigOpts& copts)
     }
 }
 
+bool ConnectionBase::reloadBlacklistRules(const ConfigOpts& copts)
+{
+    const std::string& filename = copts.ipfilter.rules_filename;
+    if(filename.empty()) return false;
+
+    {
+        FileStamp stamp;
+        std::lock_guard<std::mutex> lk(m_rulesStampMutex);
+        if(!getFileStamp(filename, stamp) || stamp == m_rulesStamp) return false;
+        m_rulesStamp = stamp;
+    }
+
+    //the connections and rate counters are not affected, only the rules are replaced
+    LOG_PRINT_L0("Reloading blacklist from file " << filename);
+    try
+    {
+        m_blackList->readRules(filename.c_str());
+    }
+    catch(std::exception& e)
+    {
+        LOG_ERROR("Cannot reload blacklist, '" << e.what() << "', the previous rules remain\n" << m_blackList->getWarnings());
+        return false;
+    }
+    std::string warns = m_blackList->getWarnings();
+    if(!warns.empty())
+    {
+        LOG_PRINT_L1("Blacklist warnings :\n" << warns);
+    }
+    return true;
+}
+
+bool ConnectionBase::getFileStamp(const std::string& filename, FileStamp& stamp)
+{
+    struct stat st;
+    if(::stat(filename.c_str(), &st) != 0) return false;
+    stamp.mtime_ns = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    stamp.size = st.st_size;
+    return true;
+}
+
+void ConnectionBase::loadRouteLimits(const ConfigOpts& copts)
+{
+    const RateLimitOpts& ratelimit = copts.ratelimit;
+    auto group = [](const std::string& prefix, const RateLimitOpts::Budget& budget)
+    {
+        ipfilter::RouteLimiter::Group g;
+        g.prefix = prefix;
+        g.requests_per_sec = budget.requests_per_sec;
+        g.burst = (0 < budget.burst)? budget.burst : budget.requests_per_sec;
+        return g;
+    };
+    auto limiter = std::make_unique<ipfilter::RouteLimiter>(std::vector<ipfilter::RouteLimiter::Group>{
+        group("/dapi/v2.0/", ratelimit.dapi),
+        //callbacks of the cryptonode come from its single address, they are not limited
+        group("/dapi/v2.0/cryptonode/", RateLimitOpts::Budget()),
+        group("/walletapi/", ratelimit.walletapi),
+        group("/debug/", ratelimit.debug)
+    });
+    if(limiter->empty()) limiter.reset();
+    m_routeLimiter = std::move(limiter);
+}
+
+void ConnectionBase::reconfigureIfRequested()
+{
+    if(!m_reconfigure.exchange(false) || !m_configLoader) return;
+
+    LOG_PRINT_L0("Reloading configuration");
+    ConfigOpts copts;
+    try
+    {
+        if(!m_configLoader(copts)) return;
+    }
+    catch(std::exception& e)
+    {
+        LOG_ERROR("Cannot reload configuration, '" << e.what() << "', the current one remains");
+        return;
+    }
+
+    const IPFilterOpts& ipfilter = getCopts().ipfilter;
+    if(copts.ipfilter.requests_per_sec != ipfilter.requests_per_sec || copts.ipfilter.window_size_sec != ipfilter.window_size_sec
+            || copts.ipfilter.ban_ip_sec != ipfilter.ban_ip_sec)
+    {
+        m_blackList->setLimits(copts.ipfilter.requests_per_sec, copts.ipfilter.window_size_sec, copts.ipfilter.ban_ip_sec);
+    }
+    loadRouteLimits(copts);
+    m_looper->reconfigure(copts);
+    //without waiting for the periodic check
+    reloadBlacklistRules(getCopts());
+
+    LOG_PRINT_L0("Configuration reloaded");
+}
+
 void ConnectionBase::setSysInfoCounter(std::unique_ptr<SysInfoCounter>& counter)
 {
     assert(!m_sysInfo);
@@ -277,6 +379,14 @@ ConnectionManager* ConnectionBase::getConMgr(const ConnectionManager::Proto& pro
     return it->second.get();
 }
 
+void ConnectionBase::publish(const std::string& topic, const std::string& message, bool last)
+{
+    for(auto& it : m_conManagers)
+    {
+        it.second->publish(topic, message, last);
+    }
+}
+
 void ConnectionBase::initConnectionManagers()
 {
     std::unique_ptr<HttpConnectionManager> httpcm = std::make_unique<HttpConnectionManager>();
@@ -332,6 +442,13 @@ void Looper::serve()
 {
     setIOThread(true);
 
+    //the workers started from here are placed by the thread pool, they do not inherit the CPU of the IO thread
+    tp::CpuSet cpus = tp::currentAffinity();
+    if(0 <= m_copts.io_cpu && !tp::setCurrentAffinity({m_copts.io_cpu}))
+    {
+        LOG_ERROR("Cannot pin the IO thread to CPU " << m_copts.io_cpu);
+    }
+
     m_ready = true;
     for (;;)
     {
@@ -345,11 +462,15 @@ void Looper::serve()
         checkUpstreamBlockingIO();
         checkPeriodicTaskIO();
         executePostponedTasks();
+        deliverPublished();
         expelWorkers();
+        scaleWorkers();
+        ConnectionBase::from(m_mgr.get())->reconfigureIfRequested();
         if( stopped() && canStop() ) break;
     }
 
     setIOThread(false);
+    if(0 <= m_copts.io_cpu) tp::setCurrentAffinity(cpus);
 
     LOG_PRINT_L0("Server shutdown.");
 }
@@ -366,6 +487,17 @@ void Looper::notifyJobReady()
     mg_notify(m_mgr.get());
 }
 
+void Looper::deliverPublished()
+{
+    Published published = takePublished();
+    if(published.empty()) return;
+    ConnectionBase* conBase = ConnectionBase::from(m_mgr.get());
+    for(auto& item : published)
+    {
+        conBase->publish(item.topic, item.message, item.last);
+    }
+}
+
 void Looper::cb_event(mg_mgr *mgr, uint64_t cnt)
 {
     TaskManager& tm = ConnectionBase::from(mgr)->getLooper();
@@ -390,14 +522,109 @@ void ConnectionManager::ev_handler(ClientTask* ct, mg_connection *client, int ev
     {
     case MG_EV_CLOSE:
     {
+        ct->m_connectionManager->onClose(client);
         ct->m_client->handler = static_empty_ev_handler;
         ct->m_client = nullptr;
     } break;
+    case MG_EV_HTTP_REQUEST:
+    {
+        //pipelined requests are not supported, the connection is closed after the response,
+        //so the client repeats the request on a new one
+        LOG_PRINT_CLN(1,client,"Pipelined request is dropped; the connection is closed after the response");
+        ct->m_keepAlive = false;
+    } break;
     default:
         break;
     }
 }
 
+//the chunks are produced while there is less than this in the send buffer of the client
+constexpr size_t CHUNKED_REPLY_BUFFER_SIZE = 64 * 1024;
+
+class ConnectionManager::ChunkedReply
+{
+public:
+    ChunkedReply(ConnectionManager* manager, OutHttp::StreamProducer&& stream, bool keepAlive, double timeout)
+        : m_manager(manager)
+        , m_stream(std::move(stream))
+        , m_keepAlive(keepAlive)
+        , m_timeout(timeout)
+    { }
+
+    void ev_handler(mg_connection* client, int ev, void *ev_data)
+    {
+        switch(ev)
+        {
+        case MG_EV_SEND:
+            //the client reads, the timeout is for a client that stops reading
+            mg_set_timer(client, mg_time() + m_timeout);
+            //fall through
+        case MG_EV_POLL:
+        {
+            while(client->send_mbuf.len < CHUNKED_REPLY_BUFFER_SIZE)
+            {
+                m_chunk.clear();
+                bool more = false;
+                try
+                {
+                    more = m_stream(m_chunk);
+                }
+                catch(std::exception& ex)
+                {
+                    //the status is sent already, the client sees the reply is incomplete
+                    LOG_PRINT_CLN(1,client,"Chunked reply failed: " << ex.what() << "; closing connection");
+                    client->flags |= MG_F_CLOSE_IMMEDIATELY;
+                    break;
+                }
+                if(!m_chunk.empty()) mg_send_http_chunk(client, m_chunk.data(), m_chunk.size());
+                if(more) continue;
+                mg_send_http_chunk(client, "", 0);
+                LOG_PRINT_CLN(2,client,"Chunked reply finished");
+                mg_set_timer(client, 0);
+                m_manager->release(client, m_keepAlive);
+                delete this;
+                return;
+            }
+        } break;
+        case MG_EV_CLOSE:
+        {
+            LOG_PRINT_CLN(1,client,"Client closed connection during chunked reply");
+            client->handler = static_empty_ev_handler;
+            //the keep-alive state of the connection goes with it
+            m_manager->onClose(client);
+            delete this;
+        } break;
+        case MG_EV_TIMER:
+        {
+            LOG_PRINT_CLN(1,client,"Client timeout during chunked reply; closing connection");
+            mg_set_timer(client, 0);
+            client->flags |= MG_F_CLOSE_IMMEDIATELY;
+        } break;
+        case MG_EV_HTTP_REQUEST:
+        {
+            //pipelined, the same as for ClientTask
+            LOG_PRINT_CLN(1,client,"Pipelined request is dropped; the connection is closed after the response");
+            m_keepAlive = false;
+        } break;
+        default:
+            break;
+        }
+    }
+
+private:
+    ConnectionManager* m_manager;
+    OutHttp::StreamProducer m_stream;
+    bool m_keepAlive;
+    double m_timeout;
+    std::string m_chunk;
+};
+
+void ConnectionManager::release(mg_connection* client, bool keepAlive)
+{
+    client->flags |= MG_F_SEND_AND_CLOSE;
+    client->handler = static_empty_ev_handler;
+}
+
 
 void HttpConnectionManager::bind(Looper& looper)
 {
@@ -447,8 +674,8 @@ int HttpConnectionManager::translateMethod(const char *method, std::size_t len)
 
 int CoapConnectionManager::translateMethod(int i)
 {
-    constexpr int size = sizeof(m_methods)/sizeof(m_methods[0]);
-    assert(i<size);
+    //CoAP method codes 0.01-0.04 are GET, POST, PUT and DELETE, the first ones of m_methods
+    if(i < 0 || 4 <= i) return -1;
     return m_methods[i].second;
 }
 
@@ -478,6 +705,17 @@ void HttpConnectionManager::ev_handler_http(mg_connection *client, int ev, void
 
         mg_set_timer(client, 0);
 
+        HttpConnectionManager* httpcm = HttpConnectionManager::from_accepted(client);
+
+        //the first request of a connection is checked on accept, the next ones of a kept-alive connection here
+        if(httpcm->m_keepAliveRequests.count(client) && !conBase->getBlackList().processIp( &client->sa.sa ))
+        {
+            LOG_PRINT_CLN(2,client,"The address is in the black-list; closing kept-alive connection");
+            httpcm->m_keepAliveRequests.erase(client);
+            client->flags |= MG_F_CLOSE_IMMEDIATELY;
+            break;
+        }
+
         struct http_message *hm = (struct http_message *) ev_data;
 
         conBase->getLooper().runtimeSysInfo().count_http_req_bytes_raw(hm->message.len);
@@ -497,12 +735,26 @@ void HttpConnectionManager::ev_handler_http(mg_connection *client, int ev, void
         LOG_PRINT_CLN(1,client,"New HTTP client. uri:" << std::string(hm->uri.p, hm->uri.len) << " method:" << s_method
             << " remote: " << remote_address_host_str << ":" << remote_port);
 
-        HttpConnectionManager* httpcm = HttpConnectionManager::from_accepted(client);
         Router::JobParams prms;
         if (httpcm->matchRoute(uri, method, prms))
         {
             conBase->getLooper().runtimeSysInfo().count_http_request_routed();
 
+            //the requests over the budget are refused here, the thread pool is not involved
+            ipfilter::RouteLimiter* limiter = conBase->getRouteLimiter();
+            int group = limiter? limiter->group(uri) : -1;
+            ipfilter::IpAddress addr;
+            if(0 <= group && ipfilter::IpAddress::fromSockaddr(&client->sa.sa, addr) && !limiter->take(addr, group))
+            {
+                conBase->getLooper().runtimeSysInfo().count_http_resp_status_limited();
+
+                LOG_PRINT_CLN(2,client,"Request rate limit exceeded; closing connection");
+                std::string headers = "Retry-After: " + std::to_string(limiter->retryAfterSec(group)) + "\r\nConnection: close";
+                mg_send_head(client, 429, 0, headers.c_str());
+                client->flags |= MG_F_SEND_AND_CLOSE;
+                break;
+            }
+
             mg_str& body = hm->body;
             prms.input = Input(*hm, client_host(client));
 
@@ -512,6 +764,8 @@ void HttpConnectionManager::ev_handler_http(mg_connection *client, int ev, void
             BaseTask* bt = BaseTask::Create<ClientTask>(httpcm, client, prms).get();
             assert(dynamic_cast<ClientTask*>(bt));
             ClientTask* ptr = static_cast<ClientTask*>(bt);
+            ptr->m_keepAlive = !conBase->stopped()
+                    && httpcm->keepAlive(client, hm, conBase->getLooper().getCopts().http_keep_alive_requests);
 
             client->user_data = ptr;
             client->handler = static_ev_handler<ClientTask>;
@@ -537,7 +791,7 @@ void HttpConnectionManager::ev_handler_http(mg_connection *client, int ev, void
             break;
         }
 
-        if(!conBase->getBlackList().processIp( client->sa.sin.sin_addr.s_addr ))
+        if(!conBase->getBlackList().processIp( &client->sa.sa ))
         {
             LOG_PRINT_CLN(2,client,"The address is in the black-list; closing connection");
             client->flags |= MG_F_CLOSE_IMMEDIATELY;
@@ -549,83 +803,809 @@ void HttpConnectionManager::ev_handler_http(mg_connection *client, int ev, void
         mg_set_timer(client, mg_time() + opts.http_connection_timeout);
         break;
     }
+    case MG_EV_WEBSOCKET_HANDSHAKE_REQUEST:
+    {
+        struct http_message *hm = (struct http_message *) ev_data;
+        std::string uri(hm->uri.p, hm->uri.len);
+        HttpConnectionManager* httpcm = HttpConnectionManager::from_accepted(client);
+        auto it = httpcm->m_wsEndpoints.find(uri);
+        if(it == httpcm->m_wsEndpoints.end() || conBase->stopped())
+        {
+            LOG_PRINT_CLN(2,client,"WebSocket endpoint " << uri << " not found; closing connection");
+            mg_http_send_error(client, 404, "Not Found");
+            client->flags |= MG_F_SEND_AND_CLOSE;
+            break;
+        }
+        LOG_PRINT_CLN(1,client,"New WebSocket client. uri:" << uri);
+        httpcm->m_keepAliveRequests.erase(client);
+        httpcm->m_wsClients[client].subscribe = &it->second;
+        break;
+    }
+    case MG_EV_WEBSOCKET_FRAME:
+    {
+        HttpConnectionManager::from_accepted(client)->onWebSocketFrame(client, (struct websocket_message *) ev_data);
+        break;
+    }
     case MG_EV_TIMER:
     {
+        HttpConnectionManager* httpcm = HttpConnectionManager::from_accepted(client);
+        auto it = httpcm->m_wsClients.find(client);
+        if(it != httpcm->m_wsClients.end() && !conBase->stopped())
+        {
+            //the topics whose objects are gone are dropped
+            httpcm->checkTopics(client, it->second);
+        }
+        if(it != httpcm->m_wsClients.end() && !it->second.topics.empty() && !conBase->stopped())
+        {
+            //a subscriber waits as long as it wants, the ping finds out whether it is still there
+            mg_send_websocket_frame(client, WEBSOCKET_OP_PING, "", 0);
+            mg_set_timer(client, mg_time() + conBase->getLooper().getCopts().http_connection_timeout);
+            break;
+        }
         LOG_PRINT_CLN(1,client,"Client timeout; closing connection");
         mg_set_timer(client, 0);
+        httpcm->m_keepAliveRequests.erase(client);
+        httpcm->closeWebSocket(client);
         client->handler = ev_handler_empty; //without this we will get MG_EV_HTTP_REQUEST
         client->flags |= MG_F_CLOSE_IMMEDIATELY;
         break;
     }
+    case MG_EV_CLOSE:
+    {
+        //it is idle between the requests, it is refused or it is a WebSocket
+        HttpConnectionManager* httpcm = HttpConnectionManager::from_accepted(client);
+        httpcm->m_keepAliveRequests.erase(client);
+        httpcm->closeWebSocket(client);
+        break;
+    }
     default:
         break;
     }
 }
 
-void CoapConnectionManager::ev_handler_coap(mg_connection *client, int ev, void *ev_data)
+bool HttpConnectionManager::keepAlive(mg_connection* client, http_message* hm, int maxRequests)
+{
+    //HTTP/1.1 keeps the connection by default, HTTP/1.0 on request
+    bool keep = (mg_vcmp(&hm->proto, "HTTP/1.1") == 0);
+    if(mg_str* connection = mg_get_http_header(hm, "Connection"))
+    {
+        if(mg_vcasecmp(connection, "close") == 0) keep = false;
+        else if(mg_vcasecmp(connection, "keep-alive") == 0) keep = true;
+    }
+    if(!keep || maxRequests <= 0)
+    {
+        m_keepAliveRequests.erase(client);
+        return false;
+    }
+    int& served = m_keepAliveRequests[client];
+    if(maxRequests <= ++served)
+    {
+        LOG_PRINT_CLN(2,client,"The connection has served " << served << " requests; it is closed after the response");
+        m_keepAliveRequests.erase(client);
+        return false;
+    }
+    return true;
+}
+
+void HttpConnectionManager::release(mg_connection* client, bool keepAlive)
 {
-    uint32_t res;
-    std::string uri;
-    struct mg_coap_message *cm = (struct mg_coap_message *) ev_data;
+    if(!keepAlive)
+    {
+        m_keepAliveRequests.erase(client);
+        ConnectionManager::release(client, false);
+        return;
+    }
+    //the same as a new connection, the timer is the idle timeout now
+    const ConfigOpts& opts = ConnectionBase::from(client->mgr)->getLooper().getCopts();
+    client->user_data = this;
+    client->handler = ev_handler_http;
+    mg_set_timer(client, mg_time() + opts.http_connection_timeout);
+}
 
-    if (ev >= MG_COAP_EVENT_BASE)
-      if (!cm || cm->code_class != MG_COAP_CODECLASS_REQUEST) return;
+void HttpConnectionManager::onClose(mg_connection* client)
+{
+    m_keepAliveRequests.erase(client);
+}
+
+void HttpConnectionManager::onWebSocketFrame(mg_connection* client, websocket_message* wm)
+{
+    auto it = m_wsClients.find(client);
+    if(it == m_wsClients.end() || (wm->flags & 0x0f) != WEBSOCKET_OP_TEXT) return;
+    WebSocketClient& wsc = it->second;
+
+    ConnectionBase* conBase = ConnectionBase::from(client->mgr);
+    mg_set_timer(client, mg_time() + conBase->getLooper().getCopts().http_connection_timeout);
+
+    std::string frame(reinterpret_cast<const char*>(wm->data), wm->size);
+    std::string topic, reply;
+    bool ok = false, unsubscribe = false;
+    try
+    {
+        Context ctx(conBase->getLooper().getGcm());
+        ok = (*wsc.subscribe)(frame, ctx, topic, unsubscribe, reply);
+    }
+    catch(std::exception& ex)
+    {
+        LOG_PRINT_CLN(1,client,"WebSocket frame is rejected: " << ex.what());
+    }
+    if(ok && unsubscribe)
+    {
+        if(wsc.topics.erase(topic))
+        {
+            LOG_PRINT_CLN(2,client,"WebSocket client unsubscribed from " << topic);
+            eraseSubscriber(topic, client);
+            m_subscriptions = m_subscribers.size();
+        }
+    }
+    else if(ok && !wsc.topics.count(topic))
+    {
+        if(WEBSOCKET_MAX_TOPICS <= wsc.topics.size())
+        {
+            LOG_PRINT_CLN(1,client,"WebSocket client subscribed to " << wsc.topics.size() << " topics; closing connection");
+            client->flags |= MG_F_SEND_AND_CLOSE;
+            return;
+        }
+        LOG_PRINT_CLN(2,client,"WebSocket client subscribed to " << topic);
+        wsc.topics.emplace(topic, frame);
+        m_subscribers.emplace(topic, client);
+        m_subscriptions = m_subscribers.size();
+    }
+    if(!reply.empty()) mg_send_websocket_frame(client, WEBSOCKET_OP_TEXT, reply.data(), reply.size());
+}
+
+void HttpConnectionManager::closeWebSocket(mg_connection* client)
+{
+    auto it = m_wsClients.find(client);
+    if(it == m_wsClients.end()) return;
+    for(const auto& topic : it->second.topics)
+    {
+        eraseSubscriber(topic.first, client);
+    }
+    m_wsClients.erase(it);
+    m_subscriptions = m_subscribers.size();
+}
+
+void HttpConnectionManager::checkTopics(mg_connection* client, WebSocketClient& wsc)
+{
+    Context ctx(ConnectionBase::from(client->mgr)->getLooper().getGcm());
+    for(auto it = wsc.topics.begin(); it != wsc.topics.end();)
+    {
+        std::string topic, reply;
+        bool ok = false, unsubscribe = false;
+        try
+        {
+            ok = (*wsc.subscribe)(it->second, ctx, topic, unsubscribe, reply);
+        }
+        catch(std::exception&)
+        {
+        }
+        if(ok && !unsubscribe && topic == it->first)
+        {
+            ++it;
+            continue;
+        }
+        LOG_PRINT_CLN(2,client,"WebSocket client is unsubscribed from " << it->first);
+        eraseSubscriber(it->first, client);
+        it = wsc.topics.erase(it);
+    }
+    m_subscriptions = m_subscribers.size();
+}
+
+void HttpConnectionManager::eraseSubscriber(const std::string& topic, mg_connection* client)
+{
+    auto range = m_subscribers.equal_range(topic);
+    for(auto s = range.first; s != range.second; ++s)
+    {
+        if(s->second != client) continue;
+        m_subscribers.erase(s);
+        break;
+    }
+}
+
+void HttpConnectionManager::publish(const std::string& topic, const std::string& message, bool last)
+{
+    auto range = m_subscribers.equal_range(topic);
+    for(auto it = range.first; it != range.second; ++it)
+    {
+        if(!message.empty()) mg_send_websocket_frame(it->second, WEBSOCKET_OP_TEXT, message.data(), message.size());
+        if(!last) continue;
+        auto wsc = m_wsClients.find(it->second);
+        if(wsc != m_wsClients.end()) wsc->second.topics.erase(topic);
+    }
+    if(!last || range.first == range.second) return;
+    m_subscribers.erase(range.first, range.second);
+    m_subscriptions = m_subscribers.size();
+}
+
+//RFC 7252 EXCHANGE_LIFETIME, the blocks of a response are kept for the client that long
+constexpr double COAP_EXCHANGE_LIFETIME = 247;
+//the greatest request body collected from Block1 blocks
+constexpr size_t COAP_MAX_BODY_SIZE = 1024 * 1024;
+
+void CoapConnectionManager::ev_handler_coap(mg_connection *client, int ev, void *ev_data)
+{
+    ConnectionBase* conBase = ConnectionBase::from(client->mgr);
 
     switch (ev)
     {
     case MG_EV_ACCEPT:
     {
-        ConnectionBase* conBase = ConnectionBase::from(client->mgr);
         if(conBase->stopped())
         {
             LOG_PRINT_CLN(2,client,"Shutdown in progress; connection refused.");
             client->flags |= MG_F_CLOSE_IMMEDIATELY;
+            break;
         }
-    } break;
 
+        if(!conBase->getBlackList().processIp( &client->sa.sa ))
+        {
+            LOG_PRINT_CLN(2,client,"The address is in the black-list; closing connection");
+            client->flags |= MG_F_CLOSE_IMMEDIATELY;
+            break;
+        }
+
+        //mongoose closes the connection of a UDP client after the first response,
+        //it is kept for the next requests and the notifications
+        client->flags &= ~MG_F_SEND_AND_CLOSE;
+        CoapConnectionManager::from_accepted(client)->getPeer(client);
+    } break;
     case MG_EV_COAP_CON:
-        res = mg_coap_send_ack(client, cm->msg_id);
-        // No break
     case MG_EV_COAP_NOC:
     {
-        struct mg_coap_option *opt = cm->options;
-#define COAP_OPT_URI 11
-        for (; opt; opt = opt->next)
+        struct mg_coap_message *cm = (struct mg_coap_message *) ev_data;
+        if(cm->code_class != MG_COAP_CODECLASS_REQUEST) break;
+        if(cm->code_detail == 0 || (cm->flags & MG_COAP_FORMAT_ERROR))
         {
-            if (opt->number = COAP_OPT_URI)
+            //a confirmable empty message is a ping, it is rejected the same way as a malformed one
+            if(ev == MG_EV_COAP_CON)
             {
-                uri += "/";
-                uri += std::string(opt->value.p, opt->value.len);
+                struct mg_coap_message rst;
+                memset(&rst, 0, sizeof(rst));
+                rst.msg_type = MG_COAP_MSG_RST;
+                rst.msg_id = cm->msg_id;
+                mg_coap_send_message(client, &rst);
             }
+            break;
         }
+        CoapConnectionManager::from_accepted(client)->onRequest(client, cm);
+    } break;
+    case MG_EV_COAP_RST:
+    {
+        struct mg_coap_message *cm = (struct mg_coap_message *) ev_data;
+        CoapConnectionManager::from_accepted(client)->onReset(client, cm->msg_id);
+    } break;
+    case MG_EV_TIMER:
+    {
+        CoapConnectionManager::from_accepted(client)->onTimer(client);
+    } break;
+    case MG_EV_CLOSE:
+    {
+        CoapConnectionManager::from_accepted(client)->closePeer(client);
+    } break;
+    default:
+        break;
+    }
+}
 
-        int method = translateMethod(cm->code_detail - 1);
+CoapConnectionManager::Peer& CoapConnectionManager::getPeer(mg_connection* client)
+{
+    auto res = m_peers.emplace(client, Peer());
+    Peer& peer = res.first->second;
+    if(res.second)
+    {
+        peer.nextMsgId = utils::random_number<uint16_t>(0, 0xffff);
+        peer.lastActive = mg_time();
+        mg_set_timer(client, mg_time() + tickInterval(ConnectionBase::from(client->mgr)->getLooper().getCopts()));
+    }
+    return peer;
+}
 
-        CoapConnectionManager* coapcm = CoapConnectionManager::from_accepted(client);
-        Router::JobParams prms;
-        if (coapcm->matchRoute(uri, method, prms))
+double CoapConnectionManager::tickInterval(const ConfigOpts& opts)
+{
+    if(opts.coap_observe_interval_ms == 0) return opts.http_connection_timeout;
+    return std::min(opts.coap_observe_interval_ms / 1000.0, opts.http_connection_timeout);
+}
+
+void CoapConnectionManager::onRequest(mg_connection* client, mg_coap_message* cm)
+{
+    Peer& peer = getPeer(client);
+    peer.lastActive = mg_time();
+    const ConfigOpts& opts = ConnectionBase::from(client->mgr)->getLooper().getCopts();
+
+    Exchange ex;
+    ex.client = client;
+    ex.msgId = cm->msg_id;
+    ex.confirmable = (cm->msg_type == MG_COAP_MSG_CON);
+    ex.token.assign(cm->token.p, cm->token.len);
+    ex.szx = coap::Block::szxOf(opts.coap_block_size);
+
+    if(ex.confirmable)
+    {
+        //a repeated request, the ACK is lost or the response is not ready yet
+        if(peer.inFlight.count(ex.msgId)) return;
+        if(!peer.lastReply.empty() && peer.lastMsgId == ex.msgId)
         {
-            mg_str& body = cm->payload;
-            prms.input.load(body.p, body.len);
+            LOG_PRINT_CLN(2,client,"Repeated CoAP request " << ex.msgId << "; the response is sent again");
+            mg_send(client, peer.lastReply.data(), peer.lastReply.size());
+            return;
+        }
+    }
 
-            BaseTask* rb_ptr = BaseTask::Create<ClientTask>(coapcm, client, prms).get();
-            assert(dynamic_cast<ClientTask*>(rb_ptr));
-            ClientTask* ptr = static_cast<ClientTask*>(rb_ptr);
+    std::string path, query;
+    bool hasObserve = false, hasBlock1 = false, hasBlock2 = false;
+    uint32_t observe = 0;
+    coap::Block block1, block2;
+    for(struct mg_coap_option *opt = cm->options; opt; opt = opt->next)
+    {
+        const mg_str& value = opt->value;
+        bool valid = true;
+        switch(opt->number)
+        {
+        case coap::OPT_URI_PATH:
+            path += "/";
+            path.append(value.p, value.len);
+            break;
+        case coap::OPT_URI_QUERY:
+            if(!query.empty()) query += "&";
+            query.append(value.p, value.len);
+            break;
+        case coap::OPT_OBSERVE:
+            valid = hasObserve = coap::decodeUint(value.p, value.len, observe);
+            break;
+        case coap::OPT_BLOCK1:
+            valid = hasBlock1 = coap::Block::decode(value.p, value.len, block1);
+            break;
+        case coap::OPT_BLOCK2:
+            valid = hasBlock2 = coap::Block::decode(value.p, value.len, block2);
+            break;
+        //the server is the host and the replies are of its formats
+        case coap::OPT_URI_HOST:
+        case coap::OPT_URI_PORT:
+        case coap::OPT_ACCEPT:
+            break;
+        default:
+            valid = !coap::isCritical(opt->number);
+            break;
+        }
+        if(!valid)
+        {
+            LOG_PRINT_CLN(1,client,"CoAP option " << opt->number << " is not supported");
+            sendError(ex, coap::BAD_OPTION);
+            return;
+        }
+    }
+    if(path.empty()) path = "/";
+    ex.resource = query.empty()? path : path + "?" + query;
+    ex.method = translateMethod(cm->code_detail - 1);
+    if(ex.method < 0)
+    {
+        sendError(ex, coap::METHOD_NOT_ALLOWED);
+        return;
+    }
+    if(hasBlock2)
+    {
+        //the client can ask for smaller blocks only
+        ex.szx = std::min(ex.szx, block2.szx);
+        ex.block2Num = block2.num;
+    }
 
-            client->user_data = ptr;
-            client->handler = static_ev_handler<ClientTask>;
+    LOG_PRINT_CLN(1,client,"New CoAP request. uri:" << ex.resource << " method:" << m_methods[cm->code_detail - 1].first
+        << " msg_id:" << ex.msgId << (ex.confirmable? " CON" : " NON"));
 
-            ConnectionBase* conBase = ConnectionBase::from(client->mgr);
-            conBase->getLooper().onNewClient(ptr->getSelf());
+    std::string body(cm->payload.p, cm->payload.len);
+    if(hasBlock1)
+    {
+        std::string& received = peer.block1[ex.resource];
+        if(block1.num == 0) received.clear();
+        if(received.size() != block1.offset() || (block1.more && body.size() != block1.size()))
+        {
+            peer.block1.erase(ex.resource);
+            sendError(ex, coap::REQUEST_ENTITY_INCOMPLETE);
+            return;
         }
-        break;
+        if(COAP_MAX_BODY_SIZE < received.size() + body.size())
+        {
+            peer.block1.erase(ex.resource);
+            sendError(ex, coap::REQUEST_ENTITY_TOO_LARGE);
+            return;
+        }
+        received += body;
+        ex.block1 = true;
+        ex.block1Num = block1.num;
+        ex.block1Szx = block1.szx;
+        if(block1.more)
+        {
+            Representation rep;
+            rep.code = coap::CONTINUE;
+            sendResponse(ex, rep);
+            return;
+        }
+        body = std::move(received);
+        peer.block1.erase(ex.resource);
     }
-    case MG_EV_COAP_ACK:
-    case MG_EV_COAP_RST:
-        break;
-    default:
-        break;
+
+    //the next blocks are of the representation sent for the first one
+    if(0 < ex.block2Num)
+    {
+        auto it = peer.block2.find(ex.resource);
+        if(it != peer.block2.end() && mg_time() < it->second.expires)
+        {
+            sendResponse(ex, it->second);
+            return;
+        }
     }
+
+    if(hasObserve && 0 < opts.coap_observe_interval_ms)
+    {
+        //the request is repeated for the observation, so it must be safe to repeat
+        bool observable = ex.method == METHOD_GET || m_observable.count(path);
+        if(observe == coap::OBSERVE_REGISTER && !observable)
+        {
+            LOG_PRINT_CLN(2,client,"CoAP " << path << " cannot be observed, it is answered once");
+            peer.observations.erase(ex.token);
+        }
+        else if(observe == coap::OBSERVE_REGISTER)
+        {
+            //it is registered again if it is known already
+            Observation& obs = peer.observations[ex.token];
+            obs.method = ex.method;
+            obs.path = path;
+            obs.query = query;
+            obs.body = body;
+            obs.szx = ex.szx;
+            obs.refreshing = true;
+            obs.expires = mg_time() + opts.coap_observe_lifetime;
+            ex.observe = true;
+        }
+        else if(observe == coap::OBSERVE_DEREGISTER)
+        {
+            peer.observations.erase(ex.token);
+        }
+    }
+
+    Router::JobParams prms;
+    if(!matchRoute(path, ex.method, prms))
+    {
+        LOG_PRINT_CLN(2,client,"Matching Route not found");
+        if(ex.observe) peer.observations.erase(ex.token);
+        sendError(ex, coap::NOT_FOUND);
+        return;
+    }
+
+    //the same budgets as for HTTP, the notifications are not counted
+    ipfilter::RouteLimiter* limiter = ConnectionBase::from(client->mgr)->getRouteLimiter();
+    int group = limiter? limiter->group(path) : -1;
+    ipfilter::IpAddress addr;
+    if(0 <= group && ipfilter::IpAddress::fromSockaddr(&client->sa.sa, addr) && !limiter->take(addr, group))
+    {
+        LOG_PRINT_CLN(2,client,"Request rate limit exceeded");
+        if(ex.observe) peer.observations.erase(ex.token);
+        sendError(ex, coap::TOO_MANY_REQUESTS);
+        return;
+    }
+    startTask(std::move(ex), prms, path, query, std::move(body));
+}
+
+void CoapConnectionManager::startTask(Exchange&& ex, Router::JobParams& prms, const std::string& path, const std::string& query, std::string&& body)
+{
+    mg_connection* client = ex.client;
+    Peer& peer = m_peers[client];
+
+    prms.input.body = std::move(body);
+    prms.input.uri = path;
+    prms.input.query_string = query;
+    for(const auto& m : m_methods)
+    {
+        if(m.second == ex.method) prms.input.method = m.first;
+    }
+    prms.input.host = client_host(client);
+    prms.input.port = static_cast<uint16_t>(client->sa.sin.sin_port);
+
+    BaseTask* bt = BaseTask::Create<ClientTask>(this, client, prms).get();
+    assert(dynamic_cast<ClientTask*>(bt));
+    ClientTask* ptr = static_cast<ClientTask*>(bt);
+
+    //the task can respond at once
+    if(ex.confirmable) peer.inFlight.insert(ex.msgId);
+    ++peer.tasks;
+    m_exchanges.emplace(ptr, std::move(ex));
+
+    ConnectionBase::from(client->mgr)->getLooper().onNewClient(ptr->getSelf());
+}
+
+void CoapConnectionManager::respond(ClientTask* ct, const std::string& s)
+{
+    auto it = m_exchanges.find(ct);
+    if(ct->m_client == nullptr || it == m_exchanges.end())
+    {//the client is gone or the response is sent already
+        if(ct->getLastStatus() != Status::Again)
+            ct->getManager().onClientDone(ct->getSelf());
+        return;
+    }
+    Exchange ex = std::move(it->second);
+    m_exchanges.erase(it);
+    mg_connection* client = ex.client;
+    Peer& peer = m_peers[client];
+    if(ex.confirmable) peer.inFlight.erase(ex.msgId);
+    --peer.tasks;
+
+    auto& ctx = ct->getCtx();
+    bool ok = (ctx.local.getLastStatus() == Status::Ok || ctx.local.getLastStatus() == Status::Again);
+    Representation rep;
+    switch(ctx.local.getLastStatus())
+    {
+        case Status::Again:
+        case Status::Ok:              rep.code = (ex.method == METHOD_GET || ex.observe)? coap::CONTENT : coap::CHANGED; break;
+        case Status::InternalError:
+        case Status::Error:           rep.code = coap::INTERNAL_SERVER_ERROR; break;
+        case Status::Busy:            rep.code = coap::SERVICE_UNAVAILABLE;   break;
+        case Status::Drop:            rep.code = coap::BAD_REQUEST;           break;
+        default:                      assert(false);                          break;
+    }
+    rep.payload = s;
+    auto& stream = ct->getOutput().stream;
+    if(ok && stream)
+    {
+        //there is no chunked transfer, the blocks are sent from the whole payload
+        rep.payload.clear();
+        try
+        {
+            for(bool more = true; more;)
+            {
+                std::string chunk;
+                more = stream(chunk);
+                rep.payload += chunk;
+            }
+        }
+        catch(std::exception& e)
+        {
+            ok = false;
+            rep.code = coap::INTERNAL_SERVER_ERROR;
+            rep.payload = e.what();
+        }
+        stream = nullptr;
+    }
+    rep.contentFormat = !ok? coap::CONTENT_FORMAT_TEXT
+            : (ct->getOutput().get_header("Content-Type") == serializer::BINARY_CONTENT_TYPE)? coap::CONTENT_FORMAT_OCTET_STREAM
+            : coap::CONTENT_FORMAT_JSON;
+    rep.expires = mg_time() + COAP_EXCHANGE_LIFETIME;
+
+    ct->m_client = nullptr;
+    if(ct->getLastStatus() != Status::Again)
+        ct->getManager().onClientDone(ct->getSelf());
+
+    auto obs_it = ex.observe? peer.observations.find(ex.token) : peer.observations.end();
+    if(obs_it == peer.observations.end())
+    {
+        if(ex.notification) return; //the observation is cancelled meanwhile
+        LOG_PRINT_CLN(2,client,"CoAP request " << ex.resource << " finished with result " << ct->getStrStatus());
+        sendResponse(ex, rep);
+        return;
+    }
+
+    Observation& obs = obs_it->second;
+    obs.refreshing = false;
+    if(!ok)
+    {
+        //an error response ends the observation, it is sent without Observe
+        LOG_PRINT_CLN(2,client,"Observation of " << ex.resource << " ends with result " << ct->getStrStatus());
+        peer.observations.erase(obs_it);
+        sendResponse(ex, rep);
+        return;
+    }
+    if(ex.notification && rep.payload == obs.last) return;
+    obs.last = rep.payload;
+    obs.seq = (obs.seq + 1) & coap::OBSERVE_SEQ_MASK;
+    LOG_PRINT_CLN(2,client,(ex.notification? "Notification of " : "Observation of ") << ex.resource << " #" << obs.seq);
+    obs.lastMsgId = sendResponse(ex, rep, &obs.seq);
+}
+
+uint16_t CoapConnectionManager::sendResponse(const Exchange& ex, const Representation& rep, const uint32_t* observeSeq)
+{
+    mg_connection* client = ex.client;
+    Peer& peer = m_peers[client];
+
+    struct mg_coap_message cm;
+    memset(&cm, 0, sizeof(cm));
+    //a confirmable request is answered by a piggybacked ACK, others and notifications by new messages
+    const bool piggybacked = ex.confirmable && !ex.notification;
+    cm.msg_type = piggybacked? MG_COAP_MSG_ACK : MG_COAP_MSG_NOC;
+    cm.msg_id = piggybacked? ex.msgId : peer.nextMsgId++;
+    cm.token.p = ex.token.data();
+    cm.token.len = ex.token.size();
+
+    //the values are referenced by the options until the message is composed
+    std::string observe, format, block2, block1, size2;
+    auto addOption = [&cm](uint32_t number, const std::string& value)
+    {
+        mg_coap_add_option(&cm, number, const_cast<char*>(value.data()), value.size());
+    };
+
+    coap::Code code = rep.code;
+    std::string payload;
+    coap::Block block;
+    block.szx = ex.szx;
+    block.num = ex.block2Num;
+    bool blockwise = (0 < block.num || block.size() < rep.payload.size());
+    if(blockwise && rep.payload.size() <= block.offset())
+    {
+        //the block is beyond the end of the representation
+        code = coap::BAD_OPTION;
+        blockwise = false;
+    }
+    else if(blockwise)
+    {
+        payload = rep.payload.substr(block.offset(), block.size());
+        block.more = (block.offset() + payload.size() < rep.payload.size());
+        if(block.num == 0 && block.more) peer.block2[ex.resource] = rep;
+    }
+    else
+    {
+        payload = rep.payload;
+    }
+    cm.code_class = code.cls;
+    cm.code_detail = code.detail;
+
+    if(observeSeq)
+    {
+        observe = coap::encodeUint(*observeSeq);
+        addOption(coap::OPT_OBSERVE, observe);
+    }
+    if(!payload.empty())
+    {
+        format = coap::encodeUint(rep.contentFormat);
+        addOption(coap::OPT_CONTENT_FORMAT, format);
+    }
+    if(blockwise)
+    {
+        block2 = block.encode();
+        addOption(coap::OPT_BLOCK2, block2);
+    }
+    if(ex.block1)
+    {
+        //2.31 Continue asks for the next block, the response to the last one ends the transfer
+        coap::Block b1;
+        b1.num = ex.block1Num;
+        b1.szx = ex.block1Szx;
+        b1.more = (rep.code.cls == coap::CONTINUE.cls && rep.code.detail == coap::CONTINUE.detail);
+        block1 = b1.encode();
+        addOption(coap::OPT_BLOCK1, block1);
+    }
+    if(blockwise && block.num == 0)
+    {
+        size2 = coap::encodeUint(rep.payload.size());
+        addOption(coap::OPT_SIZE2, size2);
+    }
+    cm.payload.p = payload.data();
+    cm.payload.len = payload.size();
+
+    struct mbuf io;
+    mbuf_init(&io, 0);
+    uint32_t res = mg_coap_compose(&cm, &io);
+    mg_coap_free_options(&cm);
+    if(res != 0)
+    {
+        LOG_ERROR("Cannot compose CoAP response to " << client_addr(client) << ", error " << res);
+    }
+    else
+    {
+        mg_send(client, io.buf, io.len);
+        if(piggybacked)
+        {
+            peer.lastMsgId = ex.msgId;
+            peer.lastReply.assign(io.buf, io.len);
+        }
+    }
+    mbuf_free(&io);
+    return cm.msg_id;
+}
+
+void CoapConnectionManager::sendError(const Exchange& ex, coap::Code code, const std::string& message)
+{
+    Representation rep;
+    rep.code = code;
+    rep.contentFormat = coap::CONTENT_FORMAT_TEXT;
+    rep.payload = message;
+    sendResponse(ex, rep);
+}
+
+void CoapConnectionManager::refresh(mg_connection* client, const std::string& token, Observation& obs)
+{
+    Exchange ex;
+    ex.client = client;
+    ex.token = token;
+    ex.method = obs.method;
+    ex.resource = obs.query.empty()? obs.path : obs.path + "?" + obs.query;
+    ex.szx = obs.szx;
+    ex.observe = true;
+    ex.notification = true;
+
+    Router::JobParams prms;
+    if(!matchRoute(obs.path, obs.method, prms))
+    {
+        m_peers[client].observations.erase(token);
+        return;
+    }
+    obs.refreshing = true;
+    startTask(std::move(ex), prms, obs.path, obs.query, std::string(obs.body));
+}
+
+void CoapConnectionManager::onReset(mg_connection* client, uint16_t msgId)
+{
+    auto it = m_peers.find(client);
+    if(it == m_peers.end()) return;
+    auto& observations = it->second.observations;
+    for(auto o = observations.begin(); o != observations.end(); ++o)
+    {
+        //the sequence number is not zero after the first notification
+        if(o->second.seq != 0 && o->second.lastMsgId == msgId)
+        {
+            LOG_PRINT_CLN(2,client,"Observation of " << o->second.path << " is cancelled by the client");
+            observations.erase(o);
+            return;
+        }
+    }
+}
+
+void CoapConnectionManager::onTimer(mg_connection* client)
+{
+    auto it = m_peers.find(client);
+    if(it == m_peers.end()) return;
+    Peer& peer = it->second;
+    ConnectionBase* conBase = ConnectionBase::from(client->mgr);
+    const ConfigOpts& opts = conBase->getLooper().getCopts();
+    const double now = mg_time();
+
+    //the tasks can respond at once, so the observations are refreshed after the walk
+    std::vector<std::string> due;
+    for(auto o = peer.observations.begin(); o != peer.observations.end();)
+    {
+        if(conBase->stopped() || o->second.expires <= now || opts.coap_observe_interval_ms == 0)
+        {
+            LOG_PRINT_CLN(2,client,"Observation of " << o->second.path << " expired");
+            o = peer.observations.erase(o);
+            continue;
+        }
+        if(!o->second.refreshing) due.push_back(o->first);
+        ++o;
+    }
+    for(const std::string& token : due)
+    {
+        auto o = peer.observations.find(token);
+        if(o != peer.observations.end()) refresh(client, token, o->second);
+    }
+
+    for(auto b = peer.block2.begin(); b != peer.block2.end();)
+    {
+        if(b->second.expires <= now) b = peer.block2.erase(b);
+        else ++b;
+    }
+
+    if(peer.observations.empty() && peer.tasks == 0 && !(client->flags & MG_F_LISTENING)
+            && (conBase->stopped() || peer.lastActive + opts.http_connection_timeout <= now))
+    {
+        LOG_PRINT_CLN(1,client,"CoAP client is idle; closing connection");
+        mg_set_timer(client, 0);
+        client->flags |= MG_F_CLOSE_IMMEDIATELY;
+        return;
+    }
+    mg_set_timer(client, now + tickInterval(opts));
+}
+
+void CoapConnectionManager::closePeer(mg_connection* client)
+{
+    for(auto it = m_exchanges.begin(); it != m_exchanges.end();)
+    {
+        if(it->second.client == client)
+        {
+            //the response is dropped, see respond
+            it->first->m_client = nullptr;
+            it = m_exchanges.erase(it);
+        }
+        else
+            ++it;
+    }
+    m_peers.erase(client);
 }
 
 void ConnectionManager::respond(ClientTask* ct, const std::string& s)
@@ -653,23 +1633,56 @@ void ConnectionManager::respond(ClientTask* ct, const std::string& s)
     }
 
     auto& client = ct->m_client;
-    LOG_PRINT_CLN(2, client, "Reply to client: " << s);
+    //the handler can reply with serializer::BINARY, see OutHttp::loadNegotiated
+    std::string content_type = ct->getOutput().get_header("Content-Type");
+    if(content_type.empty()) content_type = "application/json";
+    if(content_type == serializer::BINARY_CONTENT_TYPE)
+    {
+        LOG_PRINT_CLN(2, client, "Reply to client: " << s.size() << " bytes of " << content_type);
+    }
+    else
+    {
+        LOG_PRINT_CLN(2, client, "Reply to client: " << s);
+    }
+    const bool keepAlive = ct->m_keepAlive;
+    const char* connection = keepAlive? "\r\nConnection: keep-alive" : "\r\nConnection: close";
+    auto& stream = ct->getOutput().stream;
+    if(Status::Ok == ctx.local.getLastStatus() && stream)
+    {
+        LOG_PRINT_CLN(2, client, "Client request finished with chunked reply");
+        //-1 means Transfer-Encoding: chunked
+        mg_send_head(client, code, -1, ("Content-Type: " + content_type + connection).c_str());
+        if(ct->getLastStatus() != Status::Again)
+            ct->getManager().onClientDone(ct->getSelf());
+        //the reply owns the producer from now, the task can go
+        double timeout = ct->getManager().getCopts().http_connection_timeout;
+        client->user_data = new ChunkedReply(this, std::move(stream), keepAlive, timeout);
+        client->handler = static_ev_handler<ChunkedReply>;
+        mg_set_timer(client, mg_time() + timeout);
+        client = nullptr;
+        return;
+    }
     if(Status::Ok == ctx.local.getLastStatus())
     {
-        mg_send_head(client, code, s.size(), "Content-Type: application/json\r\nConnection: close");
+        mg_send_head(client, code, s.size(), ("Content-Type: " + content_type + connection).c_str());
         mg_send(client, s.c_str(), s.size());
         rsi.count_http_resp_bytes_raw(s.size());
     }
+    else if(keepAlive)
+    {
+        //the same as mg_http_send_error, which closes the connection
+        mg_send_head(client, code, s.size(), (std::string("Content-Type: text/plain") + connection).c_str());
+        mg_send(client, s.c_str(), s.size());
+    }
     else
     {
         mg_http_send_error(client, code, s.c_str());
     }
 
     LOG_PRINT_CLN(2, client, "Client request finished with result " << ct->getStrStatus());
-    client->flags |= MG_F_SEND_AND_CLOSE;
     if(ct->getLastStatus() != Status::Again)
         ct->getManager().onClientDone(ct->getSelf());
-    client->handler = static_empty_ev_handler;
+    release(client, keepAlive);
     client = nullptr;
 }
 
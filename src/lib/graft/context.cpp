@@ -1,9 +1,95 @@
-
 #include "lib/graft/context.h"
+#include "lib/graft/handler_api.h"
 
 #include "supernode/requestdefines.h"
 
+#include <cassert>
+
 namespace graft {
 
+GlobalContextMap::GlobalContextMap(HandlerAPI* handlerAPI) : m_handlerAPI(handlerAPI)
+{
+    m_onKeyExpired = [this](const std::string& key){ wake(key); };
+}
+
+GlobalContextMap::WatchId GlobalContextMap::watch(const std::string& key, Waiter waiter)
+{
+    std::lock_guard<std::mutex> lk(m_waitersMutex);
+    WatchId id = ++m_lastWatchId;
+    m_waiters.emplace(key, std::make_pair(id, std::move(waiter)));
+    ++m_waitersCount;
+    return id;
+}
+
+void GlobalContextMap::unwatch(const std::string& key, WatchId id)
+{
+    std::lock_guard<std::mutex> lk(m_waitersMutex);
+    auto range = m_waiters.equal_range(key);
+    for(auto it = range.first; it != range.second; ++it)
+    {
+        if(it->second.first != id) continue;
+        m_waiters.erase(it);
+        --m_waitersCount;
+        break;
+    }
+}
+
+void GlobalContextMap::addOrUpdate(const std::string& key, const std::any& value, std::chrono::seconds ttl, OnExpired onExpired)
+{
+    TSHashtable::addOrUpdate(key, value, ttl, onExpired);
+    wake(key);
+}
+
+void GlobalContextMap::remove(const std::string& key)
+{
+    TSHashtable::remove(key);
+    wake(key);
+}
+
+bool GlobalContextMap::apply(const std::string& key, std::function<bool(std::any&)> f)
+{
+    bool res = TSHashtable::apply(key, f);
+    if(res) wake(key);
+    return res;
+}
+
+void GlobalContextMap::wake(const std::string& key)
+{
+    if(m_waitersCount.load(std::memory_order_acquire) == 0) return;
+    std::vector<Waiter> waiters;
+    {
+        std::lock_guard<std::mutex> lk(m_waitersMutex);
+        auto range = m_waiters.equal_range(key);
+        for(auto it = range.first; it != range.second; ++it)
+        {
+            waiters.push_back(std::move(it->second.second));
+        }
+        m_waiters.erase(range.first, range.second);
+        m_waitersCount -= waiters.size();
+    }
+    for(auto& waiter : waiters)
+    {
+        waiter(key);
+    }
+}
+
+void Context::resumeOnChange(const std::string& key)
+{
+    HandlerAPI* api = handlerAPI();
+    assert(api);
+    uuid_t uuid = getId();
+    GlobalContextMap::WatchId id = global.watch(key, [api, uuid](const std::string&){ api->resumePostponed(uuid); });
+    m_watches.emplace_back(key, id);
+}
+
+void Context::stopWatching()
+{
+    for(auto& watch : m_watches)
+    {
+        global.unwatch(watch.first, watch.second);
+    }
+    m_watches.clear();
+}
+
 }
 
@@ -0,0 +1,191 @@
+#include "lib/graft/context_snapshot.h"
+
+#include <misc_log_ex.h>
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <algorithm>
+#include <iterator>
+#include <chrono>
+#include <ctime>
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "supernode.contextsnapshot"
+
+namespace graft {
+
+namespace
+{
+
+//file layout: magic, version, save time (unix seconds), entries count, entries
+//entry: key, ttl (seconds), seconds left before expiration (-1 if never expires), encoded value
+const uint32_t SNAPSHOT_MAGIC = 0x58544347; //"GCTX"
+const uint32_t SNAPSHOT_VERSION = 1;
+const int64_t NEVER_EXPIRES = -1;
+
+std::chrono::seconds steadyNow()
+{
+    namespace ch = std::chrono;
+    return ch::time_point_cast<ch::seconds>(ch::steady_clock::now()).time_since_epoch();
+}
+
+bool endsWith(const std::string& s, const std::string& suffix)
+{
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+} //namespace
+
+void ContextSnapshot::addNamespace(const std::string& suffix, Encode encode, Decode decode)
+{
+    m_codecs[suffix] = Codec{std::move(encode), std::move(decode)};
+}
+
+const ContextSnapshot::Codec* ContextSnapshot::findCodec(const std::string& key) const
+{
+    //the longest suffix wins, so ":sale" does not take ":saledetails" keys
+    const Codec* res = nullptr;
+    size_t len = 0;
+    for(auto& it : m_codecs)
+    {
+        const std::string& suffix = it.first;
+        if(suffix.size() <= len || !endsWith(key, suffix)) continue;
+        if(!m_selected.empty() && std::find(m_selected.begin(), m_selected.end(), suffix) == m_selected.end()) continue;
+        res = &it.second;
+        len = suffix.size();
+    }
+    return res;
+}
+
+size_t ContextSnapshot::save(GlobalContextMap& gcm, const std::string& filename) const
+{
+    struct Item
+    {
+        std::string key;
+        std::any value;
+        std::chrono::seconds ttl;
+        std::chrono::seconds expires;
+        const Codec* codec;
+    };
+
+    //copy values first, the buckets are locked only while they are walked
+    std::vector<Item> items;
+    gcm.forEachEntry([this, &items](const std::string& key, const std::any& value, std::chrono::seconds ttl, std::chrono::seconds expires, bool hasOnExpired)
+    {
+        if(hasOnExpired) return;
+        const Codec* codec = findCodec(key);
+        if(!codec) return;
+        items.push_back(Item{key, value, ttl, expires, codec});
+    });
+
+    std::chrono::seconds now = steadyNow();
+    std::string body, value;
+    uint32_t count = 0;
+    for(auto& item : items)
+    {
+        value.clear();
+        if(!item.codec->encode(item.value, value))
+        {
+            LOG_PRINT_L1("context snapshot: cannot encode value of '" << item.key << "'");
+            continue;
+        }
+        int64_t left = NEVER_EXPIRES;
+        if(item.expires != std::chrono::seconds::max())
+        {
+            left = (item.expires - now).count();
+            if(left <= 0) continue;
+        }
+        write(body, item.key);
+        write(body, static_cast<int64_t>(item.ttl.count()));
+        write(body, left);
+        write(body, value);
+        ++count;
+    }
+
+    std::string header;
+    write(header, SNAPSHOT_MAGIC);
+    write(header, SNAPSHOT_VERSION);
+    write(header, static_cast<int64_t>(std::time(nullptr)));
+    write(header, count);
+
+    std::string tmp = filename + ".tmp";
+    {
+        std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+        ofs.write(header.data(), header.size());
+        ofs.write(body.data(), body.size());
+        if(!ofs)
+        {
+            LOG_ERROR("context snapshot: cannot write '" << tmp << "'");
+            return 0;
+        }
+    }
+    boost::system::error_code ec;
+    boost::filesystem::rename(tmp, filename, ec);
+    if(ec)
+    {
+        LOG_ERROR("context snapshot: cannot rename '" << tmp << "' to '" << filename << "' : " << ec.message());
+        return 0;
+    }
+    LOG_PRINT_L2("context snapshot: " << count << " entries saved to '" << filename << "'");
+    return count;
+}
+
+size_t ContextSnapshot::load(GlobalContextMap& gcm, const std::string& filename) const
+{
+    std::ifstream ifs(filename, std::ios::binary);
+    if(!ifs)
+    {
+        LOG_PRINT_L1("context snapshot: no snapshot '" << filename << "'");
+        return 0;
+    }
+    std::string buf((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+
+    const char* data = buf.data();
+    const char* end = data + buf.size();
+
+    uint32_t magic = 0, version = 0, count = 0;
+    int64_t saved = 0;
+    if(!read(data, end, magic) || !read(data, end, version) || !read(data, end, saved) || !read(data, end, count)
+            || magic != SNAPSHOT_MAGIC || version != SNAPSHOT_VERSION)
+    {
+        LOG_ERROR("context snapshot: invalid file '" << filename << "'");
+        return 0;
+    }
+
+    int64_t elapsed = std::max<int64_t>(0, static_cast<int64_t>(std::time(nullptr)) - saved);
+    std::chrono::seconds now = steadyNow();
+    size_t restored = 0;
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        std::string key, value;
+        int64_t ttl, left;
+        if(!read(data, end, key) || !read(data, end, ttl) || !read(data, end, left) || !read(data, end, value))
+        {
+            LOG_ERROR("context snapshot: truncated file '" << filename << "', " << i << " of " << count << " entries read");
+            break;
+        }
+
+        std::chrono::seconds expires = std::chrono::seconds::max();
+        if(left != NEVER_EXPIRES)
+        {
+            left -= elapsed;
+            if(left <= 0) continue;
+            expires = now + std::chrono::seconds(left);
+        }
+
+        const Codec* codec = findCodec(key);
+        if(!codec) continue;
+
+        std::any any;
+        const char* vdata = value.data();
+        if(!codec->decode(vdata, vdata + value.size(), any))
+        {
+            LOG_PRINT_L1("context snapshot: cannot decode value of '" << key << "'");
+            continue;
+        }
+        if(gcm.restore(key, any, std::chrono::seconds(ttl), expires)) ++restored;
+    }
+    LOG_PRINT_L0("context snapshot: " << restored << " entries restored from '" << filename << "'");
+    return restored;
+}
+
+}//namespace graft
@@ -2,6 +2,9 @@
 #include "lib/graft/inout.h"
 #include "lib/graft/mongoosex.h"
 
+#include <boost/algorithm/string/predicate.hpp>
+#include <algorithm>
+
 namespace graft
 {
 std::unordered_map<std::string, std::tuple<std::string,int,bool,double>> OutHttp::uri_substitutions;
@@ -54,6 +57,32 @@ std::string InOutHttpBase::combine_headers()
     return s;
 }
 
+std::string InOutHttpBase::get_header(const std::string& name) const
+{
+    auto it = std::find_if(headers.begin(), headers.end(), [&name](auto& pair){ return boost::iequals(pair.first, name); });
+    return (it == headers.end())? std::string() : it->second;
+}
+
+void InOutHttpBase::set_header(const std::string& name, const std::string& value)
+{
+    auto it = std::find_if(headers.begin(), headers.end(), [&name](auto& pair){ return boost::iequals(pair.first, name); });
+    if(it == headers.end())
+        headers.emplace_back(name, value);
+    else
+        it->second = value;
+}
+
+bool InHttp::binary() const
+{
+    //parameters like "; charset=..." can follow the type
+    return boost::istarts_with(get_header("Content-Type"), serializer::BINARY_CONTENT_TYPE);
+}
+
+bool InHttp::acceptsBinary() const
+{
+    return binary() || boost::icontains(get_header("Accept"), serializer::BINARY_CONTENT_TYPE);
+}
+
 std::string OutHttp::makeUri(const std::string& default_uri) const
 {
     std::string uri_ = default_uri;
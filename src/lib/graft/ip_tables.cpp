@@ -0,0 +1,414 @@
+#include "lib/graft/ip_tables.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <random>
+
+namespace graft
+{
+namespace ipfilter
+{
+
+namespace
+{
+
+const uint8_t V4_MAPPED_PREFIX[12] = {0,0,0,0, 0,0,0,0, 0,0,0xff,0xff};
+
+uint64_t mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+uint64_t hashBytes(const IpAddress& addr, uint64_t seed)
+{
+    uint64_t a, b;
+    std::memcpy(&a, addr.bytes.data(), sizeof(a));
+    std::memcpy(&b, addr.bytes.data() + sizeof(a), sizeof(b));
+    return mix(mix(seed ^ a) ^ b);
+}
+
+} //namespace
+
+#ifndef __cpp_inline_variables
+constexpr int PrefixTable::Trie::ROOT_BITS;
+constexpr int PrefixTable::Trie::BITS;
+constexpr size_t RateTable::DEFAULT_CAPACITY;
+constexpr size_t RateTable::PROBES;
+constexpr std::chrono::seconds RateTable::one_sec;
+constexpr size_t RouteLimiter::DEFAULT_CAPACITY;
+constexpr size_t RouteLimiter::PROBES;
+#endif
+
+IpAddress IpAddress::fromV4(in_addr_t addr)
+{
+    IpAddress res;
+    std::memcpy(res.bytes.data(), V4_MAPPED_PREFIX, sizeof(V4_MAPPED_PREFIX));
+    res.bytes[12] = uint8_t(addr >> 24);
+    res.bytes[13] = uint8_t(addr >> 16);
+    res.bytes[14] = uint8_t(addr >> 8);
+    res.bytes[15] = uint8_t(addr);
+    return res;
+}
+
+IpAddress IpAddress::fromV6(const uint8_t* addr)
+{
+    IpAddress res;
+    std::memcpy(res.bytes.data(), addr, res.bytes.size());
+    return res;
+}
+
+bool IpAddress::fromSockaddr(const sockaddr* sa, IpAddress& addr)
+{
+    switch(sa->sa_family)
+    {
+    case AF_INET:
+        addr = fromV4(ntohl(reinterpret_cast<const sockaddr_in*>(sa)->sin_addr.s_addr));
+        return true;
+    case AF_INET6:
+        addr = fromV6(reinterpret_cast<const sockaddr_in6*>(sa)->sin6_addr.s6_addr);
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool IpAddress::parse(const std::string& s, IpAddress& addr)
+{
+    in_addr v4;
+    if(inet_pton(AF_INET, s.c_str(), &v4) == 1)
+    {
+        addr = fromV4(ntohl(v4.s_addr));
+        return true;
+    }
+    in6_addr v6;
+    if(inet_pton(AF_INET6, s.c_str(), &v6) == 1)
+    {
+        addr = fromV6(v6.s6_addr);
+        return true;
+    }
+    return false;
+}
+
+bool IpAddress::isV4() const
+{
+    return std::memcmp(bytes.data(), V4_MAPPED_PREFIX, sizeof(V4_MAPPED_PREFIX)) == 0;
+}
+
+in_addr_t IpAddress::v4() const
+{
+    return (in_addr_t(bytes[12]) << 24) | (in_addr_t(bytes[13]) << 16) | (in_addr_t(bytes[14]) << 8) | in_addr_t(bytes[15]);
+}
+
+IpAddress IpAddress::network(int len) const
+{
+    IpAddress res = *this;
+    int bits = (isV4()? 96 : 0) + len;
+    for(int i = 0; i < 16; ++i, bits -= 8)
+    {
+        if(8 <= bits) continue;
+        res.bytes[i] &= (bits <= 0)? 0 : uint8_t(0xff << (8 - bits));
+    }
+    return res;
+}
+
+std::string IpAddress::toString() const
+{
+    char buf[INET6_ADDRSTRLEN];
+    if(isV4())
+    {
+        in_addr v4;
+        v4.s_addr = htonl(this->v4());
+        return inet_ntop(AF_INET, &v4, buf, sizeof(buf));
+    }
+    return inet_ntop(AF_INET6, bytes.data(), buf, sizeof(buf));
+}
+
+size_t IpAddressHash::operator()(const IpAddress& addr) const
+{
+    return hashBytes(addr, 0);
+}
+
+void PrefixTable::clear()
+{
+    m_rules.clear();
+    m_v4.clear();
+    m_v6.clear();
+    m_dirty = false;
+}
+
+void PrefixTable::insert(const IpAddress& addr, int len, Allow allow)
+{
+    m_rules[std::make_pair(addr.network(len), len)] = allow;
+    m_dirty = true;
+}
+
+bool PrefixTable::erase(const IpAddress& addr, int len)
+{
+    if(m_rules.erase(std::make_pair(addr.network(len), len)) == 0) return false;
+    m_dirty = true;
+    return true;
+}
+
+std::pair<bool, PrefixTable::Allow> PrefixTable::find(const IpAddress& addr) const
+{
+    assert(!m_dirty);
+    if(addr.isV4()) return m_v4.find(addr.bytes.data() + 12, 4);
+    return m_v6.find(addr.bytes.data(), 16);
+}
+
+std::pair<bool, PrefixTable::Allow> PrefixTable::findRule(const IpAddress& addr) const
+{
+    for(int len = addr.maxPrefixLen(); 0 < len; --len)
+    {
+        auto it = m_rules.find(std::make_pair(addr.network(len), len));
+        if(it != m_rules.end()) return std::make_pair(true, it->second);
+    }
+    return std::make_pair(false, false);
+}
+
+void PrefixTable::compile()
+{
+    m_v4.clear();
+    m_v6.clear();
+
+    //shorter prefixes first, longer ones overwrite them in the expanded ranges
+    using Rule = decltype(m_rules)::value_type;
+    std::vector<const Rule*> rules;
+    rules.reserve(m_rules.size());
+    for(auto& rule : m_rules) rules.push_back(&rule);
+    std::stable_sort(rules.begin(), rules.end(), [](const Rule* a, const Rule* b) { return a->first.second < b->first.second; });
+
+    for(const Rule* rule : rules)
+    {
+        const IpAddress& addr = rule->first.first;
+        int len = rule->first.second;
+        if(addr.isV4()) m_v4.insert(addr.bytes.data() + 12, len, rule->second);
+        else m_v6.insert(addr.bytes.data(), len, rule->second);
+    }
+    m_dirty = false;
+}
+
+void PrefixTable::Trie::insert(const uint8_t* key, int len, Allow allow)
+{
+    if(m_entries.empty()) m_entries.resize(size_t(1) << ROOT_BITS);
+
+    size_t base = 0;
+    size_t idx = (size_t(key[0]) << 8) | key[1];
+    int levelEnd = ROOT_BITS;
+    for(int byte = 2; levelEnd < len; ++byte, levelEnd += BITS)
+    {
+        if(m_entries[base + idx].child < 0)
+        {
+            int32_t child = int32_t(m_entries.size());
+            m_entries.resize(m_entries.size() + (size_t(1) << BITS));
+            m_entries[base + idx].child = child;
+        }
+        base = m_entries[base + idx].child;
+        idx = key[byte];
+    }
+
+    //the prefix is expanded to the level boundary
+    size_t count = size_t(1) << (levelEnd - len);
+    size_t first = idx & ~(count - 1);
+    for(size_t i = first; i < first + count; ++i)
+    {
+        m_entries[base + i].value = allow? 1 : 0;
+    }
+}
+
+std::pair<bool, PrefixTable::Allow> PrefixTable::Trie::find(const uint8_t* key, int keyBytes) const
+{
+    if(m_entries.empty()) return std::make_pair(false, false);
+
+    const Entry* e = &m_entries[(size_t(key[0]) << 8) | key[1]];
+    int value = e->value;
+    for(int byte = 2; 0 <= e->child && byte < keyBytes; ++byte)
+    {
+        e = &m_entries[e->child + key[byte]];
+        if(0 <= e->value) value = e->value;
+    }
+    if(value < 0) return std::make_pair(false, false);
+    return std::make_pair(true, value == 1);
+}
+
+RateTable::RateTable(int requests_per_sec, int window_size_sec, size_t capacity)
+    : m_requestsPerSec(requests_per_sec)
+    , m_wndSizeSec(window_size_sec)
+    , m_wndSize(std::chrono::seconds(window_size_sec))
+{
+    size_t size = PROBES;
+    while(size < capacity) size <<= 1;
+    m_slots.resize(size);
+    m_mask = size - 1;
+
+    std::random_device rd;
+    m_seed = (uint64_t(rd()) << 32) ^ rd();
+}
+
+bool RateTable::inc(const IpAddress& addr, clock::time_point now)
+{
+    size_t h = hashBytes(addr, m_seed);
+    Slot* found = nullptr;
+    Slot* free = nullptr;
+    Slot* victim = nullptr;
+    for(size_t i = 0; i < PROBES; ++i)
+    {
+        Slot& slot = m_slots[(h + i) & m_mask];
+        if(!slot.used || outdated(slot, now))
+        {//too old data is not used
+            if(!free) free = &slot;
+            continue;
+        }
+        if(slot.addr == addr)
+        {
+            found = &slot;
+            break;
+        }
+        //the addresses with a few requests are evicted first, so a flood of distinct addresses
+        //does not push out the counters of the heavy ones
+        if(!victim || slot.count < victim->count || (slot.count == victim->count && slot.start < victim->start)) victim = &slot;
+    }
+
+    if(!found)
+    {
+        Slot& slot = free? *free : *victim;
+        slot.addr = addr;
+        slot.used = true;
+        slot.start = now;
+        slot.count = 1;
+        return false;
+    }
+
+    Slot& wnd = *found;
+    auto tp_end = wnd.start + m_wndSize;
+    if(tp_end + one_sec < now)
+    {
+        auto secs = std::chrono::duration_cast<std::chrono::seconds>(now - tp_end);
+        wnd.count -= secs.count() * m_requestsPerSec;
+        if(wnd.count <= 0)
+        {
+            wnd.start = now;
+            wnd.count = 1;
+            return false;
+        }
+        wnd.start += std::chrono::seconds(secs.count());
+    }
+    if(m_wndSizeSec * m_requestsPerSec < ++wnd.count)
+    {
+        wnd.used = false;
+        return true;
+    }
+    return false;
+}
+
+size_t RateTable::activeCount(clock::time_point now) const
+{
+    return std::count_if(m_slots.begin(), m_slots.end(), [this, now](const Slot& slot) { return slot.used && !outdated(slot, now); });
+}
+
+RouteLimiter::RouteLimiter(const std::vector<Group>& groups, size_t capacity)
+{
+    m_groups = groups;
+    for(Group& g : m_groups)
+    {
+        if(g.requests_per_sec <= 0) continue;
+        g.burst = std::max(g.burst, 1.0);
+        m_limited = true;
+    }
+
+    size_t size = PROBES;
+    while(size < capacity) size <<= 1;
+    m_slots.resize(size);
+    m_mask = size - 1;
+
+    std::random_device rd;
+    m_seed = (uint64_t(rd()) << 32) ^ rd();
+}
+
+int RouteLimiter::group(const std::string& path) const
+{
+    int res = -1;
+    for(size_t i = 0; i < m_groups.size(); ++i)
+    {
+        const std::string& prefix = m_groups[i].prefix;
+        if(path.compare(0, prefix.size(), prefix) != 0) continue;
+        if(res < 0 || m_groups[res].prefix.size() < prefix.size()) res = int(i);
+    }
+    if(0 <= res && m_groups[res].requests_per_sec <= 0) return -1;
+    return res;
+}
+
+double RouteLimiter::tokens(const Slot& slot, clock::time_point now) const
+{
+    const Group& g = m_groups[slot.group];
+    double elapsed = std::chrono::duration<double>(now - slot.last).count();
+    return std::min(g.burst, slot.tokens + elapsed * g.requests_per_sec);
+}
+
+bool RouteLimiter::take(const IpAddress& addr, int group, clock::time_point now)
+{
+    assert(0 <= group && size_t(group) < m_groups.size());
+    size_t h = hashBytes(addr, m_seed + uint64_t(group));
+    Slot* found = nullptr;
+    Slot* free = nullptr;
+    Slot* victim = nullptr;
+    double victimTokens = 0;
+    for(size_t i = 0; i < PROBES; ++i)
+    {
+        Slot& slot = m_slots[(h + i) & m_mask];
+        if(slot.group < 0)
+        {
+            if(!free) free = &slot;
+            continue;
+        }
+        if(slot.group == group && slot.addr == addr)
+        {
+            found = &slot;
+            break;
+        }
+        //the fullest bucket loses the least when it is reused, a full one nothing
+        double t = tokens(slot, now);
+        if(!victim || victimTokens < t)
+        {
+            victim = &slot;
+            victimTokens = t;
+        }
+    }
+
+    if(!found)
+    {
+        Slot& slot = free? *free : *victim;
+        slot.addr = addr;
+        slot.group = group;
+        slot.tokens = m_groups[group].burst;
+        slot.last = now;
+        found = &slot;
+    }
+
+    Slot& slot = *found;
+    slot.tokens = tokens(slot, now);
+    slot.last = now;
+    if(slot.tokens < 1) return false;
+    slot.tokens -= 1;
+    return true;
+}
+
+int RouteLimiter::retryAfterSec(int group) const
+{
+    assert(0 <= group && size_t(group) < m_groups.size());
+    return std::max(1, int(std::ceil(1 / m_groups[group].requests_per_sec)));
+}
+
+} //namespace ipfilter
+} //namespace graft
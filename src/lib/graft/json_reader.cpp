@@ -0,0 +1,322 @@
+#include "lib/graft/json_reader.h"
+
+#include <cstdlib>
+
+namespace graft
+{
+namespace json
+{
+
+#ifndef __cpp_inline_variables
+constexpr int JsonReader::MAX_DEPTH;
+#endif
+
+void JsonReader::fail(rapidjson::ParseErrorCode code) const
+{
+    throw rapidjson::ParseResult(code, m_ptr - m_begin);
+}
+
+char JsonReader::peek()
+{
+    while(m_ptr != m_end && (*m_ptr == ' ' || *m_ptr == '\n' || *m_ptr == '\r' || *m_ptr == '\t')) ++m_ptr;
+    return (m_ptr == m_end)? '\0' : *m_ptr;
+}
+
+void JsonReader::expect(const char* literal)
+{
+    size_t len = std::strlen(literal);
+    if(size_t(m_end - m_ptr) < len || std::memcmp(m_ptr, literal, len) != 0) fail(rapidjson::kParseErrorValueInvalid);
+    m_ptr += len;
+}
+
+JsonReader::Type JsonReader::next()
+{
+    switch(peek())
+    {
+    case 'n': return Type::Null;
+    case 't': case 'f': return Type::Bool;
+    case '"': return Type::String;
+    case '{': return Type::Object;
+    case '[': return Type::Array;
+    case '-': case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+        return Type::Number;
+    case '\0':
+        if(m_ptr == m_end) fail((m_ptr == m_begin)? rapidjson::kParseErrorDocumentEmpty : rapidjson::kParseErrorValueInvalid);
+        //fall through
+    default:
+        fail(rapidjson::kParseErrorValueInvalid);
+    }
+}
+
+bool JsonReader::readBool()
+{
+    if(peek() == 't')
+    {
+        expect("true");
+        return true;
+    }
+    expect("false");
+    return false;
+}
+
+void JsonReader::readNull()
+{
+    peek();
+    expect("null");
+}
+
+void JsonReader::readNumber(Number& number)
+{
+    peek();
+    const char* start = m_ptr;
+    auto isDigit = [this]() { return m_ptr != m_end && '0' <= *m_ptr && *m_ptr <= '9'; };
+
+    number = Number();
+    if(*m_ptr == '-')
+    {
+        number.negative = true;
+        ++m_ptr;
+    }
+    if(!isDigit()) fail(rapidjson::kParseErrorValueInvalid);
+
+    bool overflow = false;
+    if(*m_ptr == '0')
+    {
+        ++m_ptr;
+    }
+    else
+    {
+        for(; isDigit(); ++m_ptr)
+        {
+            uint64_t digit = *m_ptr - '0';
+            if(number.u > (std::numeric_limits<uint64_t>::max() - digit) / 10) overflow = true;
+            else number.u = number.u * 10 + digit;
+        }
+    }
+
+    bool fraction = false;
+    if(m_ptr != m_end && *m_ptr == '.')
+    {
+        ++m_ptr;
+        if(!isDigit()) fail(rapidjson::kParseErrorNumberMissFraction);
+        while(isDigit()) ++m_ptr;
+        fraction = true;
+    }
+    if(m_ptr != m_end && (*m_ptr == 'e' || *m_ptr == 'E'))
+    {
+        ++m_ptr;
+        if(m_ptr != m_end && (*m_ptr == '+' || *m_ptr == '-')) ++m_ptr;
+        if(!isDigit()) fail(rapidjson::kParseErrorNumberMissExponent);
+        while(isDigit()) ++m_ptr;
+        fraction = true;
+    }
+
+    if(number.negative && number.u == 0 && !fraction) number.negative = false; //"-0"
+    number.integer = !fraction && !overflow
+            && (!number.negative || number.u <= uint64_t(std::numeric_limits<int64_t>::max()) + 1);
+    if(number.integer)
+    {
+        number.d = number.negative? -static_cast<double>(number.u) : static_cast<double>(number.u);
+        return;
+    }
+    //the input is not null terminated
+    std::string text(start, m_ptr);
+    number.d = std::strtod(text.c_str(), nullptr);
+}
+
+std::string_view JsonReader::readStringView()
+{
+    if(peek() != '"') fail(rapidjson::kParseErrorValueInvalid);
+    ++m_ptr;
+
+    //fast path, no escapes
+    const char* start = m_ptr;
+    for(; m_ptr != m_end; ++m_ptr)
+    {
+        char c = *m_ptr;
+        if(c == '"')
+        {
+            return std::string_view(start, m_ptr++ - start);
+        }
+        if(c == '\\') break;
+        if(static_cast<unsigned char>(c) < 0x20) fail(rapidjson::kParseErrorStringInvalidEncoding);
+    }
+    if(m_ptr == m_end) fail(rapidjson::kParseErrorStringMissQuotationMark);
+
+    m_scratch.assign(start, m_ptr);
+    auto hex4 = [this]()->unsigned
+    {
+        if(m_end - m_ptr < 4) fail(rapidjson::kParseErrorStringUnicodeEscapeInvalidHex);
+        unsigned v = 0;
+        for(int i = 0; i < 4; ++i, ++m_ptr)
+        {
+            char c = *m_ptr;
+            v <<= 4;
+            if('0' <= c && c <= '9') v |= c - '0';
+            else if('a' <= c && c <= 'f') v |= c - 'a' + 10;
+            else if('A' <= c && c <= 'F') v |= c - 'A' + 10;
+            else fail(rapidjson::kParseErrorStringUnicodeEscapeInvalidHex);
+        }
+        return v;
+    };
+    while(m_ptr != m_end)
+    {
+        char c = *m_ptr++;
+        if(c == '"') return std::string_view(m_scratch);
+        if(static_cast<unsigned char>(c) < 0x20) fail(rapidjson::kParseErrorStringInvalidEncoding);
+        if(c != '\\')
+        {
+            m_scratch.push_back(c);
+            continue;
+        }
+        if(m_ptr == m_end) break;
+        switch(*m_ptr++)
+        {
+        case '"': m_scratch.push_back('"'); break;
+        case '\\': m_scratch.push_back('\\'); break;
+        case '/': m_scratch.push_back('/'); break;
+        case 'b': m_scratch.push_back('\b'); break;
+        case 'f': m_scratch.push_back('\f'); break;
+        case 'n': m_scratch.push_back('\n'); break;
+        case 'r': m_scratch.push_back('\r'); break;
+        case 't': m_scratch.push_back('\t'); break;
+        case 'u':
+        {
+            unsigned cp = hex4();
+            if(0xD800 <= cp && cp <= 0xDBFF)
+            {
+                if(m_end - m_ptr < 2 || m_ptr[0] != '\\' || m_ptr[1] != 'u') fail(rapidjson::kParseErrorStringUnicodeSurrogateInvalid);
+                m_ptr += 2;
+                unsigned low = hex4();
+                if(low < 0xDC00 || 0xDFFF < low) fail(rapidjson::kParseErrorStringUnicodeSurrogateInvalid);
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+            }
+            //UTF-8
+            if(cp < 0x80)
+            {
+                m_scratch.push_back(static_cast<char>(cp));
+            }
+            else if(cp < 0x800)
+            {
+                m_scratch.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+                m_scratch.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+            }
+            else if(cp < 0x10000)
+            {
+                m_scratch.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+                m_scratch.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+                m_scratch.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+            }
+            else
+            {
+                m_scratch.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+                m_scratch.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+                m_scratch.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+                m_scratch.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+            }
+        } break;
+        default:
+            --m_ptr;
+            fail(rapidjson::kParseErrorStringEscapeInvalid);
+        }
+    }
+    fail(rapidjson::kParseErrorStringMissQuotationMark);
+}
+
+void JsonReader::readString(std::string& s)
+{
+    std::string_view v = readStringView();
+    s.assign(v.data(), v.size());
+}
+
+void JsonReader::beginObject()
+{
+    if(peek() != '{') fail(rapidjson::kParseErrorValueInvalid);
+    if(++m_depth > MAX_DEPTH) fail(rapidjson::kParseErrorTermination);
+    ++m_ptr;
+    m_first = true;
+}
+
+bool JsonReader::nextMember(std::string_view& key)
+{
+    char c = peek();
+    if(c == '}')
+    {
+        leave();
+        return false;
+    }
+    if(!m_first)
+    {
+        if(c != ',') fail(rapidjson::kParseErrorObjectMissCommaOrCurlyBracket);
+        ++m_ptr;
+        c = peek();
+    }
+    m_first = false;
+    if(c != '"') fail(rapidjson::kParseErrorObjectMissName);
+    key = readStringView();
+    if(peek() != ':') fail(rapidjson::kParseErrorObjectMissColon);
+    ++m_ptr;
+    return true;
+}
+
+void JsonReader::beginArray()
+{
+    if(peek() != '[') fail(rapidjson::kParseErrorValueInvalid);
+    if(++m_depth > MAX_DEPTH) fail(rapidjson::kParseErrorTermination);
+    ++m_ptr;
+    m_first = true;
+}
+
+bool JsonReader::nextItem()
+{
+    char c = peek();
+    if(c == ']')
+    {
+        leave();
+        return false;
+    }
+    if(!m_first)
+    {
+        if(c != ',') fail(rapidjson::kParseErrorArrayMissCommaOrSquareBracket);
+        ++m_ptr;
+    }
+    m_first = false;
+    return true;
+}
+
+void JsonReader::leave()
+{
+    ++m_ptr;
+    --m_depth;
+    m_first = false;
+}
+
+void JsonReader::skipValue()
+{
+    switch(next())
+    {
+    case Type::Null: readNull(); break;
+    case Type::Bool: readBool(); break;
+    case Type::Number: { Number n; readNumber(n); } break;
+    case Type::String: readStringView(); break;
+    case Type::Object:
+    {
+        std::string_view key;
+        beginObject();
+        while(nextMember(key)) skipValue();
+    } break;
+    case Type::Array:
+    {
+        beginArray();
+        while(nextItem()) skipValue();
+    } break;
+    }
+}
+
+void JsonReader::finish()
+{
+    if(peek() != '\0' || m_ptr != m_end) fail(rapidjson::kParseErrorDocumentRootNotSingular);
+}
+
+} //namespace json
+} //namespace graft
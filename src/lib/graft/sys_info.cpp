@@ -11,6 +11,7 @@ Counter::Counter(void)
 , m_http_resp_status_error_cnt(0)
 , m_http_resp_status_drop_cnt(0)
 , m_http_resp_status_busy_cnt(0)
+, m_http_resp_status_limited_cnt(0)
 , m_http_req_bytes_raw_cnt(0)
 , m_http_resp_bytes_raw_cnt(0)
 , m_upstrm_http_req_cnt(0)
@@ -18,6 +19,11 @@ Counter::Counter(void)
 , m_upstrm_http_resp_err_cnt(0)
 , m_upstrm_http_req_bytes_raw_cnt(0)
 , m_upstrm_http_resp_bytes_raw_cnt(0)
+, m_gcm_cleanup_pass_cnt(0)
+, m_gcm_cleanup_expired_cnt(0)
+, m_gcm_cleanup_expired_last(0)
+, m_gcm_cleanup_pause_max_us(0)
+, m_gcm_cleanup_pass_max_us(0)
 , m_system_start_time(std::chrono::system_clock::now())
 {
 }
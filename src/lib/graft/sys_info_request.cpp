@@ -32,6 +32,7 @@ Status handler(const Vars& vars, const Input& input, Ctx& ctx, Output& output)
     ri.http_resp_status_error = rsi.http_resp_status_error_cnt();
     ri.http_resp_status_drop  = rsi.http_resp_status_drop_cnt();
     ri.http_resp_status_busy  = rsi.http_resp_status_busy_cnt();
+    ri.http_resp_status_limited = rsi.http_resp_status_limited_cnt();
 
     ri.http_req_bytes_raw  = rsi.http_req_bytes_raw_cnt();
     ri.http_resp_bytes_raw = rsi.http_resp_bytes_raw_cnt();
@@ -43,6 +44,12 @@ Status handler(const Vars& vars, const Input& input, Ctx& ctx, Output& output)
     ri.upstrm_http_req_bytes_raw  = rsi.upstrm_http_req_bytes_raw_cnt();
     ri.upstrm_http_resp_bytes_raw = rsi.upstrm_http_resp_bytes_raw_cnt();
 
+    ri.gcm_cleanup_passes = rsi.gcm_cleanup_pass_cnt();
+    ri.gcm_cleanup_expired = rsi.gcm_cleanup_expired_cnt();
+    ri.gcm_cleanup_expired_last_pass = rsi.gcm_cleanup_expired_last();
+    ri.gcm_cleanup_pause_max_us = rsi.gcm_cleanup_pause_max_us();
+    ri.gcm_cleanup_pass_max_us = rsi.gcm_cleanup_pass_max_us();
+
     ri.uptime_sec = rsi.system_uptime_sec();
 
     auto& cfg = out.configuration;
@@ -54,10 +61,12 @@ Status handler(const Vars& vars, const Input& input, Ctx& ctx, Output& output)
     cfg.http_connection_timeout = co.http_connection_timeout;
     cfg.upstream_request_timeout = co.upstream_request_timeout;
     cfg.workers_count = co.workers_count;
+    cfg.workers_max_count = co.workers_max_count;
     cfg.worker_queue_len = co.worker_queue_len;
     cfg.cryptonode_rpc_address = co.cryptonode_rpc_address;
     cfg.timer_poll_interval_ms = co.timer_poll_interval_ms;
     cfg.lru_timeout_ms = co.lru_timeout_ms;
+    cfg.gcm_cleanup_budget_us = co.gcm_cleanup_budget_us;
     cfg.graftlet_dirs = co.graftlet_dirs;
     cfg.log_trunc_to_size = co.log_trunc_to_size;
 
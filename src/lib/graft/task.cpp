@@ -238,7 +238,7 @@ public:
                 connItem = &it->second;
             }
         }
-        if(connItem->m_maxConnections != 0 && connItem->m_idleConnections.empty() && connItem->m_connCnt == connItem->m_maxConnections)
+        if(connItem->full())
         {
             connItem->m_taskQueue.push_back(bt);
             return;
@@ -246,7 +246,52 @@ public:
 
         createUpstreamSender(connItem, bt);
     }
+
+    //applies changed uri substitutions and timeouts; connections in progress are not affected
+    void reconfigure()
+    {
+        m_default.m_timeout = m_manager.getCopts().upstream_request_timeout;
+
+        for(auto& subs : OutHttp::uri_substitutions)
+        {
+            auto it = m_conn2item.find(subs.first);
+            if(it == m_conn2item.end())
+            {
+                LOG_PRINT_L1("Upstream '" << subs.first << "' added");
+                addItem(subs.first, subs.second);
+                continue;
+            }
+            ConnItem& connItem = it->second;
+            if(connItem.m_keepAlive != std::get<2>(subs.second))
+            {
+                LOG_PRINT_L0("Keep-alive of upstream '" << subs.first << "' cannot be changed without restart");
+            }
+            if(connItem.m_uri != std::get<0>(subs.second))
+            {
+                connItem.m_uri = std::get<0>(subs.second);
+                //idle connections are to the previous uri
+                for(auto& item : connItem.m_idleConnections)
+                {
+                    UpstreamStub::close(item.first);
+                }
+            }
+            connItem.m_maxConnections = std::get<1>(subs.second);
+            connItem.m_timeout = timeout(subs.second);
+            //the limit could be raised
+            while(!connItem.m_taskQueue.empty() && !connItem.full())
+            {
+                BaseTaskPtr bt = connItem.m_taskQueue.front(); connItem.m_taskQueue.pop_front();
+                createUpstreamSender(&connItem, bt);
+            }
+        }
+        for(auto& item : m_conn2item)
+        {
+            if(OutHttp::uri_substitutions.count(item.first)) continue;
+            LOG_PRINT_L0("Upstream '" << item.first << "' is removed from the configuration, it remains until restart");
+        }
+    }
 private:
+    using Substitution = decltype(OutHttp::uri_substitutions)::mapped_type;
     uint64_t m_cntUpstreamSender = 0;
     uint64_t m_cntUpstreamSenderDone = 0;
 
@@ -268,7 +313,7 @@ private:
         std::pair<ConnectionId, mg_connection*> getConnection()
         {
             //TODO: something wrong with (m_connCnt <= m_maxConnections)
-            assert(m_maxConnections == 0 || m_connCnt <= m_maxConnections);
+            //m_connCnt can exceed m_maxConnections after it is lowered by reconfiguration
             std::pair<ConnectionId, mg_connection*> res = std::make_pair(0,nullptr);
             if(!m_keepAlive)
             {
@@ -320,6 +365,12 @@ private:
             m_idleConnections.erase(it);
         }
 
+        bool full() const
+        {
+            //m_connCnt can exceed m_maxConnections after it is lowered by reconfiguration
+            return m_maxConnections != 0 && m_idleConnections.empty() && m_maxConnections <= m_connCnt;
+        }
+
         ConnectionId m_newId = 0;
         int m_connCnt = 0;
         int m_uriId;
@@ -346,21 +397,30 @@ private:
 
     void init()
     {
-        int uriId = 0;
         const ConfigOpts& opts = m_manager.getCopts();
-        m_default = ConnItem(uriId++, opts.cryptonode_rpc_address.c_str(), 0, false, opts.upstream_request_timeout);
+        m_default = ConnItem(m_uriId++, opts.cryptonode_rpc_address.c_str(), 0, false, opts.upstream_request_timeout);
 
         for(auto& subs : OutHttp::uri_substitutions)
         {
-            double timeout = std::get<3>(subs.second);
-            if(timeout < 1e-5) timeout = opts.upstream_request_timeout;
-            auto res = m_conn2item.emplace(subs.first, ConnItem(uriId, std::get<0>(subs.second), std::get<1>(subs.second), std::get<2>(subs.second), timeout));
-            assert(res.second);
-            ConnItem* connItem = &res.first->second;
-            connItem->m_upstreamStub.setCallback([connItem](mg_connection* client){ connItem->onCloseIdle(client); });
+            addItem(subs.first, subs.second);
         }
     }
 
+    double timeout(const Substitution& subs) const
+    {
+        double timeout = std::get<3>(subs);
+        if(timeout < 1e-5) timeout = m_manager.getCopts().upstream_request_timeout;
+        return timeout;
+    }
+
+    void addItem(const std::string& name, const Substitution& subs)
+    {
+        auto res = m_conn2item.emplace(name, ConnItem(m_uriId, std::get<0>(subs), std::get<1>(subs), std::get<2>(subs), timeout(subs)));
+        assert(res.second);
+        ConnItem* connItem = &res.first->second;
+        connItem->m_upstreamStub.setCallback([connItem](mg_connection* client){ connItem->onCloseIdle(client); });
+    }
+
     void createUpstreamSender(ConnItem* connItem, BaseTaskPtr bt)
     {
         auto onDoneAct = [this, connItem](UpstreamSender& uss, uint64_t connectionId, mg_connection* client)
@@ -388,6 +448,7 @@ private:
 
     OnDoneCallback m_onDoneCallback;
 
+    int m_uriId = 0;
     ConnItem m_default;
     Uri2ConnItem m_conn2item;
     TaskManager& m_manager; //TODO: should be removed, and be independent of TaskManager
@@ -403,7 +464,7 @@ TaskManager::TaskManager(const ConfigOpts& copts, SysInfoCounter& sysInfoCounter
     copts.check_asserts();
 
     // TODO: validate options, throw exception if any mandatory options missing
-    initThreadPool(copts.workers_count, copts.worker_queue_len, copts.workers_expelling_interval_ms);
+    initThreadPool(copts.workers_count, copts.worker_queue_len, copts.workers_expelling_interval_ms, copts.workers_max_count);
 }
 
 TaskManager::~TaskManager()
@@ -451,6 +512,24 @@ const ConfigOpts& TaskManager::configOpts() const
     return m_copts;
 }
 
+void TaskManager::publish(const std::string& topic, const std::string& message, bool last)
+{
+    {
+        std::lock_guard<std::mutex> lk(m_publishedMutex);
+        m_published.push_back(Publication{topic, message, last});
+    }
+    if(!io_thread) notifyJobReady();
+}
+
+TaskManager::Published TaskManager::takePublished()
+{
+    assert(io_thread);
+    Published published;
+    std::lock_guard<std::mutex> lk(m_publishedMutex);
+    published.swap(m_published);
+    return published;
+}
+
 void TaskManager::checkPeriodicTaskIO()
 {
     while(true)
@@ -476,6 +555,8 @@ void TaskManager::sendUpstreamBlocking(Output& output, Input& input, std::string
     m_promiseQueue->push( std::move(pair) );
     notifyJobReady();
     err.clear();
+    //the pool can start another worker meanwhile
+    ThreadPoolX::BlockingScope blocking;
     try
     {
         input = future.get();
@@ -486,6 +567,22 @@ void TaskManager::sendUpstreamBlocking(Output& output, Input& input, std::string
     }
 }
 
+bool TaskManager::sendUpstreamAsync(const Output& output, UpstreamCallback callback)
+{
+    assert(callback);
+    if(io_thread)
+    {//it is called from pre_action, post_action or another callback, we can send it directly
+        UpstreamTask::Ptr bt = BaseTask::Create<UpstreamTask>(*this, std::make_pair(std::move(callback), output));
+        assert(m_upstreamManager);
+        m_upstreamManager->send(bt);
+        return true;
+    }
+    bool ok = m_callbackQueue->push( std::make_pair(std::move(callback), output) );
+    if(!ok) return false;
+    notifyJobReady();
+    return true;
+}
+
 void TaskManager::checkUpstreamBlockingIO()
 {
     while(true)
@@ -497,6 +594,15 @@ void TaskManager::checkUpstreamBlockingIO()
         assert(m_upstreamManager);
         m_upstreamManager->send(bt);
     }
+    while(true)
+    {
+        CallbackItem ci;
+        bool res = m_callbackQueue->pop(ci);
+        if(!res) break;
+        UpstreamTask::Ptr bt = BaseTask::Create<UpstreamTask>(*this, std::move(ci));
+        assert(m_upstreamManager);
+        m_upstreamManager->send(bt);
+    }
 }
 
 void TaskManager::sendUpstream(BaseTaskPtr bt)
@@ -514,6 +620,9 @@ void TaskManager::onTimer(BaseTaskPtr bt)
 
 void TaskManager::respondAndDie(BaseTaskPtr bt, const std::string& s, bool die)
 {
+    //a later change of the watched keys has nothing to resume
+    bt->getCtx().stopWatching();
+
     ClientTask* ct = dynamic_cast<ClientTask*>(bt.get());
     if(ct)
     {
@@ -571,12 +680,12 @@ void TaskManager::checkThreadPoolOverflow(BaseTaskPtr bt)
     auto& params = bt->getParams();
 
     assert(m_cntJobDone <= m_cntJobSent);
-    if(params.h3.worker_action && m_cntJobSent - m_cntJobDone == m_threadPoolInputSize)
+    //there can be more jobs than the input size after the thread pool is shrunk
+    if(params.h3.worker_action && m_threadPoolInputSize <= m_cntJobSent - m_cntJobDone)
     {//check overflow
         bt->getCtx().local.setError("Service Unavailable", Status::Busy);
         respondAndDie(bt,"Thread pool overflow");
     }
-    assert(m_cntJobSent - m_cntJobDone <= m_threadPoolInputSize);
 }
 
 void TaskManager::runPreAction(BaseTaskPtr bt)
@@ -720,9 +829,9 @@ void TaskManager::postponeTask(BaseTaskPtr bt)
     auto res = m_futurePostponeUuids->extract(uuid);
     if(res.first)
     {//found
-        //set saved input
-        assert(res.second.getInputPtr());
-        bt->getParams().input = *res.second.getInputPtr();
+        //set saved input, there is no input if the task is woken by resumePostponed
+        if(res.second.getInputPtr())
+            bt->getParams().input = *res.second.getInputPtr();
         m_readyToResume.push_back(bt);
         LOG_PRINT_RQS_BT(2,bt,"for the task with uuid '" << boost::uuids::to_string(uuid) << "' an answer found; it will be resumed.");
         return;
@@ -740,13 +849,47 @@ void TaskManager::postponeTask(BaseTaskPtr bt)
     LOG_PRINT_RQS_BT(2,bt,"task with uuid '" << uuid << "' postponed.");
 }
 
+void TaskManager::resumePostponed(const Context::uuid_t& uuid)
+{
+    {
+        std::lock_guard<std::mutex> lk(m_wokenMutex);
+        m_woken.push_back(uuid);
+    }
+    if(!io_thread) notifyJobReady();
+}
+
+void TaskManager::resumeWoken()
+{
+    std::vector<Context::uuid_t> woken;
+    {
+        std::lock_guard<std::mutex> lk(m_wokenMutex);
+        woken.swap(m_woken);
+    }
+    for(auto& uuid : woken)
+    {
+        auto it = m_postponedTasks.find(uuid);
+        if(it == m_postponedTasks.end())
+        {
+            //the worker of the task has not returned yet, or the task is done and it is forgotten on expiration
+            m_futurePostponeUuids->add(Uuid_Input(uuid));
+            continue;
+        }
+        LOG_PRINT_RQS_BT(2,it->second,"task with uuid '" << uuid << "' woken.");
+        m_readyToResume.push_back(it->second);
+        m_postponedTasks.erase(it);
+    }
+}
+
 void TaskManager::executePostponedTasks()
 {
+    resumeWoken();
     while(!m_readyToResume.empty())
     {
         BaseTaskPtr& bt = m_readyToResume.front();
         Context::uuid_t uuid = bt->getCtx().getId();
         LOG_PRINT_RQS_BT(2,bt,"task with uuid '" << uuid << "' resumed.");
+        //the handler watches again if it postpones again
+        bt->getCtx().stopWatching();
         Execute(bt);
         m_readyToResume.pop_front();
     }
@@ -780,6 +923,125 @@ void TaskManager::expelWorkers()
     m_threadPool->expelWorkers();
 }
 
+void TaskManager::scaleWorkers()
+{
+    const size_t minCount = workersCount(m_copts.workers_count);
+    const size_t maxCount = std::min(size_t(m_copts.workers_max_count), m_threadPool->maxThreadCount());
+    if(maxCount <= minCount) return;
+
+    constexpr std::chrono::milliseconds scaleInterval(100);
+    constexpr std::chrono::milliseconds idleInterval(5000);
+    auto now = std::chrono::steady_clock::now();
+    if(now < m_scaleTime) return;
+    m_scaleTime = now + scaleInterval;
+
+    const size_t count = m_threadPool->threadCount();
+    //the counters include the threads of expelled and retired workers that are not finished yet
+    const uint64_t active = m_threadPool->getActiveWorkersCount();
+    const uint64_t blocked = m_threadPool->getBlockedWorkersCount();
+    const uint64_t parked = m_threadPool->getParkedWorkersCount();
+    const uint64_t running = (blocked < active)? active - blocked : 0;
+    const uint64_t pending = m_cntJobSent - m_cntJobDone;
+
+    size_t newCount = count;
+    if(parked == 0 && 0 < pending)
+    {
+        m_idleSince = now;
+        //blocked workers are replaced, so that minCount workers can run
+        if(running < minCount) newCount = count + (minCount - running);
+        //the queues are half full, a new worker takes tasks of the following requests
+        else if(m_threadPoolInputSize <= 2 * pending) newCount = count + 1;
+        newCount = std::min(newCount, maxCount);
+    }
+    else if(parked == 0 || count <= minCount)
+    {
+        m_idleSince = now;
+    }
+    else if(idleInterval <= now - m_idleSince)
+    {
+        //one by one, as long as some workers have nothing to do
+        m_idleSince = now;
+        newCount = count - 1;
+    }
+    if(newCount == count) return;
+
+    resizeThreadPool(newCount);
+    LOG_PRINT_L1("Thread pool resized to " << m_threadPool->threadCount() << " workers, blocked " << blocked
+                 << ", pending jobs " << pending);
+}
+
+void TaskManager::resizeThreadPool(size_t threadCount)
+{
+    m_threadPool->resize(threadCount);
+    //the output queue is sized for maxThreadCount
+    m_threadPoolInputSize = m_threadPool->threadCount() * m_threadPool->queueSize();
+}
+
+void TaskManager::reconfigure(const ConfigOpts& copts)
+{
+    assert(io_thread);
+    copts.check_asserts();
+
+    auto restartRequired = [](bool changed, const char* name)
+    {
+        if(changed) LOG_PRINT_L0("Option '" << name << "' is changed, it takes effect on restart");
+    };
+    restartRequired(copts.http_address != m_copts.http_address, "http-address");
+    restartRequired(copts.coap_address != m_copts.coap_address, "coap-address");
+    restartRequired(copts.cryptonode_rpc_address != m_copts.cryptonode_rpc_address, "rpc-address");
+    restartRequired(copts.worker_queue_len != m_copts.worker_queue_len, "worker-queue-len");
+    restartRequired(copts.io_cpu != m_copts.io_cpu, "io-cpu");
+    restartRequired(copts.workers_cpus != m_copts.workers_cpus, "workers-cpus");
+    restartRequired(copts.graftlet_dirs != m_copts.graftlet_dirs, "dirs");
+    restartRequired(copts.common.data_dir != m_copts.common.data_dir, "data-dir");
+    restartRequired(copts.ipfilter.rules_filename != m_copts.ipfilter.rules_filename, "rules");
+    restartRequired(copts.context_snapshot.filename != m_copts.context_snapshot.filename, "file");
+
+    //workers read the options while they are changed; only numbers are changed, strings are not,
+    //and the intervals of periodic tasks that are already scheduled remain
+    m_copts.coap_block_size = copts.coap_block_size;
+    m_copts.coap_observe_interval_ms = copts.coap_observe_interval_ms;
+    m_copts.coap_observe_lifetime = copts.coap_observe_lifetime;
+    m_copts.http_connection_timeout = copts.http_connection_timeout;
+    m_copts.http_keep_alive_requests = copts.http_keep_alive_requests;
+    m_copts.upstream_request_timeout = copts.upstream_request_timeout;
+    m_copts.timer_poll_interval_ms = copts.timer_poll_interval_ms;
+    m_copts.log_trunc_to_size = copts.log_trunc_to_size;
+    m_copts.lru_timeout_ms = copts.lru_timeout_ms;
+    m_copts.gcm_cleanup_budget_us = copts.gcm_cleanup_budget_us;
+    m_copts.ipfilter.requests_per_sec = copts.ipfilter.requests_per_sec;
+    m_copts.ipfilter.window_size_sec = copts.ipfilter.window_size_sec;
+    m_copts.ipfilter.ban_ip_sec = copts.ipfilter.ban_ip_sec;
+    m_copts.ratelimit = copts.ratelimit;
+
+    if(copts.workers_expelling_interval_ms != m_copts.workers_expelling_interval_ms)
+    {
+        m_copts.workers_expelling_interval_ms = copts.workers_expelling_interval_ms;
+        m_threadPool->setExpellingIntervalMs(copts.workers_expelling_interval_ms);
+    }
+
+    if(m_threadPool->maxThreadCount() < size_t(copts.workers_max_count))
+    {
+        LOG_PRINT_L0("Workers max count " << copts.workers_max_count << " is limited by " << m_threadPool->maxThreadCount() << " until restart");
+    }
+    m_copts.workers_max_count = copts.workers_max_count;
+
+    if(copts.workers_count != m_copts.workers_count)
+    {
+        m_copts.workers_count = copts.workers_count;
+        size_t threadCount = workersCount(copts.workers_count);
+        if(m_threadPool->maxThreadCount() < threadCount)
+        {
+            LOG_PRINT_L0("Workers count " << threadCount << " is limited by " << m_threadPool->maxThreadCount() << " until restart");
+        }
+        //the pool grows from here again if workers_max_count allows
+        resizeThreadPool(threadCount);
+        LOG_PRINT_L0("Thread pool resized to " << m_threadPool->threadCount() << " workers");
+    }
+
+    m_upstreamManager->reconfigure();
+}
+
 void TaskManager::getThreadPoolInfo(uint64_t& activeWorkers, uint64_t& expelledWorkers) const
 {
     activeWorkers = m_threadPool->getActiveWorkersCount();
@@ -842,28 +1104,66 @@ void TaskManager::onClientDone(BaseTaskPtr bt)
     ++m_cntBaseTaskDone;
 }
 
-void TaskManager::initThreadPool(int threadCount, int workersQueueSize, int expellingIntervalMs)
+size_t TaskManager::workersCount(int threadCount)
 {
     if(threadCount <= 0) threadCount = std::thread::hardware_concurrency();
-    threadCount = std::max(size_t(2), next_pow2(threadCount));
+    return std::max(size_t(2), next_pow2(threadCount));
+}
+
+std::vector<int> TaskManager::workersCpus(const ConfigOpts& copts)
+{
+    tp::CpuSet cpus;
+    if(copts.workers_cpus.empty()) return cpus;
+    if(copts.workers_cpus == "node")
+    {
+        int node = (0 <= copts.io_cpu)? tp::cpuNode(copts.io_cpu) : -1;
+        if(node < 0)
+        {
+            LOG_ERROR("NUMA node of io-cpu " << copts.io_cpu << " is unknown, workers are not pinned");
+            return cpus;
+        }
+        cpus = tp::nodeCpus(node);
+        //the IO thread has its CPU for itself if there are others
+        if(1 < cpus.size()) cpus.erase(std::remove(cpus.begin(), cpus.end(), copts.io_cpu), cpus.end());
+    }
+    else if(!tp::parseCpuList(copts.workers_cpus, cpus))
+    {
+        LOG_ERROR("Invalid workers-cpus '" << copts.workers_cpus << "', workers are not pinned");
+        cpus.clear();
+        return cpus;
+    }
+    LOG_PRINT_L1("Workers are pinned to " << cpus.size() << " CPUs");
+    return cpus;
+}
+
+void TaskManager::initThreadPool(int threadCount, int workersQueueSize, int expellingIntervalMs, int workersMaxCount)
+{
+    threadCount = workersCount(threadCount);
     if(workersQueueSize <= 0) workersQueueSize = 32;
+    //the pool grows up to this number under load or by reconfiguration, the queues below are sized for it
+    const size_t maxThreadCount = std::max({size_t(threadCount), size_t(std::max(0, workersMaxCount)),
+                                            workersCount(4 * std::thread::hardware_concurrency())});
 
     tp::ThreadPoolOptions th_op;
     th_op.setThreadCount(threadCount);
+    th_op.setMaxThreadCount(maxThreadCount);
     th_op.setQueueSize(workersQueueSize);
     th_op.setExpellingIntervalMs(expellingIntervalMs);
+    th_op.setCpus(workersCpus(m_copts));
     graft::ThreadPoolX thread_pool(th_op);
 
-    const size_t maxinputSize = th_op.threadCount()*th_op.queueSize();
+    const size_t maxinputSize = th_op.maxThreadCount()*th_op.queueSize();
     size_t resQueueSize = next_pow2( maxinputSize );
     graft::TPResQueue resQueue(resQueueSize);
 
     m_threadPool = std::make_unique<ThreadPoolX>(std::move(thread_pool));
     m_resQueue = std::make_unique<TPResQueue>(std::move(resQueue));
-    m_threadPoolInputSize = maxinputSize;
-    m_promiseQueue = std::make_unique<PromiseQueue>( threadCount );
+    m_threadPoolInputSize = th_op.threadCount()*th_op.queueSize();
+    m_promiseQueue = std::make_unique<PromiseQueue>( maxThreadCount );
+    //asynchronous requests do not hold workers, so there can be more of them than workers
+    m_callbackQueue = std::make_unique<CallbackQueue>( next_pow2(16 * maxThreadCount) );
     //TODO: it is not clear how many items we need in PeriodicTaskQueue, maybe we should make it dynamically but this requires additional synchronization
-    m_periodicTaskQueue = std::make_unique<PeriodicTaskQueue>(2*threadCount);
+    m_periodicTaskQueue = std::make_unique<PeriodicTaskQueue>(2*maxThreadCount);
     m_upstreamManager = std::make_unique<UpstreamManager>(*this, [this](UpstreamSender& uss){ onUpstreamDone(uss); } );
 
     LOG_PRINT_L1("Thread pool created with " << threadCount
@@ -907,6 +1207,24 @@ void TaskManager::upstreamDoneProcess(UpstreamSender& uss)
 
     BaseTaskPtr bt = uss.getTask();
     UpstreamTask* ust = dynamic_cast<UpstreamTask*>(bt.get());
+    if(ust && ust->m_callback)
+    {
+        std::string err;
+        if(Status::Ok != uss.getStatus())
+        {
+            err = uss.getError();
+            if(err.empty()) err = "upstream error";
+        }
+        try
+        {
+            ust->m_callback(bt->getInput(), err);
+        }
+        catch(std::exception& ex)
+        {
+            LOG_ERROR("upstream callback failed: " << ex.what());
+        }
+        return;
+    }
     if(ust)
     {
         try
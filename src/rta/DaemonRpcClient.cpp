@@ -28,16 +28,38 @@
 //
 
 #include "rta/DaemonRpcClient.h"
+#include "lib/graft/handler_api.h"
+#include "lib/graft/task.h"
 #include <rpc/core_rpc_server_commands_defs.h>
 #include <storages/http_abstract_invoke.h>
 #include <cryptonote_basic/cryptonote_format_utils.h>
 
+#include <atomic>
 #include <exception>
+#include <map>
 
 using namespace std;
 
 namespace graft {
 
+struct DaemonRpcClient::AsyncState
+{
+    HandlerAPI *api = nullptr;
+    std::mutex mutex;
+    // request (path and body) -> callbacks waiting for its response
+    std::map<std::string, std::vector<RawCallback>> inflight;
+    std::atomic<size_t> coalesced {0};
+};
+
+template<typename Request, typename Response>
+bool DaemonRpcClient::invoke(const std::string &path, const Request &req, Response &res)
+{
+    // a worker waiting for the daemon is counted as blocked, so the pool grows meanwhile
+    ThreadPoolX::BlockingScope blocking;
+    std::lock_guard<std::mutex> lock(m_http_mutex);
+    return epee::net_utils::invoke_http_json(path, req, res, m_http_client, m_rpc_timeout);
+}
+
 DaemonRpcClient::DaemonRpcClient(const std::string &daemon_addr, const std::string &daemon_login, const std::string &daemon_pass)
     :  m_rpc_timeout(std::chrono::seconds(30))
 {
@@ -68,7 +90,7 @@ bool DaemonRpcClient::get_tx_from_pool(const string &hash_str, cryptonote::trans
     cryptonote::COMMAND_RPC_GET_TRANSACTION_POOL_HASHES::request req;
     cryptonote::COMMAND_RPC_GET_TRANSACTION_POOL_HASHES::response res;
 
-    bool r = epee::net_utils::invoke_http_json("/get_transaction_pool_hashes.bin", req, res, m_http_client, m_rpc_timeout);
+    bool r = invoke("/get_transaction_pool_hashes.bin", req, res);
     if (!r) {
         LOG_ERROR("/get_transaction_pool_hashes.bin error");
         return r;
@@ -97,7 +119,7 @@ bool DaemonRpcClient::get_tx(const string &hash_str, cryptonote::transaction &ou
     req_tx.txs_hashes.push_back(hash_str);
 
     req_tx.decode_as_json = false;
-    bool r = epee::net_utils::invoke_http_json("/gettransactions", req_tx, res_tx, m_http_client, m_rpc_timeout);
+    bool r = invoke("/gettransactions", req_tx, res_tx);
     if (!r && res_tx.status != CORE_RPC_STATUS_OK) {
         LOG_ERROR("/getransactions error");
         return false;
@@ -139,7 +161,7 @@ bool DaemonRpcClient::get_height(uint64_t &height)
     // get full tx
     cryptonote::COMMAND_RPC_GET_HEIGHT::request req;
     cryptonote::COMMAND_RPC_GET_HEIGHT::response res =  boost::value_initialized<cryptonote::COMMAND_RPC_GET_HEIGHT::response>();
-    bool r = epee::net_utils::invoke_http_json("/getheight", req, res, m_http_client, m_rpc_timeout);
+    bool r = invoke("/getheight", req, res);
     if (!r && res.status != CORE_RPC_STATUS_OK) {
         LOG_ERROR("/getheight error");
         return false;
@@ -157,7 +179,7 @@ bool DaemonRpcClient::get_block_hash(uint64_t height, string &hash)
     req_t.id = epee::serialization::storage_entry(0);
     req_t.method = "on_getblockhash";
     req_t.params.push_back(height);
-    bool ok = epee::net_utils::invoke_http_json("/json_rpc", req_t, resp_t, m_http_client, m_rpc_timeout);
+    bool ok = invoke("/json_rpc", req_t, resp_t);
     if (!ok) {
         LOG_ERROR("/on_getblockhash error");
         return false;
@@ -176,7 +198,7 @@ bool DaemonRpcClient::send_supernode_stakes(const char* network_address, const c
     req.method = "send_supernode_stakes";
     req.params.network_address = network_address;
     req.params.supernode_public_id = id;
-    bool r = epee::net_utils::invoke_http_json("/json_rpc/rta", req, res, m_http_client, m_rpc_timeout);
+    bool r = invoke("/json_rpc/rta", req, res);
     if (!r) {
         MWARNING("/json_rpc/rta/send_supernode_stakes error");
         return false;
@@ -195,7 +217,7 @@ bool DaemonRpcClient::send_supernode_blockchain_based_list(const char* network_a
     req.params.network_address = network_address;
     req.params.supernode_public_id = id;
     req.params.last_received_block_height = last_received_block_height;
-    bool r = epee::net_utils::invoke_http_json("/json_rpc/rta", req, res, m_http_client, m_rpc_timeout);
+    bool r = invoke("/json_rpc/rta", req, res);
     if (!r) {
         MWARNING("/json_rpc/rta/send_supernode_blockchain_based_list error");
         return false;
@@ -204,6 +226,146 @@ bool DaemonRpcClient::send_supernode_blockchain_based_list(const char* network_a
     return true;
 }
 
+void DaemonRpcClient::enableAsync(HandlerAPI *api)
+{
+    if (!api) {
+        m_async.reset();
+        return;
+    }
+    m_async = std::make_shared<AsyncState>();
+    m_async->api = api;
+}
+
+bool DaemonRpcClient::isAsync() const
+{
+    return m_async != nullptr;
+}
+
+size_t DaemonRpcClient::coalescedCount() const
+{
+    return m_async ? m_async->coalesced.load() : 0;
+}
+
+void DaemonRpcClient::invokeAsync(const string &path, const string &body, RawCallback callback)
+{
+    std::shared_ptr<AsyncState> state = m_async;
+    if (!state) {
+        LOG_ERROR("async calls are not enabled, " << path << " is not sent");
+        if (callback)
+            callback(false, string());
+        return;
+    }
+
+    string key = path + '\n' + body;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        std::vector<RawCallback> &waiters = state->inflight[key];
+        waiters.push_back(std::move(callback));
+        if (waiters.size() > 1) {
+            ++state->coalesced;
+            MDEBUG(path << " is in flight already, the call is coalesced");
+            return;
+        }
+    }
+
+    // the state is captured, not the client, the response can come when the client is gone
+    auto done = [state, key, path](Input &input, const string &err)
+    {
+        std::vector<RawCallback> waiters;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            auto it = state->inflight.find(key);
+            if (it != state->inflight.end()) {
+                waiters.swap(it->second);
+                state->inflight.erase(it);
+            }
+        }
+        bool ok = err.empty() && input.resp_code == 200;
+        if (!ok)
+            MWARNING(path << " error: " << (err.empty() ? "http code " + std::to_string(input.resp_code) : err));
+        for (RawCallback &cb : waiters) {
+            if (cb)
+                cb(ok, input.body);
+        }
+    };
+
+    Output output;
+    output.path = path;
+    output.body = body;
+    if (!state->api->sendUpstreamAsync(output, done)) {
+        Input input;
+        done(input, "upstream queue is full");
+    }
+}
+
+void DaemonRpcClient::get_height_async(HeightCallback callback)
+{
+    cryptonote::COMMAND_RPC_GET_HEIGHT::request req;
+    string body;
+    epee::serialization::store_t_to_json(req, body);
+    invokeAsync("/getheight", body, [callback](bool ok, const string &response)
+    {
+        cryptonote::COMMAND_RPC_GET_HEIGHT::response res = boost::value_initialized<cryptonote::COMMAND_RPC_GET_HEIGHT::response>();
+        ok = ok && epee::serialization::load_t_from_json(res, response) && res.status == CORE_RPC_STATUS_OK;
+        if (callback)
+            callback(ok, ok ? res.height : 0);
+    });
+}
+
+void DaemonRpcClient::get_block_hash_async(uint64_t height, BlockHashCallback callback)
+{
+    epee::json_rpc::request<cryptonote::COMMAND_RPC_GETBLOCKHASH::request> req = AUTO_VAL_INIT(req);
+    req.jsonrpc = "2.0";
+    req.id = epee::serialization::storage_entry(0);
+    req.method = "on_getblockhash";
+    req.params.push_back(height);
+    string body;
+    epee::serialization::store_t_to_json(req, body);
+    invokeAsync("/json_rpc", body, [callback](bool ok, const string &response)
+    {
+        epee::json_rpc::response<cryptonote::COMMAND_RPC_GETBLOCKHASH::response, std::string> res = AUTO_VAL_INIT(res);
+        ok = ok && epee::serialization::load_t_from_json(res, response);
+        if (callback)
+            callback(ok, ok ? res.result : string());
+    });
+}
+
+void DaemonRpcClient::send_supernode_stakes_async(const char* network_address, const char* id, ResultCallback callback)
+{
+    epee::json_rpc::request<cryptonote::COMMAND_RPC_SUPERNODE_GET_STAKES::request> req = AUTO_VAL_INIT(req);
+    req.jsonrpc = "2.0";
+    req.id = epee::serialization::storage_entry(0);
+    req.method = "send_supernode_stakes";
+    req.params.network_address = network_address;
+    req.params.supernode_public_id = id;
+    string body;
+    epee::serialization::store_t_to_json(req, body);
+    invokeAsync("/json_rpc/rta", body, [callback](bool ok, const string &)
+    {
+        if (callback)
+            callback(ok);
+    });
+}
+
+void DaemonRpcClient::send_supernode_blockchain_based_list_async(const char* network_address, const char* id, uint64_t last_received_block_height,
+                                                                 ResultCallback callback)
+{
+    epee::json_rpc::request<cryptonote::COMMAND_RPC_SUPERNODE_GET_BLOCKCHAIN_BASED_LIST::request> req = AUTO_VAL_INIT(req);
+    req.jsonrpc = "2.0";
+    req.id = epee::serialization::storage_entry(0);
+    req.method = "send_supernode_blockchain_based_list";
+    req.params.network_address = network_address;
+    req.params.supernode_public_id = id;
+    req.params.last_received_block_height = last_received_block_height;
+    string body;
+    epee::serialization::store_t_to_json(req, body);
+    invokeAsync("/json_rpc/rta", body, [callback](bool ok, const string &)
+    {
+        if (callback)
+            callback(ok);
+    });
+}
+
 bool DaemonRpcClient::init(const string &daemon_address, boost::optional<epee::net_utils::http::login> daemon_login)
 {
     return m_http_client.set_server(daemon_address, daemon_login);
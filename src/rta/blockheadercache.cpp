@@ -0,0 +1,99 @@
+#include "rta/blockheadercache.h"
+
+#include <misc_log_ex.h>
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "supernode.blockheadercache"
+
+namespace graft {
+
+#ifndef __cpp_inline_variables
+constexpr size_t BlockHeaderCache::DEFAULT_CAPACITY;
+constexpr int64_t BlockHeaderCache::DEFAULT_TTL_SECONDS;
+constexpr uint64_t BlockHeaderCache::CONFIRMATIONS;
+#endif
+
+BlockHeaderCache::BlockHeaderCache(size_t capacity, clock::duration ttl)
+    : m_capacity(capacity ? capacity : 1)
+    , m_ttl(ttl)
+{
+}
+
+bool BlockHeaderCache::fresh(clock::time_point updated, clock::time_point now) const
+{
+    return updated != clock::time_point() && now - updated < m_ttl;
+}
+
+void BlockHeaderCache::setHeight(uint64_t height)
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (height < m_height) {
+        MWARNING("blockchain height decreased from " << m_height << " to " << height);
+        // blocks above the new top are not in the chain anymore
+        m_hashes.erase(m_hashes.lower_bound(height), m_hashes.end());
+    }
+    m_height = height;
+    m_height_updated = clock::now();
+}
+
+void BlockHeaderCache::advanceHeight(uint64_t height)
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (height < m_height)
+        return;
+    m_height = height;
+    m_height_updated = clock::now();
+}
+
+bool BlockHeaderCache::getHeight(uint64_t &height) const
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (!fresh(m_height_updated, clock::now()))
+        return false;
+    height = m_height;
+    return true;
+}
+
+uint64_t BlockHeaderCache::lastHeight() const
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return m_height;
+}
+
+bool BlockHeaderCache::stale() const
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return !fresh(m_height_updated, clock::now());
+}
+
+void BlockHeaderCache::setBlockHash(uint64_t height, const std::string &hash)
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    Entry &entry = m_hashes[height];
+    entry.hash = hash;
+    entry.updated = clock::now();
+    // the lowest blocks are the least likely to be asked for again
+    while (m_hashes.size() > m_capacity)
+        m_hashes.erase(m_hashes.begin());
+}
+
+bool BlockHeaderCache::getBlockHash(uint64_t height, std::string &hash) const
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    auto it = m_hashes.find(height);
+    if (it == m_hashes.end())
+        return false;
+    bool confirmed = height + CONFIRMATIONS <= m_height;
+    if (!confirmed && !fresh(it->second.updated, clock::now()))
+        return false;
+    hash = it->second.hash;
+    return true;
+}
+
+size_t BlockHeaderCache::size() const
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return m_hashes.size();
+}
+
+} // namespace graft
@@ -8,9 +8,18 @@
 #include <boost/multiprecision/cpp_int.hpp>
 #include <boost/filesystem.hpp>
 
+#include <file_io_utils.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <future>
+#include <limits>
 
 #undef MONERO_DEFAULT_LOG_CATEGORY
 #define MONERO_DEFAULT_LOG_CATEGORY "supernode.fullsupernodelist"
@@ -64,64 +73,59 @@ namespace {
         return result;
     }
 
-}
+    // supernode list index file: header followed by entries
+    //   header: magic, version, entries count
+    //   entry:  id key (binary), stake amount, stake block height, stake unlock time, last update time,
+    //           wallet address, network address (both as 16-bit length followed by characters)
+    const uint32_t INDEX_MAGIC   = 0x49534e47; // "GNSI"
+    const uint32_t INDEX_VERSION = 1;
 
-namespace graft {
+    class IndexReader
+    {
+    public:
+        IndexReader(const char *data, size_t size) : m_ptr(data), m_end(data + size) { }
 
-namespace utils {
+        template <typename T>
+        bool read(T &value)
+        {
+            if (size_t(m_end - m_ptr) < sizeof(T))
+                return false;
+            std::memcpy(&value, m_ptr, sizeof(T));
+            m_ptr += sizeof(T);
+            return true;
+        }
 
-class ThreadPool
-{
-public:
-    ThreadPool(size_t threads = 0);
-    template <typename Callable>
-    void enqueue(Callable job);
-    void run();
-    std::future<void> runAsync();
+        bool read(std::string &value)
+        {
+            uint16_t size = 0;
+            if (!read(size) || size_t(m_end - m_ptr) < size)
+                return false;
+            value.assign(m_ptr, size);
+            m_ptr += size;
+            return true;
+        }
 
-private:
-    boost::asio::io_service m_ioservice;
-    boost::thread_group m_threadpool;
-    std::unique_ptr<boost::asio::io_service::work> m_work;
-};
+    private:
+        const char *m_ptr;
+        const char *m_end;
+    };
 
-ThreadPool::ThreadPool(size_t threads)
-{
-    m_work = std::unique_ptr<boost::asio::io_service::work>{new boost::asio::io_service::work(m_ioservice)};
-    if (threads == 0) {
-        threads = boost::thread::hardware_concurrency();
-    }
-    for (int i = 0; i < threads; i++) {
-        m_threadpool.create_thread(boost::bind(&boost::asio::io_service::run, &m_ioservice));
+    template <typename T>
+    void index_write(std::string &buf, const T &value)
+    {
+        buf.append(reinterpret_cast<const char*>(&value), sizeof(T));
     }
-}
 
+    void index_write(std::string &buf, const std::string &value)
+    {
+        uint16_t size = static_cast<uint16_t>(std::min<size_t>(value.size(), std::numeric_limits<uint16_t>::max()));
+        index_write(buf, size);
+        buf.append(value.data(), size);
+    }
 
-template<typename Callable>
-void ThreadPool::enqueue(Callable job)
-{
-    m_ioservice.dispatch(job);
-}
-
-void ThreadPool::run()
-{
-    m_work.reset();
-    m_work.reset();
-    while (!m_ioservice.stopped())
-        m_ioservice.poll();
-    m_threadpool.join_all();
-    m_ioservice.stop();
-}
-
-std::future<void> ThreadPool::runAsync()
-{
-    return std::async(std::launch::async, [&]() {
-       this->run();
-    });
 }
 
-} // namespace utils;
-
+namespace graft {
 
 #ifndef __cpp_inline_variables
 constexpr int32_t FullSupernodeList::TIERS, FullSupernodeList::ITEMS_PER_TIER, FullSupernodeList::AUTH_SAMPLE_SIZE;
@@ -132,13 +136,12 @@ FullSupernodeList::FullSupernodeList(const string &daemon_address, bool testnet)
     : m_daemon_address(daemon_address)
     , m_testnet(testnet)
     , m_rpc_client(daemon_address, "", "")
-    , m_tp(new utils::ThreadPool())
+    , m_block_headers(std::make_shared<BlockHeaderCache>())
     , m_blockchain_based_list_max_block_number()
     , m_stakes_max_block_number()
     , m_next_recv_stakes(boost::date_time::not_a_date_time)
     , m_next_recv_blockchain_based_list(boost::date_time::not_a_date_time)
 {
-    m_refresh_counter = 0;
 }
 
 FullSupernodeList::~FullSupernodeList()
@@ -447,32 +450,179 @@ vector<string> FullSupernodeList::items() const
 
 bool FullSupernodeList::getBlockHash(uint64_t height, string &hash)
 {
+    if (m_block_headers->getBlockHash(height, hash))
+        return true;
     bool result = m_rpc_client.get_block_hash(height, hash);
+    if (result)
+        m_block_headers->setBlockHash(height, hash);
     return result;
 }
 
-std::future<void> FullSupernodeList::refreshAsync()
+bool FullSupernodeList::index_entry::operator == (const index_entry &other) const
 {
-    m_refresh_counter = 0;
-    auto worker = [&](const std::string &address) {
-        SupernodePtr sn = this->get(address);
-        if (sn) {
-            sn->refresh();
+    return wallet_address == other.wallet_address
+            && network_address == other.network_address
+            && stake_amount == other.stake_amount
+            && stake_block_height == other.stake_block_height
+            && stake_unlock_time == other.stake_unlock_time
+            && last_update_time == other.last_update_time;
+}
+
+size_t FullSupernodeList::loadIndex(const string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        MDEBUG("no supernode list index at " << path);
+        return 0;
+    }
 
-            ++m_refresh_counter;
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return 0;
+    }
+
+    size_t size = static_cast<size_t>(st.st_size);
+    void *data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        LOG_ERROR("failed to map supernode list index " << path << ": " << std::strerror(errno));
+        return 0;
+    }
+
+    IndexReader reader(static_cast<const char*>(data), size);
+    uint32_t magic = 0, version = 0, count = 0;
+    if (!reader.read(magic) || !reader.read(version) || !reader.read(count)
+            || magic != INDEX_MAGIC || version != INDEX_VERSION) {
+        LOG_ERROR("invalid supernode list index " << path);
+        ::munmap(data, size);
+        return 0;
+    }
+
+    index_map index;
+    std::vector<SupernodePtr> loaded;
+    loaded.reserve(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        crypto::public_key id_key;
+        index_entry entry;
+        if (!reader.read(id_key) || !reader.read(entry.stake_amount) || !reader.read(entry.stake_block_height)
+                || !reader.read(entry.stake_unlock_time) || !reader.read(entry.last_update_time)
+                || !reader.read(entry.wallet_address) || !reader.read(entry.network_address)) {
+            LOG_ERROR("truncated supernode list index " << path << ", read " << i << " of " << count << " entries");
+            break;
         }
-    };
 
-    for (const auto &address : this->items()) {
-        m_tp->enqueue(boost::bind<void>(worker, address));
+        supernode_stake stake;
+        stake.amount = entry.stake_amount;
+        stake.block_height = entry.stake_block_height;
+        stake.unlock_time = entry.stake_unlock_time;
+        stake.supernode_public_id = epee::string_tools::pod_to_hex(id_key);
+        stake.supernode_public_address = entry.wallet_address;
+
+        SupernodePtr sn (Supernode::createFromStake(stake, m_daemon_address, m_testnet));
+        if (!sn)
+            continue;
+        sn->setLastUpdateTime(entry.last_update_time);
+        sn->setNetworkAddress(entry.network_address);
+
+        index.emplace(stake.supernode_public_id, std::move(entry));
+        loaded.push_back(sn);
     }
+    ::munmap(data, size);
 
-    return m_tp->runAsync();
+    size_t result = 0;
+    {
+        boost::unique_lock<boost::shared_mutex> writerLock(m_access);
+        for (const auto &sn : loaded) {
+            if (m_list.find(sn->idKeyAsString()) != m_list.end())
+                continue;
+            addImpl(sn);
+            ++result;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_index_access);
+        m_index.swap(index);
+    }
+
+    MINFO("loaded " << result << " supernodes from index " << path);
+    return result;
 }
 
-size_t FullSupernodeList::refreshedItems() const
+size_t FullSupernodeList::saveIndex(const string &path)
 {
-    return m_refresh_counter;
+    std::vector<SupernodePtr> supernodes;
+    {
+        boost::shared_lock<boost::shared_mutex> readerLock(m_access);
+        supernodes.reserve(m_list.size());
+        for (const auto &it : m_list)
+            supernodes.push_back(it.second);
+    }
+
+    std::lock_guard<std::mutex> lock(m_index_access);
+
+    index_map index;
+    index.reserve(supernodes.size());
+    size_t changed = 0;
+    for (const SupernodePtr &sn : supernodes) {
+        index_entry entry;
+        entry.wallet_address = sn->walletAddress();
+        entry.network_address = sn->networkAddress();
+        entry.stake_amount = sn->stakeAmount();
+        entry.stake_block_height = sn->stakeBlockHeight();
+        entry.stake_unlock_time = sn->stakeUnlockTime();
+        entry.last_update_time = sn->lastUpdateTime();
+
+        auto prev = m_index.find(sn->idKeyAsString());
+        if (prev == m_index.end() || !(prev->second == entry)) {
+            // only supernodes changed since the last save are refreshed
+            sn->refresh();
+            ++changed;
+        }
+        index.emplace(sn->idKeyAsString(), std::move(entry));
+    }
+
+    for (const auto &it : m_index) {
+        if (index.find(it.first) == index.end())
+            ++changed;
+    }
+
+    if (!changed)
+        return 0;
+
+    std::string buf;
+    index_write(buf, INDEX_MAGIC);
+    index_write(buf, INDEX_VERSION);
+    index_write(buf, static_cast<uint32_t>(index.size()));
+    for (const auto &it : index) {
+        crypto::public_key id_key;
+        epee::string_tools::hex_to_pod(it.first, id_key);
+        index_write(buf, id_key);
+        index_write(buf, it.second.stake_amount);
+        index_write(buf, it.second.stake_block_height);
+        index_write(buf, it.second.stake_unlock_time);
+        index_write(buf, it.second.last_update_time);
+        index_write(buf, it.second.wallet_address);
+        index_write(buf, it.second.network_address);
+    }
+
+    // write to temporary file and rename, so the index is never seen partially written
+    std::string tmp_path = path + ".tmp";
+    if (!epee::file_io_utils::save_string_to_file(tmp_path, buf)) {
+        LOG_ERROR("failed to write supernode list index " << tmp_path);
+        return changed;
+    }
+    boost::system::error_code ec;
+    fs::rename(tmp_path, path, ec);
+    if (ec) {
+        LOG_ERROR("failed to rename " << tmp_path << " to " << path << ": " << ec.message());
+        return changed;
+    }
+
+    m_index.swap(index);
+    MDEBUG("supernode list index saved, " << m_index.size() << " entries, " << changed << " changed");
+    return changed;
 }
 
 void FullSupernodeList::updateStakes(uint64_t block_number, const supernode_stake_array& stakes, const std::string& cryptonode_rpc_address, bool testnet)
@@ -553,22 +703,69 @@ bool check_timeout_expired(boost::posix_time::ptime& next_recv_time)
 
 void FullSupernodeList::synchronizeWithCryptonode(const char* network_address, const char* address)
 {
+    // the cryptonode answers with pushes to /dapi/v2.0, so the results are not awaited in async mode
     if (check_timeout_expired(m_next_recv_stakes))
     {
-        m_rpc_client.send_supernode_stakes(network_address, address);
+        if (m_rpc_client.isAsync())
+            m_rpc_client.send_supernode_stakes_async(network_address, address);
+        else
+            m_rpc_client.send_supernode_stakes(network_address, address);
     }
 
     if (check_timeout_expired(m_next_recv_blockchain_based_list))
     {
-        m_rpc_client.send_supernode_blockchain_based_list(network_address, address, m_blockchain_based_list_max_block_number);
+        if (m_rpc_client.isAsync())
+            m_rpc_client.send_supernode_blockchain_based_list_async(network_address, address, m_blockchain_based_list_max_block_number);
+        else
+            m_rpc_client.send_supernode_blockchain_based_list(network_address, address, m_blockchain_based_list_max_block_number);
+    }
+
+    // fallback for the height, normally it is updated by blockchain based list pushes
+    if (m_block_headers->stale())
+    {
+        if (m_rpc_client.isAsync())
+            pollBlockchainHeight();
+        else
+            getBlockchainHeight();
     }
 }
 
+void FullSupernodeList::enableAsyncRpc(HandlerAPI* api)
+{
+    m_rpc_client.enableAsync(api);
+}
+
 uint64_t FullSupernodeList::getBlockchainHeight() const
 {
     uint64_t result = 0;
+    if (m_block_headers->getHeight(result))
+        return result;
+
+    if (m_rpc_client.isAsync())
+    {
+        result = m_block_headers->lastHeight();
+        if (result != 0)
+        {
+            pollBlockchainHeight();
+            return result;
+        }
+    }
+
     bool ret = m_rpc_client.get_height(result);
-    return ret ? result : 0;
+    if (!ret)
+        return 0;
+    m_block_headers->setHeight(result);
+    return result;
+}
+
+void FullSupernodeList::pollBlockchainHeight() const
+{
+    std::shared_ptr<BlockHeaderCache> cache = m_block_headers;
+    m_rpc_client.get_height_async([cache](bool ok, uint64_t height)
+    {
+        if (ok)
+            cache->setHeight(height);
+    });
 }
 
 void FullSupernodeList::setBlockchainBasedList(uint64_t block_number, const blockchain_based_list_ptr& list)
@@ -599,6 +796,9 @@ void FullSupernodeList::setBlockchainBasedList(uint64_t block_number, const bloc
 
     m_blockchain_based_lists[block_number] = list;
 
+    // the list is built for the top block, while the height is the number of blocks as /getheight reports it
+    m_block_headers->advanceHeight(block_number + 1);
+
     if (block_number > m_blockchain_based_list_max_block_number)
         m_blockchain_based_list_max_block_number = block_number;
 
@@ -0,0 +1,168 @@
+#include "rta/signatureverifier.h"
+
+#include <misc_log_ex.h>
+#include <algorithm>
+#include <cstring>
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "supernode.signatureverifier"
+
+namespace graft {
+
+#ifndef __cpp_inline_variables
+constexpr size_t SignatureVerifier::DEFAULT_CACHE_SIZE;
+#endif
+
+struct SignatureVerifier::Job
+{
+    enum class State { Queued, Running, Done };
+
+    explicit Job(const Item &item) : item(item) { }
+
+    Item item;
+    State state = State::Queued;
+    bool result = false;
+};
+
+size_t SignatureVerifier::ItemHash::operator()(const Item &item) const
+{
+    // signature is random enough to be a hash itself, mix in the others to spread equal signatures
+    size_t h, k, s;
+    std::memcpy(&h, &item.hash, sizeof(h));
+    std::memcpy(&k, &item.pkey, sizeof(k));
+    std::memcpy(&s, &item.signature, sizeof(s));
+    return s ^ (h * 31) ^ (k * 131);
+}
+
+bool SignatureVerifier::ItemEqual::operator()(const Item &l, const Item &r) const
+{
+    return l.hash == r.hash && l.pkey == r.pkey && l.signature == r.signature;
+}
+
+SignatureVerifier::SignatureVerifier(size_t cacheSize)
+    : m_cacheSize(cacheSize)
+{
+}
+
+SignatureVerifier::~SignatureVerifier()
+{
+}
+
+SignatureVerifier &SignatureVerifier::instance()
+{
+    static SignatureVerifier verifier;
+    return verifier;
+}
+
+bool SignatureVerifier::verify(const crypto::hash &hash, const crypto::public_key &pkey, const crypto::signature &signature)
+{
+    return verifyBatch({Item{hash, pkey, signature}});
+}
+
+bool SignatureVerifier::verifyBatch(const std::vector<Item> &items, std::vector<bool> *results)
+{
+    if (results)
+        results->assign(items.size(), false);
+
+    std::vector<std::pair<size_t, JobPtr>> jobs;
+    bool all_ok = true;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        const Item &item = items[i];
+        auto cached = m_cache.find(item);
+        if (cached != m_cache.end())
+        {
+            ++m_cacheHits;
+            all_ok = all_ok && cached->second;
+            if (results)
+                (*results)[i] = cached->second;
+            continue;
+        }
+
+        ++m_cacheMisses;
+        auto inflight = m_inflight.find(item);
+        if (inflight != m_inflight.end())
+        {
+            jobs.emplace_back(i, inflight->second);
+            continue;
+        }
+
+        JobPtr job = std::make_shared<Job>(item);
+        m_inflight.emplace(item, job);
+        m_queue.push_back(job);
+        jobs.emplace_back(i, job);
+    }
+
+    if (!jobs.empty())
+        m_cv.notify_all();
+
+    auto hasQueued = [&jobs]()
+    {
+        return std::any_of(jobs.begin(), jobs.end(), [](const auto &j) { return j.second->state == Job::State::Queued; });
+    };
+    auto allDone = [&jobs]()
+    {
+        return std::all_of(jobs.begin(), jobs.end(), [](const auto &j) { return j.second->state == Job::State::Done; });
+    };
+
+    // help with the pending checks of everybody while some of ours are not taken yet,
+    // then wait for the ones taken by the other callers
+    while (!allDone())
+    {
+        if (hasQueued() && !m_queue.empty())
+        {
+            JobPtr job = m_queue.front();
+            m_queue.pop_front();
+            runJob(job, lock);
+            continue;
+        }
+        m_cv.wait(lock, [&]() { return allDone() || (hasQueued() && !m_queue.empty()); });
+    }
+
+    for (const auto &j : jobs)
+    {
+        all_ok = all_ok && j.second->result;
+        if (results)
+            (*results)[j.first] = j.second->result;
+    }
+    return all_ok;
+}
+
+void SignatureVerifier::clearCache()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_cache.clear();
+    m_cacheOrder.clear();
+}
+
+void SignatureVerifier::runJob(const JobPtr &job, std::unique_lock<std::mutex> &lock)
+{
+    job->state = Job::State::Running;
+    lock.unlock();
+    bool result = crypto::check_signature(job->item.hash, job->item.pkey, job->item.signature);
+    lock.lock();
+
+    job->result = result;
+    job->state = Job::State::Done;
+    m_inflight.erase(job->item);
+    cacheResult(job->item, result);
+    m_cv.notify_all();
+}
+
+void SignatureVerifier::cacheResult(const Item &item, bool result)
+{
+    if (m_cacheSize == 0)
+        return;
+    if (!m_cache.emplace(item, result).second)
+        return;
+    m_cacheOrder.push_back(item);
+    while (m_cacheOrder.size() > m_cacheSize)
+    {
+        m_cache.erase(m_cacheOrder.front());
+        m_cacheOrder.pop_front();
+    }
+}
+
+} // namespace graft
@@ -1,5 +1,6 @@
 #include "supernode/supernode.h"
 #include "rta/fullsupernodelist.h"
+#include "rta/signatureverifier.h"
 #include "supernode/requests/send_supernode_announce.h"
 
 #include <misc_log_ex.h>
@@ -161,7 +162,7 @@ bool Supernode::verifySignature(const string &msg, const crypto::public_key &pke
 
 bool Supernode::verifyHash(const crypto::hash &hash, const crypto::public_key &pkey, const crypto::signature &signature)
 {
-    return crypto::check_signature(hash, pkey, signature);
+    return SignatureVerifier::instance().verify(hash, pkey, signature);
 }
 
 bool Supernode::refresh()
@@ -5,6 +5,7 @@
 #include "rta/supernode.h"
 #include "supernode/requests/broadcast.h"
 #include "supernode/requests/sale_status.h"
+#include "supernode/requests/status_subscription.h"
 
 #include <string_tools.h> // epee
 #include <misc_log_ex.h>
@@ -122,7 +123,7 @@ void cleanPaySaleData(const std::string& payment_id, Context& ctx)
 {
     ctx.global.remove(payment_id + CONTEXT_KEY_PAY);
     ctx.global.remove(payment_id + CONTEXT_KEY_SALE);
-    ctx.global.remove(payment_id + CONTEXT_KEY_STATUS);
+    supernode::request::removePaymentStatus(ctx, payment_id);
 }
 
 void buildBroadcastSaleStatusOutput(const std::string& payment_id, int status, const SupernodePtr& supernode, Output& output)
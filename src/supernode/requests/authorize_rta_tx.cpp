@@ -32,7 +32,9 @@
 #include "supernode/requests/send_raw_tx.h"
 #include "supernode/requests/multicast.h"
 #include "supernode/requests/broadcast.h"
+#include "supernode/requests/status_subscription.h"
 #include "rta/supernode.h"
+#include "rta/signatureverifier.h"
 #include <misc_log_ex.h>
 #include <exception>
 
@@ -175,14 +177,21 @@ bool validateAuthResponse(const AuthorizeRtaTxResponse &arg, const SupernodePtr
         return false;
     }
 
-
+    crypto::public_key id_key;
+    if (!epee::string_tools::hex_to_pod(arg.signature.id_key, id_key)) {
+        LOG_ERROR("Error parsing id key: " << arg.signature.id_key);
+        return false;
+    }
 
     std::string msg = arg.tx_id + ":" + std::to_string(arg.result);
-    crypto::public_key id_key;
-    epee::string_tools::hex_to_pod(arg.signature.id_key, id_key);
-    bool r1 = supernode->verifySignature(msg, id_key, sign_result);
-    bool r2 = supernode->verifyHash(tx_id, id_key, sign_tx_id);
-    return r1 && r2;
+    crypto::hash msg_hash;
+    crypto::cn_fast_hash(msg.data(), msg.size(), msg_hash);
+
+    // both signatures checked as one batch; duplicates of the same response are served from the cache
+    return SignatureVerifier::instance().verifyBatch({
+        SignatureVerifier::Item{msg_hash, id_key, sign_result},
+        SignatureVerifier::Item{tx_id, id_key, sign_tx_id}
+    });
 }
 
 Status storeRequestAndReplyOk(const Router::vars_t& vars, const graft::Input& input,
@@ -480,7 +489,7 @@ Status handleRtaAuthResponseMulticast(const Router::vars_t& vars, const graft::I
 
             // tx rejected by auth sample, broadcast status;
             ctx.global[__FUNCTION__] = RtaAuthResponseHandlerState::StatusBroadcastReply;
-            ctx.global.set(payment_id + CONTEXT_KEY_STATUS, static_cast<int> (RTAStatus::Fail), RTA_TX_TTL);
+            setPaymentStatus(ctx, payment_id, static_cast<int>(RTAStatus::Fail), RTA_TX_TTL);
             buildBroadcastSaleStatusOutput(payment_id, static_cast<int> (RTAStatus::Fail), supernode, output);
             return Status::Forward;
         } else if (authResult.approved.size() >= rta_votes_to_approve) {
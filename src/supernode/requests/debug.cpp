@@ -58,6 +58,7 @@ Status getSupernodeList(const Router::vars_t& vars, const graft::Input& input,
     auto supernodes = fsl->items();
 
     SupernodeListJsonRpcResult resp;
+    std::vector<DbSupernode> items;
 
     resp.result.height = fsl->getBlockchainBasedListMaxBlockNumber();
     resp.result.has_blockchain_based_list = fsl->hasBlockchainBasedList(resp.result.height);
@@ -105,9 +106,10 @@ Status getSupernodeList(const Router::vars_t& vars, const graft::Input& input,
         dbSupernode.AuthSampleBlockchainBasedListTier = fsl->getSupernodeBlockchainBasedListTier(dbSupernode.PublicId, auth_sample_base_block_number);
         dbSupernode.IsAvailableForAuthSample = is_supernode_available(dbSupernode.PublicId);
 
-        resp.result.items.push_back(dbSupernode);
+        items.push_back(dbSupernode);
     }
-    output.load(resp);
+    //the list can be long, it is serialized while it is sent
+    output.loadStream(serializer::JSON<SupernodeListJsonRpcResult>::serialize(resp), "items", std::move(items));
     return Status::Ok;
 }
 
@@ -235,6 +237,8 @@ Status getBlockchainBasedListImpl(const Router::vars_t& vars, const graft::Input
         }
     }
 
+    std::vector<std::vector<DbgBlockchainBasedListEntry>> items;
+
     for (const FullSupernodeList::blockchain_based_list_tier& src_tier : bbl)
     {
         std::vector<DbgBlockchainBasedListEntry> dst_tier;
@@ -250,10 +254,23 @@ Status getBlockchainBasedListImpl(const Router::vars_t& vars, const graft::Input
             dst_tier.emplace_back(std::move(dst_sn));
         }
 
-        resp.result.Items.emplace_back(std::move(dst_tier));        
+        items.emplace_back(std::move(dst_tier));
     }
 
-    output.load(resp);
+    //a tier per chunk, the tiers are serialized while they are sent
+    auto serializeTier = [](const std::vector<DbgBlockchainBasedListEntry>& tier)
+    {
+        std::string s = "[";
+        for (const DbgBlockchainBasedListEntry& entry : tier)
+        {
+            if (s.size() != 1)
+                s += ',';
+            s += serializer::JSON<DbgBlockchainBasedListEntry>::serialize(entry);
+        }
+        return s + "]";
+    };
+
+    output.loadStream(serializer::JSON<DbgBlockchainBasedListResponseJsonRpcResult>::serialize(resp), "Items", std::move(items), serializeTier, 1);
 
     return Status::Ok;
 }
@@ -7,6 +7,7 @@
 #include "supernode/requests/broadcast.h"
 #include "supernode/requests/multicast.h"
 #include "supernode/requests/sale_status.h"
+#include "supernode/requests/status_subscription.h"
 #include "supernode/requests/authorize_rta_tx.h"
 #include "rta/supernode.h"
 #include "rta/fullsupernodelist.h"
@@ -85,7 +86,7 @@ Status processAuthorizationRequest(const std::string &tx_hex, const PayRequest &
     // TODO: what is the purpose of PayData?
     PayData data(pay_request.Address, pay_request.BlockNumber, pay_request.Amount);
     ctx.global[pay_request.PaymentID + CONTEXT_KEY_PAY] = data;
-    ctx.global[pay_request.PaymentID + CONTEXT_KEY_STATUS] = static_cast<int>(RTAStatus::InProgress);
+    setPaymentStatus(ctx, pay_request.PaymentID, static_cast<int>(RTAStatus::InProgress));
 
     output.load(cryptonode_req);
     output.path = "/json_rpc/rta";
@@ -237,7 +238,7 @@ Status handleTxAuthReply(const Router::vars_t& vars, const graft::Input& input,
     if (!input.get(resp) || resp.error.code != 0 || resp.result.status != STATUS_OK) {
 
         ctx.global.remove(payment_id + CONTEXT_KEY_PAY);
-        ctx.global.remove(payment_id + CONTEXT_KEY_STATUS);
+        removePaymentStatus(ctx, payment_id);
 
         error.error.code = ERROR_INTERNAL_ERROR;
         error.error.message = "Error multicasting request";
@@ -1,5 +1,6 @@
 
 #include "supernode/requests/reject_pay.h"
+#include "supernode/requests/status_subscription.h"
 #include "supernode/requestdefines.h"
 
 #undef MONERO_DEFAULT_LOG_CATEGORY
@@ -16,7 +17,7 @@ Status rejectPayHandler(const Router::vars_t& vars, const graft::Input& input,
     {
         return errorInvalidPaymentID(output);
     }
-    ctx.global[in.PaymentID + CONTEXT_KEY_STATUS] = static_cast<int>(RTAStatus::RejectedByWallet);
+    setPaymentStatus(ctx, in.PaymentID, static_cast<int>(RTAStatus::RejectedByWallet));
     // TODO: Reject Pay: Add broadcast and another business logic
     RejectPayResponse out;
     out.Result = STATUS_OK;
@@ -1,5 +1,6 @@
 
 #include "supernode/requests/reject_sale.h"
+#include "supernode/requests/status_subscription.h"
 #include "supernode/requestdefines.h"
 
 #undef MONERO_DEFAULT_LOG_CATEGORY
@@ -16,7 +17,7 @@ Status rejectSaleHandler(const Router::vars_t& vars, const graft::Input& input,
     {
         return errorInvalidPaymentID(output);
     }
-    ctx.global[in.PaymentID + CONTEXT_KEY_STATUS] = static_cast<int>(RTAStatus::RejectedByPOS);
+    setPaymentStatus(ctx, in.PaymentID, static_cast<int>(RTAStatus::RejectedByPOS));
     // TODO: Reject Sale: Add broadcast and another business logic
     RejectSaleResponse out;
     out.Result = STATUS_OK;
@@ -3,6 +3,7 @@
 #include "supernode/requests/multicast.h"
 #include "supernode/requests/broadcast.h"
 #include "supernode/requests/sale_status.h"
+#include "supernode/requests/status_subscription.h"
 
 #include "supernode/requestdefines.h"
 #include "lib/graft/requesttools.h"
@@ -92,7 +93,7 @@ Status handleClientSaleRequest(const Router::vars_t& vars, const graft::Input& i
     // 1. multicast sale over auth sample
     // 2. broadcast sale status
     ctx.global.set(payment_id + CONTEXT_KEY_SALE, data, SALE_TTL);
-    ctx.global.set(payment_id + CONTEXT_KEY_STATUS, static_cast<int>(RTAStatus::Waiting), SALE_TTL);
+    setPaymentStatus(ctx, payment_id, static_cast<int>(RTAStatus::Waiting), SALE_TTL);
 
     // store SaleData, payment_id and status in local context, so when we got reply from cryptonode, we just pass it to client
     ctx.local["sale_data"]  = data;
@@ -255,7 +256,7 @@ Status saleCryptonodeHandler(const Router::vars_t& vars, const graft::Input& inp
     if (!ctx.global.hasKey(payment_id + CONTEXT_KEY_SALE)) {
         // TODO: clenup after payment done;
         ctx.global[payment_id + CONTEXT_KEY_SALE] = sdm.sale_data;
-        ctx.global[payment_id + CONTEXT_KEY_STATUS] = sdm.status;
+        setPaymentStatus(ctx, payment_id, sdm.status);
         ctx.global[payment_id + CONTEXT_KEY_SALE_DETAILS] = sdm.details;
     } else {
         MWARNING("payment " << payment_id << " already known");
@@ -1,6 +1,7 @@
 
 #include "supernode/requests/sale_status.h"
 #include "supernode/requests/broadcast.h"
+#include "supernode/requests/status_subscription.h"
 #include "supernode/requestdefines.h"
 
 #include "string_tools.h"
@@ -86,7 +87,7 @@ Status updateSaleStatusHandler(const Router::vars_t& vars, const graft::Input& i
         // TODO: complete state chart for status transitions
         RTAStatus currentStatus = static_cast<RTAStatus>(ctx.global.get(ussb.PaymentID + CONTEXT_KEY_STATUS, int(RTAStatus::None)));
         if (!isFiniteRtaStatus(currentStatus)) {
-            ctx.global.set(ussb.PaymentID + CONTEXT_KEY_STATUS, ussb.Status, RTA_TX_TTL);
+            setPaymentStatus(ctx, ussb.PaymentID, ussb.Status, RTA_TX_TTL);
             MDEBUG("sale status updated for payment: " << ussb.PaymentID << " to: " << ussb.Status);
         } else {
             MWARNING("status already in finite state for payment: " << ussb.PaymentID
@@ -0,0 +1,71 @@
+
+#include "supernode/requests/status_subscription.h"
+#include "supernode/requestdefines.h"
+#include "lib/graft/connection.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "supernode.statussubscription"
+
+namespace graft::supernode::request {
+
+void setPaymentStatus(graft::Context& ctx, const std::string& payment_id, int status, std::chrono::seconds ttl)
+{
+    const std::string key = payment_id + CONTEXT_KEY_STATUS;
+    if (ttl.count())
+        ctx.global.set(key, status, ttl);
+    else
+        ctx.global[key] = status;
+
+    // the topic is the key of the status, clients do not poll sale_status/pay_status
+    if (!ctx.handlerAPI())
+        return;
+    PaymentStatus ps;
+    ps.PaymentID = payment_id;
+    ps.Status = status;
+    // nothing follows a final status, the topic ends with it
+    ctx.handlerAPI()->publish(key, serializer::JSON<PaymentStatus>::serialize(ps), isFiniteRtaStatus(static_cast<RTAStatus>(status)));
+}
+
+void removePaymentStatus(graft::Context& ctx, const std::string& payment_id)
+{
+    const std::string key = payment_id + CONTEXT_KEY_STATUS;
+    ctx.global.remove(key);
+    if (ctx.handlerAPI())
+        ctx.handlerAPI()->publish(key, std::string(), true);
+}
+
+// the reply is the current status, then the changes are pushed until a final status, the unsubscription
+// or the closing of the connection; the subscription is dropped when the status expires
+static bool subscribeHandler(const std::string& frame, graft::Context& ctx, std::string& topic, bool& unsubscribe, std::string& reply)
+{
+    PaymentStatusSubscription in;
+    serializer::JSON<PaymentStatusSubscription>::deserialize(frame, in);
+    if (in.PaymentID.empty())
+        return false;
+    topic = in.PaymentID + CONTEXT_KEY_STATUS;
+    if (in.Unsubscribe)
+    {
+        unsubscribe = true;
+        return true;
+    }
+    int status = ctx.global.get(topic, static_cast<int>(RTAStatus::None));
+    if (status == static_cast<int>(RTAStatus::None))
+    {
+        MDEBUG("subscription to unknown payment: " << in.PaymentID);
+        return false;
+    }
+    // a final status is replied only
+    unsubscribe = isFiniteRtaStatus(static_cast<RTAStatus>(status));
+    PaymentStatus out;
+    out.PaymentID = in.PaymentID;
+    out.Status = status;
+    reply = serializer::JSON<PaymentStatus>::serialize(out);
+    return true;
+}
+
+void registerPaymentStatusSubscription(graft::ConnectionManager& cm)
+{
+    cm.addWebSocketEndpoint("/dapi/v2.0/subscribe", subscribeHandler);
+}
+
+}
@@ -7,6 +7,8 @@
 #include "version.h"
 
 #include <boost/algorithm/string/trim.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
 #include <boost/program_options.hpp>
 #include <boost/property_tree/ini_parser.hpp>
 #include <regex>
@@ -28,7 +30,7 @@ namespace tools {
 
 namespace graft {
 
-static std::function<void (int sig_num)> int_handler, term_handler, hup_handler;
+static std::function<void (int sig_num)> int_handler, term_handler, hup_handler, usr1_handler;
 
 static void signal_handler_shutdown(int sig_num)
 {
@@ -40,11 +42,16 @@ static void signal_handler_terminate(int sig_num)
     if(term_handler) term_handler(sig_num);
 }
 
-static void signal_handler_restart(int sig_num)
+static void signal_handler_reconfigure(int sig_num)
 {
     if(hup_handler) hup_handler(sig_num);
 }
 
+static void signal_handler_restart(int sig_num)
+{
+    if(usr1_handler) usr1_handler(sig_num);
+}
+
 GraftServer::GraftServer()
 {
     m_connectionBase = std::make_unique<ConnectionBase>();
@@ -160,14 +167,22 @@ bool GraftServer::init(int argc, const char** argv, ConfigOpts& configOpts)
     bool res = initConfigOption(argc, argv, configOpts);
     if(!res) return false;
 
+    //the options of derived servers are not reloaded, they take effect on restart
+    m_connectionBase->setConfigLoader([this, argc, argv](ConfigOpts& copts)
+    {
+        return GraftServer::initConfigOption(argc, argv, copts);
+    });
     m_connectionBase->loadBlacklist(configOpts);
+    m_connectionBase->loadRouteLimits(configOpts);
     m_connectionBase->createLooper(configOpts);
     initGraftlets();
     addGlobalCtxCleaner();
+    addBlacklistReloader();
 
     initGlobalContext();
 
     initMisc(configOpts);
+    initContextSnapshot();
 
     m_connectionBase->initConnectionManagers();
     addGenericCallbackRoute();
@@ -205,8 +220,13 @@ GraftServer::RunRes GraftServer::run()
         stop(true);
         res = RunRes::SignalTerminate;
     };
+    //reconfigure in place
+    hup_handler = [this](int sig_num)
+    {
+        m_connectionBase->requestReconfigure();
+    };
     //restart
-    hup_handler = [this, &res](int sig_num)
+    usr1_handler = [this, &res](int sig_num)
     {
         stop();
         res = RunRes::SignalRestart;
@@ -214,6 +234,8 @@ GraftServer::RunRes GraftServer::run()
 
     serve();
 
+    saveContextSnapshot();
+
     switch(res)
     {
     case RunRes::SignalShutdown: LOG_PRINT_L0("Server shutdown"); break;
@@ -243,8 +265,11 @@ void GraftServer::initSignals()
     sa.sa_handler = signal_handler_terminate;
     ::sigaction(SIGTERM, &sa, NULL);
 
-    sa.sa_handler = signal_handler_restart;
+    sa.sa_handler = signal_handler_reconfigure;
     ::sigaction(SIGHUP, &sa, NULL);
+
+    sa.sa_handler = signal_handler_restart;
+    ::sigaction(SIGUSR1, &sa, NULL);
 }
 
 namespace details
@@ -417,7 +442,9 @@ void usage(const boost::program_options::options_description& desc)
     std::string sigmsg = "Supported signals:\n"
             "  INT  - Shutdown server gracefully closing all pending tasks.\n"
             "  TEMP - Shutdown server even if there are pending tasks.\n"
-            "  HUP  - Restart server with updated configuration parameters.\n";
+            "  HUP  - Apply updated configuration parameters without restart: workers count, timeouts,\n"
+            "         upstreams, logging, ipfilter and ratelimit sections.\n"
+            "  USR1 - Restart server with updated configuration parameters.\n";
 
     std::cout << desc << "\n" << sigmsg << "\n";
 }
@@ -525,13 +552,21 @@ bool GraftServer::initConfigOption(int argc, const char** argv, ConfigOpts& conf
     const boost::property_tree::ptree& server_conf = config.get_child("server");
     configOpts.http_address = server_conf.get<std::string>("http-address");
     configOpts.coap_address = server_conf.get<std::string>("coap-address");
+    configOpts.coap_block_size = server_conf.get<int>("coap-block-size", 1024);
+    configOpts.coap_observe_interval_ms = server_conf.get<int>("coap-observe-interval-ms", 1000);
+    configOpts.coap_observe_lifetime = server_conf.get<double>("coap-observe-lifetime", 300);
     configOpts.timer_poll_interval_ms = server_conf.get<int>("timer-poll-interval-ms");
     configOpts.http_connection_timeout = server_conf.get<double>("http-connection-timeout");
+    configOpts.http_keep_alive_requests = server_conf.get<int>("http-keep-alive-requests", 0);
     configOpts.workers_count = server_conf.get<int>("workers-count");
+    configOpts.workers_max_count = server_conf.get<int>("workers-max-count", 0);
     configOpts.worker_queue_len = server_conf.get<int>("worker-queue-len");
     configOpts.workers_expelling_interval_ms = server_conf.get<int>("workers-expelling-interval-ms", 1000);
+    configOpts.io_cpu = server_conf.get<int>("io-cpu", -1);
+    configOpts.workers_cpus = server_conf.get<std::string>("workers-cpus", "");
     configOpts.upstream_request_timeout = server_conf.get<double>("upstream-request-timeout");
     configOpts.lru_timeout_ms = server_conf.get<int>("lru-timeout-ms");
+    configOpts.gcm_cleanup_budget_us = server_conf.get<int>("gcm-cleanup-budget-us", 2000);
     configOpts.common.data_dir = server_conf.get<std::string>("data-dir");
     configOpts.common.wallet_public_address = server_conf.get<std::string>("wallet-public-address", "");
     configOpts.common.testnet = server_conf.get<bool>("testnet", false);
@@ -559,6 +594,37 @@ bool GraftServer::initConfigOption(int argc, const char** argv, ConfigOpts& conf
                 ipfilter.rules_filename = path.string();
             }
         }
+        ipfilter.rules_reload_interval_ms = ipfilter_conf.get<int>("rules-reload-interval-ms", 5000);
+    }
+
+    //ratelimit
+    auto opt_ratelimit = config.get_child_optional("ratelimit");
+    if(opt_ratelimit)
+    {
+        RateLimitOpts& ratelimit = configOpts.ratelimit;
+        const auto ratelimit_conf = opt_ratelimit.get();
+        auto get_budget = [&ratelimit_conf](const std::string& group, RateLimitOpts::Budget& budget)
+        {
+            budget.requests_per_sec = ratelimit_conf.get<double>(group + "-requests-per-sec", 0);
+            budget.burst = ratelimit_conf.get<int>(group + "-burst", 0);
+        };
+        get_budget("dapi", ratelimit.dapi);
+        get_budget("walletapi", ratelimit.walletapi);
+        get_budget("debug", ratelimit.debug);
+    }
+
+    //context snapshot
+    auto opt_snapshot = config.get_child_optional("context-snapshot");
+    if(opt_snapshot)
+    {
+        ContextSnapshotOpts& snapshot = configOpts.context_snapshot;
+        const auto snapshot_conf = opt_snapshot.get();
+        snapshot.filename = details::trim_comments(snapshot_conf.get<std::string>("file", ""));
+        snapshot.interval_ms = snapshot_conf.get<int>("interval-ms", 0);
+        std::string namespaces = details::trim_comments(snapshot_conf.get<std::string>("namespaces", ""));
+        snapshot.namespaces.clear();
+        boost::split(snapshot.namespaces, namespaces, boost::is_any_of(", "), boost::token_compress_on);
+        snapshot.namespaces.erase(std::remove(snapshot.namespaces.begin(), snapshot.namespaces.end(), std::string()), snapshot.namespaces.end());
     }
 
     //configOpts.graftlet_dirs
@@ -587,6 +653,15 @@ bool GraftServer::initConfigOption(int argc, const char** argv, ConfigOpts& conf
 
     prepareDataDir(configOpts);
 
+    if(!configOpts.context_snapshot.filename.empty())
+    {
+        fs::path path = configOpts.context_snapshot.filename;
+        if(path.is_relative())
+        {
+            configOpts.context_snapshot.filename = fs::complete(path, configOpts.common.data_dir).string();
+        }
+    }
+
     return true;
 }
 
@@ -605,11 +680,51 @@ void GraftServer::initRouters()
 
 }
 
+void GraftServer::initContextSnapshot()
+{
+    const ContextSnapshotOpts& opts = getCopts().context_snapshot;
+    if(opts.filename.empty() || m_contextSnapshot.empty()) return;
+
+    m_contextSnapshot.selectNamespaces(opts.namespaces);
+    m_contextSnapshot.load(getLooper().getGcm(), opts.filename);
+
+    if(opts.interval_ms <= 0) return;
+    //runs in the thread pool, buckets are visited one by one so request processing is not stopped
+    auto saver = [this](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        m_contextSnapshot.save(ctx.global.getGcm(), getCopts().context_snapshot.filename);
+        return graft::Status::Ok;
+    };
+    m_connectionBase->getLooper().addPeriodicTask(
+                graft::Router::Handler3(nullptr, saver, nullptr),
+                std::chrono::milliseconds(opts.interval_ms)
+                );
+}
+
+void GraftServer::saveContextSnapshot()
+{
+    const ContextSnapshotOpts& opts = getCopts().context_snapshot;
+    if(opts.filename.empty() || m_contextSnapshot.empty()) return;
+    m_contextSnapshot.save(getLooper().getGcm(), opts.filename);
+}
+
 void GraftServer::addGlobalCtxCleaner()
 {
-    auto cleaner = [](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    std::chrono::steady_clock::duration budget = m_connectionBase->getCopts().gcm_cleanup_budget();
+    SysInfoCounter& sysInfo = getSysInfoCounter();
+    auto cleaner = [budget, &sysInfo](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
     {
-        graft::Context::GlobalFriend::cleanup(ctx.global);
+        //the pass is limited in time, the rest is cleaned by the next passes
+        GlobalContextMap::CleanupStats stats = graft::Context::GlobalFriend::cleanup(ctx.global, budget);
+        namespace ch = std::chrono;
+        sysInfo.count_gcm_cleanup(stats.expired,
+                                  ch::duration_cast<ch::microseconds>(stats.maxPause).count(),
+                                  ch::duration_cast<ch::microseconds>(stats.duration).count());
+        if(stats.expired)
+        {
+            MDEBUG("global context cleanup: " << stats.expired << " expired, " << stats.buckets << " buckets in "
+                   << ch::duration_cast<ch::microseconds>(stats.duration).count() << " us");
+        }
         return graft::Status::Ok;
     };
     m_connectionBase->getLooper().addPeriodicTask(
@@ -618,4 +733,21 @@ void GraftServer::addGlobalCtxCleaner()
                 );
 }
 
+void GraftServer::addBlacklistReloader()
+{
+    const IPFilterOpts& ipfilter = getCopts().ipfilter;
+    if(ipfilter.rules_filename.empty() || ipfilter.rules_reload_interval_ms <= 0) return;
+
+    //the worker parses the file, so the IO thread is not paused
+    auto reloader = [this](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        m_connectionBase->reloadBlacklistRules(getCopts());
+        return graft::Status::Ok;
+    };
+    m_connectionBase->getLooper().addPeriodicTask(
+                graft::Router::Handler3(nullptr, reloader, nullptr),
+                std::chrono::milliseconds(ipfilter.rules_reload_interval_ms)
+                );
+}
+
 }//namespace graft
@@ -5,6 +5,7 @@
 #include "lib/graft/sys_info.h"
 #include "supernode/requestdefines.h"
 #include "supernode/requests/send_supernode_announce.h"
+#include "supernode/requests/status_subscription.h"
 #include "rta/supernode.h"
 #include "rta/fullsupernodelist.h"
 #include "lib/graft/graft_exception.h"
@@ -20,6 +21,8 @@ namespace consts {
    static const char * STAKE_WALLET_PATH = "stake-wallet";
    static const char * WATCHONLY_WALLET_PATH = "stake-wallet";
    static const size_t DEFAULT_STAKE_WALLET_REFRESH_INTERFAL_MS = 5 * 1000;
+   static const char * SUPERNODE_LIST_INDEX_FILENAME = "supernode_list.idx";
+   static const size_t SUPERNODE_LIST_INDEX_SAVE_INTERVAL_MS = 60 * 1000;
 }
 
 namespace graft
@@ -75,6 +78,7 @@ void Supernode::prepareSupernode()
     }
 
     m_configEx.watchonly_wallets_path = watchonly_wallets_path.string();
+    m_configEx.supernode_list_index_path = (data_path / consts::SUPERNODE_LIST_INDEX_FILENAME).string();
 
     MINFO("data path: " << data_path.string());
     MINFO("stake wallet path: " << stake_wallet_path.string());
@@ -102,9 +106,13 @@ void Supernode::prepareSupernode()
     graft::FullSupernodeListPtr fsl = boost::make_shared<graft::FullSupernodeList>(
                 m_configEx.cryptonode_rpc_address, m_configEx.common.testnet);
     fsl->add(supernode);
+    // known supernodes from the previous run, refreshed by stakes and announces later
+    fsl->loadIndex(m_configEx.supernode_list_index_path);
 
     //put fsl into global context
     Context ctx(getLooper().getGcm());
+    // periodic synchronization with cryptonode should not hold workers for the round trips
+    fsl->enableAsyncRpc(ctx.handlerAPI());
     ctx.global[CONTEXT_KEY_SUPERNODE] = supernode;
     ctx.global[CONTEXT_KEY_FULLSUPERNODELIST] = fsl;
     ctx.global["testnet"] = m_configEx.common.testnet;
@@ -119,11 +127,51 @@ void Supernode::initMisc(ConfigOpts& configOpts)
 
     prepareSupernode();
     startSupernodePeriodicTasks();
+    registerContextSnapshotNamespaces();
+}
 
-    std::chrono::milliseconds duration( 5000 );
-    auto deferred_task = [duration, this] () { std::this_thread::sleep_for(duration); this->loadStakeWallets(); };
-    std::thread t(deferred_task);
-    t.detach();
+void Supernode::registerContextSnapshotNamespaces()
+{
+    ContextSnapshot& snapshot = getContextSnapshot();
+    snapshot.addNamespace<int>(CONTEXT_KEY_STATUS);
+    snapshot.addNamespace<std::string>(CONTEXT_KEY_SALE_DETAILS);
+    snapshot.addNamespace<std::string>(CONTEXT_KEY_PAYMENT_ID_BY_TXID);
+    snapshot.addNamespace<uint64_t>(CONTEXT_KEY_AMOUNT_BY_TX_ID);
+
+    // SaleData and PayData have the same layout
+    auto encode = [](const auto* data, std::string& out)->bool
+    {
+        if (!data) return false;
+        ContextSnapshot::write(out, data->Address);
+        ContextSnapshot::write(out, data->BlockNumber);
+        ContextSnapshot::write(out, data->Amount);
+        return true;
+    };
+    auto decode = [](const char*& p, const char* end, auto& data)->bool
+    {
+        return ContextSnapshot::read(p, end, data.Address)
+                && ContextSnapshot::read(p, end, data.BlockNumber)
+                && ContextSnapshot::read(p, end, data.Amount);
+    };
+
+    snapshot.addNamespace(CONTEXT_KEY_SALE,
+                          [encode](const std::any& value, std::string& out) { return encode(std::any_cast<SaleData>(&value), out); },
+                          [decode](const char*& p, const char* end, std::any& value)
+                          {
+                              SaleData data;
+                              if (!decode(p, end, data)) return false;
+                              value = std::move(data);
+                              return true;
+                          });
+    snapshot.addNamespace(CONTEXT_KEY_PAY,
+                          [encode](const std::any& value, std::string& out) { return encode(std::any_cast<PayData>(&value), out); },
+                          [decode](const char*& p, const char* end, std::any& value)
+                          {
+                              PayData data("", 0, 0);
+                              if (!decode(p, end, data)) return false;
+                              value = std::move(data);
+                              return true;
+                          });
 }
 
 void Supernode::startSupernodePeriodicTasks()
@@ -165,6 +213,23 @@ void Supernode::startSupernodePeriodicTasks()
                 graft::Router::Handler3(nullptr, handler, nullptr),
                 std::chrono::milliseconds(CRYPTONODE_SYNCHRONIZATION_PERIOD_MS)
                 );
+
+    // persist supernode list index, only changed entries are refreshed
+
+    std::string index_path = m_configEx.supernode_list_index_path;
+    auto index_handler = [index_path](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        if (FullSupernodeListPtr fsl = ctx.global.get(CONTEXT_KEY_FULLSUPERNODELIST, FullSupernodeListPtr()))
+        {
+            fsl->saveIndex(index_path);
+        }
+        return graft::Status::Ok;
+    };
+
+    getConnectionBase().getLooper().addPeriodicTask(
+                graft::Router::Handler3(nullptr, index_handler, nullptr),
+                std::chrono::milliseconds(consts::SUPERNODE_LIST_INDEX_SAVE_INTERVAL_MS)
+                );
 }
 
 void Supernode::setHttpRouters(ConnectionManager& httpcm)
@@ -185,6 +250,7 @@ void Supernode::setHttpRouters(ConnectionManager& httpcm)
     // Router http_router;
     registerRTARequests(dapi_router);
     httpcm.addRouter(dapi_router);
+    registerPaymentStatusSubscription(httpcm);
 
     Router walletapi_router("/walletapi");
     registerWalletApiRequests(walletapi_router);
@@ -205,38 +271,17 @@ void Supernode::setHttpRouters(ConnectionManager& httpcm)
 
 void Supernode::setCoapRouters(ConnectionManager& coapcm)
 {
-    Router coap_router("/coap");
-    auto coap_test = [](const Router::vars_t&, const Input&, Context&, Output&)->Status
-    {
-        std::cout << "blah" << std::endl;
-        return Status::Ok;
-    };
-    Router::Handler3 h3_test(coap_test, nullptr, nullptr);
-
-    coap_router.addRoute("/test", METHOD_GET, h3_test);
-    coap_router.addRoute("/test1", METHOD_GET, h3_test);
-    coap_router.addRoute("/test2", METHOD_GET, h3_test);
-
-    coapcm.addRouter(coap_router);
-}
-
-void Supernode::loadStakeWallets()
-{
-
-    Context ctx(getLooper().getGcm());
-    std::string watchonly_wallets_path = ctx.global.get("watchonly_wallets_path", std::string());
-
-    FullSupernodeListPtr fsl = ctx.global.get(CONTEXT_KEY_FULLSUPERNODELIST, FullSupernodeListPtr());
-    size_t found_wallets = 0;
-    MDEBUG("loading supernodes wallets from: " << watchonly_wallets_path);
-    size_t loaded_wallets = fsl->loadFromDirThreaded(watchonly_wallets_path, found_wallets);
-
-    if (found_wallets != loaded_wallets) {
-        LOG_ERROR("found wallets: " << found_wallets << ", loaded wallets: " << loaded_wallets);
-    }
-    LOG_PRINT_L0("supernode list loaded");
+    using namespace graft::supernode::request;
 
-    // add our supernode as well, it wont be added from announce;
+    //the same DAPI as over HTTP, e.g. POS terminals observe sale_status instead of polling it
+    Router dapi_router("/dapi/v2.0");
+    registerRTARequests(dapi_router);
+    coapcm.addRouter(dapi_router);
+    //only the status queries are safe to repeat, other requests are answered once
+    assert(dynamic_cast<CoapConnectionManager*>(&coapcm));
+    CoapConnectionManager& coap = static_cast<CoapConnectionManager&>(coapcm);
+    coap.addObservable("/dapi/v2.0/sale_status");
+    coap.addObservable("/dapi/v2.0/pay_status");
 }
 
 void Supernode::initRouters()
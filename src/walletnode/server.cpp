@@ -7,6 +7,8 @@
 #include <boost/property_tree/ini_parser.hpp>
 
 const int WALLET_DISK_CACHES_UPDATE_TIME_MS = 10 * 60 * 1000; //TODO: move to config
+const int WALLET_SCAN_INTERVAL_MS = 5 * 1000; //TODO: move to config
+const int WALLET_WEBHOOK_RETRY_INTERVAL_MS = 100; //TODO: move to config
 
 namespace po = boost::program_options;
 
@@ -61,7 +63,12 @@ bool WalletServer::run(int argc, const char** argv)
 
         argc = 1;
 
-        if(GraftServer::run() != RunRes::SignalRestart)
+        RunRes res = GraftServer::run();
+
+        //the caches of the sessions are stored while the looper of this run is alive
+        m_walletManager.reset();
+
+        if(res != RunRes::SignalRestart)
             break;
     }
 
@@ -104,6 +111,24 @@ void WalletServer::startPeriodicTasks()
  
     getLooper().addPeriodicTask(graft::Router::Handler3(nullptr, flush_caches_handler, nullptr),
         std::chrono::milliseconds(WALLET_DISK_CACHES_UPDATE_TIME_MS), std::chrono::milliseconds(1));
+
+    Router::Handler scan_wallets_handler = [this](const graft::Router::vars_t&, const graft::Input& input, graft::Context& ctx, graft::Output& output) {
+        assert(&*m_walletManager);
+        return m_walletManager->scanWallets(input, ctx, output);
+    };
+
+    getLooper().addPeriodicTask(graft::Router::Handler3(nullptr, scan_wallets_handler, nullptr),
+        std::chrono::milliseconds(WALLET_SCAN_INTERVAL_MS));
+
+    Router::Handler webhooks_handler = [this](const graft::Router::vars_t&, const graft::Input&, graft::Context&, graft::Output&) {
+        assert(&*m_walletManager);
+        m_walletManager->sendWebHooks();
+        return Status::Ok;
+    };
+
+    //pre_action, it is run by IO thread
+    getLooper().addPeriodicTask(graft::Router::Handler3(webhooks_handler, nullptr, nullptr),
+        std::chrono::milliseconds(WALLET_WEBHOOK_RETRY_INTERVAL_MS));
 }
 
 }//namespace walletnode
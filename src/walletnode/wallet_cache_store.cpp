@@ -0,0 +1,211 @@
+#include "walletnode/wallet_cache_store.h"
+
+#include "misc_log_ex.h"
+
+#include <boost/filesystem.hpp>
+
+using namespace graft::walletnode;
+
+namespace fs = boost::filesystem;
+
+WalletCacheStore::WalletCacheStore(const std::string& dir)
+  : m_dir(dir)
+  , m_thread([this]() { run(); })
+{
+}
+
+WalletCacheStore::~WalletCacheStore()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_stop = true;
+  }
+
+  m_cond.notify_one();
+  m_thread.join();
+}
+
+void WalletCacheStore::store(const std::string& file_name, Writer writer, Done done)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_pending.find(file_name);
+
+    if (it == m_pending.end())
+    {
+      it = m_pending.emplace(file_name, Job{std::move(writer), {}}).first;
+      m_queue.push_back(file_name);
+    }
+    else
+    {
+      //the pending write takes the state of the wallet as it is when the write starts
+      LOG_PRINT_L2("Write of " << file_name << " is coalesced");
+    }
+
+    if (done)
+      it->second.done.push_back(std::move(done));
+  }
+
+  m_cond.notify_one();
+}
+
+void WalletCacheStore::touch(const std::string& file_name)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  m_index[file_name] = clock::now();
+}
+
+void WalletCacheStore::removeExpired(std::chrono::seconds age)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_removals.push_back(age);
+  }
+
+  m_cond.notify_one();
+}
+
+size_t WalletCacheStore::size() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  return m_index.size();
+}
+
+void WalletCacheStore::run()
+{
+  buildIndex();
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  for (;;)
+  {
+    m_cond.wait(lock, [this]() { return m_stop || !m_queue.empty() || !m_removals.empty(); });
+
+    if (!m_queue.empty())
+    {
+      std::string file_name = std::move(m_queue.front());
+      m_queue.pop_front();
+
+      auto it = m_pending.find(file_name);
+      Job job = std::move(it->second);
+      m_pending.erase(it);
+
+      lock.unlock();
+      write(file_name, job);
+      lock.lock();
+      continue;
+    }
+
+    if (!m_removals.empty())
+    {
+      std::chrono::seconds age = m_removals.front();
+      m_removals.pop_front();
+
+      lock.unlock();
+      remove(age);
+      lock.lock();
+      continue;
+    }
+
+    //the writes are done before stop
+    if (m_stop)
+      break;
+  }
+}
+
+void WalletCacheStore::buildIndex()
+{
+  std::map<std::string, clock::time_point> index;
+  boost::system::error_code ec;
+
+  for (fs::recursive_directory_iterator it(m_dir, ec), end; !ec && it != end; it.increment(ec))
+  {
+    if (!fs::is_regular_file(it->status()) || it->path().extension() != ".cache")
+      continue;
+
+    std::time_t modification_time = fs::last_write_time(it->path(), ec);
+
+    if (ec)
+    {
+      ec.clear();
+      continue;
+    }
+
+    index.emplace(it->path().string(), clock::from_time_t(modification_time));
+  }
+
+  LOG_PRINT_L1("Wallet cache index has " << index.size() << " files");
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  //the files used meanwhile are kept with their access times
+  for (auto& entry : m_index)
+    index[entry.first] = entry.second;
+
+  m_index.swap(index);
+}
+
+void WalletCacheStore::write(const std::string& file_name, Job& job)
+{
+  std::string tmp_file_name = file_name + ".tmp";
+
+  try
+  {
+    fs::create_directories(fs::path(file_name).parent_path());
+
+    if (job.writer(tmp_file_name))
+    {
+      //the file is never seen partially written, a load gets either the previous cache or the new one
+      fs::rename(tmp_file_name, file_name);
+
+      touch(file_name);
+    }
+  }
+  catch (std::exception& e)
+  {
+    LOG_ERROR("Failed to write wallet cache " << file_name << ": " << e.what());
+
+    boost::system::error_code ec;
+    fs::remove(tmp_file_name, ec);
+  }
+
+  for (Done& done : job.done)
+  {
+    done();
+  }
+}
+
+void WalletCacheStore::remove(std::chrono::seconds age)
+{
+  clock::time_point deadline = clock::now() - age;
+  std::vector<std::string> expired;
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (auto it = m_index.begin(); it != m_index.end();)
+    {
+      if (deadline <= it->second || m_pending.count(it->first))
+      {
+        ++it;
+        continue;
+      }
+
+      expired.push_back(it->first);
+      it = m_index.erase(it);
+    }
+  }
+
+  for (const std::string& file_name : expired)
+  {
+    LOG_PRINT_L1("  remove cache file " << file_name);
+
+    boost::system::error_code ec;
+    fs::remove(file_name, ec);
+  }
+}
@@ -1,4 +1,5 @@
 #include "walletnode/wallet_manager.h"
+#include "walletnode/wallet_holder.h"
 #include "lib/graft/inout.h"
 
 #include "walletnode/requests/balance_request.h"
@@ -10,7 +11,11 @@
 
 #include "string_tools.h"
 
+#include <rpc/core_rpc_server_commands_defs.h>
+#include <storages/portable_storage_template_helper.h>
+
 #include <mnemonics/electrum-words.h>
+#include <crypto/hash.h>
 
 #include <wallet/graft_wallet.h>
 
@@ -22,7 +27,7 @@ namespace
 {
 
 const unsigned int WALLET_MEMORY_CACHE_TTL_SECONDS       = 10 * 60; //TODO: move to config
-const unsigned int WALLET_TRANSACTIONS_QUEUE_SIZE        = 256; //TODO: move to config
+const unsigned int WALLET_STRAND_BATCH_SIZE             = 1; //TODO: move to config
 const uint64_t     WALLET_DISK_CACHE_FLUSH_DELAY_SECONDS = 3600; //TODO: move to config
 const char*        WALLETS_DIR_PREFIX                    = "wallets"; //TODO: move to config
 
@@ -118,28 +123,13 @@ struct WebHookCallback
     result.query_string = url.query;
   }
 
-  void invoke(TaskManager& task_manager)
+  void invoke(WebHookQueue& webhooks)
   {
-    if (!task_manager.addPeriodicTask(*this, std::chrono::milliseconds(1)))
-      LOG_PRINT_L1("Failed to invoke " << result.proto << "://" << result.host << ":" << result.port << result.path);
-  }
-
-  Status operator()(const Router::vars_t&, const graft::Input&, graft::Context& context, graft::Output& output)
-  {
-    if (context.local.hasKey(__FUNCTION__))
-      return Status::Stop;
-
-    LOG_PRINT_L2("Send response to " << result.proto << "://" << result.host << ":" << result.port << ". Body '" << result.body << "'");
-
-    output = result;
-
-    context.local[__FUNCTION__] = true;
-
-    return Status::Forward;
+    webhooks.push(result);
   }
 };
 
-void invoke_error_http(const char* url, const char* error_text, TaskManager& task_manager)
+void invoke_error_http(const char* url, const char* error_text, WebHookQueue& webhooks)
 {
   if (!*url)
     return;
@@ -148,47 +138,57 @@ void invoke_error_http(const char* url, const char* error_text, TaskManager& tas
 
   callback.result.body = "{'Error':'" + std::string(error_text) + "','Result':-1}";
 
-  callback.invoke(task_manager);
+  callback.invoke(webhooks);
 }
 
-void create_directories(const std::string& file_name)
+/// Identifies account data and password the wallet is loaded with, without keeping the password
+crypto::hash get_session_key(const std::string& account_data, const std::string& password)
 {
-  boost::filesystem::path path(file_name);
-  boost::filesystem::path dir = path.parent_path();
+  std::string data = account_data;
 
-  boost::filesystem::create_directories(dir);
-}
+  data.push_back('\0');
+  data += password;
 
+  return crypto::cn_fast_hash(data.data(), data.size());
 }
 
-using StrandX = tp::StrandImpl<tp::FixedFunction<void(), sizeof(GJPtr)>, tp::MPMCBoundedQueue>;
-
-struct WalletManager::WalletHolder
-{
-  tools::GraftWallet wallet;
-  StrandX            strand;
+}
 
-  WalletHolder(ThreadPoolX& thread_pool, bool testnet)
-    : wallet(testnet? cryptonote::TESTNET : cryptonote::MAINNET)
-    , strand(thread_pool, WALLET_TRANSACTIONS_QUEUE_SIZE)
-  {
-  }
-};
+constexpr size_t WalletManager::SCAN_BATCH_SIZE;
 
 WalletManager::WalletManager(TaskManager& task_manager, bool testnet)
   : m_testnet(testnet)
   , m_task_manager(task_manager)
+  , m_webhooks(task_manager.getGcm())
+  , m_cache_store(WALLETS_DIR_PREFIX)
 {
   LOG_PRINT_L1("TestNet is " << testnet);
 }
 
 WalletManager::~WalletManager()
 {
+  //the sessions that have not expired are stored here, m_cache_store completes the writes before it goes
+  std::vector<WalletPtr> wallets;
+
+  {
+    std::lock_guard<std::mutex> lock(m_sessions_mutex);
+
+    for (auto& session : m_sessions)
+    {
+      if (WalletPtr wallet = session.second.lock())
+        wallets.push_back(std::move(wallet));
+    }
+  }
+
+  LOG_PRINT_L1("Store caches of " << wallets.size() << " wallets");
+
+  for (const WalletPtr& wallet : wallets)
+    storeCache(wallet);
 }
 
 WalletManager::WalletPtr WalletManager::createWallet(Context& context)
 {
-  WalletPtr wallet(new WalletHolder(m_task_manager.getThreadPool(), m_testnet));
+  WalletPtr wallet(new WalletHolder(m_task_manager.getThreadPool(), m_testnet, WALLET_STRAND_BATCH_SIZE));
 
   wallet->wallet.init(context.global["cryptonode_rpc_address"]);
 
@@ -197,7 +197,252 @@ WalletManager::WalletPtr WalletManager::createWallet(Context& context)
 
 void WalletManager::registerWallet(Context& context, const std::string& wallet_id, const WalletPtr& wallet)
 {
-  context.global.set(wallet_id, wallet, std::chrono::seconds(WALLET_MEMORY_CACHE_TTL_SECONDS)); //TODO: what about canceling expiration, when wallet has transactions in queue?
+  auto on_expired = [this](std::pair<std::string, std::any>& entry) {
+    closeWallet(entry.first, std::any_cast<WalletPtr>(entry.second));
+  };
+
+  context.global.set(wallet_id, wallet, std::chrono::seconds(WALLET_MEMORY_CACHE_TTL_SECONDS), on_expired);
+
+  std::lock_guard<std::mutex> lock(m_sessions_mutex);
+
+  m_sessions[wallet_id] = wallet;
+}
+
+void WalletManager::closeWallet(const WalletId& wallet_id, const WalletPtr& wallet)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_closing_mutex);
+
+    m_closing_wallets[wallet_id] = wallet;
+  }
+
+  //the cache is stored after the requests queued in the strand, a request that comes meanwhile reopens the wallet
+  wallet->strand.post(FixedFunctionWrapper([wallet_id, wallet, this]() {
+    LOG_PRINT_L2("Store cache of wallet '" << wallet_id << "'");
+
+    storeCache(wallet, [wallet_id, wallet, this]() {
+      std::lock_guard<std::mutex> lock(m_closing_mutex);
+
+      auto it = m_closing_wallets.find(wallet_id);
+
+      if (it != m_closing_wallets.end() && it->second == wallet)
+        m_closing_wallets.erase(it);
+    });
+  }));
+}
+
+void WalletManager::storeCache(const WalletPtr& wallet, WalletCacheStore::Done done)
+{
+  std::string cache_file_name;
+
+  {
+    std::lock_guard<std::mutex> lock(wallet->mutex);
+
+    cache_file_name = wallet->cache_file_name;
+  }
+
+  if (cache_file_name.empty())
+  {
+    if (done)
+      done();
+
+    return;
+  }
+
+  m_cache_store.store(cache_file_name, [wallet](const std::string& tmp_file_name) {
+    std::lock_guard<std::mutex> lock(wallet->mutex);
+
+    if (!wallet->dirty)
+      return false;
+
+    wallet->wallet.store_cache(tmp_file_name);
+    wallet->dirty = false;
+
+    return true;
+  }, done);
+}
+
+WalletManager::WalletPtr WalletManager::reopenWallet(const WalletId& wallet_id)
+{
+  std::lock_guard<std::mutex> lock(m_closing_mutex);
+
+  auto it = m_closing_wallets.find(wallet_id);
+
+  if (it == m_closing_wallets.end())
+    return WalletPtr();
+
+  WalletPtr wallet = std::move(it->second);
+
+  m_closing_wallets.erase(it);
+
+  return wallet;
+}
+
+void WalletManager::refreshWallet(WalletHolder& wallet)
+{
+  //the background scan keeps the wallet at the chain height, requests between blocks do not go to the cryptonode
+  uint64_t chain_height = m_chain_height.load();
+
+  if (chain_height && wallet.scanned_height >= chain_height)
+    return;
+
+  {
+    //synchronous requests to the cryptonode; the resident wallet goes on from the height it is scanned to
+    ThreadPoolX::BlockingScope blocking;
+    wallet.wallet.refresh(true);
+  }
+
+  wallet.scanned_height = wallet.wallet.get_blockchain_current_height();
+
+  //the cache is stored when the wallet expires in the global context
+  wallet.dirty = true;
+}
+
+Status WalletManager::scanWallets(const Input& input, Context& context, Output& output)
+{
+  if (context.local.getLastStatus() != Status::Forward)
+  {
+    output.path = "/getheight";
+    output.body = "{}";
+
+    return Status::Forward;
+  }
+
+  cryptonote::COMMAND_RPC_GET_HEIGHT::response res = boost::value_initialized<cryptonote::COMMAND_RPC_GET_HEIGHT::response>();
+
+  if (!epee::serialization::load_t_from_json(res, input.body) || res.status != CORE_RPC_STATUS_OK)
+  {
+    LOG_PRINT_L1("Failed to get chain height for wallets scan");
+    return Status::Ok;
+  }
+
+  if (res.height <= m_chain_height.load())
+    return Status::Ok;
+
+  LOG_PRINT_L2("Chain height is " << res.height << ", scan wallets");
+
+  m_chain_height = res.height;
+
+  startScan();
+
+  return Status::Ok;
+}
+
+void WalletManager::startScan()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_sessions_mutex);
+
+    for (auto it = m_sessions.begin(); it != m_sessions.end();)
+    {
+      WalletPtr wallet = it->second.lock();
+
+      if (!wallet)
+      {
+        it = m_sessions.erase(it);
+        continue;
+      }
+
+      //a wallet is scanned once at a time, it is up to date after it anyway
+      if (!wallet->scan_queued)
+      {
+        wallet->scan_queued = true;
+        m_scan_queue.push_back(wallet);
+      }
+
+      ++it;
+    }
+  }
+
+  scanNext();
+}
+
+void WalletManager::scanNext()
+{
+  for (;;)
+  {
+    WalletPtr wallet;
+
+    {
+      std::lock_guard<std::mutex> lock(m_sessions_mutex);
+
+      if (m_scan_running >= SCAN_BATCH_SIZE || m_scan_queue.empty())
+        return;
+
+      wallet = std::move(m_scan_queue.front());
+      m_scan_queue.pop_front();
+      ++m_scan_running;
+    }
+
+    //the strand orders the scan with the requests to the wallet
+    wallet->strand.post(FixedFunctionWrapper([wallet, this]() {
+      try
+      {
+        std::lock_guard<std::mutex> lock(wallet->mutex);
+
+        //a wallet that is not loaded yet is refreshed by its first request
+        if (wallet->loaded)
+          refreshWallet(*wallet);
+      }
+      catch (std::exception& e)
+      {
+        LOG_PRINT_L1("Excepton " << e.what() << " during wallet scan");
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(m_sessions_mutex);
+
+        wallet->scan_queued = false;
+        --m_scan_running;
+      }
+
+      scanNext();
+    }));
+  }
+}
+
+void WalletManager::openSession(WalletHolder& wallet, const WalletId& public_address, const std::string& account_data, const std::string& password)
+{
+  std::string cache_file_name = getWalletCacheFileName(public_address);
+  crypto::hash session_key = get_session_key(account_data, password);
+
+  m_cache_store.touch(cache_file_name);
+
+  if (wallet.loaded && wallet.session_key == session_key)
+    return;
+
+  ThreadPoolX::BlockingScope blocking;
+
+  cryptonote::network_type nettype = m_testnet? cryptonote::TESTNET : cryptonote::MAINNET;
+
+  //the session keeps the wallet decrypted and its cache resident
+  if (!wallet.loaded)
+  {
+    wallet.wallet.loadFromData(account_data, password);
+
+    //the keys of another account must not become resident under this address nor write its cache
+    if (wallet.wallet.get_account().get_public_address_str(nettype) != public_address)
+      throw std::runtime_error("Account data does not match wallet '" + public_address + "'");
+
+    wallet.wallet.load_cache(cache_file_name);
+
+    wallet.session_key     = session_key;
+    wallet.cache_file_name = cache_file_name;
+    wallet.loaded          = true;
+
+    return;
+  }
+
+  //other credentials are checked aside, so a wrong password neither drops nor rescans the resident session
+  tools::GraftWallet candidate(nettype);
+
+  candidate.loadFromData(account_data, password);
+
+  if (candidate.get_account().get_public_address_str(nettype) != public_address)
+    throw std::runtime_error("Account data does not match wallet '" + public_address + "'");
+
+  //the same keys, the resident cache goes on
+  wallet.session_key = session_key;
 }
 
 std::string WalletManager::getContextWalletId(const std::string& public_address)
@@ -219,7 +464,10 @@ void WalletManager::runAsyncForWallet
 
   if (!wallet)
   {
-    wallet = createWallet(context);
+    wallet = reopenWallet(wallet_id);
+
+    if (!wallet)
+      wallet = createWallet(context);
 
     registerWallet(context, wallet_id, wallet);
   }
@@ -227,34 +475,28 @@ void WalletManager::runAsyncForWallet
   wallet->strand.post(FixedFunctionWrapper([public_address, wallet, account_data, password, fn, callback_url, this]() {
     try
     {
-      wallet->wallet.loadFromData(account_data, password);
-
-      std::string cache_file_name = getWalletCacheFileName(public_address);
+      std::lock_guard<std::mutex> lock(wallet->mutex);
 
-      wallet->wallet.load_cache(cache_file_name);
+      openSession(*wallet, public_address, account_data, password);
 
-//TODO:
-//      wallet->wallet.refresh();
-      wallet->wallet.refresh(true);
+      refreshWallet(*wallet);
 
       WebHookCallback callback(callback_url.c_str());
 
       fn(wallet->wallet, callback.result);
 
-      wallet->wallet.store_cache(cache_file_name);
-
       if (!callback_url.empty())
-        callback.invoke(m_task_manager);
+        callback.invoke(m_webhooks);
     }
     catch (std::exception& e)
     {
       LOG_PRINT_L1("Excepton " << e.what() << " during call " << __FUNCTION__);
-      invoke_error_http(callback_url.c_str(), e.what(), m_task_manager);
+      invoke_error_http(callback_url.c_str(), e.what(), m_webhooks);
     }
     catch (...)
     {
       LOG_PRINT_L1("Unhandled excepton during call " << __FUNCTION__);
-      invoke_error_http(callback_url.c_str(), "unhandled exception", m_task_manager);
+      invoke_error_http(callback_url.c_str(), "unhandled exception", m_webhooks);
     }
   }));
 }
@@ -270,17 +512,17 @@ void WalletManager::runAsync(Context& context, const Url& callback_url, const Fn
       fn(callback.result);
 
       if (!callback_url.empty())
-        callback.invoke(m_task_manager);
+        callback.invoke(m_webhooks);
     }
     catch (std::exception& e)
     {
       LOG_PRINT_L1("Excepton " << e.what() << " during call " << __FUNCTION__);
-      invoke_error_http(callback_url.c_str(), e.what(), m_task_manager);
+      invoke_error_http(callback_url.c_str(), e.what(), m_webhooks);
     }
     catch (...)
     {
       LOG_PRINT_L1("Unhandled excepton during call " << __FUNCTION__);
-      invoke_error_http(callback_url.c_str(), "unhandled exception", m_task_manager);
+      invoke_error_http(callback_url.c_str(), "unhandled exception", m_webhooks);
     }
   }));
 }
@@ -323,9 +565,12 @@ void WalletManager::createAccount(Context& context, const std::string& password,
 
     std::string cache_file_name = getWalletCacheFileName(public_address);
 
-    create_directories(cache_file_name);
+    wallet->session_key     = get_session_key(account_data, password);
+    wallet->cache_file_name = cache_file_name;
+    wallet->loaded          = true;
+    wallet->dirty           = true;
 
-    wallet->wallet.store_cache(cache_file_name);
+    storeCache(wallet);
 
     std::string wallet_id = getContextWalletId(public_address);
 
@@ -381,9 +626,12 @@ void WalletManager::restoreAccount(Context& context, const std::string& password
 
     std::string cache_file_name = getWalletCacheFileName(public_address);
 
-    create_directories(cache_file_name);
+    wallet->session_key     = get_session_key(account_data, password);
+    wallet->cache_file_name = cache_file_name;
+    wallet->loaded          = true;
+    wallet->dirty           = true;
 
-    wallet->wallet.store_cache(cache_file_name);
+    storeCache(wallet);
 
     std::string wallet_id = getContextWalletId(public_address);
 
@@ -630,57 +878,14 @@ void WalletManager::requestTransactionHistory
   });
 }
 
-namespace
-{
-
-std::vector<std::string> getAllExpiredFiles(const char* dir, const char* name_re)
-{
-  time_t now;
-
-  time(&now);
-
-  const std::string target_path(dir);
-  const boost::regex my_filter(name_re);
-
-  std::vector<std::string> result;
-
-  boost::filesystem::directory_iterator end_itr;
-
-  for (boost::filesystem::directory_iterator it(target_path); it != end_itr; ++it)
-  {
-    if (!boost::filesystem::is_regular_file(it->status()))
-      continue;
-
-    boost::smatch what;
-    std::string file_name = it->path().filename().native();
-
-    if (!boost::regex_match(file_name, what, my_filter))
-      continue;
-
-    std::time_t modification_time = last_write_time(it->path());
-    double seconds_delta = difftime(now, modification_time);
-
-    if (seconds_delta < WALLET_DISK_CACHE_FLUSH_DELAY_SECONDS)
-      continue;
-
-    result.push_back(file_name);
-  }
-
-  return result;
-}
-
-}
-
 void WalletManager::flushDiskCaches()
 {
   LOG_PRINT_L1("Flush disk caches");
 
-  std::vector<std::string> cache_files = getAllExpiredFiles(".", ".*\\.cache");
-
-  for (const std::string& cache_file_name : cache_files)
-  {
-    LOG_PRINT_L1("  remove cache file " << cache_file_name);
+  m_cache_store.removeExpired(std::chrono::seconds(WALLET_DISK_CACHE_FLUSH_DELAY_SECONDS));
+}
 
-    boost::filesystem::remove(cache_file_name);
-  }
+void WalletManager::sendWebHooks()
+{
+  m_webhooks.pump();
 }
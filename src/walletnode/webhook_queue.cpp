@@ -0,0 +1,208 @@
+#include "walletnode/webhook_queue.h"
+#include "lib/graft/context.h"
+#include "lib/graft/handler_api.h"
+
+#include "misc_log_ex.h"
+
+#include <algorithm>
+#include <cassert>
+#include <memory>
+
+using namespace graft;
+using namespace graft::walletnode;
+
+namespace
+{
+
+/// Host key of an [upstream] uri, [scheme://]host[:port][/path]
+std::string upstream_host_key(const std::string& uri)
+{
+  std::string scheme = "http", rest = uri;
+
+  size_t prot_end = rest.find("://");
+
+  if (prot_end != std::string::npos)
+  {
+    scheme = rest.substr(0, prot_end);
+    rest.erase(0, prot_end + 3);
+  }
+
+  rest = rest.substr(0, rest.find('/'));
+
+  size_t port_i = rest.find(':');
+  std::string host = rest.substr(0, port_i), port = port_i == std::string::npos ? "80" : rest.substr(port_i + 1);
+
+  std::transform(scheme.begin(), scheme.end(), scheme.begin(), ::tolower);
+  std::transform(host.begin(), host.end(), host.begin(), ::tolower);
+
+  return scheme + "://" + host + ":" + port;
+}
+
+}
+
+constexpr size_t   WebHookQueue::MAX_PENDING;
+constexpr size_t   WebHookQueue::MAX_IN_FLIGHT;
+constexpr unsigned WebHookQueue::MAX_ATTEMPTS;
+constexpr int      WebHookQueue::RETRY_BASE_DELAY_MS;
+
+WebHookQueue::WebHookQueue(GlobalContextMap& gcm)
+{
+  Context context(gcm);
+
+  m_api = context.handlerAPI();
+
+  assert(m_api);
+
+  loadUpstreams();
+}
+
+void WebHookQueue::loadUpstreams()
+{
+  std::map<std::string, std::string> upstreams;
+
+  for (auto& subs : OutHttp::uri_substitutions)
+  {
+    if (std::get<2>(subs.second))
+      upstreams.emplace(upstream_host_key(std::get<0>(subs.second)), "$" + subs.first);
+  }
+
+  if (upstreams == m_upstreams)
+    return;
+
+  LOG_PRINT_L2("Webhooks go over " << upstreams.size() << " keep-alive upstreams");
+
+  m_upstreams.swap(upstreams);
+}
+
+std::string WebHookQueue::hostKey(const Output& output)
+{
+  return output.proto + "://" + output.host + ":" + output.port;
+}
+
+bool WebHookQueue::push(const Output& output)
+{
+  std::string host_key = hostKey(output);
+
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+
+  if (m_pending >= MAX_PENDING)
+  {
+    LOG_PRINT_L1("Webhook to " << host_key << output.path << " is dropped, " << m_pending << " deliveries are outstanding");
+    return false;
+  }
+
+  Delivery delivery;
+
+  delivery.output = output;
+  delivery.due    = clock::now();
+
+  ++m_pending;
+
+  Host& host = m_hosts[host_key];
+
+  host.queue.emplace_back(std::move(delivery));
+
+  sendDue(host_key, host, clock::now());
+
+  return true;
+}
+
+void WebHookQueue::pump()
+{
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+
+  //the configuration is reloaded by IO thread, the deliveries that are not sent yet go to the upstreams it has now
+  loadUpstreams();
+
+  clock::time_point now = clock::now();
+
+  for (auto it = m_hosts.begin(); it != m_hosts.end();)
+  {
+    sendDue(it->first, it->second, now);
+
+    if (it->second.queue.empty() && !it->second.in_flight)
+      it = m_hosts.erase(it);
+    else
+      ++it;
+  }
+}
+
+size_t WebHookQueue::pending() const
+{
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+  return m_pending;
+}
+
+void WebHookQueue::sendDue(const std::string& host_key, Host& host, clock::time_point now)
+{
+  //deliveries of a host are sent in order, a retry holds the later ones till it is due
+  while (host.in_flight < MAX_IN_FLIGHT && !host.queue.empty() && host.queue.front().due <= now)
+  {
+    auto delivery = std::make_shared<Delivery>(std::move(host.queue.front()));
+
+    host.queue.pop_front();
+
+    ++host.in_flight;
+
+    LOG_PRINT_L2("Send response to " << host_key << delivery->output.path << ". Body '" << delivery->output.body << "'");
+
+    Output output = delivery->output;
+    auto upstream = m_upstreams.find(host_key);
+
+    if (upstream != m_upstreams.end())
+    {
+      //pooled keep-alive connections of the upstream, the path is kept
+      output.uri = upstream->second;
+      output.proto.clear();
+      output.host.clear();
+      output.port.clear();
+    }
+
+    bool queued = m_api->sendUpstreamAsync(output, [this, host_key, delivery](Input& input, const std::string& err) {
+      onDone(host_key, *delivery, input, err);
+    });
+
+    if (!queued)
+    {
+      //the upstream queue is full, it is tried again by pump
+      --host.in_flight;
+      host.queue.emplace_front(std::move(*delivery));
+      break;
+    }
+  }
+}
+
+void WebHookQueue::onDone(const std::string& host_key, Delivery& delivery, const Input& input, const std::string& err)
+{
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+
+  Host& host = m_hosts[host_key];
+
+  assert(host.in_flight);
+
+  --host.in_flight;
+
+  bool delivered = err.empty() && 200 <= input.resp_code && input.resp_code < 300;
+
+  if (delivered)
+  {
+    --m_pending;
+  }
+  else if (++delivery.attempts >= MAX_ATTEMPTS)
+  {
+    LOG_PRINT_L1("Webhook to " << host_key << delivery.output.path << " is dropped after " << delivery.attempts
+      << " attempts, " << (err.empty() ? "HTTP " + std::to_string(input.resp_code) : err));
+    --m_pending;
+  }
+  else
+  {
+    LOG_PRINT_L2("Webhook to " << host_key << delivery.output.path << " failed, attempt " << delivery.attempts
+      << ", " << (err.empty() ? "HTTP " + std::to_string(input.resp_code) : err));
+
+    delivery.due = clock::now() + std::chrono::milliseconds(RETRY_BASE_DELAY_MS << (delivery.attempts - 1));
+
+    host.queue.emplace_front(std::move(delivery));
+  }
+
+  sendDue(host_key, host, clock::now());
+}
@@ -1,9 +1,14 @@
 #include <gtest/gtest.h>
 #include "lib/graft/blacklist.h"
+#include "lib/graft/ip_tables.h"
 #include <chrono>
 #include <thread>
 #include "fixture.h"
 
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
 TEST(Blacklist, common)
 {
     auto bl = graft::BlackListTest::Create(100, 5, 120);
@@ -147,6 +152,136 @@ TEST(Blacklist, activity)
     }
 }
 
+TEST(Blacklist, ipv6)
+{
+    auto bl = graft::BlackListTest::Create(100, 5, 120);
+
+    std::istringstream iss("allow 2001:db8:1::/48\n deny 2001:db8::/32\n deny ::1\n allow 10.0.0.0/8\n deny 2001:db8:1:2::/64 ;; superseded");
+    bl->readRules(iss);
+    EXPECT_EQ(bl->getWarnings(), "warning: the rule at line 5 is superceded by one of previous rule\n");
+
+    EXPECT_EQ( bl->find("2001:db8::5"), std::make_pair(true, false));
+    EXPECT_EQ( bl->find("2001:db8:1:2::5"), std::make_pair(true, true));
+    EXPECT_EQ( bl->find("2001:db9::1"), std::make_pair(false, true));
+    EXPECT_EQ( bl->find("::1"), std::make_pair(true, false));
+    //IPv4 rules do not match IPv6 addresses and vice versa
+    EXPECT_EQ( bl->find("10.1.2.3"), std::make_pair(true, true));
+    EXPECT_EQ( bl->find("::a01:203"), std::make_pair(false, true));
+    EXPECT_EQ( bl->find("::ffff:10.1.2.3"), std::make_pair(true, true));
+
+    std::istringstream bad("deny 2001:db8::/129");
+    EXPECT_THROW(bl->readRules(bad), std::runtime_error);
+
+    //the limit is 500 requests per window
+    bool triggered = false;
+    int cnt = 0;
+    for(; cnt < 1000 && !triggered; ++cnt)
+    {
+        triggered = bl->active("2001:db8::7");
+    }
+    EXPECT_EQ(triggered, true);
+    EXPECT_EQ(cnt, 501);
+}
+
+TEST(Blacklist, flood)
+{
+    auto bl = graft::BlackListTest::Create(1000, 5, 120);
+
+    //distinct addresses do not grow the table, and they do not push out the counter of an active one
+    EXPECT_EQ(bl->active(1), false);
+    for(in_addr_t addr = 1000; addr < 1000000; ++addr)
+    {
+        bl->active(addr);
+        if(addr % 1000 == 0) EXPECT_EQ(bl->active(1), false);
+    }
+    EXPECT_LE(bl->activeCnt(), graft::ipfilter::RateTable::DEFAULT_CAPACITY);
+
+    //1000 requests of 5000 are counted already
+    int cnt = 1;
+    while(!bl->active(1)) ++cnt;
+    EXPECT_EQ(cnt, 4001);
+}
+
+TEST(Blacklist, reloadRules)
+{
+    auto bl = graft::BlackListTest::Create(1, 5, 120);
+    //host order
+    in_addr_t addr1 = 0x01010101, addr2 = 0x02020202;
+
+    std::istringstream iss1("deny 1.1.1.0/24");
+    bl->readRules(iss1);
+    EXPECT_EQ(bl->processIp(addr1, false), false);
+    for(int i = 0; i < 3; ++i) EXPECT_EQ(bl->processIp(addr2, false), true);
+
+    //invalid rules do not replace the current ones
+    std::istringstream bad("deny 1.1.1.0/24\n deny something");
+    EXPECT_THROW(bl->readRules(bad), std::runtime_error);
+    EXPECT_NE(bl->getWarnings().find("invalid rule format"), std::string::npos);
+    EXPECT_EQ(bl->processIp(addr1, false), false);
+
+    //the counters survive reloading, 2 more requests are allowed of 5
+    std::thread th([&bl]()
+    {
+        std::istringstream iss2("allow 1.1.1.0/24\n deny 2.2.2.2");
+        bl->readRules(iss2);
+    });
+    th.join();
+    EXPECT_EQ(bl->processIp(addr2, false), false);
+    EXPECT_EQ(bl->processIp(addr1, false), true);
+
+    std::istringstream iss3("");
+    bl->readRules(iss3);
+    EXPECT_EQ(bl->processIp(addr2, false), true);
+    EXPECT_EQ(bl->processIp(addr2, false), true);
+    EXPECT_EQ(bl->processIp(addr2, false), false);
+}
+
+TEST(Blacklist, routeLimits)
+{
+    using graft::ipfilter::RouteLimiter;
+    using graft::ipfilter::IpAddress;
+    RouteLimiter::Group dapi{"/dapi/v2.0/", 10, 3};
+    RouteLimiter::Group debug{"/debug/", 0.5, 1};
+    RouteLimiter::Group disabled{"/walletapi/", 0, 0};
+    RouteLimiter::Group exempt{"/dapi/v2.0/cryptonode/", 0, 0};
+    RouteLimiter limiter({dapi, debug, disabled, exempt});
+
+    EXPECT_EQ(limiter.group("/dapi/v2.0/pay"), 0);
+    EXPECT_EQ(limiter.group("/dapi/v2.0/cryptonode/sale"), -1);
+    EXPECT_TRUE(RouteLimiter({disabled, exempt}).empty());
+    EXPECT_EQ(limiter.group("/debug/announce"), 1);
+    EXPECT_EQ(limiter.group("/walletapi/v2.0/send_transfer"), -1);
+    EXPECT_EQ(limiter.group("/cryptonode/getheight"), -1);
+    EXPECT_EQ(limiter.retryAfterSec(0), 1);
+    EXPECT_EQ(limiter.retryAfterSec(1), 2);
+
+    IpAddress addr1 = IpAddress::fromV4(0x01010101), addr2 = IpAddress::fromV4(0x02020202);
+    auto now = RouteLimiter::clock::now();
+    //the burst, then nothing until a token is refilled
+    for(int i = 0; i < 3; ++i) EXPECT_EQ(limiter.take(addr1, 0, now), true);
+    EXPECT_EQ(limiter.take(addr1, 0, now), false);
+    //the buckets of other groups and addresses are separate
+    EXPECT_EQ(limiter.take(addr1, 1, now), true);
+    EXPECT_EQ(limiter.take(addr1, 1, now), false);
+    EXPECT_EQ(limiter.take(addr2, 0, now), true);
+
+    now += std::chrono::milliseconds(100);
+    EXPECT_EQ(limiter.take(addr1, 0, now), true);
+    EXPECT_EQ(limiter.take(addr1, 0, now), false);
+    EXPECT_EQ(limiter.take(addr1, 1, now), false);
+    now += std::chrono::seconds(2);
+    EXPECT_EQ(limiter.take(addr1, 1, now), true);
+
+    //a flood of distinct addresses does not reset the empty bucket of an active one
+    RouteLimiter small({dapi}, 64);
+    for(int i = 0; i < 3; ++i) small.take(addr1, 0, now);
+    for(in_addr_t addr = 1000; addr < 100000; ++addr)
+    {
+        small.take(IpAddress::fromV4(addr), 0, now);
+    }
+    EXPECT_EQ(small.take(addr1, 0, now), false);
+}
+
 TEST_F(GraftServerTest, ban)
 {
     m_copts.ipfilter.requests_per_sec = 3;
@@ -182,3 +317,58 @@ TEST_F(GraftServerTest, ban)
 
     stop_and_wait_for();
 }
+
+TEST_F(GraftServerTest, banKeepAlive)
+{
+    m_copts.ipfilter.requests_per_sec = 3;
+    m_copts.ipfilter.window_size_sec = 1;
+    m_copts.ipfilter.ban_ip_sec = 3;
+    m_copts.http_keep_alive_requests = 100;
+
+    run();
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_LE(0, fd);
+    sockaddr_in sa{};
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(28690);
+    inet_pton(AF_INET, "127.0.0.1", &sa.sin_addr);
+    ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)));
+
+    //returns the body, empty if the connection is closed
+    auto exchange = [fd](const std::string& request)->std::string
+    {
+        send(fd, request.c_str(), request.size(), MSG_NOSIGNAL);
+        std::string res;
+        char buf[1024];
+        for(;;)
+        {
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if(n <= 0) return std::string();
+            res.append(buf, n);
+            size_t end = res.find("\r\n\r\n");
+            size_t cl = res.find("Content-Length: ");
+            if(end == std::string::npos || cl == std::string::npos || end < cl) continue;
+            size_t len = std::stoul(res.substr(cl + 16));
+            if(end + 4 + len <= res.size()) return res.substr(end + 4, len);
+        }
+    };
+
+    std::string json_data = "something";
+    const std::string request = "POST /URI/test/123 HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Length: "
+            + std::to_string(json_data.size()) + "\r\n\r\n" + json_data;
+    //the requests of the kept-alive connection are counted as the ones of new connections
+    for(int i = 0; i < 3; ++i)
+    {
+        EXPECT_EQ(exchange(request), json_data + "123");
+    }
+    EXPECT_EQ(exchange(request), "");
+    close(fd);
+
+    //the address is banned for new connections too
+    GraftServerTestBase::Client client;
+    client.serve("http://127.0.0.1:28690/URI/test/123", "", json_data);
+    EXPECT_EQ(client.get_closed(), true);
+
+    stop_and_wait_for();
+}
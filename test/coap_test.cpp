@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+#include "lib/graft/coap.h"
+
+using namespace graft;
+
+TEST(Coap, uintOption)
+{
+    EXPECT_EQ(coap::encodeUint(0), std::string());
+    EXPECT_EQ(coap::encodeUint(1), std::string("\x01", 1));
+    EXPECT_EQ(coap::encodeUint(0x100), std::string("\x01\x00", 2));
+    EXPECT_EQ(coap::encodeUint(0xabcdef), std::string("\xab\xcd\xef", 3));
+
+    for(uint32_t v : {0u, 1u, 0xffu, 0x100u, 0xffffffu, 0xffffffffu})
+    {
+        std::string s = coap::encodeUint(v);
+        uint32_t res = 1;
+        EXPECT_TRUE(coap::decodeUint(s.data(), s.size(), res));
+        EXPECT_EQ(res, v);
+    }
+    uint32_t res;
+    EXPECT_FALSE(coap::decodeUint("\x01\x02\x03\x04\x05", 5, res));
+}
+
+TEST(Coap, blockOption)
+{
+    coap::Block block;
+    block.num = 5;
+    block.more = true;
+    block.szx = 2;
+    EXPECT_EQ(block.size(), 64);
+    EXPECT_EQ(block.offset(), 320);
+    //5 << 4 | 0x8 | 2
+    EXPECT_EQ(block.encode(), std::string("\x5a", 1));
+
+    coap::Block res;
+    std::string s = block.encode();
+    EXPECT_TRUE(coap::Block::decode(s.data(), s.size(), res));
+    EXPECT_EQ(res.num, 5);
+    EXPECT_TRUE(res.more);
+    EXPECT_EQ(res.szx, 2);
+
+    //an empty value is the first block of 16 bytes
+    EXPECT_TRUE(coap::Block::decode("", 0, res));
+    EXPECT_EQ(res.num, 0);
+    EXPECT_FALSE(res.more);
+    EXPECT_EQ(res.szx, 0);
+    EXPECT_EQ(res.size(), 16);
+
+    block.num = 0xfffff;
+    block.more = false;
+    block.szx = 6;
+    s = block.encode();
+    EXPECT_EQ(s.size(), 3);
+    EXPECT_TRUE(coap::Block::decode(s.data(), s.size(), res));
+    EXPECT_EQ(res.num, 0xfffff);
+    EXPECT_EQ(res.size(), 1024);
+
+    //szx 7 is reserved, the value is up to 3 bytes
+    EXPECT_FALSE(coap::Block::decode("\x07", 1, res));
+    EXPECT_FALSE(coap::Block::decode("\x01\x02\x03\x04", 4, res));
+
+    EXPECT_EQ(coap::Block::szxOf(1024), 6);
+    EXPECT_EQ(coap::Block::szxOf(4096), 6);
+    EXPECT_EQ(coap::Block::szxOf(512), 5);
+    EXPECT_EQ(coap::Block::szxOf(100), 2);
+    EXPECT_EQ(coap::Block::szxOf(16), 0);
+    EXPECT_EQ(coap::Block::szxOf(1), 0);
+}
@@ -10,6 +10,7 @@
 #include <gtest/gtest.h>
 #include <thread>
 #include <atomic>
+#include <functional>
 
 namespace detail
 {
@@ -36,7 +37,19 @@ protected:
     {
         graft::ConnectionManager* httpcm = getConMgr("HTTP");
         httpcm->addRouter(m_httpRouter);
+        if(m_coapRouter)
+        {
+            graft::ConnectionManager* coapcm = getConMgr("COAP");
+            coapcm->addRouter(*m_coapRouter);
+            if(m_initCoap) m_initCoap(*coapcm);
+        }
+        if(m_initHttp) m_initHttp(*httpcm);
     }
+public:
+    //they are set before init
+    graft::Router* m_coapRouter = nullptr;
+    std::function<void (graft::ConnectionManager& httpcm)> m_initHttp;
+    std::function<void (graft::ConnectionManager& coapcm)> m_initCoap;
 private:
     graft::Router& m_httpRouter;
     bool m_ignoreInitConfig;
@@ -163,6 +176,11 @@ public:
     public:
         graft::ConfigOpts m_copts;
         graft::Router m_router;
+        graft::Router m_coapRouter;
+        //registers other endpoints of the HTTP connection manager, e.g. WebSocket ones
+        std::function<void (graft::ConnectionManager& httpcm)> m_initHttp;
+        //sets up the CoAP connection manager, e.g. its observable paths
+        std::function<void (graft::ConnectionManager& coapcm)> m_initCoap;
 
         graft::Looper& getLooper() const { assert(m_gserver); return m_gserver->getLooper(); }
         graft::GlobalContextMap& getGcm() const { assert(m_gserver); return m_gserver->getContext(); }
@@ -170,7 +188,7 @@ public:
         MainServer()
         {
             m_copts.http_address = "127.0.0.1:9084";
-            m_copts.coap_address = "127.0.0.1:9086";
+            m_copts.coap_address = "udp://127.0.0.1:9086";
             m_copts.http_connection_timeout = 1;
             m_copts.upstream_request_timeout = 1;
             m_copts.workers_count = 0;
@@ -205,6 +223,9 @@ public:
         void x_run()
         {
             m_gserver = std::make_unique<detail::GSTest>(m_router, true);
+            m_gserver->m_coapRouter = &m_coapRouter;
+            m_gserver->m_initHttp = m_initHttp;
+            m_gserver->m_initCoap = m_initCoap;
             m_gserver_created = true;
             m_gserver->init(start_args.argc, start_args.argv, m_copts);
             m_gserver->run();
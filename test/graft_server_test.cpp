@@ -2,9 +2,12 @@
 
 #include "lib/graft/jsonrpc.h"
 #include "lib/graft/context.h"
+#include "lib/graft/context_snapshot.h"
 #include "lib/graft/inout.h"
 #include "lib/graft/handler_api.h"
+#include "lib/graft/serveropts.h"
 #include "lib/graft/expiring_list.h"
+#include "lib/graft/coap.h"
 #include "supernode/requests.h"
 #include "supernode/requests/sale.h"
 #include "supernode/requests/sale_status.h"
@@ -13,12 +16,22 @@
 #include "supernode/requests/pay.h"
 #include "supernode/requests/pay_status.h"
 #include "supernode/requests/reject_pay.h"
+#include "supernode/requests/status_subscription.h"
 #include "supernode/requestdefines.h"
+#include "walletnode/webhook_queue.h"
 #include "fixture.h"
 
 #include <misc_log_ex.h>
 
+#include <boost/filesystem.hpp>
 #include <deque>
+#include <iomanip>
+#include <set>
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 GRAFT_DEFINE_IO_STRUCT(Payment,
       (uint64, amount),
@@ -439,6 +452,135 @@ TEST(Context, expiration)
     EXPECT_EQ(res, cmp_res);
 }
 
+TEST(Context, incrementalCleanup)
+{
+    graft::GlobalContextMap m;
+    graft::Context ctx(m);
+
+    const int count = 5000;
+    int expired = 0;
+    auto onExpired = [&expired](std::pair<std::string, std::any>& v)->void { ++expired; };
+    for(int i = 0; i < count; ++i)
+    {
+        ctx.global.set(std::to_string(i), i, std::chrono::seconds(1), onExpired);
+    }
+    ctx.global["persistent"] = 1;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1200));
+    //with zero budget each pass stops within the first bucket, the next pass resumes from it
+    size_t passes = 0, total = 0;
+    while(expired < count && passes < count)
+    {
+        graft::GlobalContextMap::CleanupStats stats = graft::Context::GlobalFriend::cleanup(ctx.global, std::chrono::microseconds(0));
+        EXPECT_LT(stats.expired, size_t(count));
+        total += stats.expired;
+        ++passes;
+    }
+    EXPECT_EQ(expired, count);
+    EXPECT_EQ(total, size_t(count));
+    EXPECT_LT(1u, passes);
+    EXPECT_TRUE(ctx.global.hasKey("persistent"));
+
+    graft::GlobalContextMap::CleanupStats stats = graft::Context::GlobalFriend::cleanup(ctx.global, std::chrono::seconds(1));
+    EXPECT_EQ(stats.expired, 0u);
+    EXPECT_EQ(stats.buckets, 64u);
+}
+
+TEST(Context, cleanupBehindLiveEntries)
+{
+    //the expired entries are at the tail of the only bucket, behind many live ones
+    graft::TSHashtable<std::string, int> table(1);
+    const int count = 1000;
+    for(int i = 0; i < count; ++i)
+    {
+        table.addOrUpdate("expiring" + std::to_string(i), i, std::chrono::seconds(1));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1200));
+    for(int i = 0; i < 10 * count; ++i)
+    {
+        table.addOrUpdate("live" + std::to_string(i), i);
+    }
+
+    //each pass stops at the first deadline check, the next one goes on from there
+    size_t passes = 0, total = 0;
+    while(total < size_t(count) && passes < size_t(count))
+    {
+        total += table.cleanup(std::chrono::steady_clock::duration::zero()).expired;
+        ++passes;
+    }
+    EXPECT_EQ(total, size_t(count));
+    EXPECT_FALSE(table.hasKey("expiring0"));
+    EXPECT_TRUE(table.hasKey("live0"));
+}
+
+TEST(Context, cleanupBudgetFromConfig)
+{
+    graft::ConfigOpts copts;
+    copts.gcm_cleanup_budget_us = 1;
+    EXPECT_EQ(copts.gcm_cleanup_budget(), std::chrono::microseconds(1));
+    //0 is no limit
+    copts.gcm_cleanup_budget_us = 0;
+    EXPECT_EQ(copts.gcm_cleanup_budget(), std::chrono::steady_clock::duration::max());
+
+    graft::GlobalContextMap m;
+    graft::Context ctx(m);
+
+    const int count = 5000;
+    for(int i = 0; i < count; ++i)
+    {
+        ctx.global.set(std::to_string(i), i, std::chrono::seconds(1));
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1200));
+    //a single pass without limit visits all the buckets
+    graft::GlobalContextMap::CleanupStats stats = graft::Context::GlobalFriend::cleanup(ctx.global, copts.gcm_cleanup_budget());
+    EXPECT_EQ(stats.expired, size_t(count));
+    EXPECT_EQ(stats.buckets, 64u);
+}
+
+TEST(Context, watch)
+{
+    graft::GlobalContextMap m;
+    graft::Context ctx(m);
+
+    std::map<std::string, int> woken;
+    auto waiter = [&woken](const std::string& key){ ++woken[key]; };
+
+    ctx.global.watch("a", waiter);
+    ctx.global.watch("a", waiter);
+    ctx.global.watch("b", waiter);
+    ctx.global["c"] = 1;
+    EXPECT_TRUE(woken.empty());
+
+    //each waiter is woken once
+    ctx.global["a"] = 1;
+    ctx.global["a"] = 2;
+    EXPECT_EQ(woken["a"], 2);
+
+    ctx.global["b"] = 1;
+    ctx.global.watch("b", waiter);
+    ctx.global.remove("b");
+    EXPECT_EQ(woken["b"], 2);
+
+    ctx.global.set("d", 1, std::chrono::seconds(1));
+    ctx.global.watch("d", waiter);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1200));
+    graft::Context::GlobalFriend::cleanup(ctx.global, true);
+    EXPECT_EQ(woken["d"], 1);
+    EXPECT_FALSE(ctx.global.hasKey("d"));
+
+    //a removed waiter is not woken, the others of the key are
+    graft::GlobalContextMap::WatchId id = ctx.global.watch("e", waiter);
+    ctx.global.watch("e", waiter);
+    EXPECT_EQ(m.waiters(), 2u);
+    ctx.global.unwatch("e", id);
+    ctx.global.unwatch("e", id);
+    EXPECT_EQ(m.waiters(), 1u);
+    ctx.global["e"] = 1;
+    EXPECT_EQ(woken["e"], 1);
+    EXPECT_EQ(m.waiters(), 0u);
+}
+
 TEST(Context, groupSimple)
 {
     graft::GlobalContextMap m;
@@ -496,6 +638,43 @@ TEST(Context, groupSimple)
     EXPECT_EQ(ctx.global.groupGet<int>("A","b",0), 22);
 }
 
+TEST(Context, snapshot)
+{
+    std::string filename = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()).string();
+
+    graft::ContextSnapshot snapshot;
+    snapshot.addNamespace<int>(":status");
+    snapshot.addNamespace<std::string>(":details");
+
+    {
+        graft::GlobalContextMap m;
+        graft::Context ctx(m);
+        ctx.global["a:status"] = 1;
+        ctx.global.set("b:status", 2, std::chrono::seconds(100));
+        ctx.global.set("c:status", 3, std::chrono::seconds(100), [](std::pair<std::string, std::any>&){ });
+        ctx.global["a:details"] = std::string("details");
+        ctx.global["a:other"] = 4;
+        EXPECT_EQ(snapshot.save(m, filename), 3);
+    }
+
+    graft::GlobalContextMap m;
+    graft::Context ctx(m);
+    ctx.global["a:status"] = 10;
+    EXPECT_EQ(snapshot.load(m, filename), 2);
+    EXPECT_EQ(ctx.global.get("a:status", 0), 10);
+    EXPECT_EQ(ctx.global.get("b:status", 0), 2);
+    EXPECT_FALSE(ctx.global.hasKey("c:status"));
+    EXPECT_EQ(ctx.global.get("a:details", std::string()), "details");
+    EXPECT_FALSE(ctx.global.hasKey("a:other"));
+
+    //only selected namespaces
+    graft::GlobalContextMap m1;
+    snapshot.selectNamespaces({":details"});
+    EXPECT_EQ(snapshot.load(m1, filename), 1);
+
+    boost::filesystem::remove(filename);
+}
+
 TEST(ExpiringList, common)
 {
     graft::detail::ExpiringListT<int> el(200); //lifetime 200 ms
@@ -777,6 +956,933 @@ TEST_F(GraftServerTestBase, clientTimeout)
     server.stop_and_wait_for();
 }
 
+TEST_F(GraftServerTestBase, keepAlive)
+{
+    auto action = [](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        output.body = "ok";
+        return graft::Status::Ok;
+    };
+
+    MainServer server;
+    server.m_copts.http_keep_alive_requests = 2;
+    server.m_router.addRoute("/keepalive", METHOD_GET, {nullptr, action, nullptr});
+    server.run();
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_LE(0, fd);
+    sockaddr_in sa{};
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(9084);
+    inet_pton(AF_INET, "127.0.0.1", &sa.sin_addr);
+    ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)));
+
+    auto exchange = [fd](const std::string& request)->std::string
+    {
+        EXPECT_EQ(request.size(), send(fd, request.c_str(), request.size(), 0));
+        std::string res;
+        char buf[1024];
+        for(;;)
+        {
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if(n <= 0) break;
+            res.append(buf, n);
+            //the response is complete with the body of Content-Length
+            size_t end = res.find("\r\n\r\n");
+            size_t cl = res.find("Content-Length: ");
+            if(end == std::string::npos || cl == std::string::npos || end < cl) continue;
+            if(end + 4 + std::stoul(res.substr(cl + 16)) <= res.size()) break;
+        }
+        return res;
+    };
+
+    const std::string request = "GET /keepalive HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    std::string res = exchange(request);
+    EXPECT_NE(std::string::npos, res.find("Connection: keep-alive"));
+    EXPECT_EQ("ok", res.substr(res.size() - 2));
+    //the same connection, the last request of it
+    res = exchange(request);
+    EXPECT_NE(std::string::npos, res.find("Connection: close"));
+    EXPECT_EQ("ok", res.substr(res.size() - 2));
+    char c;
+    EXPECT_EQ(0, recv(fd, &c, 1, 0));
+    close(fd);
+
+    server.stop_and_wait_for();
+}
+
+TEST_F(GraftServerTestBase, chunkedReply)
+{
+    const int count = 200;
+    const std::string padding(1000, 'x');
+    auto action = [&](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        auto next = std::make_shared<int>(0);
+        //the endless stream is read partly by the client
+        bool endless = (vars.find("kind")->second == "endless");
+        output.stream = [next, endless, count, padding](std::string& chunk)->bool
+        {
+            chunk = std::to_string((*next)++) + padding;
+            return endless || *next < count;
+        };
+        return graft::Status::Ok;
+    };
+
+    MainServer server;
+    server.m_copts.http_keep_alive_requests = 2;
+    server.m_router.addRoute("/chunked/{kind}", METHOD_GET, {nullptr, action, nullptr});
+    server.run();
+
+    //the client puts the chunks together
+    std::string expected;
+    for(int i = 0; i < count; ++i) expected += std::to_string(i) + padding;
+    {
+        Client client;
+        client.serve("http://127.0.0.1:9084/chunked/finite");
+        EXPECT_EQ(200, client.get_resp_code());
+        EXPECT_EQ(expected, client.get_body());
+    }
+
+    auto connectServer = []()->int
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in sa{};
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(9084);
+        inet_pton(AF_INET, "127.0.0.1", &sa.sin_addr);
+        EXPECT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)));
+        return fd;
+    };
+    auto receiveHead = [](int fd)->std::string
+    {
+        std::string res;
+        char buf[1024];
+        while(res.find("\r\n\r\n") == std::string::npos)
+        {
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if(n <= 0) break;
+            res.append(buf, n);
+        }
+        return res.substr(0, res.find("\r\n\r\n"));
+    };
+
+    //a keep-alive connection closed by the client in the middle of the reply, several times,
+    //so the requests counted for it are not inherited by a connection that reuses its state
+    for(int i = 0; i < 3; ++i)
+    {
+        int fd = connectServer();
+        std::string request = "GET /chunked/endless HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+        EXPECT_EQ(request.size(), send(fd, request.c_str(), request.size(), 0));
+        std::string head = receiveHead(fd);
+        EXPECT_NE(std::string::npos, head.find("Transfer-Encoding: chunked"));
+        EXPECT_NE(std::string::npos, head.find("Connection: keep-alive"));
+        close(fd);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    //the server goes on
+    Client client;
+    client.serve("http://127.0.0.1:9084/chunked/finite");
+    EXPECT_EQ(200, client.get_resp_code());
+    EXPECT_EQ(expected, client.get_body());
+
+    server.stop_and_wait_for();
+}
+
+//CoAP client over a UDP socket, the messages are composed and parsed by mongoose
+class CoapTestClient
+{
+public:
+    struct Message
+    {
+        uint8_t type = MG_COAP_MSG_CON;
+        uint16_t msgId = 0;
+        std::string token;
+        graft::coap::Code code{0, 1};
+        std::multimap<uint32_t, std::string> options;
+        std::string payload;
+
+        bool hasOption(uint32_t number) const { return options.count(number); }
+        std::string option(uint32_t number) const
+        {
+            auto it = options.find(number);
+            return (it == options.end())? std::string() : it->second;
+        }
+    };
+
+    CoapTestClient(uint16_t port)
+    {
+        m_fd = socket(AF_INET, SOCK_DGRAM, 0);
+        assert(0 <= m_fd);
+        sockaddr_in sa{};
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(port);
+        inet_pton(AF_INET, "127.0.0.1", &sa.sin_addr);
+        int res = connect(m_fd, reinterpret_cast<sockaddr*>(&sa), sizeof(sa));
+        assert(res == 0);
+    }
+    ~CoapTestClient() { close(m_fd); }
+
+    void send(const Message& msg)
+    {
+        mg_coap_message cm;
+        memset(&cm, 0, sizeof(cm));
+        cm.msg_type = msg.type;
+        cm.msg_id = msg.msgId;
+        cm.code_class = msg.code.cls;
+        cm.code_detail = msg.code.detail;
+        cm.token.p = msg.token.data();
+        cm.token.len = msg.token.size();
+        for(auto& opt : msg.options)
+        {
+            mg_coap_add_option(&cm, opt.first, const_cast<char*>(opt.second.data()), opt.second.size());
+        }
+        cm.payload.p = msg.payload.data();
+        cm.payload.len = msg.payload.size();
+
+        mbuf io;
+        mbuf_init(&io, 0);
+        uint32_t res = mg_coap_compose(&cm, &io);
+        mg_coap_free_options(&cm);
+        EXPECT_EQ(res, 0);
+        EXPECT_EQ(::send(m_fd, io.buf, io.len, 0), ssize_t(io.len));
+        mbuf_free(&io);
+    }
+
+    //returns false if nothing is received within the timeout
+    bool receive(Message& msg, int timeout_ms = 2000)
+    {
+        pollfd pfd{m_fd, POLLIN, 0};
+        if(poll(&pfd, 1, timeout_ms) <= 0) return false;
+        char buf[2048];
+        ssize_t n = recv(m_fd, buf, sizeof(buf), 0);
+        if(n <= 0) return false;
+
+        mbuf io;
+        mbuf_init(&io, 0);
+        mbuf_append(&io, buf, n);
+        mg_coap_message cm;
+        mg_coap_parse(&io, &cm);
+        bool ok = !(cm.flags & (MG_COAP_FORMAT_ERROR | MG_COAP_NOT_ENOUGH_DATA));
+        if(ok)
+        {
+            msg = Message();
+            msg.type = cm.msg_type;
+            msg.msgId = cm.msg_id;
+            msg.token.assign(cm.token.p, cm.token.len);
+            msg.code = graft::coap::Code{cm.code_class, cm.code_detail};
+            for(mg_coap_option* opt = cm.options; opt; opt = opt->next)
+            {
+                msg.options.emplace(opt->number, std::string(opt->value.p, opt->value.len));
+            }
+            msg.payload.assign(cm.payload.p, cm.payload.len);
+        }
+        mg_coap_free_options(&cm);
+        mbuf_free(&io);
+        return ok;
+    }
+
+    static Message request(uint16_t msgId, graft::coap::Code code, const std::vector<std::string>& path)
+    {
+        Message msg;
+        msg.msgId = msgId;
+        msg.token = "tk";
+        msg.code = code;
+        for(auto& segment : path) msg.options.emplace(graft::coap::OPT_URI_PATH, segment);
+        return msg;
+    }
+
+private:
+    int m_fd;
+};
+
+const graft::coap::Code COAP_GET{0, 1};
+const graft::coap::Code COAP_POST{0, 2};
+
+namespace graft { namespace coap {
+
+//for EXPECT_EQ, they are found by ADL
+bool operator == (const Code& a, const Code& b) { return a.cls == b.cls && a.detail == b.detail; }
+
+std::ostream& operator << (std::ostream& os, const Code& code)
+{
+    return os << int(code.cls) << "." << std::setw(2) << std::setfill('0') << int(code.detail);
+}
+
+} } //namespace graft::coap
+
+TEST_F(GraftServerTestBase, coapConfirmable)
+{
+    using namespace graft;
+    std::atomic<int> calls{0};
+    auto action = [&calls](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        ++calls;
+        output.body = "ok";
+        return graft::Status::Ok;
+    };
+
+    MainServer server;
+    server.m_coapRouter.addRoute("/coap/echo", METHOD_GET, {nullptr, action, nullptr});
+    server.run();
+
+    CoapTestClient client(9086);
+    CoapTestClient::Message req = CoapTestClient::request(0x1234, COAP_GET, {"coap", "echo"}), rep;
+    client.send(req);
+    ASSERT_TRUE(client.receive(rep));
+    //the response is piggybacked in the ACK
+    EXPECT_EQ(rep.type, MG_COAP_MSG_ACK);
+    EXPECT_EQ(rep.msgId, 0x1234);
+    EXPECT_EQ(rep.token, "tk");
+    EXPECT_EQ(rep.code, coap::CONTENT);
+    EXPECT_EQ(rep.option(coap::OPT_CONTENT_FORMAT), coap::encodeUint(coap::CONTENT_FORMAT_JSON));
+    EXPECT_EQ(rep.payload, "ok");
+
+    //the ACK is lost, the same ACK is sent again for the repeated message without running the handler
+    client.send(req);
+    CoapTestClient::Message rep2;
+    ASSERT_TRUE(client.receive(rep2));
+    EXPECT_EQ(rep2.type, MG_COAP_MSG_ACK);
+    EXPECT_EQ(rep2.msgId, 0x1234);
+    EXPECT_EQ(rep2.payload, "ok");
+    EXPECT_EQ(calls.load(), 1);
+
+    //a new message id is a new request
+    req.msgId = 0x1235;
+    client.send(req);
+    ASSERT_TRUE(client.receive(rep));
+    EXPECT_EQ(rep.msgId, 0x1235);
+    EXPECT_EQ(calls.load(), 2);
+
+    //unknown resource
+    client.send(CoapTestClient::request(0x1236, COAP_GET, {"coap", "unknown"}));
+    ASSERT_TRUE(client.receive(rep));
+    EXPECT_EQ(rep.code, coap::NOT_FOUND);
+
+    server.stop_and_wait_for();
+}
+
+TEST_F(GraftServerTestBase, coapBlockwise)
+{
+    using namespace graft;
+    std::string data;
+    for(int i = 0; i < 100; ++i) data += char('a' + i % 26);
+
+    std::atomic<int> calls{0};
+    auto upload = [data](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        output.body = (input.body == data.substr(0, 40))? "complete" : "incomplete";
+        return graft::Status::Ok;
+    };
+    auto download = [data, &calls](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        ++calls;
+        output.body = data;
+        return graft::Status::Ok;
+    };
+
+    MainServer server;
+    server.m_copts.coap_block_size = 32;
+    server.m_coapRouter.addRoute("/upload", METHOD_POST, {nullptr, upload, nullptr});
+    server.m_coapRouter.addRoute("/download", METHOD_GET, {nullptr, download, nullptr});
+    server.run();
+
+    CoapTestClient client(9086);
+    uint16_t msgId = 100;
+    CoapTestClient::Message rep;
+
+    //Block1, 40 bytes in blocks of 16
+    for(uint32_t num = 0; num < 3; ++num)
+    {
+        coap::Block block;
+        block.num = num;
+        block.szx = 0;
+        block.more = (num < 2);
+        CoapTestClient::Message req = CoapTestClient::request(++msgId, COAP_POST, {"upload"});
+        req.options.emplace(coap::OPT_BLOCK1, block.encode());
+        req.payload = data.substr(block.offset(), std::min<size_t>(16, 40 - block.offset()));
+        client.send(req);
+        ASSERT_TRUE(client.receive(rep));
+        EXPECT_EQ(rep.msgId, msgId);
+
+        coap::Block echo;
+        std::string value = rep.option(coap::OPT_BLOCK1);
+        ASSERT_TRUE(coap::Block::decode(value.data(), value.size(), echo));
+        EXPECT_EQ(echo.num, num);
+        EXPECT_EQ(echo.more, block.more);
+        if(block.more)
+        {
+            EXPECT_EQ(rep.code, coap::CONTINUE);
+            continue;
+        }
+        EXPECT_EQ(rep.code, coap::CHANGED);
+        EXPECT_EQ(rep.payload, "complete");
+    }
+
+    //Block2, 100 bytes in blocks of coap-block-size
+    std::string received;
+    for(uint32_t num = 0;; ++num)
+    {
+        CoapTestClient::Message req = CoapTestClient::request(++msgId, COAP_GET, {"download"});
+        if(0 < num)
+        {
+            coap::Block block;
+            block.num = num;
+            block.szx = coap::Block::szxOf(32);
+            req.options.emplace(coap::OPT_BLOCK2, block.encode());
+        }
+        client.send(req);
+        ASSERT_TRUE(client.receive(rep));
+        EXPECT_EQ(rep.code, coap::CONTENT);
+
+        coap::Block block;
+        std::string value = rep.option(coap::OPT_BLOCK2);
+        ASSERT_TRUE(coap::Block::decode(value.data(), value.size(), block));
+        EXPECT_EQ(block.num, num);
+        EXPECT_EQ(block.size(), 32u);
+        if(num == 0)
+        {
+            EXPECT_EQ(rep.option(coap::OPT_SIZE2), coap::encodeUint(data.size()));
+        }
+        received += rep.payload;
+        if(!block.more) break;
+        ASSERT_LT(num, 4u);
+    }
+    EXPECT_EQ(received, data);
+    //the next blocks are of the kept representation
+    EXPECT_EQ(calls.load(), 1);
+
+    server.stop_and_wait_for();
+}
+
+TEST_F(GraftServerTestBase, coapObserve)
+{
+    using namespace graft;
+    std::atomic<int> value{0};
+    auto action = [&value](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        output.body = std::to_string(value);
+        return graft::Status::Ok;
+    };
+
+    MainServer server;
+    server.m_copts.coap_observe_interval_ms = 50;
+    //the peer is not closed while it is observing
+    server.m_copts.http_connection_timeout = 5;
+    server.m_coapRouter.addRoute("/observe", METHOD_GET, {nullptr, action, nullptr});
+    server.run();
+
+    CoapTestClient client(9086);
+    CoapTestClient::Message req = CoapTestClient::request(1, COAP_GET, {"observe"}), rep;
+    req.options.emplace(coap::OPT_OBSERVE, coap::encodeUint(coap::OBSERVE_REGISTER));
+    client.send(req);
+    ASSERT_TRUE(client.receive(rep));
+    EXPECT_EQ(rep.type, MG_COAP_MSG_ACK);
+    EXPECT_EQ(rep.code, coap::CONTENT);
+    EXPECT_EQ(rep.payload, "0");
+    ASSERT_TRUE(rep.hasOption(coap::OPT_OBSERVE));
+    uint32_t seq0 = 0;
+    std::string observe = rep.option(coap::OPT_OBSERVE);
+    EXPECT_TRUE(coap::decodeUint(observe.data(), observe.size(), seq0));
+
+    //nothing is sent while the representation is the same
+    EXPECT_FALSE(client.receive(rep, 300));
+
+    value = 1;
+    ASSERT_TRUE(client.receive(rep));
+    EXPECT_EQ(rep.type, MG_COAP_MSG_NOC);
+    EXPECT_EQ(rep.token, "tk");
+    EXPECT_EQ(rep.payload, "1");
+    uint32_t seq1 = 0;
+    observe = rep.option(coap::OPT_OBSERVE);
+    EXPECT_TRUE(coap::decodeUint(observe.data(), observe.size(), seq1));
+    EXPECT_LT(seq0, seq1);
+
+    //deregistration, the response is sent without Observe
+    req = CoapTestClient::request(2, COAP_GET, {"observe"});
+    req.options.emplace(coap::OPT_OBSERVE, coap::encodeUint(coap::OBSERVE_DEREGISTER));
+    client.send(req);
+    ASSERT_TRUE(client.receive(rep));
+    EXPECT_EQ(rep.msgId, 2);
+    EXPECT_EQ(rep.payload, "1");
+    EXPECT_FALSE(rep.hasOption(coap::OPT_OBSERVE));
+
+    value = 2;
+    EXPECT_FALSE(client.receive(rep, 300));
+
+    server.stop_and_wait_for();
+}
+
+TEST_F(GraftServerTestBase, coapObserveUnsafe)
+{
+    using namespace graft;
+    std::atomic<int> calls{0};
+    auto action = [&calls](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        output.body = std::to_string(++calls);
+        return graft::Status::Ok;
+    };
+
+    MainServer server;
+    server.m_copts.coap_observe_interval_ms = 50;
+    server.m_copts.http_connection_timeout = 5;
+    server.m_coapRouter.addRoute("/pay", METHOD_POST, {nullptr, action, nullptr});
+    server.m_coapRouter.addRoute("/status", METHOD_POST, {nullptr, action, nullptr});
+    server.m_initCoap = [](graft::ConnectionManager& cm)
+    {
+        static_cast<graft::CoapConnectionManager&>(cm).addObservable("/status");
+    };
+    server.run();
+
+    //a request with side effects is answered once without Observe
+    CoapTestClient client(9086);
+    CoapTestClient::Message req = CoapTestClient::request(1, COAP_POST, {"pay"}), rep;
+    req.options.emplace(coap::OPT_OBSERVE, coap::encodeUint(coap::OBSERVE_REGISTER));
+    client.send(req);
+    ASSERT_TRUE(client.receive(rep));
+    EXPECT_EQ(rep.code, coap::CHANGED);
+    EXPECT_EQ(rep.payload, "1");
+    EXPECT_FALSE(rep.hasOption(coap::OPT_OBSERVE));
+    EXPECT_FALSE(client.receive(rep, 300));
+    EXPECT_EQ(calls, 1);
+
+    //the observable path is repeated
+    req = CoapTestClient::request(2, COAP_POST, {"status"});
+    req.options.emplace(coap::OPT_OBSERVE, coap::encodeUint(coap::OBSERVE_REGISTER));
+    client.send(req);
+    ASSERT_TRUE(client.receive(rep));
+    EXPECT_EQ(rep.code, coap::CONTENT);
+    EXPECT_TRUE(rep.hasOption(coap::OPT_OBSERVE));
+    //each repetition returns a new representation, it is notified
+    ASSERT_TRUE(client.receive(rep));
+    EXPECT_EQ(rep.type, MG_COAP_MSG_NOC);
+    EXPECT_LT(2, calls);
+
+    server.stop_and_wait_for();
+}
+
+//WebSocket client, the frames are collected by mongoose of the client
+class WebSocketTestClient
+{
+public:
+    std::deque<std::string> frames;
+    bool handshake = false;
+    bool closed = false;
+
+    WebSocketTestClient(const std::string& url)
+    {
+        mg_mgr_init(&m_mgr, nullptr, nullptr);
+        m_client = mg_connect_ws(&m_mgr, graft::static_ev_handler<WebSocketTestClient>, url.c_str(), nullptr, nullptr);
+        assert(m_client);
+        m_client->user_data = this;
+    }
+
+    ~WebSocketTestClient()
+    {
+        mg_mgr_free(&m_mgr);
+    }
+
+    void send(const std::string& text)
+    {
+        mg_send_websocket_frame(m_client, WEBSOCKET_OP_TEXT, text.data(), text.size());
+    }
+
+    void close()
+    {
+        m_client->flags |= MG_F_CLOSE_IMMEDIATELY;
+        wait([this]{ return closed; });
+    }
+
+    //polls till the condition is met; returns false on timeout
+    bool wait(std::function<bool ()> cond, int timeout_ms = 2000)
+    {
+        auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while(!cond())
+        {
+            if(end <= std::chrono::steady_clock::now()) return false;
+            mg_mgr_poll(&m_mgr, 10);
+        }
+        return true;
+    }
+
+    void ev_handler(mg_connection* client, int ev, void *ev_data)
+    {
+        switch(ev)
+        {
+        case MG_EV_WEBSOCKET_HANDSHAKE_DONE:
+        {
+            handshake = true;
+        } break;
+        case MG_EV_WEBSOCKET_FRAME:
+        {
+            websocket_message* wm = static_cast<websocket_message*>(ev_data);
+            if((wm->flags & 0x0f) == WEBSOCKET_OP_TEXT)
+                frames.emplace_back(reinterpret_cast<const char*>(wm->data), wm->size);
+        } break;
+        case MG_EV_CLOSE:
+        {
+            client->handler = graft::static_empty_ev_handler;
+            closed = true;
+        } break;
+        }
+    }
+
+private:
+    mg_mgr m_mgr;
+    mg_connection* m_client = nullptr;
+};
+
+TEST_F(GraftServerTestBase, paymentStatusSubscription)
+{
+    using namespace graft::supernode::request;
+
+    graft::HttpConnectionManager* httpcm = nullptr;
+
+    MainServer server;
+    //the subscribers are pinged instead of being closed
+    server.m_copts.http_connection_timeout = 5;
+    server.m_initHttp = [&httpcm](graft::ConnectionManager& cm)
+    {
+        registerPaymentStatusSubscription(cm);
+        httpcm = static_cast<graft::HttpConnectionManager*>(&cm);
+    };
+    server.run();
+    ASSERT_TRUE(httpcm);
+
+    auto status = [](const std::string& frame)->int
+    {
+        PaymentStatus ps;
+        graft::serializer::JSON<PaymentStatus>::deserialize(frame, ps);
+        EXPECT_EQ(ps.PaymentID, "pid");
+        return ps.Status;
+    };
+    auto waitSubscriptions = [httpcm](size_t count)
+    {
+        auto end = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while(httpcm->subscriptions() != count && std::chrono::steady_clock::now() < end)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return httpcm->subscriptions() == count;
+    };
+
+    graft::Context ctx(server.getGcm());
+    setPaymentStatus(ctx, "pid", static_cast<int>(graft::RTAStatus::Waiting));
+
+    const std::string url = "ws://127.0.0.1:9084/dapi/v2.0/subscribe";
+    WebSocketTestClient ws1(url), ws2(url);
+    for(WebSocketTestClient* ws : {&ws1, &ws2})
+    {
+        ASSERT_TRUE(ws->wait([ws]{ return ws->handshake; }));
+        ws->send("{\"PaymentID\":\"pid\"}");
+        //the reply is the current status
+        ASSERT_TRUE(ws->wait([ws]{ return !ws->frames.empty(); }));
+        EXPECT_EQ(status(ws->frames.front()), static_cast<int>(graft::RTAStatus::Waiting));
+        ws->frames.clear();
+    }
+    EXPECT_EQ(httpcm->subscriptions(), 2u);
+
+    //the change is pushed to each subscriber
+    setPaymentStatus(ctx, "pid", static_cast<int>(graft::RTAStatus::InProgress));
+    for(WebSocketTestClient* ws : {&ws1, &ws2})
+    {
+        ASSERT_TRUE(ws->wait([ws]{ return !ws->frames.empty(); }));
+        EXPECT_EQ(status(ws->frames.front()), static_cast<int>(graft::RTAStatus::InProgress));
+        ws->frames.clear();
+    }
+
+    //the closed subscriber is dropped
+    ws1.close();
+    EXPECT_TRUE(waitSubscriptions(1));
+
+    //the unsubscribed one too, it subscribes again
+    ws2.send("{\"PaymentID\":\"pid\",\"Unsubscribe\":true}");
+    EXPECT_TRUE(waitSubscriptions(0));
+    ws2.send("{\"PaymentID\":\"pid\"}");
+    ASSERT_TRUE(ws2.wait([&ws2]{ return !ws2.frames.empty(); }));
+    EXPECT_EQ(status(ws2.frames.front()), static_cast<int>(graft::RTAStatus::InProgress));
+    ws2.frames.clear();
+    EXPECT_TRUE(waitSubscriptions(1));
+
+    //the final status ends the subscriptions
+    setPaymentStatus(ctx, "pid", static_cast<int>(graft::RTAStatus::Success));
+    ASSERT_TRUE(ws2.wait([&ws2]{ return !ws2.frames.empty(); }));
+    EXPECT_EQ(status(ws2.frames.front()), static_cast<int>(graft::RTAStatus::Success));
+    ws2.frames.clear();
+    EXPECT_TRUE(waitSubscriptions(0));
+    EXPECT_TRUE(ws1.frames.empty());
+
+    //a final status is replied without subscription
+    ws2.send("{\"PaymentID\":\"pid\"}");
+    ASSERT_TRUE(ws2.wait([&ws2]{ return !ws2.frames.empty(); }));
+    EXPECT_EQ(status(ws2.frames.front()), static_cast<int>(graft::RTAStatus::Success));
+    ws2.frames.clear();
+    EXPECT_EQ(httpcm->subscriptions(), 0u);
+
+    //the removed status ends the subscriptions
+    setPaymentStatus(ctx, "pid", static_cast<int>(graft::RTAStatus::InProgress));
+    ws2.send("{\"PaymentID\":\"pid\"}");
+    ASSERT_TRUE(ws2.wait([&ws2]{ return !ws2.frames.empty(); }));
+    EXPECT_TRUE(waitSubscriptions(1));
+    removePaymentStatus(ctx, "pid");
+    EXPECT_TRUE(waitSubscriptions(0));
+
+    //an unknown payment is not subscribed to
+    WebSocketTestClient ws3(url);
+    ASSERT_TRUE(ws3.wait([&ws3]{ return ws3.handshake; }));
+    ws3.send("{\"PaymentID\":\"unknown\"}");
+    EXPECT_FALSE(ws3.wait([&ws3]{ return !ws3.frames.empty(); }, 300));
+    EXPECT_EQ(httpcm->subscriptions(), 0u);
+
+    server.stop_and_wait_for();
+}
+
+TEST_F(GraftServerTestBase, paymentStatusExpiry)
+{
+    using namespace graft::supernode::request;
+
+    graft::HttpConnectionManager* httpcm = nullptr;
+
+    MainServer server;
+    //the topics are checked when the subscribers are pinged
+    server.m_copts.http_connection_timeout = 1;
+    server.m_initHttp = [&httpcm](graft::ConnectionManager& cm)
+    {
+        registerPaymentStatusSubscription(cm);
+        httpcm = static_cast<graft::HttpConnectionManager*>(&cm);
+    };
+    server.run();
+    ASSERT_TRUE(httpcm);
+
+    graft::Context ctx(server.getGcm());
+    setPaymentStatus(ctx, "pid", static_cast<int>(graft::RTAStatus::InProgress));
+
+    WebSocketTestClient ws("ws://127.0.0.1:9084/dapi/v2.0/subscribe");
+    ASSERT_TRUE(ws.wait([&ws]{ return ws.handshake; }));
+    ws.send("{\"PaymentID\":\"pid\"}");
+    ASSERT_TRUE(ws.wait([&ws]{ return !ws.frames.empty(); }));
+    EXPECT_EQ(httpcm->subscriptions(), 1u);
+
+    //the key is gone without a notification, as when it expires
+    ctx.global.remove("pid" + CONTEXT_KEY_STATUS);
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(3);
+    while(httpcm->subscriptions() != 0 && std::chrono::steady_clock::now() < end)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(httpcm->subscriptions(), 0u);
+
+    server.stop_and_wait_for();
+}
+
+TEST_F(GraftServerTestBase, resumeOnChange)
+{
+    auto action = [](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        const std::string key = "key" + vars.find("id")->second;
+        ctx.resumeOnChange(key);
+        if(!ctx.global.hasKey(key)) return graft::Status::Postpone;
+        output.body = ctx.global.get(key, std::string());
+        return graft::Status::Ok;
+    };
+
+    MainServer server;
+    server.m_copts.http_connection_timeout = 1;
+    server.m_router.addRoute("/watch/{id:[0-9]+}", METHOD_GET, {nullptr, action, nullptr});
+    server.run();
+
+    //the postponed task is resumed when the key is set
+    std::thread setter([&server]
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        graft::Context ctx(server.getGcm());
+        ctx.global["key1"] = std::string("value1");
+    });
+    Client client;
+    client.serve("http://127.0.0.1:9084/watch/1");
+    setter.join();
+    EXPECT_FALSE(client.get_closed());
+    EXPECT_EQ(client.get_resp_code(), 200);
+    EXPECT_EQ(client.get_body(), "value1");
+    EXPECT_EQ(server.getGcm().waiters(), 0u);
+
+    //the waiter of the expired task is removed, a later change of the key resumes nothing
+    Client client2;
+    client2.serve("http://127.0.0.1:9084/watch/2");
+    EXPECT_NE(client2.get_resp_code(), 200);
+    EXPECT_EQ(server.getGcm().waiters(), 0u);
+    graft::Context ctx(server.getGcm());
+    ctx.global["key2"] = std::string("value2");
+
+    server.stop_and_wait_for();
+}
+
+//The webhook queue of the test server and an upstream that fails the first requests of a path
+class WebHookQueueTest : public GraftServerTestBase
+{
+protected:
+    using WebHookQueue = graft::walletnode::WebHookQueue;
+    using clock = std::chrono::steady_clock;
+
+    struct Arrival
+    {
+        std::string path;
+        clock::time_point time;
+    };
+
+    std::mutex m_mutex;
+    std::vector<Arrival> m_arrivals;
+    std::map<std::string, int> m_failures; //by path, the requests answered with 500
+    std::atomic_bool m_hold{false}; //the requests are not answered
+    TempCryptoNodeServer m_upstream;
+    MainServer m_server;
+    std::unique_ptr<WebHookQueue> m_queue;
+
+    void start()
+    {
+        m_upstream.on_http = [this](const http_message* hm, int& status_code, std::string& headers, std::string& data)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::string path(hm->uri.p, hm->uri.len);
+            m_arrivals.push_back({path, clock::now()});
+            if(m_hold) return false;
+            int& failures = m_failures[path];
+            status_code = failures? 500 : 200;
+            if(failures) --failures;
+            return true;
+        };
+        m_upstream.run();
+
+        //it is called by the server thread before the server is started
+        m_server.m_initHttp = [this](graft::ConnectionManager&)
+        {
+            m_queue = std::make_unique<WebHookQueue>(m_server.getGcm());
+            auto pump = [this](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)
+            {
+                m_queue->pump();
+                return graft::Status::Ok;
+            };
+            m_server.getLooper().addPeriodicTask(graft::Router::Handler3(pump, nullptr, nullptr), std::chrono::milliseconds(50));
+        };
+        m_server.run();
+    }
+
+    void stop()
+    {
+        m_server.stop_and_wait_for();
+        m_upstream.stop_and_wait_for();
+        m_queue.reset();
+    }
+
+    bool push(const std::string& path)
+    {
+        graft::Output output;
+        output.proto = "http";
+        output.host = "127.0.0.1";
+        output.port = m_upstream.port;
+        output.path = path;
+        output.body = "{}";
+        return m_queue->push(output);
+    }
+
+    std::vector<Arrival> arrivals(const std::string& path = std::string())
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<Arrival> res;
+        std::copy_if(m_arrivals.begin(), m_arrivals.end(), std::back_inserter(res),
+                     [&path](const Arrival& a){ return path.empty() || a.path == path; });
+        return res;
+    }
+
+    bool wait(std::function<bool ()> cond, std::chrono::milliseconds timeout = std::chrono::milliseconds(5000))
+    {
+        auto end = clock::now() + timeout;
+        while(!cond())
+        {
+            if(end <= clock::now()) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return true;
+    }
+};
+
+TEST_F(WebHookQueueTest, retry)
+{
+    start();
+
+    m_failures["/a"] = 2;
+    ASSERT_TRUE(push("/a"));
+    ASSERT_TRUE(push("/b"));
+    //the first attempt of a has failed, c waits for its retry
+    ASSERT_TRUE(wait([this]{ return arrivals("/a").size() == 1; }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ASSERT_TRUE(push("/c"));
+
+    ASSERT_TRUE(wait([this]{ return m_queue->pending() == 0; }));
+
+    std::vector<Arrival> a = arrivals("/a"), b = arrivals("/b"), c = arrivals("/c");
+    ASSERT_EQ(a.size(), 3u);
+    EXPECT_EQ(b.size(), 1u);
+    ASSERT_EQ(c.size(), 1u);
+    //the delay is doubled with each attempt
+    const std::chrono::milliseconds delay(WebHookQueue::RETRY_BASE_DELAY_MS);
+    EXPECT_LE(delay, a[1].time - a[0].time);
+    EXPECT_LE(2 * delay, a[2].time - a[1].time);
+    //the deliveries of the host are in order, c is not sent before the retry of a
+    EXPECT_LE(delay, c[0].time - a[0].time);
+
+    stop();
+}
+
+TEST_F(WebHookQueueTest, inFlight)
+{
+    start();
+
+    m_hold = true;
+    for(int i = 0; i < 6; ++i)
+    {
+        ASSERT_TRUE(push("/h" + std::to_string(i)));
+    }
+    //none is answered, no more are sent to the host
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    std::vector<Arrival> sent = arrivals();
+    ASSERT_EQ(sent.size(), WebHookQueue::MAX_IN_FLIGHT);
+    std::set<std::string> paths;
+    for(auto& arrival : sent) paths.insert(arrival.path);
+    EXPECT_EQ(paths, std::set<std::string>({"/h0", "/h1", "/h2", "/h3"}));
+    EXPECT_EQ(m_queue->pending(), 6u);
+
+    //the held ones time out and are retried, the rest are sent after them
+    m_hold = false;
+    ASSERT_TRUE(wait([this]{ return m_queue->pending() == 0; }));
+    paths.clear();
+    for(auto& arrival : arrivals()) paths.insert(arrival.path);
+    EXPECT_EQ(paths.size(), 6u);
+
+    stop();
+}
+
+TEST_F(WebHookQueueTest, pendingLimit)
+{
+    start();
+
+    m_hold = true;
+    for(size_t i = 0; i < WebHookQueue::MAX_PENDING; ++i)
+    {
+        ASSERT_TRUE(push("/p"));
+    }
+    //the delivery is dropped
+    EXPECT_FALSE(push("/p"));
+    EXPECT_EQ(m_queue->pending(), WebHookQueue::MAX_PENDING);
+
+    //a delivery that is done makes room for another
+    m_hold = false;
+    ASSERT_TRUE(wait([this]{ return m_queue->pending() < WebHookQueue::MAX_PENDING; }));
+    EXPECT_TRUE(push("/p"));
+
+    stop();
+}
+
 //This test requires comparing logging output, their categories with expected.
 TEST_F(GraftServerTestBase, logging)
 {
@@ -1420,3 +2526,59 @@ TEST_F(GraftServerBlockingTest, common)
     mainServer.stop_and_wait_for();
     crypton.stop_and_wait_for();
 }
+
+TEST_F(GraftServerBlockingTest, async)
+{
+    TempCryptoN crypton;
+    crypton.answer = "crypton answer";
+    crypton.run();
+
+    std::promise<std::string> from_io, from_worker;
+    auto send = [&](graft::Context& ctx, std::promise<std::string>& promise)
+    {
+        Sstr ss; ss.s = "my string";
+        graft::Output out; out.load(ss);
+        bool ok = ctx.handlerAPI()->sendUpstreamAsync(out, [&promise](graft::Input& input, const std::string& err)
+        {
+            promise.set_value(err.empty()? input.body : err);
+        });
+        EXPECT_TRUE(ok);
+    };
+    auto pre_action = [&](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        send(ctx, from_io);
+        return graft::Status::Ok;
+    };
+    auto action = [&](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        send(ctx, from_worker);
+        return graft::Status::Ok;
+    };
+
+    MainServer mainServer;
+    mainServer.m_router.addRoute("/async_pre", METHOD_POST|METHOD_GET, graft::Router::Handler3(pre_action, nullptr, nullptr));
+    mainServer.m_router.addRoute("/async_worker", METHOD_POST|METHOD_GET, graft::Router::Handler3(nullptr, action, nullptr));
+    mainServer.run();
+
+    std::string post_data = "some data";
+    Client client;
+    client.serve("http://localhost:9084/async_pre", "", post_data);
+    EXPECT_EQ(200, client.get_resp_code());
+    client.serve("http://localhost:9084/async_worker", "", post_data);
+    EXPECT_EQ(200, client.get_resp_code());
+
+    //the handlers do not wait for the answers
+    auto f_io = from_io.get_future();
+    auto f_worker = from_worker.get_future();
+    ASSERT_EQ(std::future_status::ready, f_io.wait_for(std::chrono::seconds(5)));
+    ASSERT_EQ(std::future_status::ready, f_worker.wait_for(std::chrono::seconds(5)));
+    EXPECT_EQ(f_io.get(), crypton.answer);
+    EXPECT_EQ(f_worker.get(), crypton.answer);
+    //the body of the output is sent
+    Sstr ss; ss.s = "my string";
+    graft::Output out; out.load(ss);
+    EXPECT_EQ(crypton.body, out.body);
+
+    mainServer.stop_and_wait_for();
+    crypton.stop_and_wait_for();
+}
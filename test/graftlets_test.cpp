@@ -205,6 +205,28 @@ TEST(Graftlets, calls)
         EXPECT_EQ(true,false);
     }
 
+    try
+    {//handles are resolved once
+        std::function<int (int)> testInt1 = plugin.getHandle<int (int a)>("testGL.testInt1");
+        EXPECT_EQ(testInt1(5), 5);
+        EXPECT_EQ(testInt1(7), 7);
+
+        std::function<int (int&&, int, int&)> testInt2 = plugin.getHandle<int (int&&, int, int&)>("testGL.testInt2");
+        int a = 7;
+        int res = testInt2(3, 5, a);
+        EXPECT_EQ(a, 3 + 5);
+        EXPECT_EQ(res, a + 3 + 5);
+
+        EXPECT_THROW(plugin.getHandle<int (int)>("testGL.unknown"), std::runtime_error);
+        EXPECT_THROW(plugin.getHandle<int (std::string)>("testGL.testInt1"), std::runtime_error);
+        EXPECT_THROW(plugin.getHandle<int (int)>("unknownGL.testInt1"), std::runtime_error);
+    }
+    catch(std::exception& ex)
+    {
+        std::cout << ex.what() << "\n";
+        EXPECT_EQ(true,false);
+    }
+
     try
     {//testString1
         std::string a = "aaa";
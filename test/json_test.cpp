@@ -30,6 +30,8 @@
 #include "lib/graft/jsonrpc.h"
 
 #include <gtest/gtest.h>
+#include <map>
+#include <set>
 #include <string>
 
 using namespace std;
@@ -78,3 +80,263 @@ TEST(JsonParseTest, malformed_source)
     EXPECT_FALSE(in.get(resp));
 }
 
+
+GRAFT_DEFINE_IO_STRUCT_INITED(BinaryItem,
+     (std::string, id_key, ""),
+     (int64_t, delta, 0),
+     (bool, active, false)
+ );
+
+GRAFT_DEFINE_IO_STRUCT_INITED(BinaryMessage,
+     (uint64, amount, 0),
+     (std::string, text, ""),
+     (std::vector<BinaryItem>, items, std::vector<BinaryItem>()),
+     (double, ratio, 0)
+ );
+
+GRAFT_DEFINE_IO_STRUCT_INITED(BinaryMessageOld,
+     (uint64, amount, 0),
+     (std::string, text, "")
+ );
+
+GRAFT_DEFINE_IO_STRUCT_INITED(BinaryMessageNew,
+     (uint64, amount, 0),
+     (std::string, text, ""),
+     (std::vector<BinaryItem>, items, std::vector<BinaryItem>()),
+     (double, ratio, 0),
+     (std::string, extra, "extra")
+ );
+
+TEST(BinarySerializer, roundTrip)
+{
+    BinaryMessage msg;
+    msg.amount = 10000000000000;
+    msg.text = "Hello, World";
+    msg.ratio = 0.25;
+    for(int i = 0; i < 3; ++i)
+    {
+        BinaryItem item;
+        item.id_key = "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcde" + std::to_string(i);
+        item.delta = -1000 * i;
+        item.active = i % 2;
+        msg.items.push_back(item);
+    }
+    //upper case hex and odd length strings are kept as is
+    msg.items[2].id_key = "ABCDEF";
+
+    std::string bin = serializer::BINARY<BinaryMessage>::serialize(msg);
+    std::string json = serializer::JSON<BinaryMessage>::serialize(msg);
+    EXPECT_LT(bin.size(), json.size() / 2);
+
+    BinaryMessage res;
+    serializer::BINARY<BinaryMessage>::deserialize(bin, res);
+    EXPECT_EQ(serializer::JSON<BinaryMessage>::serialize(res), json);
+
+    BinaryMessage res64;
+    serializer::BINARY_B64<BinaryMessage>::deserialize(serializer::BINARY_B64<BinaryMessage>::serialize(msg), res64);
+    EXPECT_EQ(serializer::JSON<BinaryMessage>::serialize(res64), json);
+}
+
+TEST(BinarySerializer, compatibility)
+{
+    BinaryMessageNew msg;
+    msg.amount = 5;
+    msg.text = "abc";
+    msg.items.resize(2);
+    msg.items[1].delta = -7;
+
+    //older reader skips unknown fields
+    BinaryMessageOld old;
+    serializer::BINARY<BinaryMessageOld>::deserialize(serializer::BINARY<BinaryMessageNew>::serialize(msg), old);
+    EXPECT_EQ(old.amount, 5);
+    EXPECT_EQ(old.text, "abc");
+
+    //newer reader keeps defaults of absent fields
+    BinaryMessageNew res;
+    res.extra = "default";
+    serializer::BINARY<BinaryMessageNew>::deserialize(serializer::BINARY<BinaryMessageOld>::serialize(old), res);
+    EXPECT_EQ(res.amount, 5);
+    EXPECT_EQ(res.text, "abc");
+    EXPECT_TRUE(res.items.empty());
+    EXPECT_EQ(res.extra, "default");
+
+    BinaryMessage cur;
+    serializer::BINARY<BinaryMessage>::deserialize(serializer::BINARY<BinaryMessageNew>::serialize(msg), cur);
+    ASSERT_EQ(cur.items.size(), 2);
+    EXPECT_EQ(cur.items[1].delta, -7);
+}
+
+TEST(BinarySerializer, malformed)
+{
+    BinaryMessage msg;
+    msg.text = "Hello";
+    msg.items.resize(2);
+    std::string bin = serializer::BINARY<BinaryMessage>::serialize(msg);
+
+    //cut inside of the text, the items and the ratio
+    BinaryMessage res;
+    for(size_t len : {size_t(3), bin.size() - sizeof(double) - 1, bin.size() - 1})
+    {
+        EXPECT_THROW(serializer::BINARY<BinaryMessage>::deserialize(bin.substr(0, len), res), serializer::BinaryParseError);
+    }
+
+    Input in;
+    in.load(std::string("\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff", 11));
+    in.headers.push_back({"content-type", serializer::BINARY_CONTENT_TYPE});
+    EXPECT_FALSE(in.getNegotiated(res));
+}
+
+TEST(BinarySerializer, negotiation)
+{
+    BinaryMessage msg;
+    msg.amount = 3;
+    msg.text = "negotiated";
+
+    for(bool binary : {false, true})
+    {
+        Output out;
+        out.loadNegotiated(msg, binary);
+        EXPECT_EQ(out.get_header("content-type") == serializer::BINARY_CONTENT_TYPE, binary);
+
+        Input in;
+        in.load(out.body);
+        in.headers = out.headers;
+        EXPECT_EQ(in.binary(), binary);
+        EXPECT_EQ(in.acceptsBinary(), binary);
+
+        BinaryMessage res;
+        EXPECT_TRUE(in.getNegotiated(res));
+        EXPECT_EQ(res.amount, 3);
+        EXPECT_EQ(res.text, "negotiated");
+    }
+
+    Input in;
+    in.headers.push_back({"Accept", std::string("application/json, ") + serializer::BINARY_CONTENT_TYPE});
+    EXPECT_FALSE(in.binary());
+    EXPECT_TRUE(in.acceptsBinary());
+}
+
+GRAFT_DEFINE_IO_STRUCT_INITED(ReaderItem,
+     (std::string, name, "item"),
+     (int, value, -1)
+ );
+
+using ReaderCounts = std::map<std::string, int>;
+
+GRAFT_DEFINE_IO_STRUCT_INITED(ReaderMessage,
+     (uint64, amount, 7),
+     (int64_t, delta, 0),
+     (uint32, small, 0),
+     (double, ratio, 0),
+     (bool, flag, false),
+     (std::string, text, ""),
+     (std::vector<ReaderItem>, items, std::vector<ReaderItem>()),
+     (std::vector<std::string>, keys, std::vector<std::string>()),
+     (ReaderCounts, counts, ReaderCounts()),
+     (std::unique_ptr<ReaderItem>, ptr, nullptr)
+ );
+
+TEST(JsonReader, sameAsDocument)
+{
+    std::vector<std::string> sources = {
+        "{}",
+        " { \"amount\" : 18446744073709551615, \"delta\": -9223372036854775808, \"small\": 4294967295,"
+        "   \"ratio\": -0.375, \"flag\": true, \"text\": \"a\\\"b\\\\c\\/\\n\\u00e9\\ud83d\\ude00\" } ",
+        "{\"items\":[{\"name\":\"x\",\"value\":1},{},{\"value\":-3,\"unknown\":{\"a\":[1,{\"b\":null}]}}],"
+        " \"keys\":[\"0123abcd\",\"\"], \"counts\":{\"a\":1,\"b\":-2}, \"ptr\":{\"name\":\"p\"}}",
+        //unknown members and mismatching types are skipped
+        "{\"amount\":\"1\",\"flag\":1,\"text\":[\"t\"],\"items\":{},\"zzz\":[[[]]],\"ratio\":1.25e2,\"ptr\":null}",
+        "[1,2,3]",
+    };
+
+    for(auto& src : sources)
+    {
+        ReaderMessage dom = ReaderMessage::fromJson(src);
+        ReaderMessage sax;
+        sax.amount = 12345; //it is reset to the default
+        json::fromJson(src.data(), src.size(), sax);
+        EXPECT_EQ(serializer::JSON<ReaderMessage>::serialize(sax), serializer::JSON<ReaderMessage>::serialize(dom)) << src;
+    }
+}
+
+TEST(JsonReader, malformed)
+{
+    std::vector<std::string> sources = {
+        "",
+        "{",
+        "{\"amount\":1,}",
+        "{\"amount\" 1}",
+        "{\"amount\":1}}",
+        "{\"text\":\"abc}",
+        "{\"text\":\"\\x\"}",
+        "{\"items\":[{},]}",
+        "{\"ratio\":1.}",
+        "{\"flag\":tru}",
+        "{\"text\":\"\\ud83d\"}",
+        std::string(1000, '[') + std::string(1000, ']'),
+    };
+
+    for(auto& src : sources)
+    {
+        ReaderMessage msg;
+        EXPECT_THROW(json::fromJson(src.data(), src.size(), msg), rapidjson::ParseResult) << src;
+
+        Input in; in.load(src);
+        EXPECT_FALSE(in.get(msg)) << src;
+    }
+}
+
+TEST(JsonReader, perfectHash)
+{
+    using Fields = json::Fields<ReaderMessage>;
+    EXPECT_EQ(Fields::N, 10);
+    EXPECT_GE(Fields::M, Fields::N);
+
+    std::set<int> found;
+    for(auto& f : Fields::fields)
+    {
+        int idx = Fields::slots[json::fnv1a(f.name, f.len) % Fields::M];
+        ASSERT_GE(idx, 0);
+        EXPECT_STREQ(Fields::fields[idx].name, f.name);
+        found.insert(idx);
+    }
+    EXPECT_EQ(found.size(), Fields::N);
+}
+
+GRAFT_DEFINE_IO_STRUCT_INITED(StreamedList,
+     (std::vector<ReaderItem>, items, std::vector<ReaderItem>()),
+     (uint64, height, 0)
+ );
+
+GRAFT_DEFINE_JSON_RPC_RESPONSE_RESULT(StreamedListResult, StreamedList);
+
+TEST(OutHttp, loadStream)
+{
+    for(size_t count : {0, 1, 5, 64, 130})
+    {
+        StreamedListResult resp;
+        resp.result.height = 42;
+        const std::string envelope = serializer::JSON<StreamedListResult>::serialize(resp);
+
+        std::vector<ReaderItem> items(count);
+        for(size_t i = 0; i < count; ++i) items[i].value = i;
+        resp.result.items = items;
+        const std::string expected = serializer::JSON<StreamedListResult>::serialize(resp);
+
+        Output out;
+        out.loadStream(envelope, "items", std::move(items), 64);
+        ASSERT_TRUE(bool(out.stream));
+        EXPECT_TRUE(out.body.empty());
+
+        std::string reply;
+        size_t chunks = 0;
+        for(bool more = true; more; ++chunks)
+        {
+            std::string chunk;
+            more = out.stream(chunk);
+            reply += chunk;
+        }
+        EXPECT_EQ(reply, expected);
+        EXPECT_EQ(chunks, std::max<size_t>(1, (count + 63) / 64));
+    }
+}
@@ -30,6 +30,9 @@
 #include <misc_log_ex.h>
 #include <gtest/gtest.h>
 #include <boost/scoped_ptr.hpp>
+#include <boost/filesystem.hpp>
+#include <future>
+#include <string_tools.h>
 #include "lib/graft/thread_pool/thread_pool.hpp"
 
 
@@ -38,6 +41,8 @@
 #include "supernode/requests/send_supernode_announce.h"
 #include <rta/supernode.h>
 #include <rta/fullsupernodelist.h>
+#include <rta/signatureverifier.h>
+#include <rta/blockheadercache.h>
 #include <misc_log_ex.h>
 
 using namespace graft;
@@ -242,25 +247,6 @@ TEST_F(FullSupernodeListTest, loadFromDir2)
     EXPECT_EQ(found_wallets, loadedItems);
 }
 
-TEST_F(FullSupernodeListTest, refreshAsync)
-{
-    MGINFO_YELLOW("*** This test requires running cryptonode RPC on localhost:28881. If not running, test will fail ***");
-
-    const std::string daemon_addr = "localhost:28881";
-    const bool testnet = true;
-    size_t found_wallets = 0;
-    FullSupernodeList sn_list(daemon_addr, testnet);
-    size_t loadedItems = sn_list.loadFromDirThreaded(".", found_wallets);
-    LOG_PRINT_L0(" !!! loaded: " << loadedItems << " items");
-    MGINFO_YELLOW("*** ALL WALLETS LOADED, REFRESHING ***");
-
-    std::future<void> f = sn_list.refreshAsync();
-    MGINFO_YELLOW("*** REFRESH STARTED, WAITING ***");
-    f.wait();
-    MGINFO_YELLOW("*** ALL WALLETS REFRESHED ***");
-    EXPECT_EQ(loadedItems, sn_list.refreshedItems());
-}
-
 template<typename T>
 void print_container(std::ostream& os, const T& container, const std::string& delimiter)
 {
@@ -547,3 +533,142 @@ TEST_F(FullSupernodeListTest, announce1)
 }
 #endif
 
+
+struct SignatureVerifierTest : public ::testing::Test
+{
+    SignatureVerifierTest()
+    {
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            crypto::secret_key skey;
+            crypto::generate_keys(items[i].pkey, skey);
+            std::string msg = "message " + std::to_string(i);
+            crypto::cn_fast_hash(msg.data(), msg.size(), items[i].hash);
+            crypto::generate_signature(items[i].hash, items[i].pkey, skey, items[i].signature);
+        }
+    }
+
+    std::vector<SignatureVerifier::Item> items = std::vector<SignatureVerifier::Item>(16);
+};
+
+TEST_F(SignatureVerifierTest, batchAndCache)
+{
+    SignatureVerifier verifier;
+    std::vector<bool> results;
+    EXPECT_TRUE(verifier.verifyBatch(items, &results));
+    EXPECT_EQ(results, std::vector<bool>(items.size(), true));
+    EXPECT_EQ(verifier.cacheHits(), 0u);
+
+    // duplicate delivery
+    EXPECT_TRUE(verifier.verify(items[0].hash, items[0].pkey, items[0].signature));
+    EXPECT_EQ(verifier.cacheHits(), 1u);
+
+    // signature of another hash
+    std::vector<SignatureVerifier::Item> bad = items;
+    std::swap(bad[1].signature, bad[2].signature);
+    EXPECT_FALSE(verifier.verifyBatch(bad, &results));
+    EXPECT_TRUE(results[0]);
+    EXPECT_FALSE(results[1]);
+    EXPECT_FALSE(results[2]);
+    EXPECT_TRUE(results[3]);
+}
+
+TEST_F(SignatureVerifierTest, concurrent)
+{
+    SignatureVerifier verifier;
+    std::vector<std::future<bool>> futures;
+    for (int i = 0; i < 8; ++i)
+    {
+        futures.emplace_back(std::async(std::launch::async, [&verifier, this]()
+        {
+            return verifier.verifyBatch(items);
+        }));
+    }
+    for (auto &f : futures)
+        EXPECT_TRUE(f.get());
+    EXPECT_EQ(verifier.cacheHits() + verifier.cacheMisses(), 8 * items.size());
+}
+
+TEST_F(FullSupernodeListTest, index)
+{
+    const bool testnet = true;
+    boost::filesystem::path index_path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+
+    FullSupernodeList::supernode_stake_array stakes(4);
+    for (size_t i = 0; i < stakes.size(); ++i)
+    {
+        crypto::public_key pkey;
+        crypto::secret_key skey;
+        crypto::generate_keys(pkey, skey);
+        stakes[i].supernode_public_id = epee::string_tools::pod_to_hex(pkey);
+        stakes[i].supernode_public_address = "address " + std::to_string(i);
+        stakes[i].amount = 1000 * (i + 1);
+        stakes[i].block_height = 10 + i;
+        stakes[i].unlock_time = 100;
+    }
+
+    FullSupernodeList fsl1("localhost:28881", testnet);
+    fsl1.updateStakes(1, stakes, "localhost:28881", testnet);
+    fsl1.get(stakes[0].supernode_public_id)->setLastUpdateTime(12345);
+
+    EXPECT_EQ(fsl1.saveIndex(index_path.string()), stakes.size());
+    // nothing changed
+    EXPECT_EQ(fsl1.saveIndex(index_path.string()), 0u);
+    fsl1.get(stakes[1].supernode_public_id)->setStake(1, 2, 3);
+    EXPECT_EQ(fsl1.saveIndex(index_path.string()), 1u);
+
+    FullSupernodeList fsl2("localhost:28881", testnet);
+    EXPECT_EQ(fsl2.loadIndex(index_path.string()), stakes.size());
+    EXPECT_EQ(fsl2.size(), stakes.size());
+    SupernodePtr sn0 = fsl2.get(stakes[0].supernode_public_id);
+    ASSERT_TRUE(sn0);
+    EXPECT_EQ(sn0->lastUpdateTime(), 12345);
+    EXPECT_EQ(sn0->stakeAmount(), stakes[0].amount);
+    EXPECT_EQ(sn0->walletAddress(), stakes[0].supernode_public_address);
+    EXPECT_EQ(fsl2.get(stakes[1].supernode_public_id)->stakeAmount(), 1u);
+    // loaded entries are already indexed
+    EXPECT_EQ(fsl2.saveIndex(index_path.string()), 0u);
+
+    boost::filesystem::remove(index_path);
+}
+
+TEST(BlockHeaderCacheTest, heightAndHashes)
+{
+    BlockHeaderCache cache(4, std::chrono::milliseconds(200));
+
+    uint64_t height = 0;
+    EXPECT_FALSE(cache.getHeight(height));
+    EXPECT_TRUE(cache.stale());
+
+    cache.advanceHeight(100);
+    EXPECT_TRUE(cache.getHeight(height));
+    EXPECT_EQ(height, 100u);
+    // list of a past block
+    cache.advanceHeight(90);
+    EXPECT_EQ(cache.lastHeight(), 100u);
+
+    for (uint64_t h = 80; h < 100; h += 4)
+        cache.setBlockHash(h, std::to_string(h));
+    EXPECT_EQ(cache.size(), 4u);
+
+    std::string hash;
+    EXPECT_FALSE(cache.getBlockHash(80, hash));
+    EXPECT_TRUE(cache.getBlockHash(84, hash));
+    EXPECT_EQ(hash, "84");
+    EXPECT_TRUE(cache.getBlockHash(96, hash));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    EXPECT_TRUE(cache.stale());
+    EXPECT_FALSE(cache.getHeight(height));
+    EXPECT_EQ(cache.lastHeight(), 100u);
+    // confirmed hashes do not expire, hashes near the top do
+    EXPECT_TRUE(cache.getBlockHash(88, hash));
+    EXPECT_FALSE(cache.getBlockHash(92, hash));
+
+    // reorganization
+    cache.setHeight(95);
+    EXPECT_TRUE(cache.getHeight(height));
+    EXPECT_EQ(height, 95u);
+    EXPECT_EQ(cache.size(), 3u);
+    EXPECT_FALSE(cache.getBlockHash(96, hash));
+}
@@ -66,3 +66,40 @@ TEST(StrandTest, basic)
 
     EXPECT_EQ(value.load(std::memory_order_acquire), max_value);
 }
+
+TEST(StrandTest, manyStrands)
+{
+    //small queues, the strands must not be rejected
+    ThreadPoolOptions options;
+    options.setThreadCount(2);
+    options.setQueueSize(2);
+    ThreadPool thread_pool(options);
+
+    const int strand_count = 50;
+    const int post_count = 200;
+    std::vector<std::unique_ptr<Strand>> strands;
+    std::vector<int> last(strand_count, -1);
+    std::atomic<int> done_count = 0;
+    std::atomic<int> order_errors = 0;
+    for (int i = 0; i < strand_count; ++i)
+        strands.emplace_back(std::make_unique<Strand>(thread_pool, 1 + i % 4));
+
+    for (int j = 0; j < post_count; ++j)
+    {
+        for (int i = 0; i < strand_count; ++i)
+        {
+            strands[i]->post([&last, &done_count, &order_errors, i, j]()
+            {
+                if (last[i] + 1 != j) ++order_errors;
+                last[i] = j;
+                ++done_count;
+            });
+        }
+    }
+
+    for (int i = 0; i < 1000 && done_count != strand_count * post_count; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    EXPECT_EQ(done_count, strand_count * post_count);
+    EXPECT_EQ(order_errors, 0);
+}
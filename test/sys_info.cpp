@@ -150,6 +150,7 @@ class HandlerAPIImpl : public graft::HandlerAPI
 {
 public:
     virtual void sendUpstreamBlocking(Output& output, Input& input, std::string& err) override { }
+    virtual bool sendUpstreamAsync(const Output& output, UpstreamCallback callback) override { return false; }
     virtual bool addPeriodicTask(const Router::Handler& h_worker,
                                  std::chrono::milliseconds interval_ms,
                                  std::chrono::milliseconds initial_interval_ms = std::chrono::milliseconds::max(),
@@ -101,3 +101,179 @@ TEST(ThreadPool, expelling)
     }
     EXPECT_EQ(s, fast_per_slow * (slow_cnt+1) * slow_cnt /2 );
 }
+
+TEST(ThreadPool, resize)
+{
+    tp::ThreadPoolOptions th_op;
+    th_op.setThreadCount(2);
+    th_op.setMaxThreadCount(8);
+    th_op.setQueueSize(1024);
+
+    using ThPool = tp::ThreadPoolImpl<tp::FixedFunction<void(), 64>, tp::MPMCBoundedQueue>;
+    std::unique_ptr<ThPool> thPool = std::make_unique<ThPool>(th_op);
+    EXPECT_EQ(thPool->threadCount(), 2);
+    EXPECT_EQ(thPool->maxThreadCount(), 8);
+
+    std::atomic<int> done_cnt = 0;
+    int posted_cnt = 0;
+    auto post = [&thPool, &done_cnt, &posted_cnt](int cnt)
+    {
+        for(int i = 0; i < cnt; ++i, ++posted_cnt)
+        {
+            thPool->post([&done_cnt]()
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                ++done_cnt;
+            }, true);
+        }
+    };
+    auto wait_active = [](uint64_t cnt)
+    {
+        for(int i = 0; i < 500 && ThPool::getActiveWorkersCount() != cnt; ++i)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return ThPool::getActiveWorkersCount();
+    };
+
+    post(500);
+    thPool->resize(8);
+    EXPECT_EQ(thPool->threadCount(), 8);
+    EXPECT_EQ(wait_active(8), 8);
+    post(500);
+
+    //the tasks left in the queues of retired workers are done
+    thPool->resize(3);
+    EXPECT_EQ(thPool->threadCount(), 3);
+    post(500);
+    EXPECT_EQ(wait_active(3), 3);
+
+    thPool->resize(100);
+    EXPECT_EQ(thPool->threadCount(), 8);
+    thPool->resize(1);
+    post(500);
+    EXPECT_EQ(wait_active(1), 1);
+
+    for(int i = 0; i < 500 && done_cnt != posted_cnt; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(done_cnt, posted_cnt);
+
+    thPool.reset();
+    EXPECT_EQ(ThPool::getActiveWorkersCount(), 0);
+}
+
+TEST(ThreadPool, parking)
+{
+    tp::ThreadPoolOptions th_op;
+    th_op.setThreadCount(4);
+    th_op.setQueueSize(1024);
+
+    using ThPool = tp::ThreadPoolImpl<tp::FixedFunction<void(), 64>, tp::MPMCBoundedQueue>;
+    using Worker = tp::WorkerT<tp::FixedFunction<void(), 64>, tp::MPMCBoundedQueue>;
+    //a posted task should not wait for the timeout
+    Worker::parkingTimeoutMs = std::chrono::milliseconds(10000);
+    std::unique_ptr<ThPool> thPool = std::make_unique<ThPool>(th_op);
+
+    auto wait_parked = [](uint64_t cnt)
+    {
+        for(int i = 0; i < 500 && ThPool::getParkedWorkersCount() != cnt; ++i)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return ThPool::getParkedWorkersCount();
+    };
+    EXPECT_EQ(wait_parked(4), 4);
+
+    std::atomic<int> done_cnt = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for(int i = 0; i < 100; ++i)
+    {
+        thPool->post([&done_cnt]{ ++done_cnt; }, true);
+    }
+    for(int i = 0; i < 1000 && done_cnt != 100; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(done_cnt, 100);
+    EXPECT_LT(std::chrono::steady_clock::now() - begin, std::chrono::seconds(1));
+
+    //blocked workers are counted, the scope does nothing out of the pool
+    std::atomic<bool> release = false;
+    for(int i = 0; i < 2; ++i)
+    {
+        thPool->post([&release]
+        {
+            ThPool::BlockingScope blocking;
+            while(!release) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }, true);
+    }
+    {
+        ThPool::BlockingScope blocking;
+        for(int i = 0; i < 500 && ThPool::getBlockedWorkersCount() != 2; ++i)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        EXPECT_EQ(ThPool::getBlockedWorkersCount(), 2);
+    }
+    release = true;
+    EXPECT_EQ(wait_parked(4), 4);
+    EXPECT_EQ(ThPool::getBlockedWorkersCount(), 0);
+
+    //the workers are woken to stop
+    thPool.reset();
+    EXPECT_EQ(ThPool::getActiveWorkersCount(), 0);
+    EXPECT_EQ(ThPool::getParkedWorkersCount(), 0);
+    Worker::parkingTimeoutMs = std::chrono::milliseconds(100);
+}
+
+TEST(ThreadPool, affinity)
+{
+    tp::CpuSet cpus;
+    EXPECT_TRUE(tp::parseCpuList("0-3,8,10-11", cpus));
+    EXPECT_EQ(cpus, tp::CpuSet({0,1,2,3,8,10,11}));
+    EXPECT_FALSE(tp::parseCpuList("", cpus));
+    EXPECT_FALSE(tp::parseCpuList("3-1", cpus));
+    EXPECT_FALSE(tp::parseCpuList("1,x", cpus));
+    EXPECT_FALSE(tp::parseCpuList("1-", cpus));
+
+    tp::CpuSet process_cpus = tp::currentAffinity();
+#ifdef __linux__
+    ASSERT_FALSE(process_cpus.empty());
+#else
+    return;
+#endif
+    int cpu = process_cpus.back();
+
+    tp::ThreadPoolOptions th_op;
+    th_op.setThreadCount(2);
+    th_op.setQueueSize(16);
+    th_op.setCpus({cpu});
+
+    using ThPool = tp::ThreadPoolImpl<tp::FixedFunction<void(), 64>, tp::MPMCBoundedQueue>;
+    std::unique_ptr<ThPool> thPool = std::make_unique<ThPool>(th_op);
+
+    std::atomic<int> done_cnt = 0;
+    std::vector<tp::CpuSet> placed(4);
+    for(int i = 0; i < 4; ++i)
+    {
+        thPool->post([&placed, &done_cnt, i]
+        {
+            placed[i] = tp::currentAffinity();
+            ++done_cnt;
+        }, true);
+    }
+    for(int i = 0; i < 500 && done_cnt != 4; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(done_cnt, 4);
+    for(auto& cpus : placed)
+    {
+        EXPECT_EQ(cpus, tp::CpuSet({cpu}));
+    }
+    //the thread that posts is not affected
+    EXPECT_EQ(tp::currentAffinity(), process_cpus);
+    thPool.reset();
+}
@@ -0,0 +1,403 @@
+#include <gtest/gtest.h>
+#include "walletnode/wallet_manager.h"
+#include "walletnode/wallet_holder.h"
+#include "walletnode/wallet_cache_store.h"
+#include "fixture.h"
+
+#include <boost/filesystem.hpp>
+
+#include <atomic>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <mutex>
+
+namespace graft { namespace walletnode {
+
+//it reaches the sessions of WalletManager, the tests are run against a test server
+class WalletManagerTest : public GraftServerTestBase
+{
+protected:
+    using WalletPtr = WalletManager::WalletPtr;
+
+    static WalletPtr addSession(WalletManager& manager, Context& ctx, const std::string& id)
+    {
+        WalletPtr wallet = manager.createWallet(ctx);
+        manager.registerWallet(ctx, WalletManager::getContextWalletId(id), wallet);
+        return wallet;
+    }
+
+    static void refresh(WalletManager& manager, const WalletPtr& wallet)
+    {
+        std::lock_guard<std::mutex> lock(wallet->mutex);
+        manager.refreshWallet(*wallet);
+    }
+
+    static void openSession(WalletManager& manager, const WalletPtr& wallet, const std::string& address,
+                            const std::string& account_data, const std::string& password)
+    {
+        std::lock_guard<std::mutex> lock(wallet->mutex);
+        manager.openSession(*wallet, address, account_data, password);
+    }
+
+    static std::string cacheFileName(const std::string& address)
+    {
+        return WalletManager::getWalletCacheFileName(address);
+    }
+
+    static void setChainHeight(WalletManager& manager, uint64_t height)
+    {
+        manager.m_chain_height = height;
+    }
+
+    static void startScan(WalletManager& manager)
+    {
+        manager.startScan();
+    }
+
+    //scans running and queued
+    static std::pair<size_t, size_t> scanState(WalletManager& manager)
+    {
+        std::lock_guard<std::mutex> lock(manager.m_sessions_mutex);
+        return std::make_pair(manager.m_scan_running, manager.m_scan_queue.size());
+    }
+};
+
+} } //namespace graft::walletnode
+
+using graft::walletnode::WalletCacheStore;
+using graft::walletnode::WalletManager;
+using graft::walletnode::WalletManagerTest;
+
+TEST_F(WalletManagerTest, refreshSkip)
+{
+    std::atomic<int> requests{0};
+    TempCryptoNodeServer crypton;
+    crypton.on_http = [&requests](const http_message* hm, int& status_code, std::string& headers, std::string& data)
+    {
+        ++requests;
+        status_code = 500;
+        return true;
+    };
+    crypton.run();
+
+    MainServer server;
+    server.run();
+    {
+        graft::Context ctx(server.getGcm());
+        ctx.global["cryptonode_rpc_address"] = std::string("127.0.0.1:1234");
+
+        WalletManager manager(server.getLooper(), true);
+        WalletPtr wallet = addSession(manager, ctx, "wallet");
+        wallet->loaded = true;
+        wallet->scanned_height = 100;
+
+        //the wallet is scanned to the chain height, the request does not go to the cryptonode
+        setChainHeight(manager, 100);
+        EXPECT_NO_THROW(refresh(manager, wallet));
+        EXPECT_EQ(requests.load(), 0);
+        EXPECT_FALSE(wallet->dirty);
+        EXPECT_EQ(wallet->scanned_height, 100u);
+
+        //the chain has grown, the wallet is refreshed; the cryptonode fails it
+        setChainHeight(manager, 101);
+        try
+        {
+            refresh(manager, wallet);
+        }
+        catch(std::exception&)
+        {
+        }
+        EXPECT_LT(0, requests.load());
+
+        //the chain height is not known yet
+        requests = 0;
+        wallet->scanned_height = 100;
+        setChainHeight(manager, 0);
+        try
+        {
+            refresh(manager, wallet);
+        }
+        catch(std::exception&)
+        {
+        }
+        EXPECT_LT(0, requests.load());
+    }
+    server.stop_and_wait_for();
+    crypton.stop_and_wait_for();
+}
+
+TEST_F(WalletManagerTest, scanBatch)
+{
+    MainServer server;
+    server.run();
+    {
+        graft::Context ctx(server.getGcm());
+        ctx.global["cryptonode_rpc_address"] = std::string("127.0.0.1:1234");
+
+        WalletManager manager(server.getLooper(), true);
+
+        //the wallets are not loaded, so the scan does not refresh them; it waits for their mutexes
+        const size_t count = WalletManager::SCAN_BATCH_SIZE + 3;
+        std::vector<WalletPtr> wallets;
+        std::vector<std::unique_lock<std::mutex>> locks;
+        for(size_t i = 0; i < count; ++i)
+        {
+            wallets.push_back(addSession(manager, ctx, "wallet" + std::to_string(i)));
+            locks.emplace_back(wallets.back()->mutex);
+        }
+
+        setChainHeight(manager, 10);
+        startScan(manager);
+        EXPECT_EQ(scanState(manager), std::make_pair(WalletManager::SCAN_BATCH_SIZE, size_t(3)));
+
+        //a wallet is queued once however many times the chain grows meanwhile
+        setChainHeight(manager, 11);
+        startScan(manager);
+        EXPECT_EQ(scanState(manager), std::make_pair(WalletManager::SCAN_BATCH_SIZE, size_t(3)));
+
+        //the queued ones are started as the running ones complete
+        locks.clear();
+        const std::pair<size_t, size_t> done(0, 0);
+        std::pair<size_t, size_t> state;
+        auto end = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        do
+        {
+            state = scanState(manager);
+            EXPECT_LE(state.first, WalletManager::SCAN_BATCH_SIZE);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        while(state != done && std::chrono::steady_clock::now() < end);
+        EXPECT_EQ(state, done);
+    }
+    server.stop_and_wait_for();
+}
+
+TEST_F(WalletManagerTest, wrongPassword)
+{
+    MainServer server;
+    server.run();
+    {
+        graft::Context ctx(server.getGcm());
+        ctx.global["cryptonode_rpc_address"] = std::string("127.0.0.1:1234");
+
+        tools::GraftWallet keys(cryptonote::TESTNET), other(cryptonote::TESTNET);
+        keys.generateFromData("password");
+        other.generateFromData("password");
+        const std::string address = keys.get_account().get_public_address_str(cryptonote::TESTNET);
+        const std::string cache_file_name = cacheFileName(address);
+        boost::filesystem::create_directories(boost::filesystem::path(cache_file_name).parent_path());
+        keys.store_cache(cache_file_name);
+
+        WalletManager manager(server.getLooper(), true);
+        WalletPtr wallet = addSession(manager, ctx, address);
+
+        //the keys of another wallet are not loaded under the address
+        EXPECT_ANY_THROW(openSession(manager, wallet, address, other.getAccountData("password"), "password"));
+        EXPECT_FALSE(wallet->loaded);
+        EXPECT_TRUE(wallet->cache_file_name.empty());
+
+        openSession(manager, wallet, address, keys.getAccountData("password"), "password");
+        ASSERT_TRUE(wallet->loaded);
+
+        //the session has progress that is not stored yet
+        wallet->dirty = true;
+        wallet->scanned_height = 50;
+        const crypto::hash session_key = wallet->session_key;
+
+        auto expectResident = [&]
+        {
+            EXPECT_TRUE(wallet->loaded);
+            EXPECT_TRUE(wallet->dirty);
+            EXPECT_EQ(wallet->scanned_height, 50u);
+            EXPECT_EQ(wallet->cache_file_name, cache_file_name);
+        };
+
+        EXPECT_ANY_THROW(openSession(manager, wallet, address, keys.getAccountData("password"), "wrong"));
+        expectResident();
+        EXPECT_EQ(wallet->session_key, session_key);
+
+        //the keys of another wallet
+        EXPECT_ANY_THROW(openSession(manager, wallet, address, other.getAccountData("password"), "password"));
+        expectResident();
+        EXPECT_EQ(wallet->session_key, session_key);
+
+        //other credentials of the same keys, the session goes on with them
+        EXPECT_NO_THROW(openSession(manager, wallet, address, keys.getAccountData("password2"), "password2"));
+        expectResident();
+        EXPECT_NE(wallet->session_key, session_key);
+    }
+    server.stop_and_wait_for();
+    boost::filesystem::remove_all("wallets");
+}
+
+namespace
+{
+
+namespace fs = boost::filesystem;
+
+std::string readFile(const fs::path& path)
+{
+    std::ifstream in(path.string());
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void writeFile(const fs::path& path, const std::string& data)
+{
+    std::ofstream out(path.string());
+    out << data;
+}
+
+WalletCacheStore::Writer writeData(const std::string& data)
+{
+    return [data](const std::string& tmp_file_name)
+    {
+        writeFile(tmp_file_name, data);
+        return true;
+    };
+}
+
+//a temporary directory of cache files, removed at the end of the test
+class WalletCacheStoreTest : public ::testing::Test
+{
+protected:
+    fs::path dir = fs::temp_directory_path() / fs::unique_path("wallet_cache_store_%%%%%%%%");
+
+    void SetUp() override
+    {
+        fs::create_directories(dir);
+    }
+
+    void TearDown() override
+    {
+        fs::remove_all(dir);
+    }
+
+    std::string file(const std::string& name) const
+    {
+        return (dir / name).string();
+    }
+
+    //holds the I/O thread of the store till the future is ready
+    static void block(WalletCacheStore& store, const std::string& file_name, std::shared_future<void> release)
+    {
+        std::promise<void> started;
+        store.store(file_name, [release, &started](const std::string& tmp_file_name)
+        {
+            started.set_value();
+            release.wait();
+            return false;
+        });
+        started.get_future().wait();
+    }
+};
+
+}
+
+TEST_F(WalletCacheStoreTest, coalesce)
+{
+    WalletCacheStore store(dir.string());
+
+    std::promise<void> release;
+    block(store, file("blocker.cache"), release.get_future().share());
+
+    //the writes of the file are queued while the I/O thread is busy
+    std::atomic<int> writes1{0}, writes2{0};
+    std::vector<std::atomic<int>> done(3);
+    store.store(file("a.cache"), [&writes1](const std::string& tmp_file_name) { ++writes1; writeFile(tmp_file_name, "1"); return true; },
+                [&done] { ++done[0]; });
+    store.store(file("a.cache"), [&writes2](const std::string& tmp_file_name) { ++writes2; writeFile(tmp_file_name, "2"); return true; },
+                [&done] { ++done[1]; });
+    store.store(file("a.cache"), writeData("3"), [&done] { ++done[2]; });
+
+    std::promise<void> stored;
+    store.store(file("b.cache"), writeData("b"), [&stored] { stored.set_value(); });
+
+    release.set_value();
+    stored.get_future().wait();
+
+    //the first writer writes the file once, each caller is told once
+    EXPECT_EQ(writes1.load(), 1);
+    EXPECT_EQ(writes2.load(), 0);
+    for (auto& d : done)
+        EXPECT_EQ(d.load(), 1);
+    EXPECT_EQ(readFile(file("a.cache")), "1");
+    EXPECT_EQ(readFile(file("b.cache")), "b");
+}
+
+TEST_F(WalletCacheStoreTest, replace)
+{
+    const std::string file_name = file("xx/a.cache"), tmp_file_name = file_name + ".tmp";
+
+    WalletCacheStore store(dir.string());
+
+    //the directory of the file is created
+    std::promise<void> stored;
+    store.store(file_name, writeData("old"), [&stored] { stored.set_value(); });
+    stored.get_future().wait();
+    EXPECT_EQ(readFile(file_name), "old");
+    EXPECT_FALSE(fs::exists(tmp_file_name));
+
+    //the file is not touched while the new one is written
+    std::atomic<int> done{0};
+    std::promise<void> failed;
+    store.store(file_name, [&](const std::string& tmp)
+    {
+        EXPECT_EQ(tmp, tmp_file_name);
+        writeFile(tmp, "partial");
+        EXPECT_EQ(readFile(file_name), "old");
+        throw std::runtime_error("disk full");
+        return true;
+    }, [&] { ++done; failed.set_value(); });
+    failed.get_future().wait();
+    EXPECT_EQ(done.load(), 1);
+    EXPECT_EQ(readFile(file_name), "old");
+    EXPECT_FALSE(fs::exists(tmp_file_name));
+
+    //nothing to write
+    std::promise<void> skipped;
+    store.store(file_name, [](const std::string&) { return false; }, [&] { ++done; skipped.set_value(); });
+    skipped.get_future().wait();
+    EXPECT_EQ(done.load(), 2);
+    EXPECT_EQ(readFile(file_name), "old");
+
+    std::promise<void> replaced;
+    store.store(file_name, writeData("new"), [&] { ++done; replaced.set_value(); });
+    replaced.get_future().wait();
+    EXPECT_EQ(done.load(), 3);
+    EXPECT_EQ(readFile(file_name), "new");
+    EXPECT_FALSE(fs::exists(tmp_file_name));
+}
+
+TEST_F(WalletCacheStoreTest, removeExpired)
+{
+    const std::time_t old_time = std::time(nullptr) - 2 * 3600;
+    for (const char* name : {"old.cache", "recent.cache", "touched.cache", "pending.cache", "other.txt"})
+    {
+        writeFile(file(name), name);
+        if (std::string(name) != "recent.cache")
+            fs::last_write_time(file(name), old_time);
+    }
+
+    auto store = std::make_unique<WalletCacheStore>(dir.string());
+
+    //it is used before the index is built
+    store->touch(file("touched.cache"));
+
+    std::promise<void> release;
+    block(*store, file("blocker.cache"), release.get_future().share());
+
+    //the removal is queued with a write of an old file
+    store->removeExpired(std::chrono::hours(1));
+    store->store(file("pending.cache"), writeData("new"));
+
+    release.set_value();
+    //the queued work is done
+    store.reset();
+
+    EXPECT_FALSE(fs::exists(file("old.cache")));
+    EXPECT_TRUE(fs::exists(file("recent.cache")));
+    EXPECT_TRUE(fs::exists(file("touched.cache")));
+    EXPECT_EQ(readFile(file("pending.cache")), "new");
+    EXPECT_TRUE(fs::exists(file("other.txt")));
+}